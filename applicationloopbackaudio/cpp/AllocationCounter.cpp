@@ -0,0 +1,52 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef LOOPBACK_COUNT_ALLOCATIONS
+
+static thread_local UINT64 t_Allocations = 0;
+
+static void* countedAllocate(size_t size)
+{
+    t_Allocations++;
+    void* p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { t_Allocations++; return malloc(size != 0 ? size : 1); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { t_Allocations++; return malloc(size != 0 ? size : 1); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+bool AllocationCounter::IsEnabled()
+{
+    return true;
+}
+
+UINT64 AllocationCounter::GetThreadAllocations()
+{
+    return t_Allocations;
+}
+
+#else
+
+bool AllocationCounter::IsEnabled()
+{
+    return false;
+}
+
+UINT64 AllocationCounter::GetThreadAllocations()
+{
+    return 0;
+}
+
+#endif
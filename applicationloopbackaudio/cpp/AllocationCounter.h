@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Test hook that counts the heap allocations made through operator new on the calling thread.
+*
+* The counting operator new replacements are only compiled in when LOOPBACK_COUNT_ALLOCATIONS is defined (Debug
+* configurations). Otherwise IsEnabled returns false and GetThreadAllocations always returns 0.
+*
+* Allocations made by the system (Media Foundation, CoTaskMemAlloc, HeapAlloc) are not counted.
+*/
+namespace AllocationCounter
+{
+    bool IsEnabled();
+    // Number of operator new calls made by the calling thread since it started
+    UINT64 GetThreadAllocations();
+}
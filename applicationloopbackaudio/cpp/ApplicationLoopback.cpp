@@ -4,27 +4,44 @@
 #include <Windows.h>
 #include <iostream>
 #include "LoopbackCapture.h"
-#include "LoopbackCaptureSync.h"
+#include "CaptureSource.h"
+#include "PacketTrace.h"
+#include "WavRepair.h"
+#include "LogRing.h"
+#include "PipelineCounters.h"
+#include "SpanTrace.h"
 
 #include <comdef.h>
+#include <cstdint>
 
 void usage()
 {
     std::wcout <<
-        L"Usage: ApplicationLoopback <pid> <includetree|excludetree> <outputfilename> <endpointname> <Sync|Async>\n"
+        L"Usage: ApplicationLoopback <pid> <includetree|excludetree> <outputfilename> <endpointname> <Async|Event|Sync> [capturesource] [buffered|mapped] [segmentseconds] [statsfile] [tracefile] [latencyms]\n"
+        L"       ApplicationLoopback repair <wavfilename>\n"
         L"\n"
         L"<pid> is the process ID to capture or exclude from capture\n"
         L"includetree includes audio from that process and its child processes\n"
         L"excludetree includes audio from all processes except that process and its child processes\n"
-        L"<outputfilename> is the WAV file to receive the captured audio (10 seconds)\n"
+        L"<outputfilename> is the WAV file to receive the captured audio (10 seconds), or a .flac file to record it losslessly compressed\n"
         L"<endpointname> is a substring contained in the friendly name of the audio endpoint where the captured audio will be streamed to\n"
-        L"<Sync|Async> use synchronic or asynchronic loopbac capture\n"
+        L"<Async|Event|Sync> when the captured packets are read: Async on a Media Foundation work item queued on the buffer event,\n"
+        L"    Event on a capture thread waiting on the buffer event, Sync on a capture thread polling when the next packet is expected\n"
+        L"[capturesource] where captured packets come from: loopback (default), synthetic (1 kHz test tone), the path of a WAV file to replay,\n"
+        L"    or the path of a .lptrace packet trace to replay the packet timing of. Prefix a file with fast: to replay it as fast as it is read\n"
+        L"[buffered|mapped] how the output file is written: write calls (default) or a memory-mapped file\n"
+        L"[segmentseconds] splits the recording into files of that many seconds, listed in <outputfilename>.manifest.jsonl as they are closed, or 0 for a single file\n"
+        L"[statsfile] receives the pipeline counters every second, in the Prometheus text format, or - for none\n"
+        L"[tracefile] receives the size, flags, position and timing of every captured packet, replayable as a .lptrace capturesource, or - for none\n"
+        L"[latencyms] <targetms>[:<maxms>] latency the render path is steered to, and above which it catches up (60 by default).\n"
+        L"    A target of 0 (default) holds the latency reached once the output has settled\n"
+        L"repair rewrites the header of a recording that was interrupted before it was finalized\n"
         L"\n"
         L"Examples:\n"
         L"\n"
         L"ApplicationLoopback 1234 includetree CapturedAudio.wav Speakers Sync\n"
         L"\n"
-        L"  Captures audio from process 1234 and its children, sends it to an audio endpoint that contains the word \"Speakers\" in its name, if it exists. Uses synchronic loopback capture class\n";
+        L"  Captures audio from process 1234 and its children, sends it to an audio endpoint that contains the word \"Speakers\" in its name, if it exists. Polls the capture client from a capture thread when the next packet is expected\n";
 }
 
 // REFERENCE_TIME time units per second and per millisecond
@@ -394,36 +411,69 @@ Exit:
     return hr;
 }
 
-void loopbackCaptureSync(DWORD processId, bool includeProcessTree, PCWSTR outputFile, PCWSTR outputFriendlyName)
+/**
+* Creates the capture source selected on the command line. Returns nullptr to capture from the loopback client.
+*/
+std::unique_ptr<ICaptureSource> createCaptureSource(LoopbackCaptureBase* capturer, PCWSTR sourceName)
 {
-    LoopbackCaptureSync loopbackCapture;
-    initializeOutputClient(&loopbackCapture, outputFriendlyName);
+    if (sourceName == nullptr || wcscmp(sourceName, L"loopback") == 0)
+    {
+        return nullptr;
+    }
 
-    HRESULT hr = loopbackCapture.StartCapture(processId, includeProcessTree, outputFile);
-    if (FAILED(hr))
+    CaptureSourceTiming timing;
+    if (wcscmp(sourceName, L"synthetic") == 0)
     {
-        wil::unique_hlocal_string message;
-        FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS | FORMAT_MESSAGE_ALLOCATE_BUFFER, nullptr, hr,
-            MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (PWSTR)&message, 0, nullptr);
-        std::wcout << L"Failed to start capture\n0x" << std::hex << hr << L": " << message.get() << L"\n";
+        std::wcout << L"Capturing a synthetic 1 kHz test tone" << std::endl;
+        return std::make_unique<SyntheticCaptureSource>(capturer->getCaptureFormat(), timing);
     }
-    else
+
+    if (wcsncmp(sourceName, L"fast:", 5) == 0)
     {
-        std::wcout << L"Capturing 1000 seconds of audio." << std::endl;
-        Sleep(1000000);
+        timing.realTime = false;
+        sourceName += 5;
+    }
 
-        loopbackCapture.StopCapture();
+    std::filesystem::path fileName = sourceName;
+    if (fileName.extension() == L".lptrace")
+    {
+        auto traceSource = std::make_unique<PacketTraceCaptureSource>();
+        HRESULT hr = traceSource->Open(fileName, timing.realTime);
+        if (FAILED(hr))
+        {
+            std::wcout << L"Could not open the packet trace " << sourceName << L". Capturing from the loopback client instead." << std::endl;
+            return nullptr;
+        }
+        std::wcout << L"Replaying the " << traceSource->GetPacketCount() << L" packets of " << sourceName
+            << (timing.realTime ? L"" : L" at full speed") << std::endl;
+        return traceSource;
+    }
 
-        std::wcout << L"Finished.\n";
+    auto source = std::make_unique<WavFileCaptureSource>();
+    HRESULT hr = source->Open(fileName, timing);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Could not open " << sourceName << L" for replay. Capturing from the loopback client instead." << std::endl;
+        return nullptr;
     }
+    std::wcout << L"Replaying " << sourceName << std::endl;
+    return source;
 }
 
-void loopbackCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFile, PCWSTR outputFriendlyName)
+void loopbackCapture(DWORD processId, bool includeProcessTree, PCWSTR outputFile, PCWSTR outputFriendlyName, CaptureScheduling scheduling, PCWSTR captureSource, const WavFileSinkOptions& fileSinkOptions, PCWSTR traceFile, const LatencyPolicy& latencyPolicy)
 {
     CLoopbackCapture loopbackCapture;
+    loopbackCapture.setCaptureScheduling(scheduling);
+    loopbackCapture.setLatencyPolicy(latencyPolicy);
+    loopbackCapture.setCaptureSource(createCaptureSource(&loopbackCapture, captureSource));
+    loopbackCapture.setFileSinkOptions(fileSinkOptions);
+    if (traceFile != nullptr)
+    {
+        loopbackCapture.setPacketTraceFile(traceFile);
+    }
 
     initializeOutputClient(&loopbackCapture, outputFriendlyName);
-    HRESULT hr = loopbackCapture.StartCaptureAsync(processId, includeProcessTree, outputFile);
+    HRESULT hr = loopbackCapture.StartCapture(processId, includeProcessTree, outputFile);
     if (FAILED(hr))
     {
         wil::unique_hlocal_string message;
@@ -436,15 +486,42 @@ void loopbackCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outpu
         std::wcout << L"Capturing 1000 seconds of audio." << std::endl;
         Sleep(1000000);
 
-        loopbackCapture.StopCaptureAsync();
+        loopbackCapture.StopCapture();
 
         std::wcout << L"Finished.\n";
     }
 }
 
+int repairRecording(PCWSTR fileName)
+{
+    WavRepairResult result;
+    HRESULT hr = RepairWavFile(fileName, &result);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Could not repair " << fileName << L": 0x" << std::hex << hr << std::endl;
+        return 1;
+    }
+
+    if (!result.bRepaired)
+    {
+        std::wcout << fileName << L" is complete, " << result.dataSize << L" bytes of audio." << std::endl;
+    }
+    else
+    {
+        std::wcout << L"Repaired " << fileName << L": header claimed " << result.committedDataSize << L" bytes, recovered "
+            << result.dataSize << L" bytes of audio" << (result.bRF64 ? L" (RF64)." : L".") << std::endl;
+    }
+    return 0;
+}
+
 int wmain(int argc, wchar_t* argv[])
 {
-    if (argc != 6)
+    if (argc == 3 && wcscmp(argv[1], L"repair") == 0)
+    {
+        return repairRecording(argv[2]);
+    }
+
+    if (argc < 6 || argc > 12)
     {
         usage();
         return 0;
@@ -476,17 +553,113 @@ int wmain(int argc, wchar_t* argv[])
 
     PCWSTR outputFriendlyName = argv[4];
     
-    // Synchronous or asynchronous mode
-    PCWSTR mode = argv[5];
+    // Scheduling of the capture
+    CaptureScheduling scheduling;
+    if (wcscmp(argv[5], L"Async") == 0)
+    {
+        scheduling = CaptureScheduling::WorkQueue;
+    }
+    else if (wcscmp(argv[5], L"Event") == 0)
+    {
+        scheduling = CaptureScheduling::EventThread;
+    }
+    else if (wcscmp(argv[5], L"Sync") == 0)
+    {
+        scheduling = CaptureScheduling::Polling;
+    }
+    else
+    {
+        usage();
+        return 0;
+    }
+
+    // Optional source of the captured packets
+    PCWSTR captureSource = (argc >= 7) ? argv[6] : nullptr;
 
-    if (wcscmp(mode, L"Sync") == 0)
+    // Optional output file mode
+    WavFileSinkOptions fileSinkOptions;
+    if (argc >= 8)
     {
-        loopbackCaptureSync(processId, includeProcessTree, outputFile, outputFriendlyName);
+        if (wcscmp(argv[7], L"mapped") == 0)
+        {
+            fileSinkOptions.fileMode = OutputFileMode::Mapped;
+        }
+        else if (wcscmp(argv[7], L"buffered") != 0)
+        {
+            usage();
+            return 0;
+        }
     }
-    else if (wcscmp(mode, L"Async") == 0)
+
+    // Optional segment length
+    if (argc >= 9)
+    {
+        wchar_t* end = nullptr;
+        unsigned long segmentSeconds = wcstoul(argv[8], &end, 0);
+        // Longer segments would not fit segmentMs, and wcstoul saturates on overflow
+        if (end == argv[8] || *end != L'\0' || segmentSeconds > UINT32_MAX / 1000)
+        {
+            usage();
+            return 0;
+        }
+        fileSinkOptions.segmentMs = (UINT32)segmentSeconds * 1000;
+    }
+
+    // Optional latency bounds of the render path
+    LatencyPolicy latencyPolicy;
+    if (argc == 12)
+    {
+        wchar_t* end = nullptr;
+        unsigned long targetMs = wcstoul(argv[11], &end, 0);
+        unsigned long maxMs = latencyPolicy.maxMs;
+        if (end != argv[11] && *end == L':')
+        {
+            PCWSTR maxArg = end + 1;
+            maxMs = wcstoul(maxArg, &end, 0);
+            if (end == maxArg)
+            {
+                end = argv[11];
+            }
+        }
+        // The jitter buffer needs the target below the maximum
+        if (end == argv[11] || *end != L'\0' || targetMs >= maxMs)
+        {
+            usage();
+            return 0;
+        }
+        latencyPolicy.targetMs = (UINT32)targetMs;
+        latencyPolicy.maxMs = (UINT32)maxMs;
+    }
+
+    // Messages of the capture and render threads are printed from the log thread
+    LogRing::Get().Start();
+
+    // Optional stats file
+    if (argc >= 10 && wcscmp(argv[9], L"-") != 0)
+    {
+        HRESULT hr = PipelineCounters::StartExport(argv[9], 1000);
+        if (FAILED(hr))
+        {
+            std::wcout << L"Cannot write the stats file " << argv[9] << L": " << _com_error(hr).ErrorMessage() << std::endl;
+        }
+    }
+
+    // Optional packet trace
+    PCWSTR traceFile = (argc >= 11 && wcscmp(argv[10], L"-") != 0) ? argv[10] : nullptr;
+
+    loopbackCapture(processId, includeProcessTree, outputFile, outputFriendlyName, scheduling, captureSource, fileSinkOptions, traceFile, latencyPolicy);
+
+    PipelineCounters::StopExport();
+    LogRing::Get().Stop();
+
+#ifdef LOOPBACK_ENABLE_TRACING
+    // Timeline of the pipeline threads, for chrome://tracing or ui.perfetto.dev
+    std::filesystem::path timelineFile = std::filesystem::path(outputFile).concat(L".trace.json");
+    if (SUCCEEDED(SpanTrace::WriteChromeTrace(timelineFile)))
     {
-        loopbackCaptureAsync(processId, includeProcessTree, outputFile, outputFriendlyName);
+        std::wcout << L"Timeline written to " << timelineFile.wstring() << std::endl;
     }
+#endif
 
 
     CoUninitialize();
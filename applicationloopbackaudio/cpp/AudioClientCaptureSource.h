@@ -0,0 +1,40 @@
+#pragma once
+
+#include "CaptureSource.h"
+
+#include <AudioClient.h>
+#include <wil\com.h>
+
+/**
+* Capture source backed by a live WASAPI capture client.
+*/
+class AudioClientCaptureSource : public ICaptureSource
+{
+public:
+    AudioClientCaptureSource(IAudioCaptureClient* captureClient, const WAVEFORMATEX& format) :
+        m_Format(format)
+    {
+        m_AudioCaptureClient = captureClient;
+    }
+
+    const WAVEFORMATEX& GetFormat() const override { return m_Format; }
+
+    HRESULT GetNextPacketSize(UINT32* pNumFramesInNextPacket) override
+    {
+        return m_AudioCaptureClient->GetNextPacketSize(pNumFramesInNextPacket);
+    }
+
+    HRESULT GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition) override
+    {
+        return m_AudioCaptureClient->GetBuffer(ppData, pNumFramesToRead, pdwFlags, pu64DevicePosition, pu64QPCPosition);
+    }
+
+    HRESULT ReleaseBuffer(UINT32 NumFramesRead) override
+    {
+        return m_AudioCaptureClient->ReleaseBuffer(NumFramesRead);
+    }
+
+private:
+    wil::com_ptr_nothrow<IAudioCaptureClient> m_AudioCaptureClient;
+    WAVEFORMATEX m_Format;
+};
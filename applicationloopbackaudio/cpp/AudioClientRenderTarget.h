@@ -0,0 +1,53 @@
+#pragma once
+
+#include "RenderTarget.h"
+
+#include <AudioClient.h>
+#include <wil\com.h>
+
+/**
+* Render target backed by a live WASAPI render client.
+*/
+class AudioClientRenderTarget : public IRenderTarget
+{
+public:
+    AudioClientRenderTarget(IAudioClient* audioClient, IAudioRenderClient* renderClient)
+    {
+        m_AudioClient = audioClient;
+        m_RenderClient = renderClient;
+    }
+
+    HRESULT Start() override
+    {
+        return m_AudioClient->Start();
+    }
+
+    HRESULT Stop() override
+    {
+        return m_AudioClient->Stop();
+    }
+
+    HRESULT GetBufferSize(UINT32* pNumBufferFrames) override
+    {
+        return m_AudioClient->GetBufferSize(pNumBufferFrames);
+    }
+
+    HRESULT GetCurrentPadding(UINT32* pNumPaddingFrames) override
+    {
+        return m_AudioClient->GetCurrentPadding(pNumPaddingFrames);
+    }
+
+    HRESULT GetBuffer(UINT32 NumFramesRequested, BYTE** ppData) override
+    {
+        return m_RenderClient->GetBuffer(NumFramesRequested, ppData);
+    }
+
+    HRESULT ReleaseBuffer(UINT32 NumFramesWritten, DWORD dwFlags) override
+    {
+        return m_RenderClient->ReleaseBuffer(NumFramesWritten, dwFlags);
+    }
+
+private:
+    wil::com_ptr_nothrow<IAudioClient> m_AudioClient;
+    wil::com_ptr_nothrow<IAudioRenderClient> m_RenderClient;
+};
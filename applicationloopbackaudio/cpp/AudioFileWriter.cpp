@@ -0,0 +1,37 @@
+#include "AudioFileWriter.h"
+
+#include "FlacWriter.h"
+#include "WavWriter.h"
+
+bool IsFlacFileName(const std::filesystem::path& fileName)
+{
+    std::filesystem::path::string_type extension = fileName.extension().native();
+    if (extension.size() != 5)
+    {
+        return false;
+    }
+
+    const char expected[] = ".flac";
+    for (size_t i = 0; i < extension.size(); i++)
+    {
+        auto c = extension[i];
+        if (c >= 'A' && c <= 'Z')
+        {
+            c = c - 'A' + 'a';
+        }
+        if (c != (decltype(c))expected[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<IAudioFileWriter> CreateAudioFileWriter(const std::filesystem::path& fileName)
+{
+    if (IsFlacFileName(fileName))
+    {
+        return std::make_unique<FlacWriter>();
+    }
+    return std::make_unique<WavWriter>();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "OutputFile.h"
+
+#include <memory>
+
+/**
+* Settings shared by the recording file writers
+*/
+struct AudioFileWriterOptions
+{
+    OutputFileMode fileMode = OutputFileMode::Buffered;
+    // Compression level of FLAC files, 0 (fastest) to 8 (smallest)
+    UINT32 flacLevel = 5;
+};
+
+/**
+* Container of a recording: a header, the captured samples appended with WriteData, and sizes patched by
+* CommitHeader and Finalize. Implemented by WavWriter and FlacWriter.
+*/
+class IAudioFileWriter
+{
+public:
+    virtual ~IAudioFileWriter() = default;
+
+    virtual HRESULT Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options) = 0;
+    virtual bool IsOpen() const = 0;
+
+    // Appends captured samples. bytes does not have to be a whole number of frames.
+    virtual HRESULT WriteData(const void* data, size_t bytes) = 0;
+    // Memory the next data bytes can be written to in place, or nullptr if the writer transforms the samples or its
+    // file is not mapped
+    virtual BYTE* GetDataBuffer(size_t* pcbAvailable)
+    {
+        *pcbAvailable = 0;
+        return nullptr;
+    }
+    // Adds bytes written to the GetDataBuffer memory to the recording
+    virtual HRESULT CommitData(size_t /*bytes*/)
+    {
+        return E_NOTIMPL;
+    }
+    // Makes the header describe the data written so far, so the file stays readable if the process dies before
+    // Finalize. Does not flush.
+    virtual HRESULT CommitHeader() = 0;
+    // Waits until everything written so far, including the last committed header, reaches the disk
+    virtual HRESULT Flush() = 0;
+    // Writes the final header, flushes and closes the file
+    virtual HRESULT Finalize() = 0;
+
+    // Captured bytes accepted so far
+    virtual UINT64 GetDataSize() const = 0;
+    // Offset of the first sample in the file, or 0 if the samples are not stored as is
+    virtual UINT64 GetDataOffset() const = 0;
+};
+
+// True for file names with a .flac extension
+bool IsFlacFileName(const std::filesystem::path& fileName);
+
+// Returns a FlacWriter for .flac file names and a WavWriter otherwise
+std::unique_ptr<IAudioFileWriter> CreateAudioFileWriter(const std::filesystem::path& fileName);
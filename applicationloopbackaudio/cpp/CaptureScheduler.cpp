@@ -0,0 +1,284 @@
+#include "CaptureScheduler.h"
+#include "SpanTrace.h"
+
+#include <avrt.h>
+#include <wil\result.h>
+
+#include <algorithm>
+
+std::unique_ptr<ICaptureScheduler> CreateCaptureScheduler(CaptureScheduling scheduling)
+{
+    switch (scheduling)
+    {
+    case CaptureScheduling::EventThread:
+        return std::make_unique<EventThreadCaptureScheduler>();
+    case CaptureScheduling::Polling:
+        return std::make_unique<PollingCaptureScheduler>();
+    default:
+        return std::make_unique<WorkQueueCaptureScheduler>();
+    }
+}
+
+WorkQueueCaptureScheduler::~WorkQueueCaptureScheduler()
+{
+    Stop();
+    m_SampleReadyAsyncResult.reset();
+    if (m_dwQueueID != 0)
+    {
+        MFUnlockWorkQueue(m_dwQueueID);
+    }
+}
+
+HRESULT WorkQueueCaptureScheduler::Initialize(IAudioClient* audioClient, const WAVEFORMATEX& /*format*/, UINT64 /*periodHns*/)
+{
+    // Register MMCSS work queue https://learn.microsoft.com/en-us/windows/win32/api/mfapi/nf-mfapi-mflocksharedworkqueue
+    DWORD dwTaskID = 0;
+    RETURN_IF_FAILED(MFLockSharedWorkQueue(L"Capture", 0, &dwTaskID, &m_dwQueueID));
+
+    // Create the callback for sample events, run on the MMCSS queue, and its async result
+    m_Callback = Microsoft::WRL::Make<WorkQueueCaptureCallback>();
+    RETURN_HR_IF_NULL(E_OUTOFMEMORY, m_Callback.Get());
+    RETURN_IF_FAILED(m_Callback->Initialize(m_dwQueueID));
+    RETURN_IF_FAILED(MFCreateAsyncResult(nullptr, m_Callback.Get(), nullptr, &m_SampleReadyAsyncResult));
+
+    // Tell the system which event handle it should signal when an audio buffer is ready to be processed by the client
+    RETURN_IF_FAILED(audioClient->SetEventHandle(m_Callback->GetSampleReadyEvent()));
+
+    return S_OK;
+}
+
+HRESULT WorkQueueCaptureScheduler::Start(ICaptureDrain* drain)
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, m_Callback.Get() == nullptr);
+    return m_Callback->Start(drain, m_SampleReadyAsyncResult.get());
+}
+
+HRESULT WorkQueueCaptureScheduler::Stop()
+{
+    return (m_Callback.Get() != nullptr) ? m_Callback->Stop() : S_OK;
+}
+
+HRESULT WorkQueueCaptureCallback::Initialize(DWORD dwQueueID)
+{
+    m_dwQueueID = dwQueueID;
+    RETURN_IF_FAILED(m_SampleReadyEvent.create(wil::EventOptions::None));
+    return S_OK;
+}
+
+HRESULT WorkQueueCaptureCallback::Start(ICaptureDrain* drain, IMFAsyncResult* pResult)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    RETURN_HR_IF(E_NOT_VALID_STATE, m_Drain != nullptr);
+
+    m_hrDrain = S_OK;
+    RETURN_IF_FAILED(MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, pResult, &m_SampleReadyKey));
+    m_Drain = drain;
+    return S_OK;
+}
+
+//
+//  Stop()
+//
+//  Taking the mutex waits for the drain in progress, if any. Once the drain is released, a work item that the cancel
+//  comes too late for finds it gone and returns; its reference keeps this object alive until then.
+//
+HRESULT WorkQueueCaptureCallback::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Drain == nullptr)
+    {
+        return S_OK;
+    }
+
+    if (0 != m_SampleReadyKey)
+    {
+        MFCancelWorkItem(m_SampleReadyKey);
+        m_SampleReadyKey = 0;
+    }
+    m_Drain = nullptr;
+
+    return m_hrDrain;
+}
+
+STDMETHODIMP WorkQueueCaptureCallback::GetParameters(DWORD* pdwFlags, DWORD* pdwQueue)
+{
+    *pdwFlags = 0;
+    *pdwQueue = m_dwQueueID;
+    return S_OK;
+}
+
+//
+//  Invoke()
+//
+//  Callback method when ready to fill sample buffer
+//
+STDMETHODIMP WorkQueueCaptureCallback::Invoke(IMFAsyncResult* pResult)
+{
+    // Whichever work queue thread runs the callback gets a track of its own
+    LOOPBACK_TRACE_THREAD("MF work queue");
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_SampleReadyKey = 0;
+    if (m_Drain == nullptr)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = m_Drain->DrainPackets(nullptr);
+    if (SUCCEEDED(hr))
+    {
+        // Re-queue work item for next sample
+        hr = MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, pResult, &m_SampleReadyKey);
+    }
+    if (FAILED(hr))
+    {
+        m_SampleReadyKey = 0;
+        m_hrDrain = hr;
+    }
+
+    return S_OK;
+}
+
+EventThreadCaptureScheduler::~EventThreadCaptureScheduler()
+{
+    Stop();
+}
+
+HRESULT EventThreadCaptureScheduler::Initialize(IAudioClient* audioClient, const WAVEFORMATEX& /*format*/, UINT64 /*periodHns*/)
+{
+    RETURN_IF_FAILED(m_SampleReadyEvent.create(wil::EventOptions::None));
+    RETURN_IF_FAILED(m_StopEvent.create(wil::EventOptions::ManualReset));
+    RETURN_IF_FAILED(audioClient->SetEventHandle(m_SampleReadyEvent.get()));
+    return S_OK;
+}
+
+HRESULT EventThreadCaptureScheduler::Start(ICaptureDrain* drain)
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, m_Thread.joinable() || !m_StopEvent.is_valid());
+
+    m_Drain = drain;
+    m_hrDrain = S_OK;
+    m_StopEvent.ResetEvent();
+    m_Thread = std::thread(&EventThreadCaptureScheduler::ThreadProc, this);
+    return S_OK;
+}
+
+HRESULT EventThreadCaptureScheduler::Stop()
+{
+    if (!m_Thread.joinable())
+    {
+        return S_OK;
+    }
+
+    m_StopEvent.SetEvent();
+    m_Thread.join();
+    return m_hrDrain;
+}
+
+void EventThreadCaptureScheduler::ThreadProc()
+{
+    LOOPBACK_TRACE_THREAD("Capture");
+
+    // Same scheduling class as the capture work queue
+    DWORD taskIndex = 0;
+    HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Capture", &taskIndex);
+
+    // The stop event comes first, so it wins over a pending packet
+    HANDLE events[] = { m_StopEvent.get(), m_SampleReadyEvent.get() };
+    while (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        HRESULT hr = m_Drain->DrainPackets(nullptr);
+        if (FAILED(hr))
+        {
+            m_hrDrain = hr;
+            break;
+        }
+    }
+
+    if (hTask != NULL)
+    {
+        AvRevertMmThreadCharacteristics(hTask);
+    }
+}
+
+PollingCaptureScheduler::~PollingCaptureScheduler()
+{
+    Stop();
+}
+
+HRESULT PollingCaptureScheduler::Initialize(IAudioClient* /*audioClient*/, const WAVEFORMATEX& format, UINT64 periodHns)
+{
+    RETURN_IF_FAILED(m_StopEvent.create(wil::EventOptions::ManualReset));
+    RETURN_IF_FAILED(m_Predictor.Initialize(format.nSamplesPerSec, periodHns));
+
+    // High resolution timers fire within a fraction of a millisecond, without raising the system timer resolution.
+    // They need Windows 10 1803; older versions get a regular timer.
+    m_Timer.reset(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+    if (!m_Timer)
+    {
+        m_Timer.reset(CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS));
+    }
+    RETURN_LAST_ERROR_IF(!m_Timer);
+    return S_OK;
+}
+
+HRESULT PollingCaptureScheduler::Start(ICaptureDrain* drain)
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, m_Thread.joinable() || !m_StopEvent.is_valid());
+
+    m_Drain = drain;
+    m_hrDrain = S_OK;
+    m_Predictor.Reset();
+    m_StopEvent.ResetEvent();
+    m_Thread = std::thread(&PollingCaptureScheduler::ThreadProc, this);
+    return S_OK;
+}
+
+HRESULT PollingCaptureScheduler::Stop()
+{
+    if (!m_Thread.joinable())
+    {
+        return S_OK;
+    }
+
+    m_StopEvent.SetEvent();
+    m_Thread.join();
+    return m_hrDrain;
+}
+
+void PollingCaptureScheduler::ThreadProc()
+{
+    LOOPBACK_TRACE_THREAD("Capture");
+
+    // Same scheduling class as the capture work queue
+    DWORD taskIndex = 0;
+    HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Capture", &taskIndex);
+
+    // The stop event comes first, so it wins over a due timer
+    HANDLE events[] = { m_StopEvent.get(), m_Timer.get() };
+    do
+    {
+        HRESULT hr = m_Drain->DrainPackets(&m_Predictor);
+        if (SUCCEEDED(hr))
+        {
+            // Negative due times are relative, in 100-nanosecond units
+            UINT64 nowHns = GetQpcTimeHns();
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -std::max<LONGLONG>((LONGLONG)(m_Predictor.GetNextWakeHns(nowHns) - nowHns), 1);
+            if (!SetWaitableTimer(m_Timer.get(), &dueTime, 0, nullptr, nullptr, FALSE))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+        }
+        if (FAILED(hr))
+        {
+            m_hrDrain = hr;
+            break;
+        }
+    } while (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1);
+
+    if (hTask != NULL)
+    {
+        AvRevertMmThreadCharacteristics(hTask);
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <AudioClient.h>
+#include <wrl\implements.h>
+#include <wil\com.h>
+#include <wil\resource.h>
+#include <wil\result.h>
+
+#include "Common.h"
+#include "PacketArrivalPredictor.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+* How the capture engine wakes up to drain the captured packets
+*/
+enum class CaptureScheduling
+{
+    // Media Foundation waiting work item on the buffer event, run by the MMCSS "Capture" shared work queue
+    WorkQueue,
+    // Dedicated MMCSS thread waiting on the buffer event
+    EventThread,
+    // Dedicated MMCSS thread polling the capture client when PacketArrivalPredictor expects the next packet
+    Polling,
+};
+
+/**
+* Packet drain the capture schedulers run on every wakeup
+*/
+class ICaptureDrain
+{
+public:
+    virtual ~ICaptureDrain() = default;
+
+    // Reads every packet the capture client holds, and passes their timing to pPredictor unless it is null
+    virtual HRESULT DrainPackets(PacketArrivalPredictor* pPredictor) = 0;
+};
+
+/**
+* Decides when the capture engine drains the capture client. The engine's processing is the same whatever the
+* scheduler, so the schedulers can be compared on identical work.
+*/
+class ICaptureScheduler
+{
+public:
+    virtual ~ICaptureScheduler() = default;
+
+    // Flags the audio client must be initialized with, besides the loopback ones
+    virtual DWORD GetStreamFlags() const = 0;
+    // Called once the audio client is initialized with GetStreamFlags, before it starts. periodHns is the device period.
+    virtual HRESULT Initialize(IAudioClient* audioClient, const WAVEFORMATEX& format, UINT64 periodHns) = 0;
+    // Starts calling drain->DrainPackets on every wakeup. A failed drain stops the wakeups.
+    virtual HRESULT Start(ICaptureDrain* drain) = 0;
+    // Stops the wakeups. Returns once no drain runs, with the error of the drain that failed, if any.
+    virtual HRESULT Stop() = 0;
+};
+
+std::unique_ptr<ICaptureScheduler> CreateCaptureScheduler(CaptureScheduling scheduling);
+
+/**
+* Waiting work item callback of WorkQueueCaptureScheduler, with the state the work items share. The work items hold a
+* reference to it, so a work item the queue dispatched before Stop can still run after the scheduler is gone: it finds
+* the drain released and returns.
+*/
+class WorkQueueCaptureCallback :
+    public Microsoft::WRL::RuntimeClass< Microsoft::WRL::RuntimeClassFlags< Microsoft::WRL::ClassicCom >, Microsoft::WRL::FtmBase, IMFAsyncCallback >
+{
+public:
+    HRESULT Initialize(DWORD dwQueueID);
+    HANDLE GetSampleReadyEvent() const { return m_SampleReadyEvent.get(); }
+
+    // Queues pResult, whose callback must be this object, to drain on every buffer event
+    HRESULT Start(ICaptureDrain* drain, IMFAsyncResult* pResult);
+    // Cancels the queued work item. Returns once no drain runs and none will, with the error of the drain that
+    // failed, if any.
+    HRESULT Stop();
+
+    // IMFAsyncCallback
+    STDMETHOD(GetParameters)(DWORD* pdwFlags, DWORD* pdwQueue) override;
+    STDMETHOD(Invoke)(IMFAsyncResult* pResult) override;
+
+private:
+    wil::unique_event_nothrow m_SampleReadyEvent;
+    DWORD m_dwQueueID = 0;
+
+    // Held for the whole drain, so Stop waits for the running one, if any
+    std::mutex m_Mutex;
+    ICaptureDrain* m_Drain = nullptr;
+    MFWORKITEM_KEY m_SampleReadyKey = 0;
+    HRESULT m_hrDrain = S_OK;
+};
+
+/**
+* Drains on a Media Foundation waiting work item, queued again after every drain, on the shared MMCSS "Capture" work
+* queue. Whichever thread of the queue is free runs the drain.
+*/
+class WorkQueueCaptureScheduler : public ICaptureScheduler
+{
+public:
+    WorkQueueCaptureScheduler() = default;
+    ~WorkQueueCaptureScheduler();
+
+    DWORD GetStreamFlags() const override { return AUDCLNT_STREAMFLAGS_EVENTCALLBACK; }
+    HRESULT Initialize(IAudioClient* audioClient, const WAVEFORMATEX& format, UINT64 periodHns) override;
+    HRESULT Start(ICaptureDrain* drain) override;
+    HRESULT Stop() override;
+
+private:
+    Microsoft::WRL::ComPtr<WorkQueueCaptureCallback> m_Callback;
+    wil::com_ptr_nothrow<IMFAsyncResult> m_SampleReadyAsyncResult;
+    DWORD m_dwQueueID = 0;
+};
+
+/**
+* Drains from a thread of its own, woken up by the buffer event the audio engine sets for every packet
+*/
+class EventThreadCaptureScheduler : public ICaptureScheduler
+{
+public:
+    EventThreadCaptureScheduler() = default;
+    ~EventThreadCaptureScheduler();
+
+    DWORD GetStreamFlags() const override { return AUDCLNT_STREAMFLAGS_EVENTCALLBACK; }
+    HRESULT Initialize(IAudioClient* audioClient, const WAVEFORMATEX& format, UINT64 periodHns) override;
+    HRESULT Start(ICaptureDrain* drain) override;
+    HRESULT Stop() override;
+
+private:
+    void ThreadProc();
+
+    wil::unique_event_nothrow m_SampleReadyEvent;
+    wil::unique_event_nothrow m_StopEvent;
+    ICaptureDrain* m_Drain = nullptr;
+    std::thread m_Thread;
+    HRESULT m_hrDrain = S_OK;
+};
+
+/**
+* Drains from a thread of its own that polls the capture client when the next packet is expected, on a high resolution
+* waitable timer. Needs no buffer event. The thread wakes up about once per packet instead of every millisecond, and
+* reads the packets about as soon as the buffer event would.
+*/
+class PollingCaptureScheduler : public ICaptureScheduler
+{
+public:
+    PollingCaptureScheduler() = default;
+    ~PollingCaptureScheduler();
+
+    DWORD GetStreamFlags() const override { return 0; }
+    HRESULT Initialize(IAudioClient* audioClient, const WAVEFORMATEX& format, UINT64 periodHns) override;
+    HRESULT Start(ICaptureDrain* drain) override;
+    HRESULT Stop() override;
+
+private:
+    void ThreadProc();
+
+    wil::unique_event_nothrow m_StopEvent;
+    wil::unique_handle m_Timer;
+    PacketArrivalPredictor m_Predictor;
+    ICaptureDrain* m_Drain = nullptr;
+    std::thread m_Thread;
+    HRESULT m_hrDrain = S_OK;
+};
@@ -0,0 +1,367 @@
+#include "CaptureSource.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+/**
+* Writes one normalized sample (-1..1) in the sample format described by format
+*/
+static void WriteNormalizedSample(const WAVEFORMATEX& format, BYTE* dst, double value)
+{
+    value = std::min(1.0, std::max(-1.0, value));
+    if (format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        if (format.wBitsPerSample == 64)
+        {
+            double sample = value;
+            memcpy(dst, &sample, sizeof(sample));
+        }
+        else
+        {
+            float sample = (float)value;
+            memcpy(dst, &sample, sizeof(sample));
+        }
+    }
+    else
+    {
+        // Little-endian signed integer PCM of 16, 24 or 32 bits
+        int bytes = format.wBitsPerSample / 8;
+        double scale = (double)(1ULL << (format.wBitsPerSample - 1));
+        LONGLONG sample = (LONGLONG)std::lround(value * scale);
+        sample = std::min<LONGLONG>(sample, (LONGLONG)scale - 1);
+        for (int i = 0; i < bytes; i++)
+        {
+            dst[i] = (BYTE)(sample >> (8 * i));
+        }
+    }
+}
+
+void WriteToneFrames(const WAVEFORMATEX& format, BYTE* dst, UINT32 frames, UINT64 position, double frequency, double amplitude)
+{
+    UINT32 bytesPerSample = format.wBitsPerSample / 8;
+    for (UINT32 i = 0; i < frames; i++)
+    {
+        // Derive the phase from the absolute position so packet boundaries never introduce discontinuities
+        double t = (double)(position + i) / (double)format.nSamplesPerSec;
+        BYTE* frame = dst + (size_t)i * format.nBlockAlign;
+        for (WORD channel = 0; channel < format.nChannels; channel++)
+        {
+            double value = amplitude * sin(2.0 * PI * frequency * t + channel * PI / 2.0);
+            WriteNormalizedSample(format, frame + channel * bytesPerSample, value);
+        }
+    }
+}
+
+void PacedCaptureSource::InitializeTiming(const WAVEFORMATEX& format, const CaptureSourceTiming& timing)
+{
+    m_Format = format;
+    m_Timing = timing;
+    if (m_Timing.periodFrames == 0)
+    {
+        // Default to the 10 ms period used by the shared mode audio engine
+        m_Timing.periodFrames = m_Format.nSamplesPerSec / 100;
+    }
+    m_RandomState = (m_Timing.seed != 0) ? m_Timing.seed : 1;
+    m_PacketBuffer.resize((size_t)m_Timing.periodFrames * m_Format.nBlockAlign);
+    m_DevicePosition = 0;
+    m_NextPacketFrames = 0;
+    m_PeriodFramesLeft = 0;
+    m_bBufferHeld = false;
+    m_u64QPCStart = GetQpcTimeHns();
+}
+
+//
+//  PacketQpcPosition()
+//
+//  Time at which the frame at devicePosition is written by the simulated device clock
+//
+UINT64 PacedCaptureSource::PacketQpcPosition(UINT64 devicePosition) const
+{
+    double seconds = (double)devicePosition / (double)m_Format.nSamplesPerSec;
+    return m_u64QPCStart + (UINT64)(seconds * (1.0 + m_Timing.clockDriftPpm * 1e-6) * (double)HNS_PER_SEC);
+}
+
+UINT32 PacedCaptureSource::NextRandom()
+{
+    // xorshift32
+    m_RandomState ^= m_RandomState << 13;
+    m_RandomState ^= m_RandomState >> 17;
+    m_RandomState ^= m_RandomState << 5;
+    return m_RandomState;
+}
+
+HRESULT PacedCaptureSource::GetNextPacketSize(UINT32* pNumFramesInNextPacket)
+{
+    if (pNumFramesInNextPacket == nullptr)
+    {
+        return E_POINTER;
+    }
+    *pNumFramesInNextPacket = 0;
+
+    if (m_NextPacketFrames == 0)
+    {
+        UINT64 framesRemaining = FramesRemaining();
+        if (framesRemaining == 0)
+        {
+            return S_OK;
+        }
+
+        if (m_PeriodFramesLeft == 0)
+        {
+            m_PeriodFramesLeft = m_Timing.periodFrames;
+        }
+
+        // Either deliver the rest of the period at once, or split it the way the engine does under load
+        UINT32 frames = m_PeriodFramesLeft;
+        if (frames > 1 && m_Timing.splitProbability > 0.0 &&
+            (NextRandom() % 10000) < (UINT32)(m_Timing.splitProbability * 10000.0))
+        {
+            frames = 1 + NextRandom() % (frames - 1);
+        }
+        m_NextPacketFrames = (UINT32)std::min<UINT64>(frames, framesRemaining);
+    }
+
+    // A live endpoint only reports a packet once its last frame has been written
+    if (m_Timing.realTime && GetQpcTimeHns() < PacketQpcPosition(m_DevicePosition + m_NextPacketFrames))
+    {
+        return S_OK;
+    }
+
+    *pNumFramesInNextPacket = m_NextPacketFrames;
+    return S_OK;
+}
+
+HRESULT PacedCaptureSource::GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition)
+{
+    if (ppData == nullptr || pNumFramesToRead == nullptr || pdwFlags == nullptr)
+    {
+        return E_POINTER;
+    }
+    if (m_bBufferHeld)
+    {
+        return AUDCLNT_E_OUT_OF_ORDER;
+    }
+
+    UINT32 frames = 0;
+    HRESULT hr = GetNextPacketSize(&frames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    *ppData = nullptr;
+    *pNumFramesToRead = frames;
+    *pdwFlags = 0;
+    if (frames == 0)
+    {
+        return AUDCLNT_S_BUFFER_EMPTY;
+    }
+
+    if (!FillPacket(m_PacketBuffer.data(), frames, *pdwFlags))
+    {
+        memset(m_PacketBuffer.data(), 0, (size_t)frames * m_Format.nBlockAlign);
+        *pdwFlags |= AUDCLNT_BUFFERFLAGS_SILENT;
+    }
+
+    *ppData = m_PacketBuffer.data();
+    if (pu64DevicePosition != nullptr)
+    {
+        *pu64DevicePosition = m_DevicePosition;
+    }
+    if (pu64QPCPosition != nullptr)
+    {
+        *pu64QPCPosition = PacketQpcPosition(m_DevicePosition);
+    }
+    m_bBufferHeld = true;
+
+    return S_OK;
+}
+
+HRESULT PacedCaptureSource::ReleaseBuffer(UINT32 NumFramesRead)
+{
+    if (!m_bBufferHeld)
+    {
+        return AUDCLNT_E_OUT_OF_ORDER;
+    }
+    // Like IAudioCaptureClient, the packet is either consumed entirely or not at all
+    if (NumFramesRead != 0 && NumFramesRead != m_NextPacketFrames)
+    {
+        return AUDCLNT_E_INVALID_SIZE;
+    }
+
+    m_bBufferHeld = false;
+    if (NumFramesRead != 0)
+    {
+        m_DevicePosition += NumFramesRead;
+        m_PeriodFramesLeft -= std::min(m_PeriodFramesLeft, NumFramesRead);
+        m_NextPacketFrames = 0;
+    }
+
+    return S_OK;
+}
+
+SyntheticCaptureSource::SyntheticCaptureSource(const WAVEFORMATEX& format, const CaptureSourceTiming& timing,
+    SyntheticWaveform waveform, double frequency, double amplitude) :
+    m_Waveform(waveform),
+    m_Frequency(frequency),
+    m_Amplitude(amplitude)
+{
+    InitializeTiming(format, timing);
+}
+
+bool SyntheticCaptureSource::FillPacket(BYTE* dst, UINT32 frames, DWORD& flags)
+{
+    if (m_Waveform == SyntheticWaveform::Silence)
+    {
+        memset(dst, 0, (size_t)frames * m_Format.nBlockAlign);
+        flags |= AUDCLNT_BUFFERFLAGS_SILENT;
+        return true;
+    }
+
+    if (m_Waveform == SyntheticWaveform::Sine)
+    {
+        WriteToneFrames(m_Format, dst, frames, m_DevicePosition, m_Frequency, m_Amplitude);
+        return true;
+    }
+
+    UINT32 bytesPerSample = m_Format.wBitsPerSample / 8;
+    for (UINT32 i = 0; i < frames; i++)
+    {
+        BYTE* frame = dst + (size_t)i * m_Format.nBlockAlign;
+        for (WORD channel = 0; channel < m_Format.nChannels; channel++)
+        {
+            m_NoiseState ^= m_NoiseState << 13;
+            m_NoiseState ^= m_NoiseState >> 17;
+            m_NoiseState ^= m_NoiseState << 5;
+            double value = m_Amplitude * ((double)m_NoiseState / 2147483648.0 - 1.0);
+            WriteNormalizedSample(m_Format, frame + channel * bytesPerSample, value);
+        }
+    }
+
+    return true;
+}
+
+//
+//  Open()
+//
+//  Parses the RIFF structure of fileName and positions the reader at the start of the 'data' chunk
+//
+HRESULT WavFileCaptureSource::Open(const std::filesystem::path& fileName, const CaptureSourceTiming& timing, bool loop)
+{
+    m_File.open(fileName, std::ios::binary);
+    if (!m_File)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_File.seekg(0, std::ios::end);
+    UINT64 cbFileSize = (UINT64)m_File.tellg();
+    m_File.seekg(0, std::ios::beg);
+
+    DWORD riff[3] = {};
+    if (!m_File.read(reinterpret_cast<char*>(riff), sizeof(riff)) || (riff[0] != FCC('RIFF') && riff[0] != FCC('RF64')) || riff[2] != FCC('WAVE'))
+    {
+        return E_INVALIDARG;
+    }
+
+    WAVEFORMATEX format {};
+    bool bHaveFormat = false;
+    // Size of the data chunk from the ds64 chunk of an RF64 file
+    UINT64 cbDataSize64 = 0;
+    DWORD chunk[2] = {};
+    while (m_File.read(reinterpret_cast<char*>(chunk), sizeof(chunk)))
+    {
+        UINT64 cbChunkStart = (UINT64)m_File.tellg();
+        if (chunk[0] == FCC('fmt '))
+        {
+            if (chunk[1] < 16)
+            {
+                return E_INVALIDARG;
+            }
+            m_File.read(reinterpret_cast<char*>(&format), std::min<DWORD>(chunk[1], sizeof(format)));
+            if (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE && chunk[1] >= sizeof(WAVEFORMATEXTENSIBLE))
+            {
+                // Only the SubFormat matters to the replay, so fold the extensible header into a plain one
+                WAVEFORMATEXTENSIBLE formatex {};
+                m_File.seekg((std::streamoff)cbChunkStart);
+                m_File.read(reinterpret_cast<char*>(&formatex), sizeof(formatex));
+                format.wFormatTag = (formatex.SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+            }
+            format.cbSize = 0;
+            bHaveFormat = true;
+        }
+        else if (chunk[0] == FCC('ds64') && chunk[1] >= 2 * sizeof(UINT64))
+        {
+            UINT64 sizes[2] = {};
+            m_File.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+            cbDataSize64 = sizes[1];
+        }
+        else if (chunk[0] == FCC('data'))
+        {
+            m_cbDataOffset = cbChunkStart;
+            m_cbDataSize = (chunk[1] == 0xFFFFFFFF && cbDataSize64 != 0) ? cbDataSize64 : chunk[1];
+            // A recording that was never finalized has a zero size. Replay up to the end of the file instead.
+            if (m_cbDataSize == 0 || m_cbDataOffset + m_cbDataSize > cbFileSize)
+            {
+                m_cbDataSize = cbFileSize - m_cbDataOffset;
+            }
+            break;
+        }
+        // Chunks are padded to an even size
+        m_File.seekg((std::streamoff)(cbChunkStart + chunk[1] + (chunk[1] & 1)));
+    }
+
+    if (!bHaveFormat || m_cbDataOffset == 0 || format.nBlockAlign == 0 ||
+        (format.wFormatTag != WAVE_FORMAT_PCM && format.wFormatTag != WAVE_FORMAT_IEEE_FLOAT))
+    {
+        return E_INVALIDARG;
+    }
+
+    m_cbDataSize -= m_cbDataSize % format.nBlockAlign;
+    m_cbDataRead = 0;
+    m_bLoop = loop;
+    m_File.clear();
+    m_File.seekg((std::streamoff)m_cbDataOffset);
+
+    InitializeTiming(format, timing);
+    return S_OK;
+}
+
+UINT64 WavFileCaptureSource::FramesRemaining() const
+{
+    if (m_bLoop && m_cbDataSize != 0)
+    {
+        return ~0ULL;
+    }
+    return (m_cbDataSize - m_cbDataRead) / m_Format.nBlockAlign;
+}
+
+bool WavFileCaptureSource::FillPacket(BYTE* dst, UINT32 frames, DWORD& flags)
+{
+    UINT64 cbToRead = (UINT64)frames * m_Format.nBlockAlign;
+    while (cbToRead > 0)
+    {
+        if (m_cbDataRead == m_cbDataSize)
+        {
+            if (!m_bLoop)
+            {
+                return false;
+            }
+            m_cbDataRead = 0;
+            m_File.seekg((std::streamoff)m_cbDataOffset);
+            flags |= AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY;
+        }
+
+        UINT64 cbChunk = std::min(cbToRead, m_cbDataSize - m_cbDataRead);
+        if (!m_File.read(reinterpret_cast<char*>(dst), (std::streamsize)cbChunk))
+        {
+            return false;
+        }
+        dst += cbChunk;
+        cbToRead -= cbChunk;
+        m_cbDataRead += cbChunk;
+    }
+
+    return true;
+}
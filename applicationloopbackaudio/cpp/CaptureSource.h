@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+/**
+* Source of captured audio packets.
+*
+* Mirrors the packet draining subset of IAudioCaptureClient (GetNextPacketSize / GetBuffer / ReleaseBuffer) so the
+* capture loops can run against a live loopback client, a synthetic generator or a WAV file replay without changes.
+*/
+class ICaptureSource
+{
+public:
+    virtual ~ICaptureSource() = default;
+
+    // Sample format of the packets returned by GetBuffer
+    virtual const WAVEFORMATEX& GetFormat() const = 0;
+
+    virtual HRESULT GetNextPacketSize(UINT32* pNumFramesInNextPacket) = 0;
+    virtual HRESULT GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition) = 0;
+    virtual HRESULT ReleaseBuffer(UINT32 NumFramesRead) = 0;
+};
+
+/**
+* Packet timing model shared by the non-live capture sources.
+*/
+struct CaptureSourceTiming
+{
+    // Nominal packet size. The audio engine usually delivers one device period (10 ms) per packet.
+    UINT32 periodFrames = 0;
+    // Probability (0..1) that a period is delivered as two smaller packets instead of a single one
+    double splitProbability = 0.0;
+    // Deviation of the simulated device clock from the QPC clock, in parts per million
+    double clockDriftPpm = 0.0;
+    // When true, packets only become available once the QPC clock has passed their end time, like a live endpoint.
+    // When false, packets are always available and the source runs as fast as it is drained.
+    bool realTime = true;
+    // Seed of the packet size generator. The same seed always produces the same packet sequence.
+    UINT32 seed = 1;
+};
+
+/**
+* Base class for the synthetic and file replay capture sources.
+*
+* Generates the packet sizes, device positions and QPC timestamps; derived classes only provide the sample data.
+*/
+class PacedCaptureSource : public ICaptureSource
+{
+public:
+    const WAVEFORMATEX& GetFormat() const override { return m_Format; }
+
+    HRESULT GetNextPacketSize(UINT32* pNumFramesInNextPacket) override;
+    HRESULT GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition) override;
+    HRESULT ReleaseBuffer(UINT32 NumFramesRead) override;
+
+protected:
+    PacedCaptureSource() = default;
+
+    // Must be called by the derived class once the format is known
+    void InitializeTiming(const WAVEFORMATEX& format, const CaptureSourceTiming& timing);
+
+    // Writes frames of sample data at m_DevicePosition into dst. Returns false on end of stream.
+    virtual bool FillPacket(BYTE* dst, UINT32 frames, DWORD& flags) = 0;
+    // Number of frames left in the stream, or UINT64 max for endless sources
+    virtual UINT64 FramesRemaining() const = 0;
+
+    UINT64 PacketQpcPosition(UINT64 devicePosition) const;
+    UINT32 NextRandom();
+
+    WAVEFORMATEX m_Format {};
+    CaptureSourceTiming m_Timing;
+    std::vector<BYTE> m_PacketBuffer;
+
+    // Number of frames released so far
+    UINT64 m_DevicePosition = 0;
+    // QPC time of the first frame of the stream, in 100-nanosecond units
+    UINT64 m_u64QPCStart = 0;
+    // Size of the packet returned by the next GetBuffer call, 0 when it has not been decided yet
+    UINT32 m_NextPacketFrames = 0;
+    // Frames of the current device period that have not been delivered yet
+    UINT32 m_PeriodFramesLeft = 0;
+    UINT32 m_RandomState = 1;
+    bool m_bBufferHeld = false;
+};
+
+// Writes frames of a sine tone that starts at frame position into dst, in any PCM or float format. Each channel is a
+// quarter cycle ahead of the previous one, so swapped channels are easy to spot.
+void WriteToneFrames(const WAVEFORMATEX& format, BYTE* dst, UINT32 frames, UINT64 position, double frequency, double amplitude);
+
+enum class SyntheticWaveform
+{
+    Silence,
+    Sine,
+    WhiteNoise,
+};
+
+/**
+* Generates a test signal in any of the PCM or float formats an endpoint can present.
+*/
+class SyntheticCaptureSource : public PacedCaptureSource
+{
+public:
+    SyntheticCaptureSource(const WAVEFORMATEX& format, const CaptureSourceTiming& timing,
+        SyntheticWaveform waveform = SyntheticWaveform::Sine, double frequency = 1000.0, double amplitude = 0.5);
+
+protected:
+    bool FillPacket(BYTE* dst, UINT32 frames, DWORD& flags) override;
+    UINT64 FramesRemaining() const override { return ~0ULL; }
+
+private:
+    SyntheticWaveform m_Waveform;
+    double m_Frequency;
+    double m_Amplitude;
+    UINT32 m_NoiseState = 0x9E3779B9;
+};
+
+/**
+* Replays the 'data' chunk of a PCM or float WAV (or RF64) file as a stream of capture packets.
+*/
+class WavFileCaptureSource : public PacedCaptureSource
+{
+public:
+    WavFileCaptureSource() = default;
+
+    HRESULT Open(const std::filesystem::path& fileName, const CaptureSourceTiming& timing, bool loop = false);
+
+protected:
+    bool FillPacket(BYTE* dst, UINT32 frames, DWORD& flags) override;
+    UINT64 FramesRemaining() const override;
+
+private:
+    std::ifstream m_File;
+    // Offset and size of the 'data' chunk payload
+    UINT64 m_cbDataOffset = 0;
+    UINT64 m_cbDataSize = 0;
+    UINT64 m_cbDataRead = 0;
+    bool m_bLoop = false;
+};
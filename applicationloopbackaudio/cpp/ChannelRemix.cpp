@@ -0,0 +1,398 @@
+#include "ChannelRemix.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Frames remixed per pass, so the float staging of both sides stays in the L1 cache
+static const UINT32 ChunkFrames = 256;
+// -3 dB, the gain of a speaker folded into two neighbours
+static const float MinusThreeDb = 0.70710678f;
+
+// Index of the channel at speaker position in a layout, or -1 if the layout has no such channel
+static int GetChannelIndex(DWORD mask, UINT32 channels, DWORD position)
+{
+    if ((mask & position) == 0)
+    {
+        return -1;
+    }
+    UINT32 index = 0;
+    for (DWORD bit = 1; bit < position; bit <<= 1)
+    {
+        index += (mask & bit) ? 1 : 0;
+    }
+    return (index < channels) ? (int)index : -1;
+}
+
+/**
+* Routing of one source channel into the output layout
+*/
+struct SpeakerRouter
+{
+    DWORD dstMask;
+    UINT32 dstChannels;
+    UINT32 srcChannels;
+    UINT32 srcChannel;
+    float* matrix;
+
+    bool Has(DWORD position) const { return GetChannelIndex(dstMask, dstChannels, position) >= 0; }
+
+    // Adds the source channel to the output speaker at position, or to the speakers standing in for it
+    void Route(DWORD position, float gain)
+    {
+        int index = GetChannelIndex(dstMask, dstChannels, position);
+        if (index >= 0)
+        {
+            matrix[(size_t)index * srcChannels + srcChannel] += gain;
+            return;
+        }
+
+        switch (position)
+        {
+        case SPEAKER_FRONT_LEFT:
+        case SPEAKER_FRONT_RIGHT:
+            Route(SPEAKER_FRONT_CENTER, gain * MinusThreeDb);
+            break;
+        case SPEAKER_FRONT_CENTER:
+            if (Has(SPEAKER_FRONT_LEFT) || Has(SPEAKER_FRONT_RIGHT))
+            {
+                // A mono source is duplicated at full level; a center channel is split at -3 dB
+                float split = (srcChannels == 1) ? gain : gain * MinusThreeDb;
+                Route(SPEAKER_FRONT_LEFT, split);
+                Route(SPEAKER_FRONT_RIGHT, split);
+            }
+            break;
+        case SPEAKER_LOW_FREQUENCY:
+            // Dropped, as in the ITU downmixes
+            break;
+        case SPEAKER_BACK_LEFT:
+            Has(SPEAKER_SIDE_LEFT) ? Route(SPEAKER_SIDE_LEFT, gain) : Route(SPEAKER_FRONT_LEFT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_BACK_RIGHT:
+            Has(SPEAKER_SIDE_RIGHT) ? Route(SPEAKER_SIDE_RIGHT, gain) : Route(SPEAKER_FRONT_RIGHT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_SIDE_LEFT:
+            Has(SPEAKER_BACK_LEFT) ? Route(SPEAKER_BACK_LEFT, gain) : Route(SPEAKER_FRONT_LEFT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_SIDE_RIGHT:
+            Has(SPEAKER_BACK_RIGHT) ? Route(SPEAKER_BACK_RIGHT, gain) : Route(SPEAKER_FRONT_RIGHT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_FRONT_LEFT_OF_CENTER:
+            Route(SPEAKER_FRONT_LEFT, gain);
+            break;
+        case SPEAKER_FRONT_RIGHT_OF_CENTER:
+            Route(SPEAKER_FRONT_RIGHT, gain);
+            break;
+        case SPEAKER_BACK_CENTER:
+            Route(SPEAKER_BACK_LEFT, gain * MinusThreeDb);
+            Route(SPEAKER_BACK_RIGHT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_FRONT_LEFT:
+            Route(SPEAKER_FRONT_LEFT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_FRONT_RIGHT:
+            Route(SPEAKER_FRONT_RIGHT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_CENTER:
+        case SPEAKER_TOP_FRONT_CENTER:
+            Route(SPEAKER_FRONT_CENTER, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_BACK_LEFT:
+            Route(SPEAKER_BACK_LEFT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_BACK_RIGHT:
+            Route(SPEAKER_BACK_RIGHT, gain * MinusThreeDb);
+            break;
+        case SPEAKER_TOP_BACK_CENTER:
+            Route(SPEAKER_BACK_CENTER, gain * MinusThreeDb);
+            break;
+        }
+    }
+};
+
+static void MixScalar(const float* columns, UINT32 srcChannels, UINT32 dstChannels, const float* input, float* output, UINT32 frames)
+{
+    for (UINT32 i = 0; i < frames; i++)
+    {
+        for (UINT32 d = 0; d < dstChannels; d++)
+        {
+            float sum = 0.0f;
+            for (UINT32 s = 0; s < srcChannels; s++)
+            {
+                sum += columns[s * ChannelRemix::MaxChannels + d] * input[s];
+            }
+            output[d] = sum;
+        }
+        input += srcChannels;
+        output += dstChannels;
+    }
+}
+
+// Frames whose vector stores of width floats stay within the output; the stores of a frame spill into the next
+// frame's channels, which are overwritten right after
+static UINT32 GetVectorFrames(UINT32 dstChannels, UINT32 frames, UINT32 width)
+{
+    UINT32 samples = frames * dstChannels;
+    return (samples >= width) ? (samples - width) / dstChannels + 1 : 0;
+}
+
+#if defined(CPU_X86)
+static void MixSSE(const float* columns, UINT32 srcChannels, UINT32 dstChannels, const float* input, float* output, UINT32 frames)
+{
+    const bool bWide = dstChannels > 4;
+    UINT32 vectorFrames = GetVectorFrames(dstChannels, frames, bWide ? 8 : 4);
+    for (UINT32 i = 0; i < vectorFrames; i++)
+    {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (UINT32 s = 0; s < srcChannels; s++)
+        {
+            __m128 sample = _mm_set1_ps(input[s]);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(sample, _mm_loadu_ps(columns + s * ChannelRemix::MaxChannels)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(sample, _mm_loadu_ps(columns + s * ChannelRemix::MaxChannels + 4)));
+        }
+        _mm_storeu_ps(output, sum0);
+        if (bWide)
+        {
+            _mm_storeu_ps(output + 4, sum1);
+        }
+        input += srcChannels;
+        output += dstChannels;
+    }
+    MixScalar(columns, srcChannels, dstChannels, input, output, frames - vectorFrames);
+}
+
+TARGET_AVX2 static void MixAVX2(const float* columns, UINT32 srcChannels, UINT32 dstChannels, const float* input, float* output, UINT32 frames)
+{
+    UINT32 vectorFrames = GetVectorFrames(dstChannels, frames, 8);
+    for (UINT32 i = 0; i < vectorFrames; i++)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (UINT32 s = 0; s < srcChannels; s++)
+        {
+            // Multiply and add rounded separately, like the scalar mix: a fused multiply-add would change the low bits
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_broadcast_ss(input + s), _mm256_loadu_ps(columns + s * ChannelRemix::MaxChannels)));
+        }
+        _mm256_storeu_ps(output, sum);
+        input += srcChannels;
+        output += dstChannels;
+    }
+    MixScalar(columns, srcChannels, dstChannels, input, output, frames - vectorFrames);
+}
+#endif
+
+#if defined(CPU_NEON)
+static void MixNEON(const float* columns, UINT32 srcChannels, UINT32 dstChannels, const float* input, float* output, UINT32 frames)
+{
+    const bool bWide = dstChannels > 4;
+    UINT32 vectorFrames = GetVectorFrames(dstChannels, frames, bWide ? 8 : 4);
+    for (UINT32 i = 0; i < vectorFrames; i++)
+    {
+        float32x4_t sum0 = vdupq_n_f32(0.0f);
+        float32x4_t sum1 = vdupq_n_f32(0.0f);
+        for (UINT32 s = 0; s < srcChannels; s++)
+        {
+            sum0 = vmlaq_n_f32(sum0, vld1q_f32(columns + s * ChannelRemix::MaxChannels), input[s]);
+            sum1 = vmlaq_n_f32(sum1, vld1q_f32(columns + s * ChannelRemix::MaxChannels + 4), input[s]);
+        }
+        vst1q_f32(output, sum0);
+        if (bWide)
+        {
+            vst1q_f32(output + 4, sum1);
+        }
+        input += srcChannels;
+        output += dstChannels;
+    }
+    MixScalar(columns, srcChannels, dstChannels, input, output, frames - vectorFrames);
+}
+#endif
+
+DWORD ChannelRemix::GetDefaultChannelMask(UINT32 channels)
+{
+    switch (channels)
+    {
+    case 1:
+        return SPEAKER_FRONT_CENTER;
+    case 2:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+    case 3:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER;
+    case 4:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 5:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 6:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 7:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT |
+            SPEAKER_BACK_CENTER;
+    case 8:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT |
+            SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+    default:
+        return 0;
+    }
+}
+
+DWORD ChannelRemix::GetChannelMask(const WAVEFORMATEX& format)
+{
+    bool bExtensible = format.wFormatTag == WAVE_FORMAT_EXTENSIBLE && format.cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    return bExtensible ? reinterpret_cast<const WAVEFORMATEXTENSIBLE&>(format).dwChannelMask : 0;
+}
+
+//
+//  BuildStandardMatrix()
+//
+//  Routes every source speaker to the output, then scales a downmix so that the busiest output sums to unity gain
+//
+void ChannelRemix::BuildStandardMatrix(UINT32 srcChannels, DWORD srcMask, UINT32 dstChannels, DWORD dstMask, float* matrix)
+{
+    srcMask = (srcMask != 0) ? srcMask : GetDefaultChannelMask(srcChannels);
+    dstMask = (dstMask != 0) ? dstMask : GetDefaultChannelMask(dstChannels);
+    std::fill(matrix, matrix + (size_t)srcChannels * dstChannels, 0.0f);
+
+    SpeakerRouter router = { dstMask, dstChannels, srcChannels, 0, matrix };
+    UINT32 channel = 0;
+    for (DWORD position = 1; position != 0 && channel < srcChannels; position <<= 1)
+    {
+        if (srcMask & position)
+        {
+            router.srcChannel = channel++;
+            router.Route(position, 1.0f);
+        }
+    }
+
+    // Source channels beyond the mask have no position and only pass through to the same output channel
+    for (; channel < srcChannels && channel < dstChannels; channel++)
+    {
+        matrix[(size_t)channel * srcChannels + channel] = 1.0f;
+    }
+
+    float maxRowGain = 0.0f;
+    for (UINT32 d = 0; d < dstChannels; d++)
+    {
+        float rowGain = 0.0f;
+        for (UINT32 s = 0; s < srcChannels; s++)
+        {
+            rowGain += std::fabs(matrix[(size_t)d * srcChannels + s]);
+        }
+        maxRowGain = std::max(maxRowGain, rowGain);
+    }
+    if (maxRowGain > 1.0f)
+    {
+        for (size_t i = 0; i < (size_t)srcChannels * dstChannels; i++)
+        {
+            matrix[i] /= maxRowGain;
+        }
+    }
+}
+
+//
+//  Initialize()
+//
+//  Builds the matrix, the float staging buffers and the conversions around them, and selects the mix kernel
+//
+HRESULT ChannelRemix::Initialize(SampleFormat srcFormat, UINT32 srcChannels, DWORD srcMask, SampleFormat dstFormat, UINT32 dstChannels,
+    DWORD dstMask, const float* matrix, ChannelRemixKernel kernel)
+{
+    m_Mix = nullptr;
+    if (srcChannels == 0 || srcChannels > MaxChannels || dstChannels == 0 || dstChannels > MaxChannels)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_ConvertIn = (srcFormat == SampleFormat::Float32) ? nullptr : GetFrameConverter(srcFormat, SampleFormat::Float32, srcChannels);
+    m_ConvertOut = (dstFormat == SampleFormat::Float32) ? nullptr : GetFrameConverter(SampleFormat::Float32, dstFormat, dstChannels);
+    if ((srcFormat != SampleFormat::Float32 && m_ConvertIn == nullptr) || (dstFormat != SampleFormat::Float32 && m_ConvertOut == nullptr))
+    {
+        return E_INVALIDARG;
+    }
+
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    if (kernel == ChannelRemixKernel::Auto)
+    {
+        kernel = cpu.avx2 ? ChannelRemixKernel::AVX2 : cpu.neon ? ChannelRemixKernel::NEON : ChannelRemixKernel::SSE;
+    }
+    MixFn mix = nullptr;
+    switch (kernel)
+    {
+#if defined(CPU_X86)
+    case ChannelRemixKernel::AVX2:
+        if (!cpu.avx2)
+        {
+            return E_INVALIDARG;
+        }
+        mix = MixAVX2;
+        break;
+    case ChannelRemixKernel::SSE:
+        mix = MixSSE;
+        break;
+#endif
+#if defined(CPU_NEON)
+    case ChannelRemixKernel::NEON:
+        mix = MixNEON;
+        break;
+#endif
+    default:
+        // Requested instruction set is not available on this architecture
+        kernel = ChannelRemixKernel::Scalar;
+        mix = MixScalar;
+        break;
+    }
+
+    m_Matrix.resize((size_t)srcChannels * dstChannels);
+    if (matrix != nullptr)
+    {
+        std::copy(matrix, matrix + m_Matrix.size(), m_Matrix.begin());
+    }
+    else
+    {
+        BuildStandardMatrix(srcChannels, srcMask, dstChannels, dstMask, m_Matrix.data());
+    }
+
+    m_Columns.assign((size_t)srcChannels * MaxChannels, 0.0f);
+    for (UINT32 s = 0; s < srcChannels; s++)
+    {
+        for (UINT32 d = 0; d < dstChannels; d++)
+        {
+            m_Columns[(size_t)s * MaxChannels + d] = m_Matrix[(size_t)d * srcChannels + s];
+        }
+    }
+
+    m_Input.assign((m_ConvertIn != nullptr) ? (size_t)ChunkFrames * srcChannels : 0, 0.0f);
+    m_Output.assign((m_ConvertOut != nullptr) ? (size_t)ChunkFrames * dstChannels : 0, 0.0f);
+    m_SrcChannels = srcChannels;
+    m_DstChannels = dstChannels;
+    m_SrcFormat = srcFormat;
+    m_DstFormat = dstFormat;
+    m_Kernel = kernel;
+    m_Mix = mix;
+    return S_OK;
+}
+
+void ChannelRemix::Process(const BYTE* src, BYTE* dst, UINT32 frames)
+{
+    const size_t cbSrcFrame = (size_t)m_SrcChannels * GetSampleBytes(m_SrcFormat);
+    const size_t cbDstFrame = (size_t)m_DstChannels * GetSampleBytes(m_DstFormat);
+    while (frames > 0)
+    {
+        UINT32 chunk = std::min(frames, ChunkFrames);
+
+        const float* input = reinterpret_cast<const float*>(src);
+        if (m_ConvertIn != nullptr)
+        {
+            m_ConvertIn(src, reinterpret_cast<BYTE*>(m_Input.data()), chunk);
+            input = m_Input.data();
+        }
+        float* output = (m_ConvertOut != nullptr) ? m_Output.data() : reinterpret_cast<float*>(dst);
+        m_Mix(m_Columns.data(), m_SrcChannels, m_DstChannels, input, output, chunk);
+        if (m_ConvertOut != nullptr)
+        {
+            m_ConvertOut(reinterpret_cast<const BYTE*>(output), dst, chunk);
+        }
+
+        src += chunk * cbSrcFrame;
+        dst += chunk * cbDstFrame;
+        frames -= chunk;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Platform.h"
+#include "SampleConvert.h"
+
+#include <vector>
+
+/**
+* Instruction set used for the mix matrix. Auto picks the widest one the CPU supports.
+*/
+enum class ChannelRemixKernel
+{
+    Auto,
+    Scalar,
+    SSE,
+    AVX2,
+    NEON,
+};
+
+/**
+* Converts interleaved frames from one channel layout to another through a mix matrix, and from one sample format to
+* another in the same pass.
+*
+* The matrix has one row of srcChannels gains per output channel. The standard matrix follows the speaker positions
+* of the channel masks: channels present on both sides pass through, missing ones fold into their nearest neighbours
+* (center into left and right at -3 dB, surrounds into the fronts, ...), LFE is dropped when the output has none, and
+* a downmix is scaled so that no output can clip. Upmixes only feed the matching speakers; a user supplied matrix can
+* spread the content further.
+*
+* Frames are processed in chunks small enough to stay in the L1 cache: the source samples are widened to float, mixed
+* with vector kernels that compute every output channel of a frame at once, and narrowed to the output format. Every
+* kernel produces exactly the bytes the Scalar kernel produces for the same input, as long as it holds no NaN.
+*/
+class ChannelRemix
+{
+public:
+    static const UINT32 MaxChannels = 8;
+
+    // Speaker mask Windows assumes for a channel count when a format does not carry one
+    static DWORD GetDefaultChannelMask(UINT32 channels);
+    // dwChannelMask of an extensible format, 0 for any other format
+    static DWORD GetChannelMask(const WAVEFORMATEX& format);
+    // Fills matrix, dstChannels rows of srcChannels gains, with the standard remix between two speaker layouts. A mask of 0
+    // stands for the default layout of the channel count.
+    static void BuildStandardMatrix(UINT32 srcChannels, DWORD srcMask, UINT32 dstChannels, DWORD dstMask, float* matrix);
+
+    // Uses matrix (dstChannels rows of srcChannels gains) if given, the standard matrix otherwise
+    HRESULT Initialize(SampleFormat srcFormat, UINT32 srcChannels, DWORD srcMask, SampleFormat dstFormat, UINT32 dstChannels,
+        DWORD dstMask, const float* matrix = nullptr, ChannelRemixKernel kernel = ChannelRemixKernel::Auto);
+    bool IsInitialized() const { return m_Mix != nullptr; }
+
+    // Remixes frames frames of src into dst. Does not allocate.
+    void Process(const BYTE* src, BYTE* dst, UINT32 frames);
+
+    UINT32 GetSrcChannels() const { return m_SrcChannels; }
+    UINT32 GetDstChannels() const { return m_DstChannels; }
+    const std::vector<float>& GetMatrix() const { return m_Matrix; }
+    ChannelRemixKernel GetKernel() const { return m_Kernel; }
+
+private:
+    typedef void (*MixFn)(const float* columns, UINT32 srcChannels, UINT32 dstChannels, const float* input, float* output, UINT32 frames);
+
+    UINT32 m_SrcChannels = 0;
+    UINT32 m_DstChannels = 0;
+    SampleFormat m_SrcFormat = SampleFormat::Unknown;
+    SampleFormat m_DstFormat = SampleFormat::Unknown;
+    std::vector<float> m_Matrix;
+    // Matrix columns, padded to MaxChannels gains: column s holds the gain of source channel s in every output channel
+    std::vector<float> m_Columns;
+
+    // Format conversions on either side of the mix. Not used for float samples, which are mixed in place.
+    FrameConvertFn m_ConvertIn = nullptr;
+    FrameConvertFn m_ConvertOut = nullptr;
+    std::vector<float> m_Input;
+    std::vector<float> m_Output;
+
+    ChannelRemixKernel m_Kernel = ChannelRemixKernel::Scalar;
+    MixFn m_Mix = nullptr;
+};
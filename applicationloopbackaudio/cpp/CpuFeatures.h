@@ -0,0 +1,72 @@
+#pragma once
+
+/**
+* Runtime detection of the SIMD instruction sets used by the DSP kernels.
+*
+* Kernels for an instruction set newer than the compiler's baseline are tagged with the matching TARGET_ macro so they
+* can live in the same translation unit as the portable code; they must only be called when the CPU reports support.
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+#define CPU_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE41
+#endif
+
+struct CpuFeatures
+{
+    bool sse41 = false;
+    bool avx2 = false;
+    bool neon = false;
+
+    static const CpuFeatures& Get()
+    {
+        static const CpuFeatures features = Detect();
+        return features;
+    }
+
+private:
+    static CpuFeatures Detect()
+    {
+        CpuFeatures features;
+#if defined(CPU_X86)
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        features.sse41 = (info[2] & (1 << 19)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        // AVX also needs the OS to save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+        bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        if (maxLeaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            features.avx2 = osAvx && fma && (info[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        features.sse41 = __builtin_cpu_supports("sse4.1");
+        features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#elif defined(CPU_NEON)
+        features.neon = true;
+#endif
+        return features;
+    }
+};
@@ -0,0 +1,143 @@
+#include "DriftEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+// Bandwidth of the drift loop. Low enough to ignore scheduling jitter, high enough to lock within a minute.
+static const double LoopBandwidthHz = 0.02;
+// Time constant of the level filter. Well above the packet period, well below the loop time constant.
+static const double LevelTimeConstantSeconds = 0.5;
+// Time the output runs before the loop locks, so the start-up transient of the level is not mistaken for drift
+static const double SettleSeconds = 2.0;
+
+HRESULT DriftEstimator::Initialize(UINT32 outputRate, UINT32 targetFrames)
+{
+    if (outputRate == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_OutputRate = outputRate;
+    m_RequestedTargetFrames = targetFrames;
+
+    // Critically damped second order loop: the level error obeys e'' + 2we' + w^2 e = 0
+    double omega = 2.0 * PI * LoopBandwidthHz;
+    m_ProportionalGain = 2.0 * omega / outputRate;
+    m_IntegralGain = omega * omega / outputRate;
+
+    m_Integral = 0.0;
+    Reset();
+    return S_OK;
+}
+
+void DriftEstimator::Reset()
+{
+    m_bHasLevel = false;
+    m_bLocked = false;
+    m_SettledSeconds = 0.0;
+    m_FilteredLevel = 0.0;
+    m_TargetFrames = m_RequestedTargetFrames;
+    // Keep compensating the known drift while the loop locks again
+    m_Correction = m_Integral;
+}
+
+//
+//  OnLevelStep()
+//
+//  Settles again from the level after the step, then steers to the requested target, or holds the level reached
+//  without one. The correction stays at the drift estimate meanwhile.
+//
+void DriftEstimator::OnLevelStep()
+{
+    m_bHasLevel = false;
+    m_bLocked = false;
+    m_SettledSeconds = 0.0;
+    m_TargetFrames = m_RequestedTargetFrames;
+    m_Correction = m_Integral;
+}
+
+bool DriftEstimator::FilterLevel(double levelFrames, double seconds)
+{
+    if (!m_bHasLevel)
+    {
+        m_FilteredLevel = levelFrames;
+        m_bHasLevel = true;
+    }
+    else
+    {
+        m_FilteredLevel += (levelFrames - m_FilteredLevel) * (1.0 - std::exp(-seconds / LevelTimeConstantSeconds));
+    }
+
+    if (!m_bLocked)
+    {
+        m_SettledSeconds += seconds;
+        if (m_SettledSeconds < SettleSeconds)
+        {
+            return false;
+        }
+        m_bLocked = true;
+        m_LockedLevel = m_FilteredLevel;
+        m_LockedSeconds = 0.0;
+        if (m_TargetFrames == 0)
+        {
+            // The level runs below 0 when packets arrive just in time for the endpoint; hold it at 0 then
+            m_TargetFrames = (UINT32)std::lround(std::max(0.0, m_FilteredLevel));
+        }
+    }
+    return true;
+}
+
+//
+//  Update()
+//
+//  Filters the level, and once locked, advances the loop by seconds
+//
+double DriftEstimator::Update(double levelFrames, double seconds)
+{
+    if (!FilterLevel(levelFrames, seconds))
+    {
+        return GetRateScale();
+    }
+
+    double error = m_FilteredLevel - m_TargetFrames;
+    double limit = MaxCorrectionPpm * 1e-6;
+    double integral = m_Integral + m_IntegralGain * error * seconds;
+    double correction = m_ProportionalGain * error + integral;
+
+    // Stop integrating while the correction is clamped, so the loop does not wind up during a long excursion
+    if (std::fabs(correction) <= limit)
+    {
+        m_Integral = integral;
+    }
+    m_Correction = std::max(-limit, std::min(correction, limit));
+
+    return GetRateScale();
+}
+
+//
+//  Measure()
+//
+//  With nothing steering it, the level moves at the drift times the output rate. Once it has moved by DriftDetectMs
+//  since the lock, and no sooner than MeasureSeconds after it, the slope is the drift estimate the loop starts from.
+//
+bool DriftEstimator::Measure(double levelFrames, double seconds)
+{
+    if (!FilterLevel(levelFrames, seconds))
+    {
+        return false;
+    }
+
+    m_LockedSeconds += seconds;
+    double movedFrames = m_FilteredLevel - m_LockedLevel;
+    if (m_LockedSeconds < MeasureSeconds || std::fabs(movedFrames) < (double)m_OutputRate * DriftDetectMs / 1000)
+    {
+        return false;
+    }
+
+    double limit = MaxCorrectionPpm * 1e-6;
+    m_Integral = std::max(-limit, std::min(movedFrames / (m_LockedSeconds * m_OutputRate), limit));
+    m_Correction = m_Integral;
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Tracks the drift between the capture clock and the render clock from the fill level of the render path, and computes
+* the input rate scale of an adjustable resampler (PolyphaseResampler::SetInputRateScale) that holds the level at its
+* target indefinitely.
+*
+* The level is the number of output frames queued between the resampler and the speakers: the render ring plus the
+* endpoint buffer padding. It rises when the capture clock runs fast against the render clock and falls when it runs
+* slow. It should be sampled at the same point of every packet, e.g. just before writing it; sampling it at unrelated
+* times aliases the packet sawtooth into a slow wander the loop would chase. The level is low-pass filtered to remove
+* the remaining jitter, then drives a critically damped proportional-integral loop: the integral term converges to the
+* relative clock drift, and the proportional term pulls the level back to the target. The loop bandwidth is a few
+* hundredths of a hertz, so the rate changes by well under a part per million per packet. RenderPath adds the age of
+* the packet to the level, which moves the level and its target by the same latency but leaves the slope to the drift.
+*
+* The loop only locks once the level has settled after the output started. With a target of 0 frames, it then holds
+* the level it locked on.
+*
+* Only a slow slope of the level is drift. A late packet, a cut of the jitter buffer, an overrun or a lost capture
+* packet steps the level instead, and integrating such a step would wind the loop up to a drift that is not there.
+* OnLevelStep makes the loop settle and lock again after the step, keeping its drift estimate and its target; bringing
+* the latency back within the policy after a step is the jitter buffer's job.
+*
+* Until the converter is adjustable, Measure watches the level without steering it, and tells once it has moved far
+* enough without a step to be drift, so the resampler is only brought in when there is drift to compensate.
+*/
+class DriftEstimator
+{
+public:
+    // Correction limit, matching the range of the native resampler
+    static constexpr UINT32 MaxCorrectionPpm = 1000;
+    // Drift of the level, in milliseconds of output, that Measure takes for a clock drift
+    static constexpr UINT32 DriftDetectMs = 2;
+    // Shortest time Measure watches the level for, so the filtered jitter is not taken for a slope
+    static constexpr UINT32 MeasureSeconds = 10;
+
+    // outputRate is the rate of the frames the level counts. targetFrames 0 holds the level reached when locking.
+    HRESULT Initialize(UINT32 outputRate, UINT32 targetFrames);
+    bool IsInitialized() const { return m_OutputRate != 0; }
+
+    // Starts over, e.g. when the output restarts. The drift estimate is kept as the starting point.
+    void Reset();
+
+    // Feeds the level observed after seconds of capture. Returns the input rate scale to apply from now on.
+    double Update(double levelFrames, double seconds);
+    // Feeds the level like Update, with nothing steered by it. Returns true once the level has drifted by
+    // DriftDetectMs since it settled, with no step in between: GetDriftPpm is then the drift measured.
+    bool Measure(double levelFrames, double seconds);
+    // The level stepped since the last Update. The loop settles and locks again, on the level it reaches when no
+    // target was requested.
+    void OnLevelStep();
+
+    bool IsLocked() const { return m_bLocked; }
+    double GetRateScale() const { return 1.0 + m_Correction; }
+    // Estimated rate of the capture clock relative to the render clock, minus 1, in parts per million
+    double GetDriftPpm() const { return m_Integral * 1e6; }
+    double GetFilteredLevel() const { return m_FilteredLevel; }
+    UINT32 GetTargetFrames() const { return m_TargetFrames; }
+
+private:
+    // Filters the level. Returns true once the loop is locked.
+    bool FilterLevel(double levelFrames, double seconds);
+
+    UINT32 m_OutputRate = 0;
+    UINT32 m_RequestedTargetFrames = 0;
+    UINT32 m_TargetFrames = 0;
+    // Loop gains, per frame of level error and per frame-second of accumulated error
+    double m_ProportionalGain = 0.0;
+    double m_IntegralGain = 0.0;
+
+    bool m_bHasLevel = false;
+    bool m_bLocked = false;
+    double m_SettledSeconds = 0.0;
+    double m_FilteredLevel = 0.0;
+    // Filtered level when Measure locked, and the time since
+    double m_LockedLevel = 0.0;
+    double m_LockedSeconds = 0.0;
+    // Integral term of the loop, i.e. the drift estimate, and the total correction, both as rate deviations
+    double m_Integral = 0.0;
+    double m_Correction = 0.0;
+};
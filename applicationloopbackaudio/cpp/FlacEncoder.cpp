@@ -0,0 +1,870 @@
+#include "FlacEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Bits of the subframe header: zero bit, 6-bit type, wasted bits flag
+static const UINT32 SubframeHeaderBits = 8;
+// Channel assignments of the frame header for stereo decorrelation
+static const UINT32 ChannelLeftSide = 8;
+static const UINT32 ChannelRightSide = 9;
+static const UINT32 ChannelMidSide = 10;
+// Rice parameters above this need the 5-bit parameter coding method
+static const UINT32 MaxRice4Parameter = 14;
+static const UINT32 MaxRiceParameter = 30;
+
+//
+//  CRC-8 (polynomial x^8 + x^2 + x + 1) of the frame header and CRC-16 (x^16 + x^15 + x^2 + 1) of the whole frame
+//
+static BYTE Crc8(const BYTE* data, size_t bytes)
+{
+    static const struct Table
+    {
+        BYTE values[256];
+        Table()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                BYTE crc = (BYTE)i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (BYTE)((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+                }
+                values[i] = crc;
+            }
+        }
+    } table;
+
+    BYTE crc = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        crc = table.values[crc ^ data[i]];
+    }
+    return crc;
+}
+
+static WORD Crc16(const BYTE* data, size_t bytes)
+{
+    static const struct Table
+    {
+        WORD values[256];
+        Table()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                WORD crc = (WORD)(i << 8);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (WORD)((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+                }
+                values[i] = crc;
+            }
+        }
+    } table;
+
+    WORD crc = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        crc = (WORD)((crc << 8) ^ table.values[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+static inline UINT32 ZigZag(INT32 value)
+{
+    return ((UINT32)value << 1) ^ (UINT32)(value >> 31);
+}
+
+void FlacEncoder::BitWriter::Write(UINT32 value, UINT32 bits)
+{
+    if (bits == 0)
+    {
+        return;
+    }
+    m_Accumulator = (m_Accumulator << bits) | value;
+    m_Bits += bits;
+    FlushBytes();
+}
+
+void FlacEncoder::BitWriter::FlushBytes()
+{
+    while (m_Bits >= 8)
+    {
+        m_Bits -= 8;
+        m_pBuffer[m_cbWritten++] = (BYTE)(m_Accumulator >> m_Bits);
+    }
+}
+
+void FlacEncoder::BitWriter::WriteUnary(UINT32 zeros)
+{
+    while (zeros >= 32)
+    {
+        Write(0, 32);
+        zeros -= 32;
+    }
+    Write(1, zeros + 1);
+}
+
+void FlacEncoder::BitWriter::WriteRice(INT32 value, UINT32 parameter)
+{
+    UINT32 u = ZigZag(value);
+    UINT32 quotient = u >> parameter;
+    UINT32 low = u & ((1u << parameter) - 1);
+    if (quotient + 1 + parameter <= 32)
+    {
+        // Stop bit and remainder in one write
+        Write((1u << parameter) | low, quotient + 1 + parameter);
+    }
+    else
+    {
+        WriteUnary(quotient);
+        Write(low, parameter);
+    }
+}
+
+void FlacEncoder::BitWriter::AlignToByte()
+{
+    if (m_Bits > 0)
+    {
+        Write(0, 8 - m_Bits);
+    }
+}
+
+//
+//  GetLevelSettings()
+//
+//  Levels 0-2 use small blocks and fixed predictors only; 3-8 add LPC with growing orders and search effort
+//
+FlacEncoderSettings FlacEncoder::GetLevelSettings(UINT32 level)
+{
+    static const struct
+    {
+        UINT32 blockSize;
+        bool bStereoDecorrelation;
+        UINT32 maxLpcOrder;
+        bool bExhaustiveLpcSearch;
+        UINT32 maxPartitionOrder;
+    } levels[MaxLevel + 1] = {
+        { 1152, false, 0, false, 3 },
+        { 1152, true, 0, false, 3 },
+        { 1152, true, 0, false, 4 },
+        { 4096, false, 6, false, 4 },
+        { 4096, true, 8, false, 4 },
+        { 4096, true, 8, false, 5 },
+        { 4096, true, 8, false, 6 },
+        { 4096, true, 8, true, 6 },
+        { 4096, true, 12, true, 6 },
+    };
+
+    const auto& entry = levels[(level > MaxLevel) ? MaxLevel : level];
+    FlacEncoderSettings settings;
+    settings.blockSize = entry.blockSize;
+    settings.bStereoDecorrelation = entry.bStereoDecorrelation;
+    settings.maxFixedOrder = 4;
+    settings.maxLpcOrder = entry.maxLpcOrder;
+    settings.bExhaustiveLpcSearch = entry.bExhaustiveLpcSearch;
+    settings.maxPartitionOrder = entry.maxPartitionOrder;
+    return settings;
+}
+
+HRESULT FlacEncoder::Initialize(UINT32 sampleRate, UINT32 channels, UINT32 bitsPerSample, const FlacEncoderSettings& settings)
+{
+    if (sampleRate == 0 || sampleRate > 655350 || channels == 0 || channels > MaxChannels ||
+        (bitsPerSample != 8 && bitsPerSample != 16 && bitsPerSample != 24) ||
+        settings.blockSize < 16 || settings.blockSize > 65535 || settings.maxFixedOrder > 4 ||
+        settings.maxLpcOrder > MaxLpcOrder || settings.maxPartitionOrder > MaxPartitionOrder)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_Settings = settings;
+    m_SampleRate = sampleRate;
+    m_Channels = channels;
+    m_BitsPerSample = bitsPerSample;
+    m_FrameNumber = 0;
+    m_MinFrameBytes = 0;
+    m_MaxFrameBytes = 0;
+
+    // Coefficient precision of the reference encoder for this block size, one bit less for 8-bit audio
+    UINT32 blockSize = settings.blockSize;
+    m_QlpPrecision = (blockSize <= 192) ? 7 : (blockSize <= 384) ? 8 : (blockSize <= 576) ? 9 : (blockSize <= 1152) ? 10 :
+        (blockSize <= 2304) ? 11 : (blockSize <= 4608) ? 12 : 13;
+    if (bitsPerSample <= 8)
+    {
+        m_QlpPrecision--;
+    }
+
+    m_Input.assign((size_t)channels * blockSize, 0);
+    m_Mid.assign(blockSize, 0);
+    m_Side.assign(blockSize, 0);
+    // Left, right, mid and side for stereo; one per channel otherwise
+    UINT32 candidates = std::max<UINT32>(channels, 4);
+    m_Residuals.assign((size_t)candidates * blockSize, 0);
+    m_Scratch.assign(blockSize, 0);
+    m_Windowed.assign(blockSize, 0.0);
+    m_Window.assign(blockSize, 0.0);
+    m_WindowFrames = 0;
+    m_PartitionSums.assign((size_t)1 << MaxPartitionOrder, 0);
+    m_Choices.assign(candidates, SubframeChoice());
+
+    // A frame never exceeds the verbatim encoding of its samples (side channels take one extra bit) plus the headers
+    m_Frame.assign((size_t)blockSize * channels * (bitsPerSample + 1) / 8 + channels * 8 + 64, 0);
+    return S_OK;
+}
+
+//
+//  EncodeFrame()
+//
+//  Picks the cheapest subframe for every channel and, for stereo, the cheapest channel decorrelation, then writes the
+//  frame
+//
+HRESULT FlacEncoder::EncodeFrame(UINT32 frames, const BYTE** ppFrame, size_t* pcbFrame)
+{
+    if (frames == 0 || frames > m_Settings.blockSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    const UINT32 blockSize = m_Settings.blockSize;
+    UINT32 channelAssignment = m_Channels - 1;
+    // Candidate index (into m_Choices / m_Residuals) of each coded channel, and its input samples and bit depth
+    UINT32 coded[MaxChannels];
+    const INT32* codedSamples[MaxChannels];
+    UINT32 codedBits[MaxChannels];
+
+    for (UINT32 channel = 0; channel < m_Channels; channel++)
+    {
+        coded[channel] = channel;
+        codedSamples[channel] = GetChannelBuffer(channel);
+        codedBits[channel] = m_BitsPerSample;
+    }
+
+    if (m_Channels == 2 && m_Settings.bStereoDecorrelation)
+    {
+        const INT32* left = GetChannelBuffer(0);
+        const INT32* right = GetChannelBuffer(1);
+        for (UINT32 i = 0; i < frames; i++)
+        {
+            m_Mid[i] = (left[i] + right[i]) >> 1;
+            m_Side[i] = left[i] - right[i];
+        }
+
+        // Candidates 0-3: left, right, mid, side
+        const INT32* samples[4] = { left, right, m_Mid.data(), m_Side.data() };
+        for (UINT32 candidate = 0; candidate < 4; candidate++)
+        {
+            UINT32 bits = m_BitsPerSample + (candidate == 3 ? 1 : 0);
+            ChooseSubframe(samples[candidate], frames, bits, m_Choices[candidate], &m_Residuals[(size_t)candidate * blockSize]);
+        }
+
+        UINT32 left_ = m_Choices[0].bits;
+        UINT32 right_ = m_Choices[1].bits;
+        UINT32 mid_ = m_Choices[2].bits;
+        UINT32 side_ = m_Choices[3].bits;
+        UINT32 best = left_ + right_;
+        if (left_ + side_ < best)
+        {
+            best = left_ + side_;
+            channelAssignment = ChannelLeftSide;
+        }
+        if (side_ + right_ < best)
+        {
+            best = side_ + right_;
+            channelAssignment = ChannelRightSide;
+        }
+        if (mid_ + side_ < best)
+        {
+            channelAssignment = ChannelMidSide;
+        }
+
+        // The frame lists the channels in this order for each assignment
+        static const UINT32 order[4][2] = { { 0, 1 }, { 0, 3 }, { 3, 1 }, { 2, 3 } };
+        UINT32 row = (channelAssignment == 1) ? 0 : channelAssignment - ChannelLeftSide + 1;
+        for (UINT32 channel = 0; channel < 2; channel++)
+        {
+            coded[channel] = order[row][channel];
+            codedSamples[channel] = samples[coded[channel]];
+            codedBits[channel] = m_BitsPerSample + (coded[channel] == 3 ? 1 : 0);
+        }
+    }
+    else
+    {
+        for (UINT32 channel = 0; channel < m_Channels; channel++)
+        {
+            ChooseSubframe(codedSamples[channel], frames, m_BitsPerSample, m_Choices[channel], &m_Residuals[(size_t)channel * blockSize]);
+        }
+    }
+
+    m_Writer.Reset(m_Frame.data());
+    WriteFrameHeader(frames, channelAssignment);
+    for (UINT32 channel = 0; channel < m_Channels; channel++)
+    {
+        WriteSubframe(codedSamples[channel], frames, codedBits[channel], m_Choices[coded[channel]], &m_Residuals[(size_t)coded[channel] * blockSize]);
+    }
+    m_Writer.AlignToByte();
+
+    WORD crc = Crc16(m_Frame.data(), m_Writer.GetBytesWritten());
+    m_Writer.Write(crc, 16);
+
+    UINT32 cbFrame = (UINT32)m_Writer.GetBytesWritten();
+    m_MinFrameBytes = (m_FrameNumber == 0) ? cbFrame : std::min(m_MinFrameBytes, cbFrame);
+    m_MaxFrameBytes = std::max(m_MaxFrameBytes, cbFrame);
+    m_FrameNumber++;
+
+    *ppFrame = m_Frame.data();
+    *pcbFrame = cbFrame;
+    return S_OK;
+}
+
+void FlacEncoder::WriteFrameHeader(UINT32 frames, UINT32 channelAssignment)
+{
+    // Sync code, reserved bit, fixed block size strategy
+    m_Writer.Write(0x3FFE, 14);
+    m_Writer.Write(0, 1);
+    m_Writer.Write(0, 1);
+
+    UINT32 blockSizeCode = 0;
+    if (frames == 192)
+    {
+        blockSizeCode = 1;
+    }
+    for (UINT32 code = 2; code <= 5 && blockSizeCode == 0; code++)
+    {
+        if (frames == (576u << (code - 2)))
+        {
+            blockSizeCode = code;
+        }
+    }
+    for (UINT32 code = 8; code <= 15 && blockSizeCode == 0; code++)
+    {
+        if (frames == (256u << (code - 8)))
+        {
+            blockSizeCode = code;
+        }
+    }
+    if (blockSizeCode == 0)
+    {
+        // Block size stored after the frame number
+        blockSizeCode = (frames <= 256) ? 6 : 7;
+    }
+
+    static const UINT32 sampleRates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+    UINT32 sampleRateCode = 0;
+    for (UINT32 code = 1; code < sizeof(sampleRates) / sizeof(sampleRates[0]); code++)
+    {
+        if (sampleRates[code] == m_SampleRate)
+        {
+            sampleRateCode = code;
+        }
+    }
+
+    UINT32 sampleSizeCode = (m_BitsPerSample == 8) ? 1 : (m_BitsPerSample == 16) ? 4 : 6;
+
+    m_Writer.Write(blockSizeCode, 4);
+    m_Writer.Write(sampleRateCode, 4);
+    m_Writer.Write(channelAssignment, 4);
+    m_Writer.Write(sampleSizeCode, 3);
+    m_Writer.Write(0, 1);
+
+    // Frame number, coded like an extended UTF-8 character
+    UINT64 number = m_FrameNumber;
+    if (number < 0x80)
+    {
+        m_Writer.Write((UINT32)number, 8);
+    }
+    else
+    {
+        UINT32 bytes = 2;
+        while (bytes < 7 && number >= (1ull << (5 * bytes + 1)))
+        {
+            bytes++;
+        }
+        UINT32 prefix = (0xFF00u >> bytes) & 0xFF;
+        m_Writer.Write(prefix | (UINT32)(number >> (6 * (bytes - 1))), 8);
+        for (UINT32 i = bytes - 1; i > 0; i--)
+        {
+            m_Writer.Write(0x80 | (UINT32)((number >> (6 * (i - 1))) & 0x3F), 8);
+        }
+    }
+
+    if (blockSizeCode == 6)
+    {
+        m_Writer.Write(frames - 1, 8);
+    }
+    else if (blockSizeCode == 7)
+    {
+        m_Writer.Write(frames - 1, 16);
+    }
+
+    m_Writer.Write(Crc8(m_Frame.data(), m_Writer.GetBytesWritten()), 8);
+}
+
+//
+//  ChooseSubframe()
+//
+//  Tries the constant, fixed and LPC encodings and keeps the smallest; verbatim is the fallback
+//
+void FlacEncoder::ChooseSubframe(const INT32* samples, UINT32 frames, UINT32 bitsPerSample, SubframeChoice& choice, INT32* residual)
+{
+    choice.type = SubframeType::Verbatim;
+    choice.order = 0;
+    choice.bits = SubframeHeaderBits + frames * bitsPerSample;
+
+    bool bConstant = true;
+    for (UINT32 i = 1; i < frames && bConstant; i++)
+    {
+        bConstant = (samples[i] == samples[0]);
+    }
+    if (bConstant)
+    {
+        choice.type = SubframeType::Constant;
+        choice.bits = SubframeHeaderBits + bitsPerSample;
+        return;
+    }
+
+    SubframeChoice candidate;
+    INT32* scratch = m_Scratch.data();
+
+    UINT32 maxFixedOrder = std::min(m_Settings.maxFixedOrder, frames - 1);
+    for (UINT32 order = 0; order <= maxFixedOrder; order++)
+    {
+        ComputeFixedResidual(samples, frames, order, scratch);
+        UINT32 bits = SubframeHeaderBits + order * bitsPerSample + ChooseRicePartitions(scratch, frames, order, candidate);
+        if (bits < choice.bits)
+        {
+            candidate.type = SubframeType::Fixed;
+            candidate.order = order;
+            candidate.bits = bits;
+            choice = candidate;
+            memcpy(residual, scratch, frames * sizeof(INT32));
+        }
+    }
+
+    UINT32 maxLpcOrder = std::min(m_Settings.maxLpcOrder, frames - 1);
+    if (maxLpcOrder == 0)
+    {
+        return;
+    }
+
+    double errors[MaxLpcOrder];
+    UINT32 orders = ComputeLpcCoefficients(samples, frames, maxLpcOrder, errors);
+    if (orders == 0)
+    {
+        return;
+    }
+
+    UINT32 firstOrder = 1;
+    UINT32 lastOrder = orders;
+    if (!m_Settings.bExhaustiveLpcSearch)
+    {
+        // Pick the order whose expected residual size plus coefficient overhead is smallest
+        double bestBits = 0.0;
+        double errorScale = 0.5 / frames;
+        for (UINT32 order = 1; order <= orders; order++)
+        {
+            double bitsPerResidual = (errors[order - 1] > 0.0) ? std::max(0.0, 0.5 * std::log2(errorScale * errors[order - 1])) : 0.0;
+            double bits = bitsPerResidual * (frames - order) + order * (double)(bitsPerSample + m_QlpPrecision);
+            if (order == 1 || bits < bestBits)
+            {
+                bestBits = bits;
+                firstOrder = order;
+            }
+        }
+        lastOrder = firstOrder;
+    }
+
+    for (UINT32 order = firstOrder; order <= lastOrder; order++)
+    {
+        if (!QuantizeLpcCoefficients(m_LpcCoefficients[order - 1], order, m_QlpPrecision, candidate.qlpCoefficients, &candidate.qlpShift) ||
+            !ComputeLpcResidual(samples, frames, candidate.qlpCoefficients, order, candidate.qlpShift, scratch))
+        {
+            continue;
+        }
+
+        UINT32 bits = SubframeHeaderBits + order * bitsPerSample + 4 + 5 + order * m_QlpPrecision +
+            ChooseRicePartitions(scratch, frames, order, candidate);
+        if (bits < choice.bits)
+        {
+            candidate.type = SubframeType::Lpc;
+            candidate.order = order;
+            candidate.bits = bits;
+            candidate.qlpPrecision = m_QlpPrecision;
+            choice = candidate;
+            memcpy(residual, scratch, frames * sizeof(INT32));
+        }
+    }
+}
+
+void FlacEncoder::WriteSubframe(const INT32* samples, UINT32 frames, UINT32 bitsPerSample, const SubframeChoice& choice, const INT32* residual)
+{
+    switch (choice.type)
+    {
+    case SubframeType::Constant:
+        m_Writer.Write(0x00, SubframeHeaderBits);
+        m_Writer.WriteSigned(samples[0], bitsPerSample);
+        break;
+
+    case SubframeType::Verbatim:
+        m_Writer.Write(0x01 << 1, SubframeHeaderBits);
+        for (UINT32 i = 0; i < frames; i++)
+        {
+            m_Writer.WriteSigned(samples[i], bitsPerSample);
+        }
+        break;
+
+    case SubframeType::Fixed:
+        m_Writer.Write((0x08 | choice.order) << 1, SubframeHeaderBits);
+        for (UINT32 i = 0; i < choice.order; i++)
+        {
+            m_Writer.WriteSigned(samples[i], bitsPerSample);
+        }
+        WriteResidual(residual, frames, choice.order, choice);
+        break;
+
+    case SubframeType::Lpc:
+        m_Writer.Write((0x20 | (choice.order - 1)) << 1, SubframeHeaderBits);
+        for (UINT32 i = 0; i < choice.order; i++)
+        {
+            m_Writer.WriteSigned(samples[i], bitsPerSample);
+        }
+        m_Writer.Write(choice.qlpPrecision - 1, 4);
+        m_Writer.WriteSigned(choice.qlpShift, 5);
+        for (UINT32 i = 0; i < choice.order; i++)
+        {
+            m_Writer.WriteSigned(choice.qlpCoefficients[i], choice.qlpPrecision);
+        }
+        WriteResidual(residual, frames, choice.order, choice);
+        break;
+    }
+}
+
+//
+//  ChooseRicePartitions()
+//
+//  Estimates the Rice coded size of residual for every partition order from the per-partition sums, keeps the best
+//  order and parameters, and returns the exact size of that coding in bits
+//
+UINT32 FlacEncoder::ChooseRicePartitions(const INT32* residual, UINT32 frames, UINT32 predictorOrder, SubframeChoice& choice)
+{
+    // Every partition must be the same size, and the first must have room for the warm-up samples
+    UINT32 maxOrder = m_Settings.maxPartitionOrder;
+    while (maxOrder > 0 && ((frames & ((1u << maxOrder) - 1)) != 0 || (frames >> maxOrder) <= predictorOrder))
+    {
+        maxOrder--;
+    }
+
+    UINT64* sums = m_PartitionSums.data();
+    UINT32 partitionSize = frames >> maxOrder;
+    for (UINT32 partition = 0; partition < (1u << maxOrder); partition++)
+    {
+        UINT32 start = (partition == 0) ? predictorOrder : partition * partitionSize;
+        UINT32 end = (partition + 1) * partitionSize;
+        UINT64 sum = 0;
+        for (UINT32 i = start; i < end; i++)
+        {
+            sum += ZigZag(residual[i]);
+        }
+        sums[partition] = sum;
+    }
+
+    UINT64 bestBits = ~0ULL;
+    UINT32 parameters[1 << MaxPartitionOrder];
+    for (INT32 order = (INT32)maxOrder; order >= 0; order--)
+    {
+        UINT32 partitions = 1u << order;
+        partitionSize = frames >> order;
+        UINT64 bits = 0;
+        UINT32 maxParameter = 0;
+        for (UINT32 partition = 0; partition < partitions; partition++)
+        {
+            UINT64 count = partitionSize - ((partition == 0) ? predictorOrder : 0);
+            UINT64 sum = sums[partition];
+
+            // Smallest k with count * 2^(k + 1) >= sum, then its neighbours
+            UINT32 k = 0;
+            while (k < MaxRiceParameter && (count << (k + 1)) < sum)
+            {
+                k++;
+            }
+            UINT64 best = count * (k + 1) + (sum >> k);
+            UINT32 bestK = k;
+            if (k > 0 && count * k + (sum >> (k - 1)) < best)
+            {
+                best = count * k + (sum >> (k - 1));
+                bestK = k - 1;
+            }
+            if (k < MaxRiceParameter && count * (k + 2) + (sum >> (k + 1)) < best)
+            {
+                best = count * (k + 2) + (sum >> (k + 1));
+                bestK = k + 1;
+            }
+
+            parameters[partition] = bestK;
+            maxParameter = std::max(maxParameter, bestK);
+            bits += best;
+        }
+        bits += (UINT64)partitions * ((maxParameter > MaxRice4Parameter) ? 5 : 4);
+
+        if (bits < bestBits)
+        {
+            bestBits = bits;
+            choice.partitionOrder = (UINT32)order;
+            memcpy(choice.riceParameters, parameters, partitions * sizeof(UINT32));
+        }
+
+        // Merge pairs of partitions into the sums of the next lower order
+        for (UINT32 partition = 0; partition < partitions / 2; partition++)
+        {
+            sums[partition] = sums[2 * partition] + sums[2 * partition + 1];
+        }
+    }
+
+    // Exact size of the chosen coding
+    UINT32 partitions = 1u << choice.partitionOrder;
+    partitionSize = frames >> choice.partitionOrder;
+    UINT32 maxParameter = 0;
+    UINT64 bits = 2 + 4;
+    for (UINT32 partition = 0; partition < partitions; partition++)
+    {
+        UINT32 k = choice.riceParameters[partition];
+        UINT32 start = (partition == 0) ? predictorOrder : partition * partitionSize;
+        UINT32 end = (partition + 1) * partitionSize;
+        bits += (UINT64)(end - start) * (k + 1);
+        for (UINT32 i = start; i < end; i++)
+        {
+            bits += ZigZag(residual[i]) >> k;
+        }
+        maxParameter = std::max(maxParameter, k);
+    }
+    bits += (UINT64)partitions * ((maxParameter > MaxRice4Parameter) ? 5 : 4);
+
+    return (UINT32)std::min<UINT64>(bits, 0xFFFFFFFF);
+}
+
+void FlacEncoder::WriteResidual(const INT32* residual, UINT32 frames, UINT32 predictorOrder, const SubframeChoice& choice)
+{
+    UINT32 partitions = 1u << choice.partitionOrder;
+    UINT32 partitionSize = frames >> choice.partitionOrder;
+    UINT32 maxParameter = 0;
+    for (UINT32 partition = 0; partition < partitions; partition++)
+    {
+        maxParameter = std::max(maxParameter, choice.riceParameters[partition]);
+    }
+
+    // Coding method 0 has 4-bit Rice parameters, method 1 has 5-bit ones
+    UINT32 method = (maxParameter > MaxRice4Parameter) ? 1 : 0;
+    m_Writer.Write(method, 2);
+    m_Writer.Write(choice.partitionOrder, 4);
+    for (UINT32 partition = 0; partition < partitions; partition++)
+    {
+        UINT32 k = choice.riceParameters[partition];
+        m_Writer.Write(k, method ? 5 : 4);
+
+        UINT32 start = (partition == 0) ? predictorOrder : partition * partitionSize;
+        UINT32 end = (partition + 1) * partitionSize;
+        for (UINT32 i = start; i < end; i++)
+        {
+            m_Writer.WriteRice(residual[i], k);
+        }
+    }
+}
+
+void FlacEncoder::ComputeFixedResidual(const INT32* x, UINT32 frames, UINT32 order, INT32* residual) const
+{
+    // Warm-up samples are stored verbatim, so their residual is never coded
+    for (UINT32 i = 0; i < order; i++)
+    {
+        residual[i] = 0;
+    }
+
+    switch (order)
+    {
+    case 0:
+        memcpy(residual, x, frames * sizeof(INT32));
+        break;
+    case 1:
+        for (UINT32 i = 1; i < frames; i++)
+        {
+            residual[i] = x[i] - x[i - 1];
+        }
+        break;
+    case 2:
+        for (UINT32 i = 2; i < frames; i++)
+        {
+            residual[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+        }
+        break;
+    case 3:
+        for (UINT32 i = 3; i < frames; i++)
+        {
+            residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+        }
+        break;
+    case 4:
+        for (UINT32 i = 4; i < frames; i++)
+        {
+            residual[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+        }
+        break;
+    }
+}
+
+//
+//  ComputeLpcCoefficients()
+//
+//  Tukey(0.5) window, autocorrelation, then Levinson-Durbin recursion. Row n of m_LpcCoefficients receives the
+//  predictor of order n + 1, in the sign convention of the FLAC decoder (prediction = sum of coefficient * past sample).
+//
+UINT32 FlacEncoder::ComputeLpcCoefficients(const INT32* samples, UINT32 frames, UINT32 maxOrder, double* errors)
+{
+    if (m_WindowFrames != frames)
+    {
+        UINT32 taper = frames / 4;
+        for (UINT32 i = 0; i < frames; i++)
+        {
+            double w = 1.0;
+            if (taper > 0 && i < taper)
+            {
+                w = 0.5 - 0.5 * cos(M_PI * i / taper);
+            }
+            else if (taper > 0 && i >= frames - taper)
+            {
+                w = 0.5 - 0.5 * cos(M_PI * (frames - 1 - i) / taper);
+            }
+            m_Window[i] = w;
+        }
+        m_WindowFrames = frames;
+    }
+
+    double* windowed = m_Windowed.data();
+    for (UINT32 i = 0; i < frames; i++)
+    {
+        windowed[i] = samples[i] * m_Window[i];
+    }
+
+    double autocorrelation[MaxLpcOrder + 1];
+    for (UINT32 lag = 0; lag <= maxOrder; lag++)
+    {
+        double sum = 0.0;
+        for (UINT32 i = lag; i < frames; i++)
+        {
+            sum += windowed[i] * windowed[i - lag];
+        }
+        autocorrelation[lag] = sum;
+    }
+    if (autocorrelation[0] == 0.0)
+    {
+        return 0;
+    }
+
+    double lpc[MaxLpcOrder];
+    double error = autocorrelation[0];
+    for (UINT32 i = 0; i < maxOrder; i++)
+    {
+        double r = -autocorrelation[i + 1];
+        for (UINT32 j = 0; j < i; j++)
+        {
+            r -= lpc[j] * autocorrelation[i - j];
+        }
+        r /= error;
+
+        lpc[i] = r;
+        for (UINT32 j = 0; j < i / 2; j++)
+        {
+            double tmp = lpc[j];
+            lpc[j] += r * lpc[i - 1 - j];
+            lpc[i - 1 - j] += r * tmp;
+        }
+        if (i & 1)
+        {
+            lpc[i / 2] += lpc[i / 2] * r;
+        }
+
+        error *= 1.0 - r * r;
+        for (UINT32 j = 0; j <= i; j++)
+        {
+            m_LpcCoefficients[i][j] = -lpc[j];
+        }
+        errors[i] = error;
+
+        if (error <= 0.0)
+        {
+            return i + 1;
+        }
+    }
+    return maxOrder;
+}
+
+//
+//  QuantizeLpcCoefficients()
+//
+//  Scales the coefficients to precision-bit integers with the largest shift that fits, carrying the rounding error
+//  from one coefficient to the next
+//
+bool FlacEncoder::QuantizeLpcCoefficients(const double* coefficients, UINT32 order, UINT32 precision, INT32* qlp, INT32* pShift) const
+{
+    double cmax = 0.0;
+    for (UINT32 i = 0; i < order; i++)
+    {
+        cmax = std::max(cmax, std::fabs(coefficients[i]));
+    }
+    if (cmax <= 0.0)
+    {
+        return false;
+    }
+
+    // One bit of the precision is the sign
+    INT32 qmax = (1 << (precision - 1)) - 1;
+    INT32 qmin = -(1 << (precision - 1));
+
+    int log2cmax = 0;
+    frexp(cmax, &log2cmax);
+    INT32 shift = (INT32)(precision - 1) - (log2cmax - 1) - 1;
+    // The shift is a 5-bit signed field, and decoders only accept non-negative shifts
+    shift = std::min(shift, 15);
+    if (shift < 0)
+    {
+        return false;
+    }
+
+    double error = 0.0;
+    for (UINT32 i = 0; i < order; i++)
+    {
+        error += coefficients[i] * (double)(1 << shift);
+        INT32 q = (INT32)lround(error);
+        q = std::max(qmin, std::min(qmax, q));
+        error -= q;
+        qlp[i] = q;
+    }
+    *pShift = shift;
+    return true;
+}
+
+bool FlacEncoder::ComputeLpcResidual(const INT32* samples, UINT32 frames, const INT32* qlp, UINT32 order, INT32 shift, INT32* residual) const
+{
+    for (UINT32 i = 0; i < order; i++)
+    {
+        residual[i] = 0;
+    }
+
+    for (UINT32 i = order; i < frames; i++)
+    {
+        INT64 sum = 0;
+        for (UINT32 j = 0; j < order; j++)
+        {
+            sum += (INT64)qlp[j] * samples[i - 1 - j];
+        }
+        INT64 r = samples[i] - (sum >> shift);
+        if (r > 0x3FFFFFFF || r < -0x40000000)
+        {
+            return false;
+        }
+        residual[i] = (INT32)r;
+    }
+    return true;
+}
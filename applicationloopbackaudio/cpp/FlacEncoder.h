@@ -0,0 +1,158 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+
+/**
+* Encoder parameters selected by a compression level, following the spirit of the reference encoder's -0 ... -8
+*/
+struct FlacEncoderSettings
+{
+    UINT32 blockSize = 4096;
+    // Try left/side, right/side and mid/side in addition to independent channels (stereo only)
+    bool bStereoDecorrelation = true;
+    // Highest fixed predictor order tried (0-4)
+    UINT32 maxFixedOrder = 4;
+    // Highest LPC order tried (0 disables LPC, up to 32)
+    UINT32 maxLpcOrder = 8;
+    // Encode every LPC order up to maxLpcOrder and keep the smallest, instead of the order the Levinson-Durbin error
+    // estimate predicts
+    bool bExhaustiveLpcSearch = false;
+    // Highest Rice partition order tried (up to FlacEncoder::MaxPartitionOrder)
+    UINT32 maxPartitionOrder = 5;
+};
+
+/**
+* Streaming encoder of FLAC frames.
+*
+* Each call to EncodeFrame turns one block of integer PCM into a complete FLAC frame: a frame header with CRC-8, one
+* subframe per channel (constant, verbatim, fixed or quantized LPC prediction, whichever is smallest) with partitioned
+* Rice coded residuals, and the CRC-16 footer. The stream header (the "fLaC" marker and STREAMINFO) is written by the
+* caller, see FlacWriter.
+*
+* Frames use a fixed block size, so only the last one of the stream may be shorter. All buffers are allocated by
+* Initialize; encoding does not allocate.
+*/
+class FlacEncoder
+{
+public:
+    static const UINT32 MaxLevel = 8;
+    static const UINT32 MaxLpcOrder = 32;
+    static const UINT32 MaxPartitionOrder = 8;
+    static const UINT32 MaxChannels = 8;
+
+    static FlacEncoderSettings GetLevelSettings(UINT32 level);
+
+    // bitsPerSample must be 8, 16 or 24
+    HRESULT Initialize(UINT32 sampleRate, UINT32 channels, UINT32 bitsPerSample, const FlacEncoderSettings& settings);
+
+    UINT32 GetBlockSize() const { return m_Settings.blockSize; }
+    UINT32 GetChannels() const { return m_Channels; }
+
+    // Returns the planar input buffer of a channel, GetBlockSize() samples long
+    INT32* GetChannelBuffer(UINT32 channel) { return &m_Input[(size_t)channel * m_Settings.blockSize]; }
+
+    // Encodes the first frames samples of the channel buffers as the next frame of the stream. The frame stays valid
+    // until the next call.
+    HRESULT EncodeFrame(UINT32 frames, const BYTE** ppFrame, size_t* pcbFrame);
+
+    UINT64 GetFramesEncoded() const { return m_FrameNumber; }
+    UINT32 GetMinFrameBytes() const { return m_MinFrameBytes; }
+    UINT32 GetMaxFrameBytes() const { return m_MaxFrameBytes; }
+
+private:
+    // Subframe encodings
+    enum class SubframeType
+    {
+        Constant,
+        Verbatim,
+        Fixed,
+        Lpc,
+    };
+
+    // Best encoding found for one channel of a block
+    struct SubframeChoice
+    {
+        SubframeType type = SubframeType::Verbatim;
+        UINT32 order = 0;
+        UINT32 bits = 0;
+        UINT32 partitionOrder = 0;
+        // Rice parameters of the residual partitions
+        UINT32 riceParameters[1 << MaxPartitionOrder];
+        // Quantized LPC coefficients, their precision and shift
+        INT32 qlpCoefficients[MaxLpcOrder];
+        UINT32 qlpPrecision = 0;
+        INT32 qlpShift = 0;
+    };
+
+    // MSB-first bit packer into a preallocated byte buffer
+    class BitWriter
+    {
+    public:
+        void Reset(BYTE* buffer) { m_pBuffer = buffer; m_cbWritten = 0; m_Accumulator = 0; m_Bits = 0; }
+        void Write(UINT32 value, UINT32 bits);
+        void WriteSigned(INT32 value, UINT32 bits) { Write((UINT32)value & (bits == 32 ? 0xFFFFFFFFu : ((1u << bits) - 1)), bits); }
+        void WriteUnary(UINT32 zeros);
+        void WriteRice(INT32 value, UINT32 parameter);
+        // Pads with zero bits up to the next byte boundary
+        void AlignToByte();
+        size_t GetBytesWritten() const { return m_cbWritten; }
+
+    private:
+        void FlushBytes();
+
+        BYTE* m_pBuffer = nullptr;
+        size_t m_cbWritten = 0;
+        UINT64 m_Accumulator = 0;
+        UINT32 m_Bits = 0;
+    };
+
+    // Finds the cheapest encoding of samples, writing the residual of that encoding to residual
+    void ChooseSubframe(const INT32* samples, UINT32 frames, UINT32 bitsPerSample, SubframeChoice& choice, INT32* residual);
+    void WriteSubframe(const INT32* samples, UINT32 frames, UINT32 bitsPerSample, const SubframeChoice& choice, const INT32* residual);
+    // Bits of the partitioned Rice coding of residual with the best partition order; fills the partition parameters
+    UINT32 ChooseRicePartitions(const INT32* residual, UINT32 frames, UINT32 predictorOrder, SubframeChoice& choice);
+    void WriteResidual(const INT32* residual, UINT32 frames, UINT32 predictorOrder, const SubframeChoice& choice);
+
+    void ComputeFixedResidual(const INT32* samples, UINT32 frames, UINT32 order, INT32* residual) const;
+    // Computes the LPC coefficients of orders 1..maxOrder from the windowed autocorrelation of samples. Returns the
+    // number of orders computed and the prediction error of each.
+    UINT32 ComputeLpcCoefficients(const INT32* samples, UINT32 frames, UINT32 maxOrder, double* errors);
+    bool QuantizeLpcCoefficients(const double* coefficients, UINT32 order, UINT32 precision, INT32* qlp, INT32* pShift) const;
+    // Returns false if a residual does not fit in the 32-bit range the decoder uses
+    bool ComputeLpcResidual(const INT32* samples, UINT32 frames, const INT32* qlp, UINT32 order, INT32 shift, INT32* residual) const;
+
+    void WriteFrameHeader(UINT32 frames, UINT32 channelAssignment);
+
+    FlacEncoderSettings m_Settings;
+    UINT32 m_SampleRate = 0;
+    UINT32 m_Channels = 0;
+    UINT32 m_BitsPerSample = 0;
+    UINT32 m_QlpPrecision = 0;
+
+    UINT64 m_FrameNumber = 0;
+    UINT32 m_MinFrameBytes = 0;
+    UINT32 m_MaxFrameBytes = 0;
+
+    // Planar input, m_Channels blocks
+    std::vector<INT32> m_Input;
+    // Mid and side channels of stereo input
+    std::vector<INT32> m_Mid;
+    std::vector<INT32> m_Side;
+    // Residual of the best encoding of each candidate channel, and scratch for the one being evaluated
+    std::vector<INT32> m_Residuals;
+    std::vector<INT32> m_Scratch;
+    // Windowed samples, window and autocorrelation scratch of the LPC analysis
+    std::vector<double> m_Windowed;
+    std::vector<double> m_Window;
+    // Block length m_Window was computed for
+    UINT32 m_WindowFrames = 0;
+    // LPC coefficients of every order computed by ComputeLpcCoefficients, row n holding order n + 1
+    double m_LpcCoefficients[MaxLpcOrder][MaxLpcOrder];
+    // Per-partition sums of the zigzag encoded residual at the highest partition order
+    std::vector<UINT64> m_PartitionSums;
+    std::vector<SubframeChoice> m_Choices;
+    std::vector<BYTE> m_Frame;
+    BitWriter m_Writer;
+};
@@ -0,0 +1,285 @@
+#include "FlacWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Size of the STREAMINFO block, including its metadata block header
+static const UINT32 StreamInfoBytes = 4 + 34;
+// Offset of the STREAMINFO block, right after the "fLaC" marker
+static const UINT64 StreamInfoOffset = 4;
+
+//
+//  Create()
+//
+//  Creates the file and writes the stream marker and a STREAMINFO block without sample count
+//
+HRESULT FlacWriter::Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options)
+{
+    if (format.wFormatTag != WAVE_FORMAT_PCM || format.nChannels == 0 ||
+        format.nBlockAlign != format.nChannels * format.wBitsPerSample / 8)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_Encoder.Initialize(format.nSamplesPerSec, format.nChannels, format.wBitsPerSample, FlacEncoder::GetLevelSettings(options.flacLevel));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // The encoder already batches its output, so a mapped file would not save anything
+    m_File = CreateOutputFile(OutputFileMode::Buffered);
+    hr = m_File->Create(fileName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_Format = format;
+    m_cbDataSize = 0;
+    m_cbEncoded = 0;
+    m_SamplesEncoded = 0;
+    m_PendingFrames = 0;
+    m_PartialFrame.assign(format.nBlockAlign, 0);
+    m_cbPartialFrame = 0;
+    m_Output.assign(OutputBufferBytes + m_Encoder.GetBlockSize() * (size_t)format.nBlockAlign * 2, 0);
+    m_cbOutput = 0;
+
+    DWORD marker = FCC('fLaC');
+    if (FAILED(hr = m_File->Write(&marker, sizeof(marker))) || FAILED(hr = WriteStreamInfo(true)))
+    {
+        return hr;
+    }
+    return S_OK;
+}
+
+void FlacWriter::Deinterleave(const BYTE* data, UINT32 frames)
+{
+    const UINT32 channels = m_Format.nChannels;
+    for (UINT32 channel = 0; channel < channels; channel++)
+    {
+        INT32* dst = m_Encoder.GetChannelBuffer(channel) + m_PendingFrames;
+        switch (m_Format.wBitsPerSample)
+        {
+        case 8:
+            // 8-bit WAV samples are unsigned
+            for (UINT32 i = 0; i < frames; i++)
+            {
+                dst[i] = (INT32)data[(size_t)i * channels + channel] - 128;
+            }
+            break;
+        case 16:
+            for (UINT32 i = 0; i < frames; i++)
+            {
+                const BYTE* p = data + ((size_t)i * channels + channel) * 2;
+                dst[i] = (INT32)(short)(p[0] | (p[1] << 8));
+            }
+            break;
+        case 24:
+            for (UINT32 i = 0; i < frames; i++)
+            {
+                const BYTE* p = data + ((size_t)i * channels + channel) * 3;
+                dst[i] = (INT32)((UINT32)p[0] << 8 | (UINT32)p[1] << 16 | (UINT32)p[2] << 24) >> 8;
+            }
+            break;
+        }
+    }
+    m_PendingFrames += frames;
+}
+
+//
+//  WriteData()
+//
+//  Fills the encoder's block with the captured frames, encoding every block that is complete
+//
+HRESULT FlacWriter::WriteData(const void* data, size_t bytes)
+{
+    const BYTE* src = static_cast<const BYTE*>(data);
+    const UINT32 frameBytes = m_Format.nBlockAlign;
+    const UINT32 blockSize = m_Encoder.GetBlockSize();
+    m_cbDataSize += bytes;
+
+    // Complete a frame split by the previous call
+    if (m_cbPartialFrame > 0)
+    {
+        size_t cbCopy = std::min(bytes, frameBytes - m_cbPartialFrame);
+        memcpy(&m_PartialFrame[m_cbPartialFrame], src, cbCopy);
+        m_cbPartialFrame += cbCopy;
+        src += cbCopy;
+        bytes -= cbCopy;
+        if (m_cbPartialFrame < frameBytes)
+        {
+            return S_OK;
+        }
+
+        m_cbPartialFrame = 0;
+        Deinterleave(m_PartialFrame.data(), 1);
+        if (m_PendingFrames == blockSize)
+        {
+            HRESULT hr = EncodePending();
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+    }
+
+    UINT64 frames = bytes / frameBytes;
+    while (frames > 0)
+    {
+        UINT32 count = (UINT32)std::min<UINT64>(frames, blockSize - m_PendingFrames);
+        Deinterleave(src, count);
+        src += (size_t)count * frameBytes;
+        frames -= count;
+
+        if (m_PendingFrames == blockSize)
+        {
+            HRESULT hr = EncodePending();
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+    }
+
+    m_cbPartialFrame = bytes % frameBytes;
+    memcpy(m_PartialFrame.data(), src, m_cbPartialFrame);
+    return S_OK;
+}
+
+HRESULT FlacWriter::EncodePending()
+{
+    const BYTE* pFrame = nullptr;
+    size_t cbFrame = 0;
+    HRESULT hr = m_Encoder.EncodeFrame(m_PendingFrames, &pFrame, &cbFrame);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    memcpy(&m_Output[m_cbOutput], pFrame, cbFrame);
+    m_cbOutput += cbFrame;
+    m_SamplesEncoded += m_PendingFrames;
+    m_PendingFrames = 0;
+
+    if (m_cbOutput >= OutputBufferBytes)
+    {
+        return WriteOutput();
+    }
+    return S_OK;
+}
+
+HRESULT FlacWriter::WriteOutput()
+{
+    if (m_cbOutput == 0)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = m_File->Write(m_Output.data(), m_cbOutput);
+    if (SUCCEEDED(hr))
+    {
+        m_cbEncoded += m_cbOutput;
+        m_cbOutput = 0;
+    }
+    return hr;
+}
+
+//
+//  WriteStreamInfo()
+//
+//  Writes the STREAMINFO block for the frames encoded so far, appending it when the stream is created and
+//  overwriting it in place afterwards
+//
+HRESULT FlacWriter::WriteStreamInfo(bool bAppend)
+{
+    BYTE info[StreamInfoBytes] = {};
+
+    // Metadata block header: last-block flag, type 0 (STREAMINFO), 24-bit length
+    info[0] = 0x80;
+    info[3] = 34;
+
+    UINT32 blockSize = m_Encoder.GetBlockSize();
+    UINT32 minFrameBytes = m_Encoder.GetMinFrameBytes();
+    UINT32 maxFrameBytes = m_Encoder.GetMaxFrameBytes();
+    BYTE* p = info + 4;
+    p[0] = (BYTE)(blockSize >> 8);
+    p[1] = (BYTE)blockSize;
+    p[2] = (BYTE)(blockSize >> 8);
+    p[3] = (BYTE)blockSize;
+    p[4] = (BYTE)(minFrameBytes >> 16);
+    p[5] = (BYTE)(minFrameBytes >> 8);
+    p[6] = (BYTE)minFrameBytes;
+    p[7] = (BYTE)(maxFrameBytes >> 16);
+    p[8] = (BYTE)(maxFrameBytes >> 8);
+    p[9] = (BYTE)maxFrameBytes;
+
+    // 20-bit sample rate, 3-bit channels - 1, 5-bit bits per sample - 1, 36-bit total samples
+    UINT64 packed = ((UINT64)m_Format.nSamplesPerSec << 44) | ((UINT64)(m_Format.nChannels - 1) << 41) |
+        ((UINT64)(m_Format.wBitsPerSample - 1) << 36) | (m_SamplesEncoded & 0xFFFFFFFFFull);
+    for (int i = 0; i < 8; i++)
+    {
+        p[10 + i] = (BYTE)(packed >> (56 - 8 * i));
+    }
+    // p[18..33]: MD5 signature, zero when not computed
+
+    if (bAppend)
+    {
+        return m_File->Write(info, sizeof(info));
+    }
+    return m_File->WriteAt(StreamInfoOffset, info, sizeof(info));
+}
+
+HRESULT FlacWriter::CommitHeader()
+{
+    HRESULT hr = WriteOutput();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    return WriteStreamInfo(false);
+}
+
+HRESULT FlacWriter::Flush()
+{
+    HRESULT hr = WriteOutput();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    return m_File->Flush();
+}
+
+//
+//  Finalize()
+//
+//  Encodes the last, shorter block, writes the final STREAMINFO, then flushes and closes the file
+//
+HRESULT FlacWriter::Finalize()
+{
+    if (!IsOpen())
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
+    if (m_PendingFrames > 0)
+    {
+        hr = EncodePending();
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteOutput();
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteStreamInfo(false);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = m_File->Flush();
+    }
+    HRESULT hrClose = m_File->Close();
+
+    return SUCCEEDED(hr) ? hrClose : hr;
+}
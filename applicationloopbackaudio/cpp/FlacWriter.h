@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AudioFileWriter.h"
+#include "FlacEncoder.h"
+
+#include <vector>
+
+/**
+* Writes a native FLAC stream: the "fLaC" marker, a STREAMINFO block, then one frame per block of captured samples
+* encoded by FlacEncoder.
+*
+* The samples are encoded on the thread that calls WriteData (the file sink's writer thread), never on the capture
+* thread. Encoded frames are collected in a buffer and written out in large writes. CommitHeader rewrites the sample
+* count and frame sizes in STREAMINFO, so an interrupted recording decodes up to its last committed frame.
+*
+* FLAC carries integer PCM only: 8, 16 and 24-bit WAVE_FORMAT_PCM captures are supported. The MD5 signature of
+* STREAMINFO is left at zero, which tells decoders it was not computed.
+*/
+class FlacWriter : public IAudioFileWriter
+{
+public:
+    // Encoded frames are written out once this much is pending
+    static const UINT32 OutputBufferBytes = 256 * 1024;
+
+    HRESULT Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options) override;
+    bool IsOpen() const override { return m_File && m_File->IsOpen(); }
+
+    HRESULT WriteData(const void* data, size_t bytes) override;
+    HRESULT CommitHeader() override;
+    HRESULT Flush() override;
+    HRESULT Finalize() override;
+
+    UINT64 GetDataSize() const override { return m_cbDataSize; }
+    UINT64 GetDataOffset() const override { return 0; }
+    // Bytes of FLAC stream produced so far
+    UINT64 GetEncodedSize() const { return m_cbEncoded; }
+
+private:
+    // Converts interleaved frames to the encoder's planar 32-bit buffers
+    void Deinterleave(const BYTE* data, UINT32 frames);
+    HRESULT EncodePending();
+    HRESULT WriteOutput();
+    HRESULT WriteStreamInfo(bool bAppend);
+
+    std::unique_ptr<IOutputFile> m_File;
+    FlacEncoder m_Encoder;
+    WAVEFORMATEX m_Format {};
+    UINT64 m_cbDataSize = 0;
+    UINT64 m_cbEncoded = 0;
+    UINT64 m_SamplesEncoded = 0;
+
+    // Frames in the encoder's buffers that do not form a whole block yet
+    UINT32 m_PendingFrames = 0;
+    // Bytes of a frame split across two WriteData calls
+    std::vector<BYTE> m_PartialFrame;
+    size_t m_cbPartialFrame = 0;
+
+    std::vector<BYTE> m_Output;
+    size_t m_cbOutput = 0;
+};
@@ -0,0 +1,203 @@
+#include "JitterBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+
+HRESULT JitterBuffer::Initialize(const LatencyPolicy& policy, const WAVEFORMATEX& format, UINT32 maxFrames)
+{
+    if (format.nBlockAlign == 0 || format.nChannels == 0 || format.nSamplesPerSec == 0 || maxFrames == 0 || policy.maxMs == 0 ||
+        policy.targetMs >= policy.maxMs)
+    {
+        return E_INVALIDARG;
+    }
+
+    auto msToFrames = [&](UINT32 ms) { return (UINT32)((UINT64)ms * format.nSamplesPerSec / 1000); };
+    m_Policy = policy;
+    m_FrameBytes = format.nBlockAlign;
+    m_Channels = format.nChannels;
+    m_TargetFrames = msToFrames(policy.targetMs);
+    m_MaxFrames = msToFrames(policy.maxMs);
+    m_ReleaseFrames = (policy.targetMs != 0) ? m_TargetFrames : m_MaxFrames / 2;
+    m_SliceFrames = std::max(msToFrames(policy.sliceMs), (UINT32)1);
+    m_CrossfadeFrames = msToFrames(policy.crossfadeMs);
+    m_bCatchingUp = false;
+
+    // Raised cosine: the two gains always sum to 1, so correlated audio on both sides of the cut keeps its level
+    m_FadeIn.resize(m_CrossfadeFrames);
+    for (UINT32 i = 0; i < m_CrossfadeFrames; i++)
+    {
+        double x = std::sin(0.5 * PI * (i + 0.5) / m_CrossfadeFrames);
+        m_FadeIn[i] = (float)(x * x);
+    }
+
+    SampleFormat sampleFormat = GetSampleFormat(format);
+    m_ToFloat = GetFrameConverter(sampleFormat, SampleFormat::Float32, m_Channels);
+    m_FromFloat = GetFrameConverter(SampleFormat::Float32, sampleFormat, m_Channels);
+    if (m_ToFloat == nullptr || m_FromFloat == nullptr)
+    {
+        m_ToFloat = nullptr;
+        m_FromFloat = nullptr;
+    }
+    m_FadeOutFrames.resize((size_t)m_CrossfadeFrames * m_Channels);
+    m_FadeInFrames.resize((size_t)m_CrossfadeFrames * m_Channels);
+
+    m_TimeStretch = TimeStretch();
+    if (policy.catchUp == CatchUpMode::TimeStretch && m_ToFloat != nullptr)
+    {
+        HRESULT hr = m_TimeStretch.Initialize(m_Channels, format.nSamplesPerSec, maxFrames);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_TimeStretch.SetSpeed(1.0 + policy.maxSpeedupPercent / 100.0);
+        m_StretchFrames.resize((size_t)maxFrames * m_Channels);
+    }
+
+    m_Stats = JitterBufferStats();
+    return S_OK;
+}
+
+bool JitterBuffer::OnPacketRead(UINT64 ageUs)
+{
+    m_Stats.maxPacketAgeUs = std::max(m_Stats.maxPacketAgeUs, ageUs);
+    if (ageUs <= (UINT64)m_Policy.lateCaptureMs * 1000)
+    {
+        return false;
+    }
+    m_Stats.latePackets++;
+    return true;
+}
+
+//
+//  GetDropFrames()
+//
+//  Starts catching up when the latency goes over the maximum, and stops once it is back at the release level. While
+//  the time stretch catches up, slices are only cut past the emergency level.
+//
+UINT32 JitterBuffer::GetDropFrames(double latencyFrames, UINT32 packetFrames)
+{
+    // The frames held back by the time stretch play before the packet
+    latencyFrames += m_TimeStretch.IsInitialized() ? m_TimeStretch.GetBufferedFrames() : 0;
+    if (!m_bCatchingUp && latencyFrames > m_MaxFrames)
+    {
+        m_bCatchingUp = true;
+        m_Stats.catchUps++;
+    }
+    if (!m_bCatchingUp)
+    {
+        return 0;
+    }
+
+    double excess = latencyFrames - m_ReleaseFrames;
+    if (excess < 1.0)
+    {
+        m_bCatchingUp = false;
+        return 0;
+    }
+    if (packetFrames <= m_CrossfadeFrames)
+    {
+        return 0;
+    }
+
+    UINT32 limit = packetFrames - m_CrossfadeFrames;
+    if (latencyFrames <= 2.0 * m_MaxFrames - m_ReleaseFrames)
+    {
+        if (m_TimeStretch.IsInitialized())
+        {
+            return 0;
+        }
+        limit = std::min(limit, m_SliceFrames);
+    }
+    return (UINT32)std::min(excess, (double)limit);
+}
+
+//
+//  DropFrames()
+//
+//  The frames before the cut fade out while the frames after it fade in, then the tail is moved down
+//
+UINT32 JitterBuffer::DropFrames(BYTE* frames, UINT32 frameCount, UINT32 dropFrames)
+{
+    if (dropFrames == 0 || frameCount < dropFrames + m_CrossfadeFrames)
+    {
+        return frameCount;
+    }
+
+    if (m_ToFloat != nullptr && m_CrossfadeFrames > 0)
+    {
+        m_ToFloat(frames, reinterpret_cast<BYTE*>(m_FadeOutFrames.data()), m_CrossfadeFrames);
+        m_ToFloat(frames + (size_t)dropFrames * m_FrameBytes, reinterpret_cast<BYTE*>(m_FadeInFrames.data()), m_CrossfadeFrames);
+        for (UINT32 i = 0; i < m_CrossfadeFrames; i++)
+        {
+            float gain = m_FadeIn[i];
+            float* fadeOut = &m_FadeOutFrames[(size_t)i * m_Channels];
+            const float* fadeIn = &m_FadeInFrames[(size_t)i * m_Channels];
+            for (UINT32 channel = 0; channel < m_Channels; channel++)
+            {
+                fadeOut[channel] += gain * (fadeIn[channel] - fadeOut[channel]);
+            }
+        }
+        m_FromFloat(reinterpret_cast<const BYTE*>(m_FadeOutFrames.data()), frames, m_CrossfadeFrames);
+        memmove(frames + (size_t)m_CrossfadeFrames * m_FrameBytes, frames + (size_t)(dropFrames + m_CrossfadeFrames) * m_FrameBytes,
+            (size_t)(frameCount - dropFrames - m_CrossfadeFrames) * m_FrameBytes);
+    }
+    else
+    {
+        // Hard cut
+        memmove(frames, frames + (size_t)dropFrames * m_FrameBytes, (size_t)(frameCount - dropFrames) * m_FrameBytes);
+    }
+
+    m_Stats.slicesDropped++;
+    m_Stats.framesDropped += dropFrames;
+    return frameCount - dropFrames;
+}
+
+//
+//  Stretch()
+//
+//  The stretch takes over the packets when catching up starts and keeps them once caught up, until DrainStretch has
+//  read everything it held back
+//
+UINT32 JitterBuffer::Stretch(BYTE* frames, UINT32 frameCount, UINT32 maxFrames)
+{
+    if (!m_TimeStretch.IsInitialized() || (!m_bCatchingUp && m_TimeStretch.GetBufferedFrames() == 0))
+    {
+        return frameCount;
+    }
+
+    float* stretchFrames = m_StretchFrames.data();
+    m_ToFloat(frames, reinterpret_cast<BYTE*>(stretchFrames), frameCount);
+    m_TimeStretch.Write(stretchFrames, frameCount);
+
+    maxFrames = std::min(maxFrames, (UINT32)(m_StretchFrames.size() / m_Channels));
+    UINT32 framesRead = m_bCatchingUp ? m_TimeStretch.Read(stretchFrames, maxFrames) : m_TimeStretch.Drain(stretchFrames, maxFrames);
+    m_FromFloat(reinterpret_cast<const BYTE*>(stretchFrames), frames, framesRead);
+
+    UpdateStretchStats();
+    return framesRead;
+}
+
+UINT32 JitterBuffer::DrainStretch(BYTE* frames, UINT32 maxFrames)
+{
+    if (!m_TimeStretch.IsInitialized() || m_bCatchingUp)
+    {
+        return 0;
+    }
+
+    float* stretchFrames = m_StretchFrames.data();
+    maxFrames = std::min(maxFrames, (UINT32)(m_StretchFrames.size() / m_Channels));
+    UINT32 framesRead = m_TimeStretch.Drain(stretchFrames, maxFrames);
+    m_FromFloat(reinterpret_cast<const BYTE*>(stretchFrames), frames, framesRead);
+    UpdateStretchStats();
+    return framesRead;
+}
+
+void JitterBuffer::UpdateStretchStats()
+{
+    const TimeStretchStats& stretchStats = m_TimeStretch.GetStats();
+    m_Stats.framesStretched = stretchStats.framesIn;
+    m_Stats.framesSaved = stretchStats.framesIn - stretchStats.framesOut - m_TimeStretch.GetBufferedFrames();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Platform.h"
+#include "SampleConvert.h"
+#include "TimeStretch.h"
+
+#include <vector>
+
+/**
+* How a JitterBuffer brings the latency back down once it goes over the maximum
+*/
+enum class CatchUpMode
+{
+    // Cut slices out of the packets
+    Cut,
+    // Play the packets faster at the same pitch, with TimeStretch. Slower to catch up, but nothing is cut, which keeps
+    // speech intelligible. Far over the maximum, e.g. after a stall, slices are still cut.
+    TimeStretch,
+};
+
+/**
+* Latency bounds of the render path. The latency of a packet is its age when the capture loop reads it plus the audio
+* queued ahead of it in the render ring and the endpoint buffer.
+*/
+struct LatencyPolicy
+{
+    // Latency the render path starts at, is steered to by the drift compensation, and is brought back to after catching
+    // up. 0 holds the level reached once the output has settled after starting, and catches up to half of maxMs.
+    UINT32 targetMs = 0;
+    // Above this latency, slices are cut out of the packets until the latency is back at the target
+    UINT32 maxMs = 60;
+    // Packets older than this when they are read count as late. They are still played.
+    UINT32 lateCaptureMs = 15;
+    // Largest slice cut out of one packet while catching up. Once the latency is further above maxMs than maxMs is
+    // above the target, e.g. after a stall, up to the whole packet but the crossfade is cut.
+    UINT32 sliceMs = 5;
+    // Length of the crossfade over each cut
+    UINT32 crossfadeMs = 3;
+    CatchUpMode catchUp = CatchUpMode::Cut;
+    // Speed-up of the time stretch while catching up, in percent
+    UINT32 maxSpeedupPercent = 8;
+};
+
+/**
+* Counters of a JitterBuffer. Updated by the capture thread only.
+*/
+struct JitterBufferStats
+{
+    UINT64 latePackets = 0;
+    // Oldest packet read, in microseconds
+    UINT64 maxPacketAgeUs = 0;
+    UINT64 slicesDropped = 0;
+    UINT64 framesDropped = 0;
+    // Times the latency went over maxMs
+    UINT64 catchUps = 0;
+    // Frames played faster by the time stretch, and the frames of latency that saved
+    UINT64 framesStretched = 0;
+    UINT64 framesSaved = 0;
+};
+
+/**
+* Holds the latency of the render path within a LatencyPolicy without flushing it.
+*
+* Instead of throwing away every queued packet when capture falls behind, the capture loop keeps playing everything
+* and the jitter buffer trims the excess a little at a time: once the latency goes over the maximum, a slice at the start
+* of each packet is cut out and the audio on both sides of the cut is crossfaded, until the latency is back at the
+* target. With CatchUpMode::TimeStretch, the packets go through a TimeStretch playing them slightly faster instead.
+* The stretch is only in the path while catching up, and lets go of the audio it holds back seamlessly afterwards. Slow drifts toward the maximum are handled before that by the drift compensation, which speeds up the
+* resampling slightly to steer the latency to the same target.
+*
+* The cuts and the time stretch work in place, in the output format, on the frames just written to the render ring.
+* Only the crossfaded or stretched frames are converted to float and back.
+*/
+class JitterBuffer
+{
+public:
+    // format is the format of the frames DropFrames and Stretch edit, maxFrames the most frames they are given at once
+    HRESULT Initialize(const LatencyPolicy& policy, const WAVEFORMATEX& format, UINT32 maxFrames);
+    bool IsInitialized() const { return m_FrameBytes != 0; }
+
+    // Records the age of a packet read by the capture loop. Returns true if the packet is late.
+    bool OnPacketRead(UINT64 ageUs);
+
+    // Frames to cut from the start of a packet of packetFrames output frames whose first frame plays after
+    // latencyFrames frames, not counting the frames the time stretch holds back
+    UINT32 GetDropFrames(double latencyFrames, UINT32 packetFrames);
+    // Cuts dropFrames frames from the start of frames, crossfading across the cut, and moves the rest down. Returns the
+    // number of frames left. frameCount must be at least dropFrames plus the crossfade length.
+    UINT32 DropFrames(BYTE* frames, UINT32 frameCount, UINT32 dropFrames);
+    // Passes a packet through the time stretch while catching up, after GetDropFrames and DropFrames. Returns the number
+    // of frames written back to frames, at most maxFrames. Leaves the packet as it is when not catching up.
+    UINT32 Stretch(BYTE* frames, UINT32 frameCount, UINT32 maxFrames);
+    // Once caught up, reads the frames the time stretch still holds back, up to maxFrames. Call after Stretch until it
+    // returns 0.
+    UINT32 DrainStretch(BYTE* frames, UINT32 maxFrames);
+
+    UINT32 GetTargetFrames() const { return m_TargetFrames; }
+    const JitterBufferStats& GetStats() const { return m_Stats; }
+
+private:
+    void UpdateStretchStats();
+
+    LatencyPolicy m_Policy;
+    UINT32 m_FrameBytes = 0;
+    UINT32 m_Channels = 0;
+    // Latencies of the policy, in output frames. m_ReleaseFrames is where catching up stops.
+    UINT32 m_TargetFrames = 0;
+    UINT32 m_MaxFrames = 0;
+    UINT32 m_ReleaseFrames = 0;
+    UINT32 m_SliceFrames = 0;
+    UINT32 m_CrossfadeFrames = 0;
+    bool m_bCatchingUp = false;
+    // Catches up instead of the cuts below the emergency level, when the policy asks for it and the format converts
+    TimeStretch m_TimeStretch;
+    std::vector<float> m_StretchFrames;
+
+    // Fade-in gains of the crossfade; the fade-out gains are 1 minus them
+    std::vector<float> m_FadeIn;
+    // Conversions of the crossfaded and stretched frames, or nullptr if the format has no converter (the cuts are then
+    // hard, and there is no time stretch)
+    FrameConvertFn m_ToFloat = nullptr;
+    FrameConvertFn m_FromFloat = nullptr;
+    std::vector<float> m_FadeOutFrames;
+    std::vector<float> m_FadeInFrames;
+
+    JitterBufferStats m_Stats;
+};
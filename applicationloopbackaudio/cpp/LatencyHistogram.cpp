@@ -0,0 +1,99 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+static UINT32 HighestBit(UINT64 value)
+{
+    UINT32 bit = 0;
+    for (UINT32 shift = 32; shift > 0; shift /= 2)
+    {
+        if (value >> shift)
+        {
+            value >>= shift;
+            bit += shift;
+        }
+    }
+    return bit;
+}
+
+//
+//  GetBucketIndex()
+//
+//  A value of exponent e >= SubBucketBits lands in sub-bucket (value >> (e - SubBucketBits)) - SubBucketCount of the
+//  bucket group e - SubBucketBits + 1. Group 0 holds the small values one per bucket.
+//
+UINT32 LatencyHistogram::GetBucketIndex(UINT64 value)
+{
+    value = std::min(value, ((UINT64)1 << MaxValueBits) - 1);
+    if (value < SubBucketCount)
+    {
+        return (UINT32)value;
+    }
+
+    UINT32 shift = HighestBit(value) - SubBucketBits;
+    return (shift + 1) * SubBucketCount + (UINT32)(value >> shift) - SubBucketCount;
+}
+
+UINT64 LatencyHistogram::GetBucketUpperBound(UINT32 index)
+{
+    if (index < SubBucketCount)
+    {
+        return index;
+    }
+
+    UINT32 shift = index / SubBucketCount - 1;
+    UINT64 lower = (UINT64)(SubBucketCount + index % SubBucketCount) << shift;
+    return lower + ((UINT64)1 << shift) - 1;
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto& count : m_Counts)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_Max.store(0, std::memory_order_relaxed);
+}
+
+//
+//  GetSnapshot()
+//
+//  Copies the counts first and the maximum last: the maximum then covers every counted value, and caps the bucket
+//  bounds of the top percentiles
+//
+LatencyHistogramSnapshot LatencyHistogram::GetSnapshot() const
+{
+    UINT64 counts[BucketCount];
+    LatencyHistogramSnapshot snapshot;
+    for (UINT32 i = 0; i < BucketCount; i++)
+    {
+        counts[i] = m_Counts[i].load(std::memory_order_relaxed);
+        snapshot.count += counts[i];
+    }
+    snapshot.max = m_Max.load(std::memory_order_relaxed);
+    if (snapshot.count == 0)
+    {
+        return snapshot;
+    }
+
+    // Smallest value with at least the given fraction of the values at or below it
+    auto percentile = [&](double fraction)
+    {
+        UINT64 rank = std::max((UINT64)std::ceil(fraction * snapshot.count), (UINT64)1);
+        UINT64 seen = 0;
+        for (UINT32 i = 0; i < BucketCount; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return std::min(GetBucketUpperBound(i), snapshot.max);
+            }
+        }
+        return snapshot.max;
+    };
+    snapshot.p50 = percentile(0.5);
+    snapshot.p99 = percentile(0.99);
+    snapshot.p999 = percentile(0.999);
+    return snapshot;
+}
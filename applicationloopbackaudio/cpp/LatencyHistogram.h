@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <atomic>
+
+/**
+* Percentiles of a LatencyHistogram, in the unit of the recorded values. Each percentile is the highest value of the
+* bucket it falls in, capped at the maximum, so it overstates the true value by at most 1/SubBucketCount.
+*/
+struct LatencyHistogramSnapshot
+{
+    UINT64 count = 0;
+    UINT64 p50 = 0;
+    UINT64 p99 = 0;
+    UINT64 p999 = 0;
+    UINT64 max = 0;
+};
+
+/**
+* Log-bucketed histogram of non-negative integer values, in the style of HdrHistogram.
+*
+* Values below SubBucketCount get a bucket each. Above that, every power of two is split into SubBucketCount linear
+* buckets, so the relative resolution is the same from microseconds to seconds. Values of MaxValueBits bits or more
+* land in the last bucket.
+*
+* Record is wait-free: one relaxed atomic increment, plus a relaxed compare-exchange on the rare new maximum. It can be
+* called on a real-time thread. GetSnapshot can be called from any thread at any time without stopping the recording;
+* it sees every value recorded before it started, and possibly some recorded while it runs.
+*/
+class LatencyHistogram
+{
+public:
+    // 128 buckets per power of two, e.g. 256 us wide around 50 ms: fine enough to tell p50 from p99 of a steady latency
+    static const UINT32 SubBucketBits = 7;
+    static const UINT32 SubBucketCount = 1 << SubBucketBits;
+    static const UINT32 MaxValueBits = 40;
+    static const UINT32 BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
+
+    LatencyHistogram() { Reset(); }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(UINT64 value)
+    {
+        m_Counts[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        UINT64 max = m_Max.load(std::memory_order_relaxed);
+        while (value > max && !m_Max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    LatencyHistogramSnapshot GetSnapshot() const;
+    // Must not race with Record
+    void Reset();
+
+private:
+    static UINT32 GetBucketIndex(UINT64 value);
+    // Highest value that lands in the bucket
+    static UINT64 GetBucketUpperBound(UINT32 index);
+
+    std::atomic<UINT64> m_Counts[BucketCount];
+    std::atomic<UINT64> m_Max;
+};
+
+/**
+* Latency histograms of the capture pipeline. Recorded by the capture thread for every callback and every packet.
+*/
+struct CaptureLatencyHistograms
+{
+    // Time spent in one capture callback (Async) or one pass of the capture loop (Sync), in 100-nanosecond units
+    LatencyHistogram callbackHns;
+    // Time between the capture of the first frame of a packet (u64QPCPosition) and its read, in microseconds
+    LatencyHistogram packetAgeUs;
+    // Time spent in resampleAudioStream per packet, in 100-nanosecond units
+    LatencyHistogram resampleHns;
+    // Frames queued in the render ring when a packet is written to it
+    LatencyHistogram renderQueueFrames;
+};
+
+struct CaptureLatencySnapshot
+{
+    LatencyHistogramSnapshot callbackHns;
+    LatencyHistogramSnapshot packetAgeUs;
+    LatencyHistogramSnapshot resampleHns;
+    LatencyHistogramSnapshot renderQueueFrames;
+};
@@ -0,0 +1,221 @@
+#include "LogRing.h"
+#include "SpanTrace.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <system_error>
+
+static const char* const s_LevelNames[] = { "debug", "info", "warning", "error" };
+
+LogRing& LogRing::Get()
+{
+    static LogRing ring;
+    return ring;
+}
+
+LogRing::LogRing()
+    : m_Cells(new Cell[Capacity])
+{
+    for (UINT32 i = 0; i < Capacity; i++)
+    {
+        m_Cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_StartTimeHns = GetQpcTimeHns();
+}
+
+LogRing::~LogRing()
+{
+    Stop();
+}
+
+HRESULT LogRing::Start()
+{
+    if (m_Thread.joinable())
+    {
+        return S_FALSE;
+    }
+
+    m_bStopRequested = false;
+    try
+    {
+        m_Thread = std::thread(&LogRing::ThreadProc, this);
+    }
+    catch (const std::system_error&)
+    {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+void LogRing::Stop()
+{
+    if (m_Thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_bStopRequested = true;
+        }
+        m_StopRequested.notify_one();
+        m_Thread.join();
+    }
+
+    Flush();
+    UINT64 dropped = m_Dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        std::cout << "Log: " << dropped << " messages dropped" << std::endl;
+    }
+}
+
+//
+//  Push()
+//
+//  Claims the next record by advancing the enqueue position, fills it, then hands it to the consumer by publishing its
+//  sequence. The rate limit is checked first so suppressed messages cost two relaxed atomics.
+//
+void LogRing::Push(LogFormat& format, const LogArg* args, UINT32 argCount)
+{
+    UINT64 nowHns = GetQpcTimeHns();
+    if (format.minIntervalMs != 0)
+    {
+        UINT64 nextTimeHns = format.nextTimeHns.load(std::memory_order_relaxed);
+        if (nowHns < nextTimeHns ||
+            !format.nextTimeHns.compare_exchange_strong(nextTimeHns, nowHns + (UINT64)format.minIntervalMs * 10000, std::memory_order_relaxed))
+        {
+            format.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    Cell* cell = nullptr;
+    UINT64 position = m_EnqueuePosition.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &m_Cells[position % Capacity];
+        INT64 difference = (INT64)(cell->sequence.load(std::memory_order_acquire) - position);
+        if (difference == 0)
+        {
+            if (m_EnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full: the consumer has not freed this record yet
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = m_EnqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord& record = cell->record;
+    record.format = &format;
+    record.timestampHns = nowHns;
+    record.suppressed = format.suppressed.exchange(0, std::memory_order_relaxed);
+    record.argCount = argCount;
+    for (UINT32 i = 0; i < argCount; i++)
+    {
+        record.args[i] = args[i];
+    }
+    cell->sequence.store(position + 1, std::memory_order_release);
+}
+
+bool LogRing::Pop(LogRecord* record)
+{
+    Cell& cell = m_Cells[m_DequeuePosition % Capacity];
+    if (cell.sequence.load(std::memory_order_acquire) != m_DequeuePosition + 1)
+    {
+        return false;
+    }
+
+    *record = cell.record;
+    cell.sequence.store(m_DequeuePosition + Capacity, std::memory_order_release);
+    m_DequeuePosition++;
+    return true;
+}
+
+//
+//  Flush()
+//
+//  Formats each record as "[seconds since start] level: text", replacing the placeholders of the text in order
+//
+void LogRing::Flush()
+{
+    LogRecord record;
+    std::string line;
+    char number[32];
+    while (Pop(&record))
+    {
+        line.clear();
+        UINT64 elapsedHns = (record.timestampHns > m_StartTimeHns) ? record.timestampHns - m_StartTimeHns : 0;
+        snprintf(number, sizeof(number), "[%10.6f] ", elapsedHns / 1e7);
+        line += number;
+        line += s_LevelNames[(int)record.format->level];
+        line += ": ";
+
+        UINT32 argIndex = 0;
+        for (const char* text = record.format->text; *text != '\0'; text++)
+        {
+            bool bHex = strncmp(text, "{:x}", 4) == 0;
+            if ((strncmp(text, "{}", 2) != 0 && !bHex) || argIndex == record.argCount)
+            {
+                line += *text;
+                continue;
+            }
+
+            const LogArg& arg = record.args[argIndex++];
+            switch (arg.type)
+            {
+            case LogArgType::Signed:
+                if (bHex)
+                {
+                    snprintf(number, sizeof(number), "0x%" PRIX64, (UINT64)arg.i);
+                }
+                else
+                {
+                    snprintf(number, sizeof(number), "%" PRId64, arg.i);
+                }
+                break;
+            case LogArgType::Unsigned:
+                snprintf(number, sizeof(number), bHex ? "0x%" PRIX64 : "%" PRIu64, arg.u);
+                break;
+            case LogArgType::Double:
+                snprintf(number, sizeof(number), "%g", arg.d);
+                break;
+            }
+            line += number;
+            text += bHex ? 3 : 1;
+        }
+
+        if (record.suppressed > 0)
+        {
+            snprintf(number, sizeof(number), " (%u more suppressed)", record.suppressed);
+            line += number;
+        }
+        std::cout << line << '\n';
+    }
+    std::cout.flush();
+}
+
+void LogRing::ThreadProc()
+{
+    LOOPBACK_TRACE_THREAD("Log");
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_StopRequested.wait_for(lock, std::chrono::milliseconds(FlushIntervalMs), [this] { return m_bStopRequested; }))
+    {
+        lock.unlock();
+        {
+            LOOPBACK_TRACE_SPAN("Log flush");
+            Flush();
+        }
+        lock.lock();
+    }
+}
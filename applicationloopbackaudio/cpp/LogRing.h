@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+enum class LogLevel
+{
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+/**
+* A message that can be logged, and its format ID: LOOPBACK_LOG declares one static LogFormat per call site.
+*
+* text is the message with a {} placeholder for each argument, or {:x} to print an integer in hexadecimal. Messages of
+* the same format are rate limited to one per minIntervalMs; the ones in between are counted and the count is printed
+* with the next message that gets through.
+*/
+struct LogFormat
+{
+    LogLevel level;
+    const char* text;
+    UINT32 minIntervalMs;
+    std::atomic<UINT64> nextTimeHns { 0 };
+    std::atomic<UINT32> suppressed { 0 };
+};
+
+/**
+* Asynchronous binary log for the real-time threads.
+*
+* Writing a message never formats, allocates, blocks or touches the console: it copies the format ID, up to MaxArgs
+* numeric arguments and a timestamp into a fixed-size record of a bounded multi-producer ring, and returns. The log
+* thread started by Start formats the records and prints them to std::cout every FlushIntervalMs. When the ring is full,
+* the message is dropped and counted instead of waiting.
+*
+* The ring is lock-free: a producer only retries when another producer claimed the same record at the same moment.
+*/
+class LogRing
+{
+public:
+    static const UINT32 Capacity = 1024;
+    static const UINT32 MaxArgs = 4;
+    static constexpr UINT32 FlushIntervalMs = 20;
+
+    static LogRing& Get();
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // Starts the log thread. Until then, messages wait in the ring.
+    HRESULT Start();
+    // Prints the messages left in the ring and stops the log thread
+    void Stop();
+
+    // Messages below level are discarded when written
+    void SetLevel(LogLevel level) { m_Level.store(level, std::memory_order_relaxed); }
+    LogLevel GetLevel() const { return m_Level.load(std::memory_order_relaxed); }
+    // Messages dropped because the ring was full, since the last Stop
+    UINT64 GetDroppedRecords() const { return m_Dropped.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void Write(LogFormat& format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= MaxArgs, "Too many log arguments");
+        if (format.level < GetLevel())
+        {
+            return;
+        }
+        LogArg values[MaxArgs + 1] = { MakeArg(args)... };
+        Push(format, values, (UINT32)sizeof...(Args));
+    }
+
+private:
+    enum class LogArgType
+    {
+        Signed,
+        Unsigned,
+        Double,
+    };
+
+    struct LogArg
+    {
+        LogArgType type;
+        union
+        {
+            INT64 i;
+            UINT64 u;
+            double d;
+        };
+    };
+
+    struct LogRecord
+    {
+        const LogFormat* format;
+        UINT64 timestampHns;
+        UINT32 suppressed;
+        UINT32 argCount;
+        LogArg args[MaxArgs];
+    };
+
+    // One record of the ring. sequence tells the producers and the consumer whose turn it is (Vyukov's bounded queue).
+    struct Cell
+    {
+        std::atomic<UINT64> sequence;
+        LogRecord record;
+    };
+
+    template <typename T>
+    static LogArg MakeArg(T value)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Only numbers can be logged");
+        LogArg arg;
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            arg.type = LogArgType::Double;
+            arg.d = (double)value;
+        }
+        else if constexpr (std::is_signed<T>::value)
+        {
+            arg.type = LogArgType::Signed;
+            arg.i = (INT64)value;
+        }
+        else
+        {
+            arg.type = LogArgType::Unsigned;
+            arg.u = (UINT64)value;
+        }
+        return arg;
+    }
+
+    LogRing();
+    ~LogRing();
+    void Push(LogFormat& format, const LogArg* args, UINT32 argCount);
+    bool Pop(LogRecord* record);
+    // Prints the records in the ring. Log thread only.
+    void Flush();
+    void ThreadProc();
+
+    std::unique_ptr<Cell[]> m_Cells;
+    alignas(64) std::atomic<UINT64> m_EnqueuePosition { 0 };
+    alignas(64) UINT64 m_DequeuePosition = 0;
+    std::atomic<LogLevel> m_Level { LogLevel::Info };
+    std::atomic<UINT64> m_Dropped { 0 };
+    UINT64 m_StartTimeHns = 0;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_StopRequested;
+    bool m_bStopRequested = false;
+};
+
+// Logs text with the given arguments from any thread, at most once per minIntervalMs (0 for every time)
+#define LOOPBACK_LOG(level, minIntervalMs, text, ...) \
+    do \
+    { \
+        static LogFormat s_LogFormat { level, text, minIntervalMs }; \
+        LogRing::Get().Write(s_LogFormat, ##__VA_ARGS__); \
+    } while (0)
@@ -1,7 +1,13 @@
 #include <wchar.h>
 #include <iostream>
+#include <algorithm>
 #include <audioclientactivationparams.h>
 #include "LoopbackCapture.h"
+#include "AudioClientCaptureSource.h"
+#include "AllocationCounter.h"
+#include "LogRing.h"
+#include "PipelineCounters.h"
+#include "SpanTrace.h"
 
 HRESULT CLoopbackCapture::SetDeviceStateErrorIfFailed(HRESULT hr)
 {
@@ -14,33 +20,25 @@ HRESULT CLoopbackCapture::SetDeviceStateErrorIfFailed(HRESULT hr)
 
 HRESULT CLoopbackCapture::InitializeLoopbackCapture()
 {
-    // Create events for sample ready or user stop
-    RETURN_IF_FAILED(m_SampleReadyEvent.create(wil::EventOptions::None));
-
     // Initialize MF
     RETURN_IF_FAILED(MFStartup(MF_VERSION, MFSTARTUP_LITE));
-
-    // Register MMCSS work queue https://learn.microsoft.com/en-us/windows/win32/api/mfapi/nf-mfapi-mflocksharedworkqueue
-    DWORD dwTaskID = 0;
-    RETURN_IF_FAILED(MFLockSharedWorkQueue(L"Capture", 0, &dwTaskID, &m_dwQueueID));
-
-    // Set the capture event work queue to use the MMCSS queue
-    m_xSampleReady.SetQueueID(m_dwQueueID);
+    m_bMFStarted = true;
 
     // Create the completion event as auto-reset
     RETURN_IF_FAILED(m_hActivateCompleted.create(wil::EventOptions::None));
 
-    // Create the capture-stopped event as auto-reset
-    RETURN_IF_FAILED(m_hCaptureStopped.create(wil::EventOptions::None));
+    m_Scheduler = CreateCaptureScheduler(m_Scheduling);
 
     return S_OK;
 }
 
 CLoopbackCapture::~CLoopbackCapture()
 {
-    if (m_dwQueueID != 0)
+    // The scheduler goes first: it may still hold the shared work queue
+    m_Scheduler.reset();
+    if (m_bMFStarted)
     {
-        MFUnlockWorkQueue(m_dwQueueID);
+        MFShutdown();
     }
 }
 
@@ -119,23 +117,30 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
             // output format will be null if there's no output client
             if (m_pOutputFormat)
             {
-                if (compareFormats(&m_CaptureFormat, &m_pOutputFormat->Format))
+                bool bSameFormat = compareFormats(&m_CaptureFormat, &m_pOutputFormat->Format);
+                if (bSameFormat && !m_bDriftCompensation)
                 {
                     // No resampling needed
                     std::cout << "Capture and output formats are identical. No resampling needed." << std::endl;
                 }
+                else if (bSameFormat)
+                {
+                    // The resampler only comes in to follow a drift between the two endpoint clocks, once one is measured
+                    std::cout << "Capture and output formats are identical. Copying until a clock drift is measured." << std::endl;
+                    RETURN_IF_FAILED(initializeResampler(&m_CaptureFormat, m_pOutputFormat));
+                }
                 else
                 {
                     // Capture and output formats differ. Resampling needed
-                    std::cout << "Capture and output formats are different. Initializing Media Foundation resampler." << std::endl;
-                    RETURN_IF_FAILED(initializeMFTResampler(&m_CaptureFormat, m_pOutputFormat));
+                    std::cout << "Capture and output formats are different. Resampling needed." << std::endl;
+                    RETURN_IF_FAILED(initializeResampler(&m_CaptureFormat, m_pOutputFormat));
                 }
             }
 
             // Get the device period
             // Note: Returns "Not implemented" ...
-            REFERENCE_TIME hnsDefaultDevicePeriod;
-            REFERENCE_TIME hnsMinimumDevicePeriod;
+            REFERENCE_TIME hnsDefaultDevicePeriod = 0;
+            REFERENCE_TIME hnsMinimumDevicePeriod = 0;
             hr = m_AudioClient->GetDevicePeriod(&hnsDefaultDevicePeriod, &hnsMinimumDevicePeriod);
             if (FAILED(hr))
             {
@@ -151,8 +156,9 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
             }
 
             // Initialize the AudioClient in Shared Mode with the user specified buffer
+            // The scheduler adds the flags it needs, e.g. the event callback
             RETURN_IF_FAILED(m_AudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
-                AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM,
+                AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | m_Scheduler->GetStreamFlags(),
                 0,
                 0,
                 &m_CaptureFormat,
@@ -194,12 +200,25 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
 
             // Get the capture client
             RETURN_IF_FAILED(m_AudioClient->GetService(IID_PPV_ARGS(&m_AudioCaptureClient)));
+            if (m_CaptureSource == nullptr)
+            {
+                m_CaptureSource = std::make_unique<AudioClientCaptureSource>(m_AudioCaptureClient.get(), m_CaptureFormat);
+            }
+            RETURN_IF_FAILED(startPacketTrace());
+
+            // Size the resampler buffers for the largest packet expected (two device periods or the whole endpoint
+            // buffer), so that resampleAudioStream does not allocate once capture is running. Without a device period,
+            // assume the 10 ms of the shared mode engine.
+            UINT64 periodHns = (hnsDefaultDevicePeriod > 0) ? (UINT64)hnsDefaultDevicePeriod : HNS_PER_SEC / 100;
+            UINT32 periodFrames = (UINT32)(periodHns * m_CaptureFormat.nSamplesPerSec / HNS_PER_SEC);
+            UINT32 maxPacketFrames = std::max(2 * periodFrames, m_BufferFrames);
+            RETURN_IF_FAILED(allocateResamplerBuffers(maxPacketFrames));
 
-            // Create Async callback for sample events
-            RETURN_IF_FAILED(MFCreateAsyncResult(nullptr, &m_xSampleReady, nullptr, &m_SampleReadyAsyncResult));
+            // Start draining the render ring into the output endpoint
+            RETURN_IF_FAILED(startRenderPump(maxPacketFrames));
 
-            // Tell the system which event handle it should signal when an audio buffer is ready to be processed by the client
-            RETURN_IF_FAILED(m_AudioClient->SetEventHandle(m_SampleReadyEvent.get()));
+            // Prepare the wakeups (buffer event, work queue...) of the scheduler
+            RETURN_IF_FAILED(m_Scheduler->Initialize(m_AudioClient.get(), m_CaptureFormat, periodHns));
 
             // Creates the WAV file.
             RETURN_IF_FAILED(CreateWAVFile());
@@ -218,78 +237,28 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
 //
 //  CreateWAVFile()
 //
-//  Creates a WAV file in music folder
+//  Creates the WAV file and starts the writer thread that records the captured packets to it
 //
 HRESULT CLoopbackCapture::CreateWAVFile()
 {
-    return SetDeviceStateErrorIfFailed([&]()->HRESULT
-        {
-            m_hFile.reset(CreateFile(m_outputFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
-            RETURN_LAST_ERROR_IF(!m_hFile);
-
-            // Create and write the WAV header
-            if (m_CaptureFormat.wFormatTag == WAVE_FORMAT_EXTENSIBLE)
-            {
-                // WAVEFORMATEXTENSIBLE does not fit in a .wav file. In this case, generate a file without header.
-            }
-            else
-            {
-                // 1. RIFF chunk descriptor
-                DWORD header[] = {
-                    FCC('RIFF'),        // RIFF header
-                    0,                  // Total size of WAV (will be filled in later)
-                    FCC('WAVE'),        // WAVE FourCC
-                    FCC('fmt '),        // Start of 'fmt ' chunk
-                    sizeof(m_CaptureFormat) // Size of fmt chunk
-                };
-                DWORD dwBytesWritten = 0;
-                RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), header, sizeof(header), &dwBytesWritten, NULL));
-
-                m_cbHeaderSize += dwBytesWritten;
-
-                // 2. The fmt sub-chunk
-                WI_ASSERT(m_CaptureFormat.cbSize == 0);
-                RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &m_CaptureFormat, sizeof(m_CaptureFormat), &dwBytesWritten, NULL));
-                m_cbHeaderSize += dwBytesWritten;
-
-                // 3. The data sub-chunk
-                DWORD data[] = { FCC('data'), 0 };  // Start of 'data' chunk
-                RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), data, sizeof(data), &dwBytesWritten, NULL));
-                m_cbHeaderSize += dwBytesWritten;
-            }
-
-            return S_OK;
-        }());
+    return SetDeviceStateErrorIfFailed(startFileSink(m_outputFileName));
 }
 
 
 //
 //  FixWAVHeader()
 //
-//  The size values were not known when we originally wrote the header, so now go through and fix the values
+//  Waits for the writer thread to flush the pending packets, then fixes the size values of the header. Closes the
+//  packet trace too.
 //
 HRESULT CLoopbackCapture::FixWAVHeader()
 {
-    // Write the size of the 'data' chunk first
-    DWORD dwPtr = SetFilePointer(m_hFile.get(), m_cbHeaderSize - sizeof(DWORD), NULL, FILE_BEGIN);
-    RETURN_LAST_ERROR_IF(INVALID_SET_FILE_POINTER == dwPtr);
-
-    DWORD dwBytesWritten = 0;
-    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &m_cbDataSize, sizeof(DWORD), &dwBytesWritten, NULL));
-
-    // Write the total file size, minus RIFF chunk and size
-    // sizeof(DWORD) == sizeof(FOURCC)
-    RETURN_LAST_ERROR_IF(INVALID_SET_FILE_POINTER == SetFilePointer(m_hFile.get(), sizeof(DWORD), NULL, FILE_BEGIN));
-
-    DWORD cbTotalSize = m_cbDataSize + m_cbHeaderSize - 8;
-    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &cbTotalSize, sizeof(DWORD), &dwBytesWritten, NULL));
-
-    RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_hFile.get()));
-
-    return S_OK;
+    HRESULT hr = stopFileSink();
+    stopPacketTrace();
+    return hr;
 }
 
-HRESULT CLoopbackCapture::StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName)
+HRESULT CLoopbackCapture::StartCapture(DWORD processId, bool includeProcessTree, PCWSTR outputFileName)
 {
     m_outputFileName = outputFileName;
     auto resetOutputFileName = wil::scope_exit([&] { m_outputFileName = nullptr; });
@@ -301,159 +270,78 @@ HRESULT CLoopbackCapture::StartCaptureAsync(DWORD processId, bool includeProcess
     if (m_DeviceState == DeviceState::Initialized)
     {
         m_DeviceState = DeviceState::Starting;
-        return MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_xStartCapture, nullptr);
-    }
-
-    return S_OK;
-}
-
-//
-//  OnStartCapture()
-//
-//  Callback method to start capture
-//
-HRESULT CLoopbackCapture::OnStartCapture(IMFAsyncResult* pResult)
-{
-    std::cout << "\n\n#####################" << __FUNCTION__ << "#####################\n\n";
-    return SetDeviceStateErrorIfFailed([&]()->HRESULT
-        {
-            // Start the capture
-            RETURN_IF_FAILED(m_AudioClient->Start());
+        return SetDeviceStateErrorIfFailed([&]()->HRESULT
+            {
+                // Start the capture
+                RETURN_IF_FAILED(m_AudioClient->Start());
 
-            m_DeviceState = DeviceState::Capturing;
-            MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
+                m_DeviceState = DeviceState::Capturing;
+                RETURN_IF_FAILED(m_Scheduler->Start(this));
 
-            std::cout << "\n\n##################### Leaving " << __FUNCTION__ << "#####################\n\n";
+                return S_OK;
+            }());
+    }
 
-            return S_OK;
-        }());
+    return S_OK;
 }
 
-
 //
-//  StopCaptureAsync()
+//  StopCapture()
 //
-//  Stop capture asynchronously via MF Work Item
+//  Stops the wakeups, then the audio client and the render path, and finalizes the recording
 //
-HRESULT CLoopbackCapture::StopCaptureAsync()
+HRESULT CLoopbackCapture::StopCapture()
 {
     RETURN_HR_IF(E_NOT_VALID_STATE, (m_DeviceState != DeviceState::Capturing) &&
         (m_DeviceState != DeviceState::Error));
 
     m_DeviceState = DeviceState::Stopping;
 
-    RETURN_IF_FAILED(MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_xStopCapture, nullptr));
-
-    // Wait for capture to stop
-    m_hCaptureStopped.wait();
-
-    if (m_OutputAudioClient != nullptr)
-    {
-        m_OutputAudioClient->Stop();
-    }
-
-    return S_OK;
-}
-
-//
-//  OnStopCapture()
-//
-//  Callback method to stop capture
-//
-HRESULT CLoopbackCapture::OnStopCapture(IMFAsyncResult* pResult)
-{
-    // Stop capture by cancelling Work Item
-    // Cancel the queued work item (if any)
-    if (0 != m_SampleReadyKey)
+    // Returns once no drain runs, so nothing is pushed to the file sink past this point
+    HRESULT hrDrain = m_Scheduler->Stop();
+    if (FAILED(hrDrain))
     {
-        MFCancelWorkItem(m_SampleReadyKey);
-        m_SampleReadyKey = 0;
+        _com_error err(hrDrain);
+        std::wcout << L"Capture stopped on error: " << err.ErrorMessage() << std::endl;
     }
 
     m_AudioClient->Stop();
-    m_SampleReadyAsyncResult.reset();
 
-    return FinishCaptureAsync();
-}
+    stopRenderPump();
 
-//
-//  FinishCaptureAsync()
-//
-//  Finalizes WAV file on a separate thread via MF Work Item
-//
-HRESULT CLoopbackCapture::FinishCaptureAsync()
-{
-    // We should be flushing when this is called
-    return MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_xFinishCapture, nullptr);
-}
-
-//
-//  OnFinishCapture()
-//
-//  Because of the asynchronous nature of the MF Work Queues and the DataWriter, there could still be
-//  a sample processing.  So this will get called to finalize the WAV header.
-//
-HRESULT CLoopbackCapture::OnFinishCapture(IMFAsyncResult* pResult)
-{
-    // FixWAVHeader will set the DeviceStateStopped when all async tasks are complete
-    HRESULT hr = S_OK;
-
-    if (m_CaptureFormat.wFormatTag != WAVE_FORMAT_EXTENSIBLE)
-    {
-        hr = FixWAVHeader();
-    }
+    HRESULT hr = FixWAVHeader();
 
     // Stop MFTransform
     if (m_ResamplerTransform != nullptr)
     {
         // This should happen right before the last audio frame, and then the resampler function should be called one last time
-        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, NULL);
-        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, NULL);
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, NULL);
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, NULL);
 
         // Shut down the resampler
-        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, NULL);
-        MFShutdown();
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, NULL);
     }
 
-    m_DeviceState = DeviceState::Stopped;
-
-    m_hCaptureStopped.SetEvent();
-
-    return hr;
-}
-
-//
-//  OnSampleReady()
-//
-//  Callback method when ready to fill sample buffer
-//
-HRESULT CLoopbackCapture::OnSampleReady(IMFAsyncResult* pResult)
-{
-    if (SUCCEEDED(OnAudioSampleRequested()))
-    {
-        // Re-queue work item for next sample
-        if (m_DeviceState == DeviceState::Capturing)
-        {
-            // Re-queue work item for next sample
-            return MFPutWaitingWorkItem(m_SampleReadyEvent.get(), 0, m_SampleReadyAsyncResult.get(), &m_SampleReadyKey);
-        }
-    }
-    else
+    if (AllocationCounter::IsEnabled())
     {
-        m_DeviceState = DeviceState::Error;
+        std::cout << "Steady-state capture allocations: " << getSteadyStateAllocations() << std::endl;
     }
+    printLatencySnapshot();
 
-    return S_OK;
+    m_DeviceState = DeviceState::Stopped;
+
+    return hr;
 }
 
 //
-//  OnAudioSampleRequested()
+//  DrainPackets()
 //
-//  Called when audio device fires m_SampleReadyEvent
+//  Called by the scheduler on every wakeup: reads every packet the capture client holds
 //
-HRESULT CLoopbackCapture::OnAudioSampleRequested()
+HRESULT CLoopbackCapture::DrainPackets(PacketArrivalPredictor* pPredictor)
 {
     auto lock = m_CritSec.lock();
+    UINT32 framesRead = 0;
 
     UINT32 FramesAvailable = 0;
     BYTE* Data = nullptr;
@@ -462,10 +350,9 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested()
     UINT64 u64DevicePosition = 0;
     // Time at which the first frame of the audio packet was written to the endpoint buffer, in 100-nanosecond units
     UINT64 u64QPCPosition = 0;
-    DWORD cbBytesToCapture = 0;
     HRESULT hr = S_OK;
 
-    // If this flag is set, we have already queued up the async call to finialize the WAV header
+    // If this flag is set, the capture is stopping and the WAV header is about to be finalized
     // So we don't want to grab or write any more data that would possibly give us an invalid size
     if (m_DeviceState == DeviceState::Stopping)
     {
@@ -493,154 +380,89 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested()
     // We do this by calling IAudioCaptureClient::GetNextPacketSize
     // over and over again until it indicates there are no more packets remaining.
 
-// TODO: DEBUGGING! DELETE TIMING CODE!
-    {
-        LARGE_INTEGER frequency, OnAudioSampleRequestedStartTime, OnAudioSampleRequestedEndTime;
-        QueryPerformanceFrequency(&frequency);
-        QueryPerformanceCounter(&OnAudioSampleRequestedStartTime);
-        while (SUCCEEDED(m_AudioCaptureClient->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0)
-        {
-            cbBytesToCapture = FramesAvailable * m_CaptureFormat.nBlockAlign;
+    PipelineCounters::Add(PipelineCounter::CaptureWakeups);
+    UINT64 wakeupStartHns = GetQpcTimeHns();
 
-            // WAV files have a 4GB (0xFFFFFFFF) size limit, so likely we have hit that limit when we
-            // overflow here.  Time to stop the capture
-            if ((m_cbDataSize + cbBytesToCapture) < m_cbDataSize)
-            {
-                StopCaptureAsync();
-                break;
-            }
-
-            // Get sample buffer
-            RETURN_IF_FAILED(m_AudioCaptureClient->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, &u64DevicePosition, &u64QPCPosition));
-
-            if (dwCaptureFlags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)
+    // Count the heap allocations of every wakeup once the first packets went through. Steady-state capture, from the
+    // capture client to the render ring and the file sink, must not allocate.
+    UINT64 allocationsBefore = AllocationCounter::GetThreadAllocations();
+    auto countAllocations = wil::scope_exit([&]
+        {
+            if (m_bCaptureWarmedUp)
             {
-                std::cout << "Timestamp error!" << std::endl;
+                m_SteadyStateAllocations += AllocationCounter::GetThreadAllocations() - allocationsBefore;
             }
-            else
-            {
-                UINT32 captureClientCurrentPadding = 0;
-                m_AudioClient->GetCurrentPadding(&captureClientCurrentPadding);
-                m_u64QPCPositionPrev = u64QPCPosition;
-                LARGE_INTEGER endTime;
-                // Ticks per second
-                QueryPerformanceCounter(&endTime);
-                LONGLONG endTimeMicroseconds = (endTime.QuadPart * 1000000) / frequency.QuadPart;
-                LONGLONG elapsedTime = endTimeMicroseconds - (u64QPCPosition / 10), maxDelay = 15000;
-                if (elapsedTime > maxDelay)
-                {
-                    std::cout << "Time elapsed since the first frame of the audio packet was written: " << elapsedTime << " us" << std::endl;
-                    // Release the loopback capture's buffer back
-                    hr = m_AudioCaptureClient->ReleaseBuffer(FramesAvailable);
-                    RETURN_IF_FAILED(hr);
-                    // Discard samples that are older than maxDelay microseconds
-                    while (SUCCEEDED(m_AudioCaptureClient->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0)
-                    {
-                        RETURN_IF_FAILED(m_AudioCaptureClient->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, &u64DevicePosition, &u64QPCPosition));
-                        hr = m_AudioCaptureClient->ReleaseBuffer(FramesAvailable);
-                        RETURN_IF_FAILED(hr);
-                    }
-
-                    //if (m_OutputAudioClient != nullptr && m_bAudioStreamStarted)
-                    //{
-                    //	m_OutputAudioClient->Stop();
-                    //	m_OutputAudioClient->Reset();
-                    //	m_OutputAudioClient->Start();
-                    //}
-                    std::cout << "Discarded all late samples" << std::endl;
-
-                    continue;
-                }
-
-            }
-            //      // Write File
-                  //if (m_DeviceState != DeviceState::Stopping)
-                  //{
-                  //	DWORD dwBytesWritten = 0;
-                  //	RETURN_IF_WIN32_BOOL_FALSE(WriteFile(
-                  //		m_hFile.get(),
-                  //		Data,
-                  //		cbBytesToCapture,
-                  //		&dwBytesWritten,
-                  //		NULL));
-                  //}
-
-                  // Stream to endpoint
-            if (m_OutputAudioClient != nullptr)
-            {
-                if (!m_bAudioStreamStarted)
-                {
-                    hr = m_OutputAudioClient->Start();
-                    RETURN_IF_FAILED(hr);
-                    m_bAudioStreamStarted = true;
-
-                    // Initialize audio resampler transform (if needed)
-                    if (m_ResamplerTransform != nullptr)
-                    {
-                        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL);
-                        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL);
-                        hr = m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL);
-                    }
-                }
-
-                // See how much buffer space is available.
-                UINT32 numFramesPadding = 0;
-                auto hr = m_OutputAudioClient->GetCurrentPadding(&numFramesPadding);
-                RETURN_IF_FAILED(hr);
-                std::cout << "Output client current padding: " << numFramesPadding << std::endl;
-
-                // Get the actual size of the allocated buffer.
-                UINT32 bufferFrameCount = 0;
-                hr = m_OutputAudioClient->GetBufferSize(&bufferFrameCount);
-                RETURN_IF_FAILED(hr);
-
-                // Space available in the render client's buffer
-                UINT32 clientFramesAvailable = bufferFrameCount - numFramesPadding;
-
-                // Check that there's enough space in the audio client to take in all the data obtained from the loopback interface
-                float samplingRatio = (float)m_pOutputFormat->Format.nSamplesPerSec / (float)m_CaptureFormat.nSamplesPerSec;
-                if (clientFramesAvailable < (int)(FramesAvailable * samplingRatio) + 1)
-                {
-                    std::cout << "No space available in the render client to play back all the captured audio frames" << std::endl;
-                }
-                else
-                {
-                    // Grab all the available space in the shared buffer.
-                    BYTE* pData = NULL;
+            m_bCaptureWarmedUp = m_bCaptureWarmedUp || framesRead > 0;
+        });
+    while (SUCCEEDED(m_CaptureSource->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0)
+    {
+        LOOPBACK_TRACE_SPAN("Packet");
 
-                    hr = m_OutputRenderClient->GetBuffer((int)(FramesAvailable * samplingRatio) + 1, &pData);
-                    RETURN_IF_FAILED(hr);
+        // Get sample buffer
+        {
+            LOOPBACK_TRACE_SPAN("GetBuffer");
+            RETURN_IF_FAILED(m_CaptureSource->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, &u64DevicePosition, &u64QPCPosition));
+        }
 
-                    // Resample the audio stream to the desired output format
-                    UINT32 framesWritten = 0;
-                    resampleAudioStream(Data, pData, FramesAvailable, clientFramesAvailable, framesWritten);
-                    std::cout << "Resampled " << FramesAvailable << " frames into " << framesWritten << " frames. Requested frames " << (int)(FramesAvailable * samplingRatio) + 1 << std::endl;
+        LOOPBACK_LOG(LogLevel::Debug, 0, "Packet {}: {} frames captured at {}", u64DevicePosition, FramesAvailable, u64QPCPosition);
+        PipelineCounters::Add(PipelineCounter::PacketsCaptured);
+        PipelineCounters::Add(PipelineCounter::FramesCaptured, FramesAvailable);
+        if (dwCaptureFlags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY)
+        {
+            PipelineCounters::Add(PipelineCounter::Discontinuities);
+            LOOPBACK_LOG(LogLevel::Warning, 1000, "Capture glitch before packet {}", u64DevicePosition);
+            m_RenderPath.OnCaptureDiscontinuity();
+        }
 
-                    // Release the render client's buffer back
-                    hr = m_OutputRenderClient->ReleaseBuffer(framesWritten, 0);
-                    RETURN_IF_FAILED(hr);
-                }
+        // Record the packet. The writer thread does the disk I/O.
+        {
+            LOOPBACK_TRACE_SPAN("File sink push");
+            m_FileSink.Push(Data, FramesAvailable);
+        }
+        framesRead += FramesAvailable;
 
+        // Age of the packet. Late packets are played too; the jitter buffer trims the latency they add.
+        UINT64 packetAgeUs = 0;
+        if (dwCaptureFlags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)
+        {
+            PipelineCounters::Add(PipelineCounter::TimestampErrors);
+            LOOPBACK_LOG(LogLevel::Warning, 1000, "Timestamp error on packet {}", u64DevicePosition);
+        }
+        else
+        {
+            m_u64QPCPositionPrev = u64QPCPosition;
+            if (pPredictor != nullptr)
+            {
+                pPredictor->OnPacket(u64QPCPosition, FramesAvailable, wakeupStartHns);
             }
+            UINT64 nowHns = GetQpcTimeHns();
+            packetAgeUs = (nowHns > u64QPCPosition) ? (nowHns - u64QPCPosition) / 10 : 0;
+            m_LatencyHistograms.packetAgeUs.Record(packetAgeUs);
+        }
 
-            // Release the loopback capture's buffer back
-            hr = m_AudioCaptureClient->ReleaseBuffer(FramesAvailable);
-            RETURN_IF_FAILED(hr);
+        // Stream to endpoint. Hands the packet to the render pump and never blocks, even when the endpoint falls behind.
+        renderCapturedFrames(Data, FramesAvailable, packetAgeUs);
 
-            // Increase the size of our 'data' chunk.  m_cbDataSize needs to be accurate
-            m_cbDataSize += cbBytesToCapture;
+        // Release the loopback capture's buffer back
+        {
+            LOOPBACK_TRACE_SPAN("ReleaseBuffer");
+            hr = m_CaptureSource->ReleaseBuffer(FramesAvailable);
         }
-        QueryPerformanceCounter(&OnAudioSampleRequestedEndTime);
-        LONGLONG OnAudioSampleRequestedElapsedTime = ((OnAudioSampleRequestedEndTime.QuadPart - OnAudioSampleRequestedStartTime.QuadPart) * 1000000) / frequency.QuadPart;
-        std::cout << __FUNCTION__ << " execution took " << OnAudioSampleRequestedElapsedTime << "us" << std::endl;
+        RETURN_IF_FAILED(hr);
     }
-    // END TIMING BLOCK
-
 
-
-    if (FramesAvailable == 0)
+    // Only the wakeups that found packets: the empty polls would drown them
+    if (framesRead > 0)
+    {
+        m_LatencyHistograms.callbackHns.Record(GetQpcTimeHns() - wakeupStartHns);
+    }
+    else
     {
-        std::cout << "There're no more frames to read. Leaving OnAudioSampleRequested()" << std::endl;
+        PipelineCounters::Add(PipelineCounter::EmptyCaptureWakeups);
+        if (pPredictor != nullptr)
+        {
+            pPredictor->OnEmptyWakeup(wakeupStartHns);
+        }
     }
 
     return S_OK;
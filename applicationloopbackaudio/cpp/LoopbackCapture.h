@@ -1,6 +1,7 @@
 #pragma once
 
 #include "LoopbackCaptureBase.h"
+#include "CaptureScheduler.h"
 
 #include <AudioClient.h>
 #include <mmdeviceapi.h>
@@ -17,21 +18,24 @@ using namespace ATL;
 
 using namespace Microsoft::WRL;
 
+/**
+* Process loopback capture engine: activates the loopback audio client, drains its packets into the recording and the
+* render path, and finalizes the recording. The ICaptureScheduler selected with setCaptureScheduling decides when the
+* packets are drained; everything else is the same for every scheduler.
+*/
 class CLoopbackCapture :
-    public RuntimeClass< RuntimeClassFlags< ClassicCom >, FtmBase, IActivateAudioInterfaceCompletionHandler >, public LoopbackCaptureBase
+    public RuntimeClass< RuntimeClassFlags< ClassicCom >, FtmBase, IActivateAudioInterfaceCompletionHandler >, public LoopbackCaptureBase,
+    private ICaptureDrain
 {
 public:
     CLoopbackCapture() = default;
     ~CLoopbackCapture();
 
-    HRESULT StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName);
-    HRESULT StopCaptureAsync();
+    // Must be called before the capture starts. WorkQueue by default.
+    void setCaptureScheduling(CaptureScheduling scheduling) { m_Scheduling = scheduling; }
 
-    METHODASYNCCALLBACK(CLoopbackCapture, StartCapture, OnStartCapture);
-    METHODASYNCCALLBACK(CLoopbackCapture, StopCapture, OnStopCapture);
-    // Creates an instance of CallbackSampleReady class, called m_xSampleReady
-    METHODASYNCCALLBACK(CLoopbackCapture, SampleReady, OnSampleReady);
-    METHODASYNCCALLBACK(CLoopbackCapture, FinishCapture, OnFinishCapture);
+    HRESULT StartCapture(DWORD processId, bool includeProcessTree, PCWSTR outputFileName);
+    HRESULT StopCapture();
 
     // IActivateAudioInterfaceCompletionHandler
     STDMETHOD(ActivateCompleted)(IActivateAudioInterfaceAsyncOperation* operation);
@@ -50,32 +54,25 @@ private:
         Stopped,
     };
 
-    HRESULT OnStartCapture(IMFAsyncResult* pResult);
-    HRESULT OnStopCapture(IMFAsyncResult* pResult);
-    HRESULT OnFinishCapture(IMFAsyncResult* pResult);
-    HRESULT OnSampleReady(IMFAsyncResult* pResult);
+    // ICaptureDrain
+    HRESULT DrainPackets(PacketArrivalPredictor* pPredictor) override;
 
     HRESULT InitializeLoopbackCapture();
     HRESULT CreateWAVFile();
     HRESULT FixWAVHeader();
-    HRESULT OnAudioSampleRequested();
 
     HRESULT ActivateAudioInterface(DWORD processId, bool includeProcessTree);
-    HRESULT FinishCaptureAsync();
 
     HRESULT SetDeviceStateErrorIfFailed(HRESULT hr);
 
-    IAudioClient2* m_AudioClient2;
+    CaptureScheduling m_Scheduling = CaptureScheduling::WorkQueue;
+    std::unique_ptr<ICaptureScheduler> m_Scheduler;
+    bool m_bMFStarted = false;
+
+    IAudioClient2* m_AudioClient2 = nullptr;
     UINT32 m_BufferFrames = 0;
-    wil::com_ptr_nothrow<IMFAsyncResult> m_SampleReadyAsyncResult;
 
-    wil::unique_event_nothrow m_SampleReadyEvent;
-    MFWORKITEM_KEY m_SampleReadyKey = 0;
-    wil::unique_hfile m_hFile;
     wil::critical_section m_CritSec;
-    DWORD m_dwQueueID = 0;
-    DWORD m_cbHeaderSize = 0;
-    DWORD m_cbDataSize = 0;
 
     // These two members are used to communicate between the main thread
     // and the ActivateCompleted callback.
@@ -84,9 +81,7 @@ private:
 
     DeviceState m_DeviceState{ DeviceState::Uninitialized };
     wil::unique_event_nothrow m_hActivateCompleted;
-    wil::unique_event_nothrow m_hCaptureStopped;
 
-    bool m_bAudioStreamStarted = false;
     UINT64 m_u64QPCPositionPrev = 0;
     IAudioClock* m_pAudioClock = NULL;
 };
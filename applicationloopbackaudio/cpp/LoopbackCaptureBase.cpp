@@ -1,5 +1,11 @@
 #include "LoopbackCaptureBase.h"
+#include "AudioClientRenderTarget.h"
+#include "LogRing.h"
+#include "PipelineCounters.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 
 LoopbackCaptureBase::LoopbackCaptureBase()
@@ -25,6 +31,408 @@ LoopbackCaptureBase::LoopbackCaptureBase()
     //m_CaptureFormat.cbSize = 0;
 }
 
+void LoopbackCaptureBase::setCaptureSource(std::unique_ptr<ICaptureSource> source)
+{
+    m_CaptureSource = std::move(source);
+    if (m_CaptureSource != nullptr)
+    {
+        m_CaptureFormat = m_CaptureSource->GetFormat();
+    }
+}
+
+/**
+* Initializes the resampler selected by m_ResamplerEngine. The native resampler falls back to Media Foundation when
+* the conversion uses a sample format or channel count it does not handle. Formats with the same sample rate need no
+* resampler at all: they are converted directly, through the channel remix if the channel layouts differ. With drift
+* compensation on, the render path switches them to the adjustable native resampler through StartAdjusting once it has
+* measured a drift, so the resampler only adds its delay when there is a drift to compensate.
+*
+* The sample format conversions are picked here, once, as converters specialized for the negotiated formats and
+* channel count, so the per-packet path does not look at the formats again.
+*/
+HRESULT LoopbackCaptureBase::initializeResampler(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex)
+{
+    m_ConvertFrames = nullptr;
+    m_ChannelRemix = ChannelRemix();
+    m_bDriftDeferred = false;
+    if (m_bDriftCompensation && m_ResamplerEngine != ResamplerEngine::Native)
+    {
+        std::cout << "Clock drift compensation needs the native resampler. Disabled." << std::endl;
+    }
+
+    bool bCompensateDrift = m_bDriftCompensation && m_ResamplerEngine == ResamplerEngine::Native;
+    if (inputFmt->nSamplesPerSec == outputFmtex->Format.nSamplesPerSec)
+    {
+        if (inputFmt->nChannels == outputFmtex->Format.nChannels)
+        {
+            m_ConvertFrames = GetFrameConverter(GetSampleFormat(*inputFmt), GetSampleFormat(outputFmtex->Format), inputFmt->nChannels);
+            if (m_ConvertFrames != nullptr)
+            {
+                std::cout << "Only the sample format differs. Converting samples without resampling." << std::endl;
+                m_bDriftDeferred = bCompensateDrift;
+                return S_OK;
+            }
+        }
+        else if (SUCCEEDED(initializeChannelRemix(inputFmt, outputFmtex, GetSampleFormat(*inputFmt))))
+        {
+            std::cout << "Only the channel layout and sample format differ. Remixing without resampling." << std::endl;
+            m_bDriftDeferred = bCompensateDrift;
+            return S_OK;
+        }
+    }
+
+    if (m_ResamplerEngine == ResamplerEngine::Native)
+    {
+        HRESULT hr = initializeNativeResampler(inputFmt, outputFmtex);
+        if (SUCCEEDED(hr))
+        {
+            std::cout << "Using the native polyphase resampler" << std::endl;
+            return hr;
+        }
+        std::cout << "The native resampler does not support this conversion. Initializing Media Foundation resampler." << std::endl;
+    }
+    return initializeMFTResampler(inputFmt, outputFmtex);
+}
+
+/**
+* Initializes the built-in polyphase resampler and its float staging buffers
+*/
+HRESULT LoopbackCaptureBase::initializeNativeResampler(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex)
+{
+    m_ConvertToFloat = GetFrameConverter(GetSampleFormat(*inputFmt), SampleFormat::Float32, inputFmt->nChannels);
+    if (m_ConvertToFloat == nullptr)
+    {
+        return E_NOTIMPL;
+    }
+
+    // The resampler runs at the capture channel count. The remix, if any, converts its output to the output format.
+    if (inputFmt->nChannels != outputFmtex->Format.nChannels)
+    {
+        m_ConvertFromFloat = nullptr;
+        if (FAILED(initializeChannelRemix(inputFmt, outputFmtex, SampleFormat::Float32)))
+        {
+            return E_NOTIMPL;
+        }
+    }
+    else
+    {
+        m_ConvertFromFloat = GetFrameConverter(SampleFormat::Float32, GetSampleFormat(outputFmtex->Format), inputFmt->nChannels);
+        if (m_ConvertFromFloat == nullptr)
+        {
+            return E_NOTIMPL;
+        }
+    }
+
+    HRESULT hr = m_NativeResampler.Initialize(inputFmt->nSamplesPerSec, outputFmtex->Format.nSamplesPerSec, inputFmt->nChannels, m_ResamplerQuality,
+        ResamplerKernel::Auto, m_bDriftCompensation);
+    if (FAILED(hr))
+    {
+        m_ChannelRemix = ChannelRemix();
+        return hr;
+    }
+
+    if (m_NativeResampler.IsAdjustable())
+    {
+        std::cout << "Compensating the clock drift between the capture and output endpoints" << std::endl;
+    }
+    return S_OK;
+}
+
+/**
+* Initializes the channel remix with the user matrix if one of the right size was set, or with the standard matrix of
+* the two channel masks. A capture format without a mask is taken to use the default layout of its channel count.
+*/
+HRESULT LoopbackCaptureBase::initializeChannelRemix(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex, SampleFormat srcFormat)
+{
+    const WAVEFORMATEX& outputFormat = outputFmtex->Format;
+    const float* matrix = nullptr;
+    if (!m_ChannelMixMatrix.empty())
+    {
+        if (m_ChannelMixMatrix.size() == (size_t)inputFmt->nChannels * outputFormat.nChannels)
+        {
+            matrix = m_ChannelMixMatrix.data();
+        }
+        else
+        {
+            std::cout << "The channel mix matrix needs " << inputFmt->nChannels * outputFormat.nChannels << " gains. Using the standard matrix." << std::endl;
+        }
+    }
+
+    HRESULT hr = m_ChannelRemix.Initialize(srcFormat, inputFmt->nChannels, ChannelRemix::GetChannelMask(*inputFmt), GetSampleFormat(outputFormat),
+        outputFormat.nChannels, ChannelRemix::GetChannelMask(outputFormat), matrix);
+    if (SUCCEEDED(hr))
+    {
+        std::cout << "Remixing " << inputFmt->nChannels << " channels to " << outputFormat.nChannels << " channels" << std::endl;
+    }
+    return hr;
+}
+
+/**
+* Preallocates the buffers resampleAudioStream uses, so processing a packet of up to maxPacketFrames frames does not
+* allocate. Called once the device period is known and again, exceptionally, if a larger packet shows up.
+*/
+HRESULT LoopbackCaptureBase::allocateResamplerBuffers(UINT32 maxPacketFrames)
+{
+    HRESULT hr = S_OK;
+
+    if (m_NativeResampler.IsInitialized())
+    {
+        // The output count depends on the resampler phase and rate scale, so size for the worst case
+        UINT32 maxOutputFrames = m_NativeResampler.GetMaxOutputFrames(maxPacketFrames);
+        m_ResamplerInput.resize((size_t)maxPacketFrames * m_CaptureFormat.nChannels);
+        m_ResamplerOutput.resize((size_t)maxOutputFrames * m_CaptureFormat.nChannels);
+    }
+    else if (m_ResamplerTransform != nullptr)
+    {
+        DWORD cbCapacity = maxPacketFrames * m_CaptureFormat.nBlockAlign;
+        for (int i = 0; i < ResamplerInputPoolSize; i++)
+        {
+            m_ResamplerInputSamples[i].Release();
+            m_ResamplerInputBuffers[i].Release();
+            RETURN_IF_FAILED(MFCreateMemoryBuffer(cbCapacity, &m_ResamplerInputBuffers[i]));
+            RETURN_IF_FAILED(MFCreateSample(&m_ResamplerInputSamples[i]));
+            RETURN_IF_FAILED(m_ResamplerInputSamples[i]->AddBuffer(m_ResamplerInputBuffers[i]));
+        }
+        m_cbResamplerInputCapacity = cbCapacity;
+        m_NextResamplerInput = 0;
+
+        if (m_ResamplerOutputSample == nullptr)
+        {
+            m_ResamplerOutputBuffer = Microsoft::WRL::Make<CWrappedMediaBuffer>();
+            RETURN_HR_IF_NULL(E_OUTOFMEMORY, m_ResamplerOutputBuffer.Get());
+            RETURN_IF_FAILED(MFCreateSample(&m_ResamplerOutputSample));
+            RETURN_IF_FAILED(m_ResamplerOutputSample->AddBuffer(m_ResamplerOutputBuffer.Get()));
+        }
+    }
+
+    return hr;
+}
+
+/**
+* Sets up the render path: a ring sized for m_RenderBufferMs of output audio, and the pump thread that drains it into
+* the output endpoint. Does nothing when no output endpoint was configured.
+*/
+HRESULT LoopbackCaptureBase::startRenderPump(UINT32 maxPacketFrames)
+{
+    if (m_RenderTarget == nullptr && m_OutputAudioClient != nullptr && m_OutputRenderClient != nullptr)
+    {
+        m_RenderTarget = std::make_unique<AudioClientRenderTarget>(m_OutputAudioClient, m_OutputRenderClient);
+    }
+    if (m_RenderTarget == nullptr || m_pOutputFormat == nullptr)
+    {
+        return S_OK;
+    }
+
+    // Wake up twice per 10 ms engine period, and start the endpoint once two periods are buffered
+    RenderPathOptions options;
+    options.bufferMs = m_RenderBufferMs;
+    options.wakeIntervalMs = 5;
+    options.prefillMs = 20;
+    options.latencyPolicy = m_LatencyPolicy;
+    RETURN_IF_FAILED(m_RenderPath.Start(m_RenderTarget.get(), this, m_CaptureFormat, m_pOutputFormat->Format, maxPacketFrames, options));
+    std::cout << "Render ring: " << m_RenderPath.GetRingStats().capacityFrames << " frames" << std::endl;
+    return S_OK;
+}
+
+void LoopbackCaptureBase::stopRenderPump()
+{
+    if (!m_RenderPath.IsStarted())
+    {
+        return;
+    }
+
+    HRESULT hr = m_RenderPath.Stop();
+    if (FAILED(hr))
+    {
+        _com_error err(hr);
+        std::wcout << L"Render pump stopped: " << err.ErrorMessage() << std::endl;
+    }
+
+    SpscFrameRingStats ringStats = m_RenderPath.GetRingStats();
+    RenderPumpStats pumpStats = m_RenderPath.GetPumpStats();
+    std::cout << "Render ring: high water " << ringStats.highWaterFrames << "/" << ringStats.capacityFrames << " frames, "
+        << ringStats.overrunFrames << " frames dropped, " << pumpStats.starvedWakeups << " starved wakeups" << std::endl;
+    if (m_RenderPath.HasJitterBuffer())
+    {
+        const JitterBufferStats& jitterStats = m_RenderPath.GetJitterStats();
+        std::cout << "Jitter buffer: " << jitterStats.latePackets << " late packets (oldest " << jitterStats.maxPacketAgeUs << "us), "
+            << jitterStats.catchUps << " catch-ups, " << jitterStats.framesDropped << " frames cut in " << jitterStats.slicesDropped << " slices, "
+            << jitterStats.framesSaved << " frames saved stretching " << jitterStats.framesStretched << " frames" << std::endl;
+    }
+    const DriftEstimator& driftEstimator = m_RenderPath.GetDriftEstimator();
+    if (driftEstimator.IsLocked())
+    {
+        std::cout << "Clock drift: " << driftEstimator.GetDriftPpm() << " ppm, render level " << driftEstimator.GetFilteredLevel()
+            << "/" << driftEstimator.GetTargetFrames() << " frames" << std::endl;
+    }
+}
+
+HRESULT LoopbackCaptureBase::startFileSink(PCWSTR fileName)
+{
+    return m_FileSink.Start(fileName, m_CaptureFormat, m_FileSinkOptions);
+}
+
+HRESULT LoopbackCaptureBase::stopFileSink()
+{
+    HRESULT hr = m_FileSink.Stop();
+
+    WavFileSinkStats stats = m_FileSink.GetStats();
+    std::cout << "File writer: " << stats.bytesWritten << " bytes in " << stats.writes << " writes, slowest write "
+        << stats.maxWriteHns / 10 << "us, high water " << stats.highWaterFrames << "/" << stats.capacityFrames << " frames, "
+        << stats.droppedFrames << " frames dropped, " << stats.headerCommits << " header commits, " << stats.flushes
+        << " flushes (slowest " << stats.maxFlushHns / 10 << "us)" << std::endl;
+
+    return hr;
+}
+
+/**
+* Wraps m_CaptureSource so the capture loops trace every packet they read, with the writer thread doing the disk I/O
+*/
+HRESULT LoopbackCaptureBase::startPacketTrace()
+{
+    if (m_PacketTraceFile.empty() || m_CaptureSource == nullptr)
+    {
+        return S_OK;
+    }
+
+    RETURN_IF_FAILED(m_PacketTrace.Start(m_PacketTraceFile, m_CaptureFormat));
+    m_CaptureSource = std::make_unique<TracingCaptureSource>(std::move(m_CaptureSource), &m_PacketTrace);
+    std::wcout << L"Tracing the captured packets to " << m_PacketTraceFile.wstring() << std::endl;
+    return S_OK;
+}
+
+HRESULT LoopbackCaptureBase::stopPacketTrace()
+{
+    if (!m_PacketTrace.IsRunning())
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = m_PacketTrace.Stop();
+
+    PacketTraceStats stats = m_PacketTrace.GetStats();
+    std::cout << "Packet trace: " << stats.packets << " packets, " << stats.bytesWritten << " bytes, "
+        << stats.droppedPackets << " packets dropped" << std::endl;
+
+    return hr;
+}
+
+/**
+* Producer side of the render ring. Called by the capture loops for every captured packet.
+*/
+void LoopbackCaptureBase::renderCapturedFrames(BYTE* data, UINT32 framesAvailable, UINT64 packetAgeUs)
+{
+    if (!m_RenderPath.IsStarted())
+    {
+        return;
+    }
+
+    m_LatencyHistograms.renderQueueFrames.Record(m_RenderPath.GetRingStats().fillFrames);
+    m_ConvertHns = 0;
+    INT64 nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    m_RenderPath.WritePacket(data, framesAvailable, packetAgeUs, nowNs);
+    m_LatencyHistograms.resampleHns.Record(m_ConvertHns);
+}
+
+//
+//  Reset()
+//
+//  Starts the resampler from a clean state (if needed) before the first packet of the render stream
+//
+void LoopbackCaptureBase::Reset()
+{
+    if (m_NativeResampler.IsInitialized())
+    {
+        m_NativeResampler.Reset();
+    }
+    else if (m_ResamplerTransform != nullptr)
+    {
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL);
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL);
+        m_ResamplerTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL);
+    }
+}
+
+UINT32 LoopbackCaptureBase::GetMaxConvertedFrames(UINT32 frames)
+{
+    if (m_NativeResampler.IsInitialized())
+    {
+        return m_NativeResampler.GetMaxOutputFrames(frames);
+    }
+    if (m_bDriftDeferred)
+    {
+        // What the adjustable resampler StartAdjusting brings in can write
+        return (UINT32)std::ceil(frames / (1.0 - PolyphaseResampler::MaxRateScalePpm * 1e-6)) + 2;
+    }
+    return (UINT32)((UINT64)frames * m_pOutputFormat->Format.nSamplesPerSec / m_CaptureFormat.nSamplesPerSec) + 2;
+}
+
+UINT32 LoopbackCaptureBase::Convert(BYTE* src, UINT32 frames, BYTE* dst, UINT32 maxFrames)
+{
+    UINT32 framesWritten = 0;
+    UINT64 startHns = GetQpcTimeHns();
+    resampleAudioStream(src, dst, frames, maxFrames, framesWritten);
+    m_ConvertHns += GetQpcTimeHns() - startHns;
+    return framesWritten;
+}
+
+//
+//  StartAdjusting()
+//
+//  Replaces the direct conversion with the adjustable native resampler, between two packets on the capture thread.
+//  Keeps the direct conversion if the resampler cannot be initialized.
+//
+bool LoopbackCaptureBase::StartAdjusting()
+{
+    if (!m_bDriftDeferred)
+    {
+        return false;
+    }
+    m_bDriftDeferred = false;
+
+    ChannelRemix directRemix = std::move(m_ChannelRemix);
+    m_ChannelRemix = ChannelRemix();
+    if (FAILED(initializeNativeResampler(&m_CaptureFormat, m_pOutputFormat)))
+    {
+        m_ChannelRemix = std::move(directRemix);
+        return false;
+    }
+
+    m_ConvertFrames = nullptr;
+    // The resampler grows its buffers on its first packet: that is not steady state
+    m_bCaptureWarmedUp = false;
+    return true;
+}
+
+CaptureLatencySnapshot LoopbackCaptureBase::getLatencySnapshot() const
+{
+    CaptureLatencySnapshot snapshot;
+    snapshot.callbackHns = m_LatencyHistograms.callbackHns.GetSnapshot();
+    snapshot.packetAgeUs = m_LatencyHistograms.packetAgeUs.GetSnapshot();
+    snapshot.resampleHns = m_LatencyHistograms.resampleHns.GetSnapshot();
+    snapshot.renderQueueFrames = m_LatencyHistograms.renderQueueFrames.GetSnapshot();
+    return snapshot;
+}
+
+void LoopbackCaptureBase::printLatencySnapshot() const
+{
+    CaptureLatencySnapshot snapshot = getLatencySnapshot();
+    auto print = [](const char* name, const LatencyHistogramSnapshot& histogram, double scale, const char* unit)
+    {
+        std::cout << name << ": p50 " << histogram.p50 * scale << unit << ", p99 " << histogram.p99 * scale << unit << ", p99.9 "
+            << histogram.p999 * scale << unit << ", max " << histogram.max * scale << unit << " (" << histogram.count << " samples)" << std::endl;
+    };
+    print("Capture callback", snapshot.callbackHns, 0.1, "us");
+    print("Packet age", snapshot.packetAgeUs, 1.0, "us");
+    print("Resampling", snapshot.resampleHns, 0.1, "us");
+    print("Render queue", snapshot.renderQueueFrames, 1.0, " frames");
+    UINT64 timestampErrors = PipelineCounters::Get(PipelineCounter::TimestampErrors);
+    if (timestampErrors > 0)
+    {
+        std::cout << "Timestamp errors: " << timestampErrors << std::endl;
+    }
+}
+
 /**
 * Initializes a Media Foundation audio resampler
 * Taken from https://sourceforge.net/p/playpcmwin/wiki/HowToUseResamplerMFT/
@@ -90,19 +498,81 @@ Exit:
 	return hr;
 }
 
+UINT32 LoopbackCaptureBase::getMaxOutputFrames(UINT32 framesAvailable)
+{
+    if (m_NativeResampler.IsInitialized())
+    {
+        // The native resampler knows exactly how many frames the next packet produces
+        return m_NativeResampler.GetOutputFrames(framesAvailable);
+    }
+    if (m_ResamplerTransform != nullptr)
+    {
+        float samplingRatio = (float)m_pOutputFormat->Format.nSamplesPerSec / (float)m_CaptureFormat.nSamplesPerSec;
+        return (UINT32)(framesAvailable * samplingRatio) + 1;
+    }
+    return framesAvailable;
+}
+
 void LoopbackCaptureBase::resampleAudioStream(BYTE* src, BYTE* dst, UINT32 framesAvailable, UINT32 clientFramesAvailable, UINT32& framesWritten)
 {
     BYTE  *data = src; //< input PCM data 
     DWORD bytes = framesAvailable * m_CaptureFormat.nBlockAlign; //< bytes need to be smaller than approx. 1Mbytes
     HRESULT hr = S_OK;
 
-	if (m_ResamplerTransform != nullptr)
+    if (m_ConvertFrames != nullptr)
+    {
+        m_ConvertFrames(src, dst, framesAvailable);
+        framesWritten = framesAvailable;
+    }
+    else if (m_NativeResampler.IsInitialized())
+    {
+        UINT32 channels = m_CaptureFormat.nChannels;
+        if (m_ResamplerInput.size() < (size_t)framesAvailable * channels ||
+            m_ResamplerOutput.size() < (size_t)m_NativeResampler.GetMaxOutputFrames(framesAvailable) * channels)
+        {
+            hr = allocateResamplerBuffers(framesAvailable);
+            if (FAILED(hr))
+            {
+                LOOPBACK_LOG(LogLevel::Error, 1000, "Could not grow the resampler buffers to {} frames: {:x}", framesAvailable, (UINT32)hr);
+                framesWritten = 0;
+                return;
+            }
+        }
+
+        m_ConvertToFloat(src, reinterpret_cast<BYTE*>(m_ResamplerInput.data()), framesAvailable);
+        framesWritten = m_NativeResampler.Process(m_ResamplerInput.data(), framesAvailable, m_ResamplerOutput.data());
+        if (m_ChannelRemix.IsInitialized())
+        {
+            m_ChannelRemix.Process(reinterpret_cast<const BYTE*>(m_ResamplerOutput.data()), dst, framesWritten);
+        }
+        else
+        {
+            m_ConvertFromFloat(reinterpret_cast<const BYTE*>(m_ResamplerOutput.data()), dst, framesWritten);
+        }
+    }
+    else if (m_ChannelRemix.IsInitialized())
+    {
+        m_ChannelRemix.Process(src, dst, framesAvailable);
+        framesWritten = framesAvailable;
+    }
+	else if (m_ResamplerTransform != nullptr)
 	{
-		MFT_OUTPUT_STREAM_INFO outputStreamInfo;
-		m_ResamplerTransform->GetOutputStreamInfo(0, &outputStreamInfo);
+		// Packets larger than the pool were sized for are rare (the pool covers the whole endpoint buffer)
+		if (bytes > m_cbResamplerInputCapacity)
+		{
+			hr = allocateResamplerBuffers(framesAvailable);
+			if (FAILED(hr))
+			{
+				LOOPBACK_LOG(LogLevel::Error, 1000, "Could not grow the resampler buffers to {} frames: {:x}", framesAvailable, (UINT32)hr);
+				framesWritten = 0;
+				return;
+			}
+		}
 
-		CComPtr<IMFMediaBuffer> pBuffer = NULL;
-		hr = MFCreateMemoryBuffer(bytes , &pBuffer);
+		// Copy the packet into the next pooled input sample
+		int index = m_NextResamplerInput;
+		m_NextResamplerInput = (m_NextResamplerInput + 1) % ResamplerInputPoolSize;
+		IMFMediaBuffer* pBuffer = m_ResamplerInputBuffers[index];
 
 		BYTE  *pByteBufferTo = NULL;
 		hr = pBuffer->Lock(&pByteBufferTo, NULL, NULL);
@@ -112,26 +582,16 @@ void LoopbackCaptureBase::resampleAudioStream(BYTE* src, BYTE* dst, UINT32 frame
 
 		hr = pBuffer->SetCurrentLength(bytes);
 
-		IMFSample *pSample = NULL;
-		hr = MFCreateSample(&pSample);
-		hr = pSample->AddBuffer(pBuffer);
+		hr = m_ResamplerTransform->ProcessInput(0, m_ResamplerInputSamples[index], 0);
 
-		hr = m_ResamplerTransform->ProcessInput(0, pSample, 0);
+		// Let the transform write straight into the render client's buffer
+		m_ResamplerOutputBuffer->SetTarget(dst, getMaxOutputFrames(framesAvailable) * m_pOutputFormat->Format.nBlockAlign);
 
-		// Allocate a buffer to receive output from media transform
 		MFT_OUTPUT_DATA_BUFFER outputDataBuffer;
 		outputDataBuffer.dwStreamID = 0;
 		outputDataBuffer.dwStatus = 0;
 		outputDataBuffer.pEvents = NULL;
-
-		CComPtr<IMFSample> pOutSample = NULL;
-		hr = MFCreateSample(&pOutSample);
-		DWORD OutputMediaBufferCapacity = m_pOutputFormat->Format.nAvgBytesPerSec;
-		CComPtr<IMFMediaBuffer> outSampleBuffer = NULL;
-		MFCreateMemoryBuffer(OutputMediaBufferCapacity, &outSampleBuffer);
-		outSampleBuffer->SetCurrentLength(0);
-		pOutSample->AddBuffer(outSampleBuffer);
-		outputDataBuffer.pSample = pOutSample;
+		outputDataBuffer.pSample = m_ResamplerOutputSample;
 		DWORD dwStatus;
 		hr = m_ResamplerTransform->ProcessOutput(0, 1, &outputDataBuffer, &dwStatus);
 		//if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT) {
@@ -140,11 +600,7 @@ void LoopbackCaptureBase::resampleAudioStream(BYTE* src, BYTE* dst, UINT32 frame
 		//}
 
 		DWORD cbBytes = 0;
-		BYTE  *pByteBuffer = NULL;
-		hr = outSampleBuffer->GetCurrentLength(&cbBytes);
-		outSampleBuffer->Lock(&pByteBuffer, NULL, NULL);
-		memcpy(dst, pByteBuffer, cbBytes);
-		outSampleBuffer->Unlock();
+		hr = m_ResamplerOutputBuffer->GetCurrentLength(&cbBytes);
 
 		framesWritten = cbBytes / m_pOutputFormat->Format.nBlockAlign;
     }
@@ -154,88 +610,4 @@ void LoopbackCaptureBase::resampleAudioStream(BYTE* src, BYTE* dst, UINT32 frame
         memcpy(dst, src, bytes);
         framesWritten = framesAvailable;
     }
-	//// If MFT is not available, use linear interpolation
-	//else if (m_pOutputFormat != nullptr)
-	//{
-	//	// Resample the audio stream to the desired output format
-	//	if (m_pOutputFormat->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)
-	//	{
-	//		if (m_pOutputFormat->Format.wBitsPerSample == 32)
-	//		{
-
-	//			// TODO: DEBUGGING! DELETE TIMING CODE!
-	//			LARGE_INTEGER frequency, startTime, endTime;
-	//			QueryPerformanceFrequency(&frequency);
-	//			QueryPerformanceCounter(&startTime);
-	//			// Convert from 16-bit PCM to 32-bit float. No sample rate change!
-	//			//for (int i = 0; i < framesAvailable; i++)
-	//			//{
-	//			//	int16_t* srcPtr = (int16_t*)(src + i * m_CaptureFormat.nBlockAlign);
-	//			//	float* dstPtr = (float*)(dst + i * m_pOutputFormat->Format.nBlockAlign);
-
-	//			//	for (auto channel = 0; channel < m_CaptureFormat.nChannels; channel++)
-	//			//	{
-	//			//		*dstPtr = (float)(*srcPtr / 32768.0f);
-	//			//		dstPtr++;
-	//			//		srcPtr++;
-	//			//	}
-	//			//}
-	//			// Perform linear interpolation if needed
-	//			float sampleRatio = (float)m_pOutputFormat->Format.nSamplesPerSec / (float)m_CaptureFormat.nSamplesPerSec; // Ratio between the two sample rates
-	//			auto srcSamples = framesAvailable * m_CaptureFormat.nChannels; // Number of bytes in the input buffer
-	//			int dstFrames = (int)(framesAvailable * sampleRatio); // Number of frames in the output buffer
-	//			framesWritten = dstFrames;
-	//			int dstSamples = dstFrames * m_pOutputFormat->Format.nChannels; // Number of bytes in the output buffer
-
-	//			for (auto i = 0; i < dstSamples; i++)
-	//			{
-	//				if (i >= clientFramesAvailable)
-	//				{
-	//					// Avoid overwriting buffer
-	//					break;
-	//				}
-	//				float realPos = i / sampleRatio;
-	//				int iLow = (int)realPos;
-	//				int iHigh = iLow + 1;
-	//				float remainder = realPos - (float)iLow;
-
-	//				float lowval = 0;
-	//				float highval = 0;
-	//				if ((iLow >= 0) && (iLow < srcSamples))
-	//				{
-	//					lowval = ((int16_t*)src)[iLow] / 32768.0f;
-	//				}
-	//				if ((iHigh >= 0) && (iHigh < srcSamples))
-	//				{
-	//					highval = ((int16_t*)src)[iHigh] / 32768.0f;
-	//				}
-
-	//				((float*)dst)[i] = (highval * remainder) + (lowval * (1 - remainder));
-	//			}
-
-
-	//			QueryPerformanceCounter(&endTime);
-	//			LONGLONG elapsedTime = ((endTime.QuadPart - startTime.QuadPart) * 1000000) / frequency.QuadPart;
-	//			std::cout << "Execution took " << elapsedTime << "us" << std::endl;
-	//			// END TIMING BLOCK
-
-
-	//		}
-	//		else if (m_pOutputFormat->Format.wBitsPerSample == 64)
-	//		{
-	//			// Convert from 16-bit PCM to 64-bit float
-	//			for (int i = 0; i < framesAvailable; i++)
-	//			{
-	//				int16_t* srcPtr = (int16_t*)(src + i * m_CaptureFormat.nBlockAlign);
-	//				double* dstPtr = (double*)(dst + i * m_pOutputFormat->Format.nBlockAlign);
-	//				for (auto channel = 0; channel < m_CaptureFormat.nChannels; channel++)
-	//				{
-	//					*dstPtr = (double)(*srcPtr / 32768.0f);
-	//					dstPtr++;
-	//					srcPtr++;
-	//				}
-	//			}
-	//		}
-	//	}
-	//}
 }
\ No newline at end of file
@@ -14,6 +14,18 @@ using namespace ATL;
 #include <comdef.h>
 
 #include "Common.h"
+#include "CaptureSource.h"
+#include "ChannelRemix.h"
+#include "LatencyHistogram.h"
+#include "PacketTrace.h"
+#include "PolyphaseResampler.h"
+#include "SampleConvert.h"
+#include "WrappedMediaBuffer.h"
+#include "RenderPath.h"
+#include "WavFileSink.h"
+
+#include <memory>
+#include <vector>
 
 #define EXIT_ON_ERROR(hres) \
 if (FAILED(hres)) \
@@ -26,26 +38,110 @@ if (FAILED(hres)) \
 #define BITS_PER_BYTE 8
 
 /**
-* Base class for LoopbackCaptureSync and LoopbackCaptureAsync classes
+* Implementation used by resampleAudioStream when the capture and output formats differ
+*/
+enum class ResamplerEngine
+{
+    // Built-in polyphase resampler. Falls back to Media Foundation for conversions it does not support.
+    Native,
+    // Media Foundation CResamplerMediaObject
+    MediaFoundation,
+};
+
+/**
+* Base class of CLoopbackCapture
 * 
 * Defines common methods and attributes. This class holds the necessary state and methods to resample the captured samples into a sample format compatible with an output client, defined externally.
+* It is the converter of its RenderPath.
 */
-class LoopbackCaptureBase
+class LoopbackCaptureBase : private IRenderConverter
 {
 public:
+    // Getters
+    const WAVEFORMATEX& getCaptureFormat() const { return m_CaptureFormat; }
+
     // Setters
     void setAudioRenderClient(IAudioRenderClient* rc) { m_OutputRenderClient = rc; }
     void setAudioClient(IAudioClient* ac) { m_OutputAudioClient = ac; }
     void setOutputFormat(WAVEFORMATEXTENSIBLE* wf) { m_pOutputFormat = wf; }
     void setResamplerTransform(IMFTransform* transform) { m_ResamplerTransform = transform; }
+    void setResamplerEngine(ResamplerEngine engine) { m_ResamplerEngine = engine; }
+    void setResamplerQuality(ResamplerQuality quality) { m_ResamplerQuality = quality; }
+    // Mix matrix used when the capture and output channel counts differ: one row of capture channel gains per output
+    // channel. An empty matrix, or one of the wrong size, selects the standard matrix of the two channel masks.
+    void setChannelMixMatrix(const std::vector<float>& matrix) { m_ChannelMixMatrix = matrix; }
+    // Keeps the render path at a constant fill level by resampling slightly off the nominal ratio, following the drift
+    // between the capture and output clocks. On by default; needs the native resampler. Formats with the same sample
+    // rate are converted directly until a drift is measured.
+    void setDriftCompensation(bool enabled) { m_bDriftCompensation = enabled; }
+    // Latency bounds of the render path, held by the drift compensation and the jitter buffer. Must be called before
+    // the capture starts.
+    void setLatencyPolicy(const LatencyPolicy& policy) { m_LatencyPolicy = policy; }
+    // Replaces the live loopback capture client as the source of captured packets. Must be called before the capture starts.
+    // The capture format becomes the format of the source.
+    void setCaptureSource(std::unique_ptr<ICaptureSource> source);
+    // Replaces the output endpoint set with setAudioClient/setAudioRenderClient. Must be called before the capture starts.
+    void setRenderTarget(std::unique_ptr<IRenderTarget> target) { m_RenderTarget = std::move(target); }
+    // Capacity of the ring between the capture thread and the render pump, in milliseconds of output audio
+    void setRenderBufferMs(UINT32 ms) { m_RenderBufferMs = ms; }
+    // Tuning of the file sink, including how it writes the file. Must be called before the capture starts.
+    void setFileSinkOptions(const WavFileSinkOptions& options) { m_FileSinkOptions = options; }
+    // Records the timing of every captured packet to a packet trace, replayable with PacketTraceCaptureSource. Must be
+    // called before the capture starts.
+    void setPacketTraceFile(const std::filesystem::path& fileName) { m_PacketTraceFile = fileName; }
 
+    // Initializes the resampler selected by m_ResamplerEngine
+    HRESULT initializeResampler(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex);
     HRESULT initializeMFTResampler(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex);
+    HRESULT initializeNativeResampler(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex);
+    // Initializes m_ChannelRemix from the capture channel layout to the output one, reading srcFormat samples
+    HRESULT initializeChannelRemix(WAVEFORMATEX* inputFmt, WAVEFORMATEXTENSIBLE* outputFmtex, SampleFormat srcFormat);
     // Takes an audio framebuffer and outputs a resampled framebuffer, resampled to the format specified by m_pOutputFormat
     void resampleAudioStream(BYTE* src, BYTE* dst, UINT32 framesAvailable, UINT32 clientFramesAvailable, UINT32& framesWritten);
+    // Upper bound of the frames resampleAudioStream will write for framesAvailable captured frames
+    UINT32 getMaxOutputFrames(UINT32 framesAvailable);
+    // Preallocates every buffer resampleAudioStream needs for packets of up to maxPacketFrames frames
+    HRESULT allocateResamplerBuffers(UINT32 maxPacketFrames);
+    // Heap allocations made by the capture thread while draining packets, after the first wakeup that read packets.
+    // Always 0 unless LOOPBACK_COUNT_ALLOCATIONS is defined.
+    UINT64 getSteadyStateAllocations() const { return m_SteadyStateAllocations; }
+
+    // Starts the render path for packets of up to maxPacketFrames captured frames
+    HRESULT startRenderPump(UINT32 maxPacketFrames);
+    // Stops the render path and the output endpoint, and prints its counters
+    void stopRenderPump();
+    // Resamples a captured packet into the render ring. Never blocks: frames that do not fit in the ring are dropped.
+    // packetAgeUs is the time since the first frame of the packet was captured, 0 if unknown.
+    void renderCapturedFrames(BYTE* data, UINT32 framesAvailable, UINT64 packetAgeUs);
+    SpscFrameRingStats getRenderRingStats() const { return m_RenderPath.GetRingStats(); }
+    // Percentiles of the latency histograms so far. Can be called from any thread while capturing.
+    CaptureLatencySnapshot getLatencySnapshot() const;
+    // Prints getLatencySnapshot
+    void printLatencySnapshot() const;
+
+    // Creates the output file and starts the writer thread recording the captured packets to it
+    HRESULT startFileSink(PCWSTR fileName);
+    // Flushes the pending packets, finalizes the file and prints the writer counters
+    HRESULT stopFileSink();
+
+    // Starts tracing the packets of m_CaptureSource if a packet trace file was set
+    HRESULT startPacketTrace();
+    // Writes the pending packets of the trace, closes it and prints its counters
+    HRESULT stopPacketTrace();
 
     // This constructor sets the values for m_CaptureFormat
     LoopbackCaptureBase();
 
+private:
+    // IRenderConverter
+    void Reset() override;
+    UINT32 GetMaxConvertedFrames(UINT32 frames) override;
+    UINT32 Convert(BYTE* src, UINT32 frames, BYTE* dst, UINT32 maxFrames) override;
+    bool IsAdjustable() const override { return m_NativeResampler.IsAdjustable(); }
+    void SetInputRateScale(double scale) override { m_NativeResampler.SetInputRateScale(scale); }
+    bool CanStartAdjusting() const override { return m_bDriftDeferred; }
+    bool StartAdjusting() override;
+
 protected:
     // Output stream to an output endpoint
     IAudioClient* m_OutputAudioClient = NULL;
@@ -53,10 +149,60 @@ protected:
     IAudioRenderClient* m_OutputRenderClient = nullptr;
     // Media Foundations transform for resampling captured samples to a format compatible with the output client (m_pOutputFormat)
     CComPtr<IMFTransform> m_ResamplerTransform = NULL;
+    ResamplerEngine m_ResamplerEngine = ResamplerEngine::Native;
+    ResamplerQuality m_ResamplerQuality = ResamplerQuality::Best;
+    // Converts the captured frames straight to the output format when the rates and channels match
+    FrameConvertFn m_ConvertFrames = nullptr;
+    // Built-in resampler, used instead of m_ResamplerTransform when it is initialized
+    PolyphaseResampler m_NativeResampler;
+    // Float staging buffers of the native resampler, and the conversions to and from them
+    std::vector<float> m_ResamplerInput;
+    std::vector<float> m_ResamplerOutput;
+    FrameConvertFn m_ConvertToFloat = nullptr;
+    FrameConvertFn m_ConvertFromFloat = nullptr;
+    // Converts the capture channel layout to the output one: on its own when the rates match, or after the native
+    // resampler in place of m_ConvertFromFloat
+    ChannelRemix m_ChannelRemix;
+    std::vector<float> m_ChannelMixMatrix;
+    // Makes m_NativeResampler adjustable, so the render path can steer its input rate scale from the render level
+    bool m_bDriftCompensation = true;
+    // Drift compensation is on, but the formats are converted directly until the render path measures a drift
+    bool m_bDriftDeferred = false;
+    // Latency bounds the render path holds
+    LatencyPolicy m_LatencyPolicy;
+    // Input samples handed to m_ResamplerTransform, used round robin so a sample the transform still holds is not overwritten
+    static const int ResamplerInputPoolSize = 4;
+    CComPtr<IMFSample> m_ResamplerInputSamples[ResamplerInputPoolSize];
+    CComPtr<IMFMediaBuffer> m_ResamplerInputBuffers[ResamplerInputPoolSize];
+    DWORD m_cbResamplerInputCapacity = 0;
+    int m_NextResamplerInput = 0;
+    // Output sample of m_ResamplerTransform. Its buffer points straight into the render client's buffer.
+    CComPtr<IMFSample> m_ResamplerOutputSample;
+    Microsoft::WRL::ComPtr<CWrappedMediaBuffer> m_ResamplerOutputBuffer;
+    // Steady state starts after the first wakeup that read packets, and again after the converter changes
+    bool m_bCaptureWarmedUp = false;
+    UINT64 m_SteadyStateAllocations = 0;
     // Sample format compatible with the output client
     WAVEFORMATEXTENSIBLE* m_pOutputFormat = NULL;
     // Sample format of the captured samples
     WAVEFORMATEX m_CaptureFormat {};
     wil::com_ptr_nothrow<IAudioClient> m_AudioClient;
     wil::com_ptr_nothrow<IAudioCaptureClient> m_AudioCaptureClient;
+    // Source the capture loops drain packets from. Wraps m_AudioCaptureClient unless a source was set with setCaptureSource.
+    std::unique_ptr<ICaptureSource> m_CaptureSource;
+    // Endpoint the render pump plays back to. Wraps m_OutputAudioClient unless a target was set with setRenderTarget.
+    std::unique_ptr<IRenderTarget> m_RenderTarget;
+    // Ring, pump, drift compensation and jitter buffer between the capture thread and the output endpoint
+    RenderPath m_RenderPath;
+    UINT32 m_RenderBufferMs = 200;
+    // Time spent converting the packet being rendered, in 100-nanosecond units
+    UINT64 m_ConvertHns = 0;
+    // Always on. Recorded by the capture thread, with no console output on it.
+    CaptureLatencyHistograms m_LatencyHistograms;
+    // Records the captured packets, in the capture format, from its own thread
+    WavFileSink m_FileSink;
+    WavFileSinkOptions m_FileSinkOptions;
+    // Records the packet timing, from its own thread
+    std::filesystem::path m_PacketTraceFile;
+    PacketTraceWriter m_PacketTrace;
 };
\ No newline at end of file
@@ -0,0 +1,346 @@
+#include "MappedOutputFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// errno wrapped the same way HRESULT_FROM_WIN32 wraps a Win32 error code
+static HRESULT HResultFromErrno(int error)
+{
+    return (HRESULT)(0x80070000 | (error & 0xFFFF));
+}
+#endif
+
+MappedOutputFile::MappedOutputFile(UINT32 extentBytes)
+{
+    // Extents are mapped at multiples of their size, so keep them a multiple of the header view (and of the
+    // allocation granularity)
+    m_ExtentBytes = std::max<UINT32>(extentBytes / HeaderViewBytes, 1) * HeaderViewBytes;
+}
+
+MappedOutputFile::~MappedOutputFile()
+{
+    Close();
+}
+
+//
+//  Create()
+//
+//  Creates the file, preallocates the first extent and maps the header view
+//
+HRESULT MappedOutputFile::Create(const std::filesystem::path& fileName)
+{
+    Close();
+
+#ifdef _WIN32
+    // Mapping a view for writing needs read access too
+    m_hFile = CreateFileW(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    m_fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+
+    m_cbAllocated = 0;
+    m_Position = 0;
+
+    HRESULT hr = MapExtent(0);
+    if (SUCCEEDED(hr))
+    {
+        hr = MapView(0, HeaderViewBytes, &m_pHeaderView);
+    }
+    if (FAILED(hr))
+    {
+        Close();
+    }
+    return hr;
+}
+
+bool MappedOutputFile::IsOpen() const
+{
+#ifdef _WIN32
+    return m_hFile != INVALID_HANDLE_VALUE;
+#else
+    return m_fd >= 0;
+#endif
+}
+
+//
+//  Close()
+//
+//  Unmaps the views and trims the preallocated tail of the last extent
+//
+HRESULT MappedOutputFile::Close()
+{
+    if (!IsOpen())
+    {
+        return S_OK;
+    }
+
+    UnmapView(m_pHeaderView, HeaderViewBytes);
+    m_pHeaderView = nullptr;
+    UnmapView(m_pExtentView, m_ExtentBytes);
+    m_pExtentView = nullptr;
+
+    HRESULT hr = S_OK;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)m_Position;
+    if (!SetFilePointerEx(m_hFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if (ftruncate(m_fd, (off_t)m_Position) != 0)
+    {
+        hr = HResultFromErrno(errno);
+    }
+    close(m_fd);
+    m_fd = -1;
+#endif
+
+    m_cbAllocated = 0;
+    return hr;
+}
+
+HRESULT MappedOutputFile::Write(const void* data, size_t bytes)
+{
+    const BYTE* src = static_cast<const BYTE*>(data);
+    while (bytes > 0)
+    {
+        size_t cbAvailable = 0;
+        BYTE* dst = GetAppendBuffer(&cbAvailable);
+        if (dst == nullptr)
+        {
+            return E_FAIL;
+        }
+
+        size_t cbCopy = std::min(bytes, cbAvailable);
+        memcpy(dst, src, cbCopy);
+        CommitAppend(cbCopy);
+
+        src += cbCopy;
+        bytes -= cbCopy;
+    }
+    return S_OK;
+}
+
+HRESULT MappedOutputFile::WriteAt(UINT64 offset, const void* data, size_t bytes)
+{
+    if (!IsOpen())
+    {
+        return E_UNEXPECTED;
+    }
+
+    // The header is patched in place through its persistent view
+    if (offset + bytes <= HeaderViewBytes)
+    {
+        memcpy(m_pHeaderView + offset, data, bytes);
+        return S_OK;
+    }
+    if (m_pExtentView != nullptr && offset >= m_ExtentOffset && offset + bytes <= m_ExtentOffset + m_ExtentBytes)
+    {
+        memcpy(m_pExtentView + (offset - m_ExtentOffset), data, bytes);
+        return S_OK;
+    }
+
+    // Anywhere else, fall back to a positional write. Both systems keep it coherent with the mapped views.
+    if (offset + bytes > m_cbAllocated)
+    {
+        return E_INVALIDARG;
+    }
+#ifdef _WIN32
+    OVERLAPPED overlapped {};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD cbWritten = 0;
+    if (!WriteFile(m_hFile, data, (DWORD)bytes, &cbWritten, &overlapped) || cbWritten != bytes)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    if (pwrite(m_fd, data, bytes, (off_t)offset) != (ssize_t)bytes)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+    return S_OK;
+}
+
+HRESULT MappedOutputFile::Flush()
+{
+    if (!IsOpen())
+    {
+        return E_UNEXPECTED;
+    }
+
+    HRESULT hr = FlushView(m_pHeaderView, HeaderViewBytes);
+    if (SUCCEEDED(hr) && m_pExtentView != nullptr)
+    {
+        hr = FlushView(m_pExtentView, m_ExtentBytes);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Flushing the views writes the pages; the file size and allocation still need the file itself flushed
+#ifdef _WIN32
+    if (!FlushFileBuffers(m_hFile))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    if (fdatasync(m_fd) != 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+    return S_OK;
+}
+
+BYTE* MappedOutputFile::GetAppendBuffer(size_t* pcbAvailable)
+{
+    *pcbAvailable = 0;
+    if (!IsOpen() || FAILED(MapExtent(m_Position)))
+    {
+        return nullptr;
+    }
+
+    UINT64 offsetInExtent = m_Position - m_ExtentOffset;
+    *pcbAvailable = (size_t)(m_ExtentBytes - offsetInExtent);
+    return m_pExtentView + offsetInExtent;
+}
+
+HRESULT MappedOutputFile::CommitAppend(size_t bytes)
+{
+    if (m_pExtentView == nullptr || m_Position + bytes > m_ExtentOffset + m_ExtentBytes)
+    {
+        return E_INVALIDARG;
+    }
+    m_Position += bytes;
+    return S_OK;
+}
+
+//
+//  MapExtent()
+//
+//  Makes the extent containing offset the mapped one, preallocating it first if the file is not that large yet
+//
+HRESULT MappedOutputFile::MapExtent(UINT64 offset)
+{
+    UINT64 extentOffset = offset - offset % m_ExtentBytes;
+    if (m_pExtentView != nullptr && m_ExtentOffset == extentOffset)
+    {
+        return S_OK;
+    }
+
+    UnmapView(m_pExtentView, m_ExtentBytes);
+    m_pExtentView = nullptr;
+
+    UINT64 cbRequired = extentOffset + m_ExtentBytes;
+    if (cbRequired > m_cbAllocated)
+    {
+#ifdef _WIN32
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)cbRequired;
+        if (!SetFilePointerEx(m_hFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+#else
+        int error = ENOSYS;
+#ifdef __linux__
+        // Reserve real blocks so a full disk fails here instead of as a SIGBUS on a mapped page
+        error = posix_fallocate(m_fd, (off_t)m_cbAllocated, (off_t)(cbRequired - m_cbAllocated));
+#endif
+        if (error != 0 && ftruncate(m_fd, (off_t)cbRequired) != 0)
+        {
+            return HResultFromErrno(errno);
+        }
+#endif
+        m_cbAllocated = cbRequired;
+    }
+
+    HRESULT hr = MapView(extentOffset, m_ExtentBytes, &m_pExtentView);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    m_ExtentOffset = extentOffset;
+
+#ifndef _WIN32
+    madvise(m_pExtentView, m_ExtentBytes, MADV_SEQUENTIAL);
+#endif
+    return S_OK;
+}
+
+HRESULT MappedOutputFile::MapView(UINT64 offset, size_t bytes, BYTE** ppView)
+{
+    *ppView = nullptr;
+#ifdef _WIN32
+    // The mapping object only has to live until the view is mapped; the view keeps the section alive
+    HANDLE hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READWRITE, (DWORD)(m_cbAllocated >> 32), (DWORD)m_cbAllocated, NULL);
+    if (hMapping == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    void* pView = MapViewOfFile(hMapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, bytes);
+    DWORD dwError = GetLastError();
+    CloseHandle(hMapping);
+    if (pView == NULL)
+    {
+        return HRESULT_FROM_WIN32(dwError);
+    }
+#else
+    void* pView = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, (off_t)offset);
+    if (pView == MAP_FAILED)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+    *ppView = static_cast<BYTE*>(pView);
+    return S_OK;
+}
+
+void MappedOutputFile::UnmapView(BYTE* pView, size_t bytes)
+{
+    if (pView == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(pView);
+#else
+    munmap(pView, bytes);
+#endif
+}
+
+HRESULT MappedOutputFile::FlushView(BYTE* pView, size_t bytes)
+{
+#ifdef _WIN32
+    if (!FlushViewOfFile(pView, bytes))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    if (msync(pView, bytes, MS_SYNC) != 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+    return S_OK;
+}
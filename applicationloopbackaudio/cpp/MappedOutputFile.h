@@ -0,0 +1,61 @@
+#pragma once
+
+#include "OutputFile.h"
+
+/**
+* Memory-mapped output file.
+*
+* The file grows in preallocated extents of extentBytes; the extent being appended to is mapped, so appended data is
+* a memcpy into the page cache (or, with GetAppendBuffer, the producer's only copy) instead of one write call per
+* batch. The first HeaderViewBytes stay mapped for the whole recording so WriteAt patches the header in place. Close
+* trims the last extent back to the bytes actually written.
+*
+* Uses file mappings (CreateFileMapping / MapViewOfFile) on Windows and mmap elsewhere.
+*/
+class MappedOutputFile : public IOutputFile
+{
+public:
+    static const UINT32 DefaultExtentBytes = 64 * 1024 * 1024;
+    // Multiple of the Windows allocation granularity, so mapped offsets are always valid
+    static const UINT32 HeaderViewBytes = 64 * 1024;
+
+    explicit MappedOutputFile(UINT32 extentBytes = DefaultExtentBytes);
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+    ~MappedOutputFile();
+
+    HRESULT Create(const std::filesystem::path& fileName) override;
+    bool IsOpen() const override;
+    HRESULT Close() override;
+
+    HRESULT Write(const void* data, size_t bytes) override;
+    HRESULT WriteAt(UINT64 offset, const void* data, size_t bytes) override;
+    // Flushes the mapped views, then the file (FlushViewOfFile + FlushFileBuffers / msync)
+    HRESULT Flush() override;
+
+    UINT64 GetPosition() const override { return m_Position; }
+
+    BYTE* GetAppendBuffer(size_t* pcbAvailable) override;
+    HRESULT CommitAppend(size_t bytes) override;
+
+private:
+    // Maps the extent that contains offset, growing the file if needed
+    HRESULT MapExtent(UINT64 offset);
+    HRESULT MapView(UINT64 offset, size_t bytes, BYTE** ppView);
+    void UnmapView(BYTE* pView, size_t bytes);
+    HRESULT FlushView(BYTE* pView, size_t bytes);
+
+    UINT32 m_ExtentBytes;
+#ifdef _WIN32
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+#else
+    int m_fd = -1;
+#endif
+    // Size the file has been grown to, a multiple of m_ExtentBytes
+    UINT64 m_cbAllocated = 0;
+    UINT64 m_Position = 0;
+
+    BYTE* m_pHeaderView = nullptr;
+    BYTE* m_pExtentView = nullptr;
+    UINT64 m_ExtentOffset = 0;
+};
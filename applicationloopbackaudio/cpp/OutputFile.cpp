@@ -0,0 +1,219 @@
+#include "OutputFile.h"
+
+#include "MappedOutputFile.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// errno wrapped the same way HRESULT_FROM_WIN32 wraps a Win32 error code
+static HRESULT HResultFromErrno(int error)
+{
+    return (HRESULT)(0x80070000 | (error & 0xFFFF));
+}
+#endif
+
+OutputFile::~OutputFile()
+{
+    Close();
+}
+
+HRESULT OutputFile::Create(const std::filesystem::path& fileName)
+{
+    Close();
+
+#ifdef _WIN32
+    m_hFile = CreateFileW(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    m_fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+
+    m_Position = 0;
+    return S_OK;
+}
+
+HRESULT OutputFile::Open(const std::filesystem::path& fileName)
+{
+    Close();
+
+#ifdef _WIN32
+    m_hFile = CreateFileW(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_hFile, &size))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+    m_Position = (UINT64)size.QuadPart;
+#else
+    m_fd = open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return HResultFromErrno(errno);
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        HRESULT hr = HResultFromErrno(errno);
+        Close();
+        return hr;
+    }
+    m_Position = (UINT64)st.st_size;
+#endif
+
+    return S_OK;
+}
+
+bool OutputFile::IsOpen() const
+{
+#ifdef _WIN32
+    return m_hFile != INVALID_HANDLE_VALUE;
+#else
+    return m_fd >= 0;
+#endif
+}
+
+HRESULT OutputFile::Close()
+{
+#ifdef _WIN32
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    return S_OK;
+}
+
+HRESULT OutputFile::SetSize(UINT64 size)
+{
+    if (!IsOpen())
+    {
+        return E_UNEXPECTED;
+    }
+
+#ifdef _WIN32
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(m_hFile, offset, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    if (ftruncate(m_fd, (off_t)size) != 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+
+    m_Position = size;
+    return S_OK;
+}
+
+HRESULT OutputFile::Write(const void* data, size_t bytes)
+{
+    HRESULT hr = WriteAt(m_Position, data, bytes);
+    if (SUCCEEDED(hr))
+    {
+        m_Position += bytes;
+    }
+    return hr;
+}
+
+HRESULT OutputFile::WriteAt(UINT64 offset, const void* data, size_t bytes)
+{
+    if (!IsOpen())
+    {
+        return E_UNEXPECTED;
+    }
+
+    const BYTE* src = static_cast<const BYTE*>(data);
+    while (bytes > 0)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped {};
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD cbToWrite = (DWORD)std::min<size_t>(bytes, 0x40000000);
+        DWORD cbWritten = 0;
+        if (!WriteFile(m_hFile, src, cbToWrite, &cbWritten, &overlapped))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+#else
+        ssize_t cbWritten = pwrite(m_fd, src, bytes, (off_t)offset);
+        if (cbWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return HResultFromErrno(errno);
+        }
+#endif
+        if (cbWritten == 0)
+        {
+            return E_FAIL;
+        }
+        src += cbWritten;
+        offset += cbWritten;
+        bytes -= cbWritten;
+    }
+
+    return S_OK;
+}
+
+HRESULT OutputFile::Flush()
+{
+    if (!IsOpen())
+    {
+        return E_UNEXPECTED;
+    }
+
+#ifdef _WIN32
+    if (!FlushFileBuffers(m_hFile))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    if (fdatasync(m_fd) != 0)
+    {
+        return HResultFromErrno(errno);
+    }
+#endif
+    return S_OK;
+}
+
+std::unique_ptr<IOutputFile> CreateOutputFile(OutputFileMode mode)
+{
+    if (mode == OutputFileMode::Mapped)
+    {
+        return std::make_unique<MappedOutputFile>();
+    }
+    return std::make_unique<OutputFile>();
+}
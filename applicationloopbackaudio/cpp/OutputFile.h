@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <filesystem>
+#include <memory>
+
+/**
+* How the recording sinks write their files
+*/
+enum class OutputFileMode
+{
+    // Positional WriteFile / pwrite calls through the page cache
+    Buffered,
+    // Preallocated extents mapped into memory, see MappedOutputFile
+    Mapped,
+};
+
+/**
+* File written by the recording sinks: sequential appends plus in-place patches of the header.
+*/
+class IOutputFile
+{
+public:
+    virtual ~IOutputFile() = default;
+
+    // Creates the file, or truncates it if it already exists
+    virtual HRESULT Create(const std::filesystem::path& fileName) = 0;
+    virtual bool IsOpen() const = 0;
+    // Closes the file. Its size becomes GetPosition().
+    virtual HRESULT Close() = 0;
+
+    // Appends bytes at the current end of the file
+    virtual HRESULT Write(const void* data, size_t bytes) = 0;
+    // Writes bytes at offset without moving the append position
+    virtual HRESULT WriteAt(UINT64 offset, const void* data, size_t bytes) = 0;
+    // Waits until the data written so far reaches the disk
+    virtual HRESULT Flush() = 0;
+
+    // Offset the next Write appends at
+    virtual UINT64 GetPosition() const = 0;
+
+    // Memory the next appended bytes can be written to directly, or nullptr if the file has no such memory.
+    // The bytes become part of the file with CommitAppend.
+    virtual BYTE* GetAppendBuffer(size_t* pcbAvailable)
+    {
+        *pcbAvailable = 0;
+        return nullptr;
+    }
+    virtual HRESULT CommitAppend(size_t /*bytes*/)
+    {
+        return E_NOTIMPL;
+    }
+};
+
+/**
+* Buffered output file.
+*
+* Every write is positional (WriteFile with an OVERLAPPED offset on Windows, pwrite elsewhere), so patching the header
+* with WriteAt never disturbs the append position used by Write.
+*/
+class OutputFile : public IOutputFile
+{
+public:
+    OutputFile() = default;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile();
+
+    HRESULT Create(const std::filesystem::path& fileName) override;
+    // Opens an existing file for writing. Appends continue at its current end.
+    HRESULT Open(const std::filesystem::path& fileName);
+    bool IsOpen() const override;
+    HRESULT Close() override;
+
+    // Truncates or extends the file to size bytes and moves the append position there
+    HRESULT SetSize(UINT64 size);
+
+    HRESULT Write(const void* data, size_t bytes) override;
+    HRESULT WriteAt(UINT64 offset, const void* data, size_t bytes) override;
+    // FlushFileBuffers / fdatasync
+    HRESULT Flush() override;
+
+    UINT64 GetPosition() const override { return m_Position; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+#else
+    int m_fd = -1;
+#endif
+    UINT64 m_Position = 0;
+};
+
+// Returns an OutputFile or a MappedOutputFile, as selected by mode
+std::unique_ptr<IOutputFile> CreateOutputFile(OutputFileMode mode);
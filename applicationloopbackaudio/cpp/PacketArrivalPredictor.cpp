@@ -0,0 +1,120 @@
+#include "PacketArrivalPredictor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Shortest wait after an empty wakeup. Keeps the retries from spinning on short device periods.
+static const UINT64 MinRetryHns = 2500;
+
+HRESULT PacketArrivalPredictor::Initialize(UINT32 sampleRate, UINT64 periodHns)
+{
+    if (sampleRate == 0 || periodHns == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_SampleRate = sampleRate;
+    m_PeriodHns = periodHns;
+    m_RetryHns = std::max(periodHns / 16, MinRetryHns);
+    m_ProbeHns = periodHns / 8;
+    Reset();
+    return S_OK;
+}
+
+void PacketArrivalPredictor::Reset()
+{
+    m_bHasNextPosition = false;
+    m_NextPositionHns = 0;
+    m_bLastWakeupEmpty = false;
+    m_bHasPendingLowerBound = false;
+    m_PendingLowerBoundHns = 0;
+    m_Samples = 0;
+    m_NextSample = 0;
+    m_bHasLowerBound = false;
+    m_MinDelayHns = 0;
+    m_MaxDelayHns = 0;
+}
+
+//
+//  OnPacket()
+//
+//  The packet was readable when the wakeup started, which bounds its delay from above. The empty wakeups since the
+//  previous packet bound it from below, unless the packet is not the one they waited for, e.g. after a discontinuity.
+//
+void PacketArrivalPredictor::OnPacket(UINT64 positionHns, UINT32 frames, UINT64 wakeHns)
+{
+    INT64 offsetHns = (INT64)(positionHns - m_NextPositionHns);
+    bool bExpected = m_bHasNextPosition && std::abs(offsetHns) <= (INT64)(m_PeriodHns / 2);
+
+    m_UpperBoundsHns[m_NextSample] = (INT64)(wakeHns - positionHns);
+    m_bHasLowerBounds[m_NextSample] = bExpected && m_bHasPendingLowerBound;
+    m_LowerBoundsHns[m_NextSample] = m_PendingLowerBoundHns - offsetHns;
+    m_NextSample = (m_NextSample + 1) % HistoryPackets;
+    m_Samples = std::min(m_Samples + 1, HistoryPackets);
+
+    m_bHasNextPosition = true;
+    m_NextPositionHns = positionHns + (UINT64)frames * HNS_PER_SEC / m_SampleRate;
+    m_bLastWakeupEmpty = false;
+    m_bHasPendingLowerBound = false;
+    UpdateBounds();
+}
+
+void PacketArrivalPredictor::OnEmptyWakeup(UINT64 wakeHns)
+{
+    m_bLastWakeupEmpty = true;
+    if (m_bHasNextPosition)
+    {
+        INT64 lowerBoundHns = (INT64)(wakeHns - m_NextPositionHns);
+        m_PendingLowerBoundHns = m_bHasPendingLowerBound ? std::max(m_PendingLowerBoundHns, lowerBoundHns) : lowerBoundHns;
+        m_bHasPendingLowerBound = true;
+    }
+}
+
+void PacketArrivalPredictor::UpdateBounds()
+{
+    m_MaxDelayHns = m_UpperBoundsHns[(m_NextSample + HistoryPackets - 1) % HistoryPackets];
+    m_bHasLowerBound = false;
+    for (UINT32 i = 0; i < m_Samples; i++)
+    {
+        m_MaxDelayHns = std::min(m_MaxDelayHns, m_UpperBoundsHns[i]);
+        if (m_bHasLowerBounds[i])
+        {
+            m_MinDelayHns = m_bHasLowerBound ? std::max(m_MinDelayHns, m_LowerBoundsHns[i]) : m_LowerBoundsHns[i];
+            m_bHasLowerBound = true;
+        }
+    }
+
+    // Bounds that cross come from a delay that changed within the history: probe down from the upper bound again
+    if (m_bHasLowerBound && m_MinDelayHns >= m_MaxDelayHns)
+    {
+        m_bHasLowerBound = false;
+    }
+}
+
+//
+//  GetNextWakeHns()
+//
+//  Aims three quarters of the way up the bracket of the delay, or a probe step below its upper bound while the lower
+//  bound is unknown. Until the first packet, and when the prediction is lost, wakes up every half device period.
+//
+UINT64 PacketArrivalPredictor::GetNextWakeHns(UINT64 nowHns) const
+{
+    UINT64 latestHns = nowHns + m_PeriodHns;
+    if (!m_bHasNextPosition)
+    {
+        return nowHns + m_PeriodHns / 2;
+    }
+
+    INT64 delayHns = m_bHasLowerBound
+        ? m_MinDelayHns + (m_MaxDelayHns - m_MinDelayHns) * 3 / 4
+        : m_MaxDelayHns - (INT64)m_ProbeHns;
+    INT64 wakeHns = (INT64)m_NextPositionHns + delayHns;
+
+    // Right after an empty wakeup, give the packet some time
+    UINT64 earliestHns = m_bLastWakeupEmpty ? nowHns + m_RetryHns : nowHns;
+    if (wakeHns <= (INT64)earliestHns)
+    {
+        return earliestHns;
+    }
+    return std::min((UINT64)wakeHns, latestHns);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Predicts when the next captured packet can be read, so a polling capture loop can sleep until then instead of
+* waking up every millisecond to find nothing.
+*
+* A packet becomes readable a roughly constant delay after its QPC position, once the audio engine has processed the
+* period it belongs to. Every wakeup that reads a packet bounds that delay from above (the packet was there when the
+* wakeup started), and every wakeup that finds nothing bounds it from below for the packet expected next. The bounds
+* of the last HistoryPackets packets bracket the delay; the next wakeup is aimed near the top of the bracket, so it
+* usually finds the packet, while the wakeups that come too early keep the bracket tight and follow its changes.
+* The QPC position of the next packet is the position of the last one plus its duration.
+*
+* Times are QPC times in 100-nanosecond units, as GetQpcTimeHns and IAudioCaptureClient::GetBuffer return them.
+* Packets with a timestamp error must not be passed to OnPacket.
+*/
+class PacketArrivalPredictor
+{
+public:
+    // Packets the bounds of the delay are kept for
+    static constexpr UINT32 HistoryPackets = 32;
+
+    // periodHns is the device period: the interval of the wakeups until the first packet, and the longest wait
+    HRESULT Initialize(UINT32 sampleRate, UINT64 periodHns);
+    bool IsInitialized() const { return m_SampleRate != 0; }
+
+    // Forgets the packets seen so far, e.g. when the stream restarts
+    void Reset();
+
+    // A packet read by the wakeup that started at wakeHns. Packets read by the same wakeup are passed in order.
+    void OnPacket(UINT64 positionHns, UINT32 frames, UINT64 wakeHns);
+    // The wakeup that started at wakeHns found no packet
+    void OnEmptyWakeup(UINT64 wakeHns);
+
+    // Time the next wakeup is due, never before nowHns nor more than a device period after it
+    UINT64 GetNextWakeHns(UINT64 nowHns) const;
+
+    // Bracket of the delay between the QPC position of a packet and the time it can be read, once a packet was seen.
+    // The lower bound is only known once a wakeup came too early.
+    bool HasLowerBound() const { return m_bHasLowerBound; }
+    INT64 GetMinDelayHns() const { return m_MinDelayHns; }
+    INT64 GetMaxDelayHns() const { return m_MaxDelayHns; }
+
+private:
+    void UpdateBounds();
+
+    UINT32 m_SampleRate = 0;
+    UINT64 m_PeriodHns = 0;
+    // Wait after a wakeup that found nothing, and how far below the upper bound the wakeups probe without a lower one
+    UINT64 m_RetryHns = 0;
+    UINT64 m_ProbeHns = 0;
+
+    // Expected QPC position of the next packet, once a packet was seen
+    bool m_bHasNextPosition = false;
+    UINT64 m_NextPositionHns = 0;
+    // The last wakeup found nothing, and the lower bound the empty wakeups set for the next packet so far
+    bool m_bLastWakeupEmpty = false;
+    bool m_bHasPendingLowerBound = false;
+    INT64 m_PendingLowerBoundHns = 0;
+
+    // Bounds of the delay of the last HistoryPackets packets, oldest first from m_NextSample once full
+    INT64 m_UpperBoundsHns[HistoryPackets] {};
+    INT64 m_LowerBoundsHns[HistoryPackets] {};
+    bool m_bHasLowerBounds[HistoryPackets] {};
+    UINT32 m_Samples = 0;
+    UINT32 m_NextSample = 0;
+
+    bool m_bHasLowerBound = false;
+    INT64 m_MinDelayHns = 0;
+    INT64 m_MaxDelayHns = 0;
+};
@@ -0,0 +1,366 @@
+#include "PacketTrace.h"
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+// How often the writer thread moves the traced packets to the file
+static const UINT32 TraceWriteIntervalMs = 100;
+// Records written per write call
+static const UINT32 TraceBatchRecords = 1024;
+
+PacketTraceWriter::~PacketTraceWriter()
+{
+    Stop();
+}
+
+//
+//  Start()
+//
+//  Creates the file, writes its header and starts the writer thread
+//
+HRESULT PacketTraceWriter::Start(const std::filesystem::path& fileName, const WAVEFORMATEX& format, UINT32 bufferPackets)
+{
+    if (m_Thread.joinable() || format.nBlockAlign == 0 || bufferPackets == 0 ||
+        (format.wFormatTag != WAVE_FORMAT_PCM && format.wFormatTag != WAVE_FORMAT_IEEE_FLOAT))
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_File.Create(fileName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    PacketTraceHeader header;
+    header.formatTag = format.wFormatTag;
+    header.channels = format.nChannels;
+    header.samplesPerSec = format.nSamplesPerSec;
+    header.blockAlign = format.nBlockAlign;
+    header.bitsPerSample = format.wBitsPerSample;
+    hr = m_File.Write(&header, sizeof(header));
+    if (SUCCEEDED(hr))
+    {
+        hr = m_Ring.Initialize(sizeof(PacketTraceRecord), bufferPackets, 0);
+    }
+    if (FAILED(hr))
+    {
+        m_File.Close();
+        return hr;
+    }
+
+    m_Batch.assign((size_t)TraceBatchRecords * sizeof(PacketTraceRecord), 0);
+    m_hrWrite = S_OK;
+    m_bStopRequested = false;
+    m_Packets.store(0, std::memory_order_relaxed);
+    m_BytesWritten.store(sizeof(header), std::memory_order_relaxed);
+
+    m_bRunning.store(true, std::memory_order_release);
+    m_Thread = std::thread(&PacketTraceWriter::ThreadProc, this);
+    return S_OK;
+}
+
+HRESULT PacketTraceWriter::Stop()
+{
+    if (!m_Thread.joinable())
+    {
+        return S_OK;
+    }
+
+    m_bRunning.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bStopRequested = true;
+    }
+    m_StopRequested.notify_one();
+    m_Thread.join();
+
+    HRESULT hr = m_File.Close();
+    return FAILED(m_hrWrite) ? m_hrWrite : hr;
+}
+
+void PacketTraceWriter::Append(const PacketTraceRecord& record)
+{
+    if (IsRunning())
+    {
+        m_Ring.Write(reinterpret_cast<const BYTE*>(&record), 1);
+        m_Packets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+PacketTraceStats PacketTraceWriter::GetStats() const
+{
+    PacketTraceStats stats;
+    stats.packets = m_Packets.load(std::memory_order_relaxed);
+    stats.droppedPackets = m_Ring.GetStats().overrunFrames;
+    stats.bytesWritten = m_BytesWritten.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void PacketTraceWriter::ThreadProc()
+{
+    LOOPBACK_TRACE_THREAD("Packet trace writer");
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_StopRequested.wait_for(lock, std::chrono::milliseconds(TraceWriteIntervalMs), [this] { return m_bStopRequested; }))
+    {
+        lock.unlock();
+        HRESULT hr = Drain();
+        lock.lock();
+
+        if (FAILED(hr))
+        {
+            // Keep draining the ring so the capture side sees a consumer, but stop writing
+            m_hrWrite = hr;
+        }
+    }
+    lock.unlock();
+
+    HRESULT hr = Drain();
+    if (SUCCEEDED(m_hrWrite))
+    {
+        m_hrWrite = hr;
+    }
+}
+
+HRESULT PacketTraceWriter::Drain()
+{
+    UINT32 records = 0;
+    while ((records = m_Ring.Read(m_Batch.data(), TraceBatchRecords)) > 0)
+    {
+        if (FAILED(m_hrWrite))
+        {
+            continue;
+        }
+        LOOPBACK_TRACE_SPAN("Write packet trace");
+        size_t cbWrite = (size_t)records * sizeof(PacketTraceRecord);
+        HRESULT hr = m_File.Write(m_Batch.data(), cbWrite);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_BytesWritten.fetch_add(cbWrite, std::memory_order_relaxed);
+    }
+    return S_OK;
+}
+
+HRESULT TracingCaptureSource::GetNextPacketSize(UINT32* pNumFramesInNextPacket)
+{
+    if (!m_bInWakeup)
+    {
+        m_WakeHns = GetQpcTimeHns();
+        m_bInWakeup = true;
+    }
+
+    HRESULT hr = m_Source->GetNextPacketSize(pNumFramesInNextPacket);
+    if (FAILED(hr) || *pNumFramesInNextPacket == 0)
+    {
+        // The loop goes back to waiting
+        m_bInWakeup = false;
+    }
+    return hr;
+}
+
+HRESULT TracingCaptureSource::GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition)
+{
+    PacketTraceRecord record;
+    HRESULT hr = m_Source->GetBuffer(ppData, pNumFramesToRead, pdwFlags, &record.devicePosition, &record.qpcPosition);
+    if (FAILED(hr) || hr == AUDCLNT_S_BUFFER_EMPTY)
+    {
+        return hr;
+    }
+
+    if (pu64DevicePosition != nullptr)
+    {
+        *pu64DevicePosition = record.devicePosition;
+    }
+    if (pu64QPCPosition != nullptr)
+    {
+        *pu64QPCPosition = record.qpcPosition;
+    }
+
+    record.wakeHns = m_bInWakeup ? m_WakeHns : GetQpcTimeHns();
+    record.frames = *pNumFramesToRead;
+    record.flags = *pdwFlags;
+    m_Writer->Append(record);
+    return hr;
+}
+
+//
+//  Open()
+//
+//  Reads the whole trace. The records of a trace that was cut short are read up to the last complete one.
+//
+HRESULT PacketTraceCaptureSource::Open(const std::filesystem::path& fileName, bool realTime)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+    {
+        return E_INVALIDARG;
+    }
+
+    PacketTraceHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != PacketTraceHeader::Magic ||
+        header.version != PacketTraceHeader::CurrentVersion || header.headerBytes < sizeof(header) ||
+        header.recordBytes != sizeof(PacketTraceRecord) || header.blockAlign == 0 || header.channels == 0 ||
+        (header.formatTag != WAVE_FORMAT_PCM && header.formatTag != WAVE_FORMAT_IEEE_FLOAT))
+    {
+        return E_INVALIDARG;
+    }
+
+    file.seekg(0, std::ios::end);
+    UINT64 cbFileSize = (UINT64)file.tellg();
+    UINT64 recordCount = (cbFileSize - std::min<UINT64>(cbFileSize, header.headerBytes)) / sizeof(PacketTraceRecord);
+    m_Records.resize((size_t)recordCount);
+    file.seekg((std::streamoff)header.headerBytes);
+    if (recordCount > 0 && !file.read(reinterpret_cast<char*>(m_Records.data()), (std::streamsize)(recordCount * sizeof(PacketTraceRecord))))
+    {
+        return E_FAIL;
+    }
+
+    m_Format = {};
+    m_Format.wFormatTag = header.formatTag;
+    m_Format.nChannels = header.channels;
+    m_Format.nSamplesPerSec = header.samplesPerSec;
+    m_Format.nBlockAlign = header.blockAlign;
+    m_Format.wBitsPerSample = header.bitsPerSample;
+    m_Format.nAvgBytesPerSec = m_Format.nSamplesPerSec * m_Format.nBlockAlign;
+
+    UINT32 maxFrames = 0;
+    for (const PacketTraceRecord& record : m_Records)
+    {
+        maxFrames = std::max(maxFrames, record.frames);
+    }
+    m_PacketBuffer.assign((size_t)maxFrames * m_Format.nBlockAlign, 0);
+
+    m_bRealTime = realTime;
+    m_NextRecord = 0;
+    m_TonePosition = 0;
+    m_bInWakeup = false;
+    m_StartHns = 0;
+    m_bBufferHeld = false;
+    return S_OK;
+}
+
+HRESULT PacketTraceCaptureSource::GetNextPacketSize(UINT32* pNumFramesInNextPacket)
+{
+    if (pNumFramesInNextPacket == nullptr)
+    {
+        return E_POINTER;
+    }
+    *pNumFramesInNextPacket = 0;
+    if (m_NextRecord == m_Records.size())
+    {
+        return S_OK;
+    }
+
+    const PacketTraceRecord& record = m_Records[m_NextRecord];
+    if (!m_bInWakeup)
+    {
+        UINT64 nowHns = GetQpcTimeHns();
+        if (m_StartHns == 0)
+        {
+            m_StartHns = nowHns;
+        }
+
+        if (m_bRealTime)
+        {
+            // The wakeup is due as long after the start of the replay as it was after the start of the trace
+            INT64 offsetHns = (INT64)(m_StartHns - m_Records[0].wakeHns);
+            if ((INT64)nowHns < (INT64)record.wakeHns + offsetHns)
+            {
+                return S_OK;
+            }
+            m_QpcOffsetHns = offsetHns;
+        }
+        else
+        {
+            m_QpcOffsetHns = (INT64)(nowHns - record.wakeHns);
+        }
+        m_bInWakeup = true;
+        m_WakeHns = record.wakeHns;
+    }
+    else if (record.wakeHns != m_WakeHns)
+    {
+        // The recorded wakeup ends here: the loop goes back to waiting, as it did when it was recorded
+        m_bInWakeup = false;
+        return S_OK;
+    }
+
+    *pNumFramesInNextPacket = record.frames;
+    return S_OK;
+}
+
+HRESULT PacketTraceCaptureSource::GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition)
+{
+    if (ppData == nullptr || pNumFramesToRead == nullptr || pdwFlags == nullptr)
+    {
+        return E_POINTER;
+    }
+    if (m_bBufferHeld)
+    {
+        return AUDCLNT_E_OUT_OF_ORDER;
+    }
+
+    UINT32 frames = 0;
+    HRESULT hr = GetNextPacketSize(&frames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    *ppData = nullptr;
+    *pNumFramesToRead = frames;
+    *pdwFlags = 0;
+    if (frames == 0)
+    {
+        return AUDCLNT_S_BUFFER_EMPTY;
+    }
+
+    const PacketTraceRecord& record = m_Records[m_NextRecord];
+    if (record.flags & AUDCLNT_BUFFERFLAGS_SILENT)
+    {
+        memset(m_PacketBuffer.data(), 0, (size_t)frames * m_Format.nBlockAlign);
+    }
+    else
+    {
+        WriteToneFrames(m_Format, m_PacketBuffer.data(), frames, m_TonePosition, 1000.0, 0.5);
+    }
+
+    *ppData = m_PacketBuffer.data();
+    *pdwFlags = record.flags;
+    if (pu64DevicePosition != nullptr)
+    {
+        *pu64DevicePosition = record.devicePosition;
+    }
+    if (pu64QPCPosition != nullptr)
+    {
+        *pu64QPCPosition = (UINT64)((INT64)record.qpcPosition + m_QpcOffsetHns);
+    }
+    m_bBufferHeld = true;
+
+    return S_OK;
+}
+
+HRESULT PacketTraceCaptureSource::ReleaseBuffer(UINT32 NumFramesRead)
+{
+    if (!m_bBufferHeld)
+    {
+        return AUDCLNT_E_OUT_OF_ORDER;
+    }
+    // Like IAudioCaptureClient, the packet is either consumed entirely or not at all
+    if (NumFramesRead != 0 && NumFramesRead != m_Records[m_NextRecord].frames)
+    {
+        return AUDCLNT_E_INVALID_SIZE;
+    }
+
+    m_bBufferHeld = false;
+    if (NumFramesRead != 0)
+    {
+        m_TonePosition += NumFramesRead;
+        m_NextRecord++;
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Platform.h"
+#include "CaptureSource.h"
+#include "OutputFile.h"
+#include "SpscFrameRing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* One captured packet in a packet trace: what GetBuffer returned, and when the capture loop woke up to read it.
+* All the packets read in the same wakeup share its wakeHns.
+*/
+struct PacketTraceRecord
+{
+    UINT64 devicePosition = 0;
+    // QPC time of the first frame of the packet, in 100-nanosecond units
+    UINT64 qpcPosition = 0;
+    // QPC time the capture loop started the wakeup that read the packet
+    UINT64 wakeHns = 0;
+    UINT32 frames = 0;
+    DWORD flags = 0;
+};
+static_assert(sizeof(PacketTraceRecord) == 32, "Packet trace records are stored as is");
+
+/**
+* Start of a packet trace file, followed by its PacketTraceRecords up to the end of the file
+*/
+struct PacketTraceHeader
+{
+    static const DWORD Magic = FCC('LPTR');
+    static const DWORD CurrentVersion = 1;
+
+    DWORD magic = Magic;
+    DWORD version = CurrentVersion;
+    DWORD headerBytes = sizeof(PacketTraceHeader);
+    DWORD recordBytes = sizeof(PacketTraceRecord);
+    // Capture format of the packets, as a plain PCM or float format
+    WORD formatTag = 0;
+    WORD channels = 0;
+    DWORD samplesPerSec = 0;
+    WORD blockAlign = 0;
+    WORD bitsPerSample = 0;
+    DWORD reserved = 0;
+};
+static_assert(sizeof(PacketTraceHeader) == 32, "Packet trace headers are stored as is");
+
+/**
+* Counters of a PacketTraceWriter. Safe to read from any thread while it runs.
+*/
+struct PacketTraceStats
+{
+    UINT64 packets = 0;
+    // Packets lost because the writer thread fell more than bufferPackets behind
+    UINT64 droppedPackets = 0;
+    UINT64 bytesWritten = 0;
+};
+
+/**
+* Records packet traces from the capture thread to a file, like WavFileSink records the audio: Append only copies the
+* record into a wait-free ring, and a writer thread drains the ring to the file a few times per second.
+*/
+class PacketTraceWriter
+{
+public:
+    PacketTraceWriter() = default;
+    PacketTraceWriter(const PacketTraceWriter&) = delete;
+    PacketTraceWriter& operator=(const PacketTraceWriter&) = delete;
+    ~PacketTraceWriter();
+
+    // Creates the trace file and starts the writer thread. bufferPackets is the backlog the ring holds.
+    HRESULT Start(const std::filesystem::path& fileName, const WAVEFORMATEX& format, UINT32 bufferPackets = 8192);
+    // Writes the pending records and closes the file. Returns the first write error, if any.
+    HRESULT Stop();
+    bool IsRunning() const { return m_bRunning.load(std::memory_order_acquire); }
+
+    // Called by the capture thread for every captured packet
+    void Append(const PacketTraceRecord& record);
+
+    PacketTraceStats GetStats() const;
+
+private:
+    void ThreadProc();
+    HRESULT Drain();
+
+    OutputFile m_File;
+    SpscFrameRing m_Ring;
+    std::atomic<bool> m_bRunning { false };
+    HRESULT m_hrWrite = S_OK;
+
+    // Owned by the writer thread
+    std::vector<BYTE> m_Batch;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_StopRequested;
+    bool m_bStopRequested = false;
+
+    std::atomic<UINT64> m_Packets { 0 };
+    std::atomic<UINT64> m_BytesWritten { 0 };
+};
+
+/**
+* Capture source that traces every packet another source returns, without changing it.
+*
+* A wakeup of the capture loop starts with the first GetNextPacketSize call after one that found no packet, so the
+* loops are traced as they are: both drain the source until it reports an empty packet.
+*/
+class TracingCaptureSource : public ICaptureSource
+{
+public:
+    TracingCaptureSource(std::unique_ptr<ICaptureSource> source, PacketTraceWriter* writer) :
+        m_Source(std::move(source)),
+        m_Writer(writer)
+    {
+    }
+
+    const WAVEFORMATEX& GetFormat() const override { return m_Source->GetFormat(); }
+
+    HRESULT GetNextPacketSize(UINT32* pNumFramesInNextPacket) override;
+    HRESULT GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition) override;
+    HRESULT ReleaseBuffer(UINT32 NumFramesRead) override { return m_Source->ReleaseBuffer(NumFramesRead); }
+
+private:
+    std::unique_ptr<ICaptureSource> m_Source;
+    PacketTraceWriter* m_Writer;
+    bool m_bInWakeup = false;
+    UINT64 m_WakeHns = 0;
+};
+
+/**
+* Replays a packet trace: the same packet sizes, flags and device positions, read in the same groups per wakeup, with
+* a 1 kHz test tone (or silence, for the packets that were silent) as the sample data.
+*
+* In real time, each wakeup's packets become available at the recorded time since the start of the trace, with their
+* timestamps shifted by the same amount, so they age as they did live if the loop wakes up on time. Otherwise they are
+* available at once, each packet is exactly as old at the start of its wakeup as it was when it was recorded, and the
+* source reports an empty packet at the end of each recorded wakeup: each pass of the capture loop reads exactly one
+* recorded wakeup, as fast as the loop polls.
+*/
+class PacketTraceCaptureSource : public ICaptureSource
+{
+public:
+    PacketTraceCaptureSource() = default;
+
+    HRESULT Open(const std::filesystem::path& fileName, bool realTime);
+    UINT64 GetPacketCount() const { return m_Records.size(); }
+
+    const WAVEFORMATEX& GetFormat() const override { return m_Format; }
+
+    HRESULT GetNextPacketSize(UINT32* pNumFramesInNextPacket) override;
+    HRESULT GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition) override;
+    HRESULT ReleaseBuffer(UINT32 NumFramesRead) override;
+
+private:
+    WAVEFORMATEX m_Format {};
+    bool m_bRealTime = true;
+    std::vector<PacketTraceRecord> m_Records;
+    std::vector<BYTE> m_PacketBuffer;
+    size_t m_NextRecord = 0;
+    // Frames of tone generated so far, so the tone is continuous across packets
+    UINT64 m_TonePosition = 0;
+
+    // Whether the records of the current wakeup are being read, its recorded time, and the offset that maps the
+    // recorded QPC times of its packets to now
+    bool m_bInWakeup = false;
+    UINT64 m_WakeHns = 0;
+    INT64 m_QpcOffsetHns = 0;
+    // QPC time the replay started, for real time replays
+    UINT64 m_StartHns = 0;
+    bool m_bBufferHeld = false;
+};
@@ -0,0 +1,207 @@
+#include "PipelineCounters.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const UINT32 CounterCount = (UINT32)PipelineCounter::Count;
+
+    struct alignas(64) CounterBlock
+    {
+        std::atomic<UINT64> values[CounterCount];
+    };
+
+    struct CounterInfo
+    {
+        const char* name;
+        const char* description;
+    };
+
+    const CounterInfo s_CounterInfo[CounterCount] =
+    {
+        { "packets_captured", "Packets read from the capture client" },
+        { "frames_captured", "Frames read from the capture client" },
+        { "capture_wakeups", "Wakeups of the capture scheduler" },
+        { "empty_capture_wakeups", "Capture wakeups that found no packet" },
+        { "timestamp_errors", "Packets flagged with a timestamp error" },
+        { "discontinuities", "Packets flagged with a data discontinuity" },
+        { "late_packets", "Packets read later than the late capture threshold" },
+        { "late_frames_cut", "Output frames cut to bring the latency back down" },
+        { "render_overrun_frames", "Output frames dropped because the render ring was full" },
+        { "frames_rendered", "Frames written to the output endpoint" },
+        { "render_starved_wakeups", "Render pump wakeups that found the endpoint had played silence since the previous one" },
+        { "file_overrun_frames", "Captured frames dropped because the file sink ring was full" },
+    };
+
+    // Zero-initialized before any thread starts. The last block is shared by the threads past MaxThreadBlocks.
+    CounterBlock s_Blocks[PipelineCounters::MaxThreadBlocks + 1];
+    std::atomic<UINT32> s_BlocksClaimed { 0 };
+    thread_local CounterBlock* t_Block = nullptr;
+
+    CounterBlock* ClaimBlock()
+    {
+        UINT32 index = s_BlocksClaimed.fetch_add(1, std::memory_order_relaxed);
+        t_Block = &s_Blocks[std::min(index, PipelineCounters::MaxThreadBlocks)];
+        return t_Block;
+    }
+
+    // Export thread
+    std::thread s_ExportThread;
+    std::mutex s_ExportMutex;
+    std::condition_variable s_ExportStopRequested;
+    bool s_bExportStopRequested = false;
+    std::filesystem::path s_ExportPath;
+    UINT64 s_ExportStartHns = 0;
+
+    UINT32 GetProcessId()
+    {
+#ifdef _WIN32
+        return (UINT32)GetCurrentProcessId();
+#else
+        return (UINT32)getpid();
+#endif
+    }
+
+    //
+    //  WriteStatsFile()
+    //
+    //  Writes the whole file next to the target, then renames it over the target
+    //
+    HRESULT WriteStatsFile()
+    {
+        std::filesystem::path tempPath = s_ExportPath;
+        tempPath += ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                return E_FAIL;
+            }
+
+            UINT32 processId = GetProcessId();
+            for (UINT32 i = 0; i < CounterCount; i++)
+            {
+                PipelineCounter counter = (PipelineCounter)i;
+                file << "# HELP loopback_" << PipelineCounters::GetName(counter) << "_total " << PipelineCounters::GetDescription(counter) << "\n"
+                    << "# TYPE loopback_" << PipelineCounters::GetName(counter) << "_total counter\n"
+                    << "loopback_" << PipelineCounters::GetName(counter) << "_total{pid=\"" << processId << "\"} "
+                    << PipelineCounters::Get(counter) << "\n";
+            }
+            file << "# HELP loopback_uptime_seconds Time since the export started\n"
+                << "# TYPE loopback_uptime_seconds gauge\n"
+                << "loopback_uptime_seconds{pid=\"" << processId << "\"} " << (GetQpcTimeHns() - s_ExportStartHns) / HNS_PER_SEC << "\n";
+            if (!file.flush())
+            {
+                return E_FAIL;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, s_ExportPath, error);
+        return error ? E_FAIL : S_OK;
+    }
+
+    void ExportThreadProc(UINT32 intervalMs)
+    {
+        std::unique_lock<std::mutex> lock(s_ExportMutex);
+        do
+        {
+            lock.unlock();
+            WriteStatsFile();
+            lock.lock();
+        } while (!s_ExportStopRequested.wait_for(lock, std::chrono::milliseconds(intervalMs), [] { return s_bExportStopRequested; }));
+    }
+}
+
+void PipelineCounters::Add(PipelineCounter counter, UINT64 value)
+{
+    CounterBlock* block = (t_Block != nullptr) ? t_Block : ClaimBlock();
+    std::atomic<UINT64>& slot = block->values[(UINT32)counter];
+    if (block == &s_Blocks[MaxThreadBlocks])
+    {
+        slot.fetch_add(value, std::memory_order_relaxed);
+    }
+    else
+    {
+        // Only this thread writes to its block
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+}
+
+UINT64 PipelineCounters::Get(PipelineCounter counter)
+{
+    UINT64 sum = 0;
+    for (const CounterBlock& block : s_Blocks)
+    {
+        sum += block.values[(UINT32)counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+const char* PipelineCounters::GetName(PipelineCounter counter)
+{
+    return s_CounterInfo[(UINT32)counter].name;
+}
+
+const char* PipelineCounters::GetDescription(PipelineCounter counter)
+{
+    return s_CounterInfo[(UINT32)counter].description;
+}
+
+HRESULT PipelineCounters::StartExport(const std::filesystem::path& path, UINT32 intervalMs)
+{
+    if (s_ExportThread.joinable())
+    {
+        return E_UNEXPECTED;
+    }
+    if (path.empty() || intervalMs == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    s_ExportPath = path;
+    s_ExportStartHns = GetQpcTimeHns();
+    s_bExportStopRequested = false;
+    HRESULT hr = WriteStatsFile();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    try
+    {
+        s_ExportThread = std::thread(ExportThreadProc, intervalMs);
+    }
+    catch (const std::system_error&)
+    {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+void PipelineCounters::StopExport()
+{
+    if (!s_ExportThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(s_ExportMutex);
+        s_bExportStopRequested = true;
+    }
+    s_ExportStopRequested.notify_one();
+    s_ExportThread.join();
+    WriteStatsFile();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <filesystem>
+
+/**
+* Process-wide event counters of the capture pipeline
+*/
+enum class PipelineCounter : UINT32
+{
+    PacketsCaptured,
+    FramesCaptured,
+    // Wakeups of the capture scheduler, and those that found no packet
+    CaptureWakeups,
+    EmptyCaptureWakeups,
+    // Packets flagged with AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR
+    TimestampErrors,
+    // Packets flagged with AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY: the engine lost audio before them
+    Discontinuities,
+    // Packets read later than LatencyPolicy::lateCaptureMs after their capture
+    LatePackets,
+    // Output frames cut by the jitter buffer to bring the latency back down
+    LateFramesCut,
+    // Output frames dropped because the render ring was full
+    RenderOverrunFrames,
+    FramesRendered,
+    // Render pump wakeups that found the endpoint had played silence since the previous one
+    RenderStarvedWakeups,
+    // Captured frames dropped because the file sink ring was full
+    FileOverrunFrames,
+    Count
+};
+
+/**
+* Registry of the PipelineCounter values.
+*
+* Each thread that counts gets its own cache-line aligned block of counters, so the capture, render and writer threads
+* never share a cache line: adding to a counter is a relaxed load and store on the thread's own block, with no atomic
+* read-modify-write. Reading a counter sums the blocks. Threads past MaxThreadBlocks share one more block, updated
+* with atomic additions.
+*/
+namespace PipelineCounters
+{
+    const UINT32 MaxThreadBlocks = 32;
+
+    void Add(PipelineCounter counter, UINT64 value = 1);
+    // Sum over all the threads. Can be called from any thread at any time.
+    UINT64 Get(PipelineCounter counter);
+    // Name of the counter in the stats file, e.g. "frames_captured"
+    const char* GetName(PipelineCounter counter);
+    const char* GetDescription(PipelineCounter counter);
+
+    // Rewrites path every intervalMs with the counters, from a background thread, until StopExport. The file is
+    // written in the Prometheus text format (e.g. for the node_exporter textfile collector), to a temporary file that
+    // is then renamed over path, so a scraper never reads a partial file.
+    HRESULT StartExport(const std::filesystem::path& path, UINT32 intervalMs);
+    // Writes the file one last time and stops the export thread
+    void StopExport();
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+/**
+* Portable subset of the Win32 declarations used by the capture pipeline.
+*
+* On Windows this simply pulls in the SDK headers. Elsewhere it declares the handful of types, constants and
+* structures that the portable pipeline stages (capture sources, DSP, writers) need, so they can be built and
+* profiled on machines without an audio stack.
+*/
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
+#include <AudioClient.h>
+
+#else
+
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+
+typedef uint8_t  BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef int32_t  INT32;
+typedef uint32_t UINT32;
+typedef int64_t  INT64;
+typedef uint64_t UINT64;
+typedef int64_t  LONGLONG;
+typedef int32_t  HRESULT;
+typedef int64_t  REFERENCE_TIME;
+
+#define S_OK            ((HRESULT)0L)
+#define S_FALSE         ((HRESULT)1L)
+#define E_NOTIMPL       ((HRESULT)0x80004001L)
+#define E_FAIL          ((HRESULT)0x80004005L)
+#define E_UNEXPECTED    ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000EL)
+#define E_INVALIDARG    ((HRESULT)0x80070057L)
+#define E_POINTER       ((HRESULT)0x80004003L)
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+// WAVEFORMATEXTENSIBLE::dwChannelMask speaker positions
+#define SPEAKER_FRONT_LEFT              0x1
+#define SPEAKER_FRONT_RIGHT             0x2
+#define SPEAKER_FRONT_CENTER            0x4
+#define SPEAKER_LOW_FREQUENCY           0x8
+#define SPEAKER_BACK_LEFT               0x10
+#define SPEAKER_BACK_RIGHT              0x20
+#define SPEAKER_FRONT_LEFT_OF_CENTER    0x40
+#define SPEAKER_FRONT_RIGHT_OF_CENTER   0x80
+#define SPEAKER_BACK_CENTER             0x100
+#define SPEAKER_SIDE_LEFT               0x200
+#define SPEAKER_SIDE_RIGHT              0x400
+#define SPEAKER_TOP_CENTER              0x800
+#define SPEAKER_TOP_FRONT_LEFT          0x1000
+#define SPEAKER_TOP_FRONT_CENTER        0x2000
+#define SPEAKER_TOP_FRONT_RIGHT         0x4000
+#define SPEAKER_TOP_BACK_LEFT           0x8000
+#define SPEAKER_TOP_BACK_CENTER         0x10000
+#define SPEAKER_TOP_BACK_RIGHT          0x20000
+
+// IAudioCaptureClient::GetBuffer flags
+#define AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY  0x1
+#define AUDCLNT_BUFFERFLAGS_SILENT              0x2
+#define AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR     0x4
+
+#define AUDCLNT_S_BUFFER_EMPTY  ((HRESULT)0x08890001L)
+#define AUDCLNT_E_OUT_OF_ORDER  ((HRESULT)0x88890007L)
+#define AUDCLNT_E_INVALID_SIZE  ((HRESULT)0x88890008L)
+
+#ifndef FCC
+#define FCC(ch4) ((((DWORD)(ch4) & 0xFF) << 24) |     \
+                  (((DWORD)(ch4) & 0xFF00) << 8) |    \
+                  (((DWORD)(ch4) & 0xFF0000) >> 8) |  \
+                  (((DWORD)(ch4) & 0xFF000000) >> 24))
+#endif
+
+struct GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+};
+
+inline bool operator==(const GUID& g1, const GUID& g2) { return memcmp(&g1, &g2, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID& g1, const GUID& g2) { return !(g1 == g2); }
+
+static const GUID KSDATAFORMAT_SUBTYPE_PCM        = { 0x00000001, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID KSDATAFORMAT_SUBTYPE_IEEE_FLOAT = { 0x00000003, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+
+#pragma pack(push, 1)
+typedef struct tWAVEFORMATEX
+{
+    WORD  wFormatTag;
+    WORD  nChannels;
+    DWORD nSamplesPerSec;
+    DWORD nAvgBytesPerSec;
+    WORD  nBlockAlign;
+    WORD  wBitsPerSample;
+    WORD  cbSize;
+} WAVEFORMATEX;
+
+typedef struct
+{
+    WAVEFORMATEX Format;
+    union
+    {
+        WORD wValidBitsPerSample;
+        WORD wSamplesPerBlock;
+        WORD wReserved;
+    } Samples;
+    DWORD dwChannelMask;
+    GUID  SubFormat;
+} WAVEFORMATEXTENSIBLE;
+#pragma pack(pop)
+
+#endif
+
+// Number of 100-nanosecond units (REFERENCE_TIME / QPC position units) per second
+#define HNS_PER_SEC 10000000ULL
+
+/**
+* Returns the current value of the performance counter in 100-nanosecond units, the same unit and time base as
+* the u64QPCPosition returned by IAudioCaptureClient::GetBuffer.
+*/
+inline UINT64 GetQpcTimeHns()
+{
+#ifdef _WIN32
+    static const LONGLONG frequency = []()
+    {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart;
+    }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // Split the conversion to avoid overflowing the 64-bit product on long uptimes
+    return (UINT64)((now.QuadPart / frequency) * (LONGLONG)HNS_PER_SEC + ((now.QuadPart % frequency) * (LONGLONG)HNS_PER_SEC) / frequency);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * HNS_PER_SEC + (UINT64)ts.tv_nsec / 100;
+#endif
+}
@@ -0,0 +1,374 @@
+#include "PolyphaseResampler.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+// Filter rows are padded to a multiple of two AVX registers so every kernel can run without a remainder loop
+static const UINT32 TapAlignment = 16;
+// Number of input frames copied into the history per iteration of Process
+static const UINT32 ChunkFrames = 1024;
+
+struct QualityParameters
+{
+    UINT32 halfLength;
+    // Passband edge, as a fraction of the Nyquist frequency of the lower of the two rates
+    double rolloff;
+    // Kaiser window shape
+    double beta;
+};
+
+static const QualityParameters s_QualityParameters[] =
+{
+    {  8, 0.80, 6.0 },  // Low
+    { 16, 0.90, 7.5 },  // Medium
+    { 32, 0.94, 8.5 },  // High
+    { 60, 0.97, 10.0 }, // Best
+};
+
+static UINT32 GreatestCommonDivisor(UINT32 a, UINT32 b)
+{
+    while (b != 0)
+    {
+        UINT32 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+static float DotProductScalar(const float* coefficients, const float* samples, size_t count)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += coefficients[i] * samples[i];
+    }
+    return sum;
+}
+
+#if defined(CPU_X86)
+static float DotProductSSE(const float* coefficients, const float* samples, size_t count)
+{
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(coefficients + i), _mm_loadu_ps(samples + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(coefficients + i + 4), _mm_loadu_ps(samples + i + 4)));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX2 static float DotProductAVX2(const float* coefficients, const float* samples, size_t count)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (size_t i = 0; i < count; i += 16)
+    {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i), _mm256_loadu_ps(samples + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i + 8), _mm256_loadu_ps(samples + i + 8), sum1);
+    }
+    __m256 sum8 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+#endif
+
+#if defined(CPU_NEON)
+static float DotProductNEON(const float* coefficients, const float* samples, size_t count)
+{
+    float32x4_t sum0 = vdupq_n_f32(0.0f);
+    float32x4_t sum1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < count; i += 8)
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(coefficients + i), vld1q_f32(samples + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(coefficients + i + 4), vld1q_f32(samples + i + 4));
+    }
+    float32x4_t sum = vaddq_f32(sum0, sum1);
+    float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+}
+#endif
+
+//
+//  Initialize()
+//
+//  Builds the coefficient table for the inputRate to outputRate conversion and selects the dot product kernel
+//
+HRESULT PolyphaseResampler::Initialize(UINT32 inputRate, UINT32 outputRate, UINT32 channels, ResamplerQuality quality, ResamplerKernel kernel,
+    bool bAdjustable)
+{
+    if (inputRate == 0 || outputRate == 0 || channels == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    UINT32 gcd = GreatestCommonDivisor(inputRate, outputRate);
+    m_Up = outputRate / gcd;
+    m_Down = inputRate / gcd;
+    if (m_Up > MaxPhases)
+    {
+        return E_INVALIDARG;
+    }
+    if (bAdjustable && m_Up < MinAdjustablePhases)
+    {
+        // Same ratio, finer phases
+        UINT32 factor = std::min((MinAdjustablePhases + m_Up - 1) / m_Up, MaxPhases / m_Up);
+        m_Up *= factor;
+        m_Down *= factor;
+    }
+
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    if (kernel == ResamplerKernel::Auto)
+    {
+        kernel = cpu.avx2 ? ResamplerKernel::AVX2 : cpu.neon ? ResamplerKernel::NEON : ResamplerKernel::SSE;
+    }
+    switch (kernel)
+    {
+#if defined(CPU_X86)
+    case ResamplerKernel::AVX2:
+        if (!cpu.avx2)
+        {
+            return E_INVALIDARG;
+        }
+        m_DotProduct = DotProductAVX2;
+        break;
+    case ResamplerKernel::SSE:
+        // SSE2 is part of the x64 baseline and of the default MSVC x86 target
+        m_DotProduct = DotProductSSE;
+        break;
+#endif
+#if defined(CPU_NEON)
+    case ResamplerKernel::NEON:
+        m_DotProduct = DotProductNEON;
+        break;
+#endif
+    case ResamplerKernel::Scalar:
+        m_DotProduct = DotProductScalar;
+        break;
+    default:
+        // Requested instruction set is not available on this architecture
+        kernel = ResamplerKernel::Scalar;
+        m_DotProduct = DotProductScalar;
+        break;
+    }
+    m_Kernel = kernel;
+    m_Channels = channels;
+    m_bAdjustable = bAdjustable;
+    m_RateScale = 1.0;
+    m_Step = m_Down;
+    m_StepFraction = 0;
+
+    DesignFilter(quality);
+
+    m_HistoryCapacity = m_Taps + ChunkFrames;
+    // Every row has m_PaddedTaps - m_Taps extra frames so the padded dot products never read past it
+    m_History.assign((size_t)m_Channels * (m_HistoryCapacity + m_PaddedTaps), 0.0f);
+    Reset();
+
+    return S_OK;
+}
+
+//
+//  DesignFilter()
+//
+//  Computes one windowed-sinc row per phase. Row p holds the taps for an output that falls p/L frames after an input frame.
+//  An adjustable resampler gets row L too, the taps one frame after row 0, to interpolate past the last phase.
+//
+void PolyphaseResampler::DesignFilter(ResamplerQuality quality)
+{
+    const QualityParameters& parameters = s_QualityParameters[(int)quality];
+
+    // When decimating, the cutoff drops below the input Nyquist frequency, so the filter needs proportionally more taps
+    double bandwidth = std::min(1.0, (double)m_Up / (double)m_Down);
+    m_HalfLength = (UINT32)std::ceil(parameters.halfLength / bandwidth);
+    m_Taps = 2 * m_HalfLength;
+    m_PaddedTaps = (m_Taps + TapAlignment - 1) / TapAlignment * TapAlignment;
+
+    // Cutoff, in cycles per input sample
+    double cutoff = 0.5 * parameters.rolloff * bandwidth;
+    double windowScale = 1.0 / BesselI0(parameters.beta);
+
+    UINT32 rows = m_bAdjustable ? m_Up + 1 : m_Up;
+    m_Coefficients.assign((size_t)rows * m_PaddedTaps, 0.0f);
+    std::vector<double> row(m_Taps);
+    for (UINT32 phase = 0; phase < rows; phase++)
+    {
+        double sum = 0.0;
+        for (UINT32 tap = 0; tap < m_Taps; tap++)
+        {
+            // Distance between the output instant and the input frame this tap is applied to
+            double distance = (double)phase / (double)m_Up + (double)m_HalfLength - 1.0 - (double)tap;
+            double x = distance / (double)m_HalfLength;
+            double window = (std::fabs(x) <= 1.0) ? BesselI0(parameters.beta * std::sqrt(1.0 - x * x)) * windowScale : 0.0;
+            double argument = 2.0 * PI * cutoff * distance;
+            double sinc = (std::fabs(argument) < 1e-12) ? 1.0 : std::sin(argument) / argument;
+            row[tap] = 2.0 * cutoff * sinc * window;
+            sum += row[tap];
+        }
+        // Normalize every phase to unity gain at DC
+        for (UINT32 tap = 0; tap < m_Taps; tap++)
+        {
+            m_Coefficients[(size_t)phase * m_PaddedTaps + tap] = (float)(row[tap] / sum);
+        }
+    }
+}
+
+void PolyphaseResampler::Reset()
+{
+    std::fill(m_History.begin(), m_History.end(), 0.0f);
+    // Start with half a filter of silence so the first output is centered on the first input frame
+    m_HistoryFrames = m_HalfLength - 1;
+    m_Position = 0;
+    m_Phase = 0;
+    m_PhaseFraction = 0;
+}
+
+void PolyphaseResampler::SetInputRateScale(double scale)
+{
+    if (!m_bAdjustable)
+    {
+        return;
+    }
+
+    double limit = MaxRateScalePpm * 1e-6;
+    m_RateScale = std::max(1.0 - limit, std::min(scale, 1.0 + limit));
+
+    double step = m_Down * m_RateScale;
+    double whole = std::floor(step);
+    m_Step = (UINT32)whole;
+    m_StepFraction = (UINT32)std::min((step - whole) * 4294967296.0, 4294967295.0);
+}
+
+UINT32 PolyphaseResampler::GetOutputFrames(UINT32 inputFrames) const
+{
+    UINT64 bufferedFrames = (UINT64)m_HistoryFrames + inputFrames;
+    if (bufferedFrames < (UINT64)m_Position + m_Taps)
+    {
+        return 0;
+    }
+    UINT64 lastPosition = bufferedFrames - m_Taps - m_Position;
+    if (m_Step == m_Down && m_StepFraction == 0)
+    {
+        // Outputs n = 0, 1, ... are produced while m_Position + (m_Phase + n * M) / L + taps <= bufferedFrames
+        return (UINT32)(((lastPosition + 1) * m_Up - m_Phase + m_Down - 1) / m_Down);
+    }
+
+    // Off the nominal ratio the fractional steps make the count depend on every carry, so replay them
+    UINT64 phase = m_Phase;
+    UINT64 phaseFraction = m_PhaseFraction;
+    const UINT64 lastPhase = (lastPosition + 1) * m_Up;
+    UINT32 frames = 0;
+    while (phase < lastPhase)
+    {
+        frames++;
+        phaseFraction += m_StepFraction;
+        phase += m_Step + (phaseFraction >> 32);
+        phaseFraction &= 0xFFFFFFFF;
+    }
+    return frames;
+}
+
+UINT32 PolyphaseResampler::GetMaxOutputFrames(UINT32 inputFrames) const
+{
+    // One more frame for the phase, and one for the input frames still in the history
+    double minStep = m_bAdjustable ? m_Down * (1.0 - MaxRateScalePpm * 1e-6) : m_Down;
+    return (UINT32)std::ceil((double)inputFrames * m_Up / minStep) + 2;
+}
+
+UINT32 PolyphaseResampler::Process(const float* input, UINT32 inputFrames, float* output)
+{
+    const size_t rowStride = (size_t)m_HistoryCapacity + m_PaddedTaps;
+    UINT32 framesWritten = 0;
+
+    while (inputFrames > 0)
+    {
+        // Append a chunk of input to the planar history
+        UINT32 chunk = std::min(inputFrames, m_HistoryCapacity - m_HistoryFrames);
+        for (UINT32 channel = 0; channel < m_Channels; channel++)
+        {
+            float* row = &m_History[channel * rowStride + m_HistoryFrames];
+            const float* src = input + channel;
+            for (UINT32 i = 0; i < chunk; i++)
+            {
+                row[i] = src[(size_t)i * m_Channels];
+            }
+        }
+        m_HistoryFrames += chunk;
+        input += (size_t)chunk * m_Channels;
+        inputFrames -= chunk;
+
+        // Produce every output whose filter span is fully inside the history
+        while (m_Position + m_Taps <= m_HistoryFrames)
+        {
+            const float* coefficients = &m_Coefficients[(size_t)m_Phase * m_PaddedTaps];
+            if (m_PhaseFraction == 0)
+            {
+                for (UINT32 channel = 0; channel < m_Channels; channel++)
+                {
+                    *output++ = m_DotProduct(coefficients, &m_History[channel * rowStride + m_Position], m_PaddedTaps);
+                }
+            }
+            else
+            {
+                // Between two phases: interpolate the outputs of the rows on either side
+                const float* nextCoefficients = coefficients + m_PaddedTaps;
+                float fraction = (float)(m_PhaseFraction * (1.0 / 4294967296.0));
+                for (UINT32 channel = 0; channel < m_Channels; channel++)
+                {
+                    const float* samples = &m_History[channel * rowStride + m_Position];
+                    float current = m_DotProduct(coefficients, samples, m_PaddedTaps);
+                    float next = m_DotProduct(nextCoefficients, samples, m_PaddedTaps);
+                    *output++ = current + fraction * (next - current);
+                }
+            }
+            framesWritten++;
+
+            UINT64 phaseFraction = (UINT64)m_PhaseFraction + m_StepFraction;
+            m_PhaseFraction = (UINT32)phaseFraction;
+            m_Phase += m_Step + (UINT32)(phaseFraction >> 32);
+            m_Position += m_Phase / m_Up;
+            m_Phase %= m_Up;
+        }
+
+        // Drop the input frames no future output can reach
+        UINT32 consumed = std::min(m_Position, m_HistoryFrames);
+        if (consumed > 0)
+        {
+            for (UINT32 channel = 0; channel < m_Channels; channel++)
+            {
+                float* row = &m_History[channel * rowStride];
+                std::copy(row + consumed, row + m_HistoryFrames, row);
+            }
+            m_HistoryFrames -= consumed;
+            m_Position -= consumed;
+        }
+    }
+
+    return framesWritten;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+
+/**
+* Filter lengths offered by the native resampler. Best matches SetHalfFilterLength(60) of the Media Foundation resampler.
+*/
+enum class ResamplerQuality
+{
+    Low,        // 8 taps per side
+    Medium,     // 16 taps per side
+    High,       // 32 taps per side
+    Best,       // 60 taps per side
+};
+
+/**
+* Instruction set used for the filter dot products. Auto picks the widest one the CPU supports.
+*/
+enum class ResamplerKernel
+{
+    Auto,
+    Scalar,
+    SSE,
+    AVX2,
+    NEON,
+};
+
+/**
+* Streaming polyphase windowed-sinc resampler for interleaved float samples.
+*
+* The conversion ratio is reduced to L/M, and one Kaiser windowed-sinc filter row is precomputed for each of the L
+* phases. The integer phase and the unconsumed input history are carried across calls to Process, so splitting a
+* stream into packets of any size produces exactly the same output as processing it at once.
+*
+* An adjustable resampler can also run slightly off its nominal ratio, to follow an input clock that drifts against
+* the output clock. The position then advances by a fractional number of phases per output, and each output is
+* interpolated between the two filter rows around it. The table gets at least MinAdjustablePhases rows for that.
+*/
+class PolyphaseResampler
+{
+public:
+    // Largest number of filter phases (L) the coefficient table may hold
+    static const UINT32 MaxPhases = 1024;
+    // Smallest number of filter phases of an adjustable resampler, so interpolating between two rows stays accurate
+    static const UINT32 MinAdjustablePhases = 256;
+    // Largest deviation from the nominal input rate SetInputRateScale accepts, in parts per million
+    static const UINT32 MaxRateScalePpm = 1000;
+
+    PolyphaseResampler() = default;
+
+    // bAdjustable allows SetInputRateScale, at the cost of a larger table and two dot products per output while the
+    // scale is not 1
+    HRESULT Initialize(UINT32 inputRate, UINT32 outputRate, UINT32 channels, ResamplerQuality quality,
+        ResamplerKernel kernel = ResamplerKernel::Auto, bool bAdjustable = false);
+    bool IsInitialized() const { return m_Channels != 0; }
+    bool IsAdjustable() const { return m_bAdjustable; }
+
+    // Corrects the nominal input rate by scale, e.g. 1.0001 when the input clock runs 100 ppm fast against the output
+    // clock: the input is consumed that much faster and fewer frames are produced. Clamped to MaxRateScalePpm. Only
+    // for adjustable resamplers; takes effect from the next output frame.
+    void SetInputRateScale(double scale);
+    double GetInputRateScale() const { return m_RateScale; }
+
+    // Clears the history and the phase, as if the stream had just started
+    void Reset();
+
+    // Exact number of frames the next call to Process(inputFrames) will produce
+    UINT32 GetOutputFrames(UINT32 inputFrames) const;
+    // Most frames Process(inputFrames) can produce at any input rate scale and phase
+    UINT32 GetMaxOutputFrames(UINT32 inputFrames) const;
+
+    // Resamples inputFrames interleaved frames into output, which must hold GetOutputFrames(inputFrames) frames.
+    // Returns the number of frames written.
+    UINT32 Process(const float* input, UINT32 inputFrames, float* output);
+
+    // Group delay of the filter, in input frames
+    UINT32 GetLatencyFrames() const { return m_HalfLength; }
+    ResamplerKernel GetKernel() const { return m_Kernel; }
+
+private:
+    typedef float (*DotProductFn)(const float* coefficients, const float* samples, size_t count);
+
+    void DesignFilter(ResamplerQuality quality);
+
+    UINT32 m_Channels = 0;
+    // Upsampling (L) and downsampling (M) factors of the reduced conversion ratio
+    UINT32 m_Up = 1;
+    UINT32 m_Down = 1;
+    UINT32 m_HalfLength = 0;
+    UINT32 m_Taps = 0;
+    // m_Taps rounded up to a multiple of the widest SIMD vector. The extra coefficients are zero.
+    UINT32 m_PaddedTaps = 0;
+    // m_Up rows of m_PaddedTaps coefficients, plus a row for phase m_Up (row 0 one frame later) if adjustable
+    std::vector<float> m_Coefficients;
+    bool m_bAdjustable = false;
+
+    // Planar input history, one row of m_HistoryCapacity frames per channel
+    std::vector<float> m_History;
+    UINT32 m_HistoryCapacity = 0;
+    UINT32 m_HistoryFrames = 0;
+    // Position of the next output in the history, as an integer frame index plus a phase in 1/L frame units
+    UINT32 m_Position = 0;
+    UINT32 m_Phase = 0;
+    // Fraction of a phase past m_Phase, in 1/2^32 phase units. Always 0 at the nominal ratio.
+    UINT32 m_PhaseFraction = 0;
+    // Phases the position advances by per output: m_Down at the nominal ratio, m_Down * m_RateScale otherwise
+    UINT32 m_Step = 1;
+    UINT32 m_StepFraction = 0;
+    double m_RateScale = 1.0;
+
+    ResamplerKernel m_Kernel = ResamplerKernel::Scalar;
+    DotProductFn m_DotProduct = nullptr;
+};
@@ -0,0 +1,212 @@
+#include "RenderPath.h"
+#include "LogRing.h"
+#include "PipelineCounters.h"
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <cmath>
+
+HRESULT RenderPath::Start(IRenderTarget* target, IRenderConverter* converter, const WAVEFORMATEX& captureFormat,
+    const WAVEFORMATEX& outputFormat, UINT32 maxPacketFrames, const RenderPathOptions& options)
+{
+    if (target == nullptr || converter == nullptr || maxPacketFrames == 0)
+    {
+        return E_INVALIDARG;
+    }
+    if (IsStarted())
+    {
+        return E_UNEXPECTED;
+    }
+
+    m_CaptureRate = captureFormat.nSamplesPerSec;
+    m_CaptureBlockAlign = captureFormat.nBlockAlign;
+    m_OutputRate = outputFormat.nSamplesPerSec;
+    m_MaxPacketFrames = maxPacketFrames;
+    m_bStreamStarted = false;
+    m_bAdjusting = converter->IsAdjustable();
+    m_bDiscontinuity = false;
+
+    // Leave room for the extra frame the converter may produce depending on its phase, and for the drift correction
+    UINT32 maxWriteFrames = converter->GetMaxConvertedFrames(maxPacketFrames);
+    UINT32 capacityFrames = std::max((UINT32)((UINT64)m_OutputRate * options.bufferMs / 1000), 2 * maxWriteFrames);
+    HRESULT hr = m_Ring.Initialize(outputFormat.nBlockAlign, capacityFrames, maxWriteFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Start the endpoint at the target latency: until the converter adjusts, nothing else brings the level to it
+    UINT32 prefillMs = std::max(options.prefillMs, options.latencyPolicy.targetMs);
+    UINT32 prefillFrames = (UINT32)((UINT64)m_OutputRate * prefillMs / 1000);
+    hr = (options.wakeIntervalMs != 0) ? m_Pump.Start(target, &m_Ring, m_OutputRate, options.wakeIntervalMs, prefillFrames)
+        : m_Pump.StartManual(target, &m_Ring, m_OutputRate, prefillFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_JitterBuffer.Initialize(options.latencyPolicy, outputFormat, maxWriteFrames);
+    if (SUCCEEDED(hr) && (m_bAdjusting || converter->CanStartAdjusting()))
+    {
+        hr = m_DriftEstimator.Initialize(m_OutputRate, m_JitterBuffer.GetTargetFrames());
+    }
+    if (FAILED(hr))
+    {
+        m_Pump.Stop();
+        return hr;
+    }
+
+    m_Converter = converter;
+    m_LevelSteps = CountLevelSteps();
+    return S_OK;
+}
+
+HRESULT RenderPath::Stop()
+{
+    m_Converter = nullptr;
+    return m_Pump.Stop();
+}
+
+//
+//  CountLevelSteps()
+//
+//  Late packets, cut and stretched frames, frames dropped on a full ring, and the gaps the endpoint filled with silence.
+//  A pump wakeup that finds the endpoint buffer empty is no step by itself: the frames it holds may still be playing.
+//
+UINT64 RenderPath::CountLevelSteps() const
+{
+    const JitterBufferStats& jitterStats = m_JitterBuffer.GetStats();
+    return jitterStats.latePackets + jitterStats.framesDropped + jitterStats.framesStretched + m_Ring.GetStats().overrunFrames +
+        m_Pump.GetStats().starvedWakeups;
+}
+
+void RenderPath::EndWrite(UINT32 frames)
+{
+    UINT32 framesQueued = m_Ring.EndWrite(frames);
+    if (framesQueued < frames)
+    {
+        PipelineCounters::Add(PipelineCounter::RenderOverrunFrames, frames - framesQueued);
+        LOOPBACK_LOG(LogLevel::Warning, 1000, "Render ring full: dropped {} frames", frames - framesQueued);
+    }
+}
+
+//
+//  WritePacket()
+//
+//  Converts the packet straight into the ring, after steering the converter rate from the render level, and cuts or
+//  stretches it when the packet would play later than the maximum latency
+//
+void RenderPath::WritePacket(BYTE* data, UINT32 frames, UINT64 packetAgeUs, INT64 nowNs)
+{
+    if (!IsStarted())
+    {
+        return;
+    }
+    LOOPBACK_TRACE_SPAN("Render write");
+
+    if (!m_bStreamStarted)
+    {
+        // Start the conversion from a clean state
+        m_Converter->Reset();
+        if (m_DriftEstimator.IsInitialized())
+        {
+            m_DriftEstimator.Reset();
+            if (m_bAdjusting)
+            {
+                m_Converter->SetInputRateScale(m_DriftEstimator.GetRateScale());
+            }
+        }
+        m_bStreamStarted = true;
+    }
+
+    if (m_JitterBuffer.OnPacketRead(packetAgeUs))
+    {
+        PipelineCounters::Add(PipelineCounter::LatePackets);
+        LOOPBACK_LOG(LogLevel::Warning, 1000, "Late packet: read {}us after it was captured", packetAgeUs);
+    }
+
+    // Render level just before this packet is written: the frames written to the ring that the endpoint has not played
+    // yet. The play position the pump sampled is extrapolated to now, so the level does not depend on when the pump
+    // last woke up. It runs ahead of the engine within a period, so a packet that arrives just in time for the endpoint
+    // finds the level below 0; the estimator takes it as it is. Nothing to measure until the endpoint plays.
+    UINT64 playedFrames = 0;
+    INT64 playedTimeNs = 0;
+    bool bHasLevel = m_Pump.GetPlayPosition(&playedFrames, &playedTimeNs);
+    double level = 0.0;
+    if (bHasLevel)
+    {
+        double played = playedFrames + (double)(nowNs - playedTimeNs) * m_OutputRate / 1e9;
+        level = (double)m_Ring.GetStats().framesWritten - played;
+    }
+
+    // The first frame of the packet plays once it has waited for its age plus the level
+    double ageFrames = (double)packetAgeUs * m_OutputRate / 1e6;
+    double latencyFrames = std::max(0.0, level) + ageFrames;
+
+    // A step of the level since the last packet is not drift: the estimator locks again after it
+    UINT64 levelSteps = CountLevelSteps();
+    if (m_DriftEstimator.IsInitialized() && (levelSteps != m_LevelSteps || m_bDiscontinuity))
+    {
+        m_DriftEstimator.OnLevelStep();
+    }
+    m_LevelSteps = levelSteps;
+    m_bDiscontinuity = false;
+
+    // Steer the converter to the target latency, or measure the drift until the converter can be steered. The age
+    // holds no drift, but counting it steers the latency the policy sets rather than the level alone.
+    if (bHasLevel && m_DriftEstimator.IsInitialized())
+    {
+        double seconds = (double)frames / m_CaptureRate;
+        if (m_bAdjusting)
+        {
+            m_Converter->SetInputRateScale(m_DriftEstimator.Update(level + ageFrames, seconds));
+        }
+        else if (m_DriftEstimator.Measure(level + ageFrames, seconds) && m_Converter->StartAdjusting())
+        {
+            m_bAdjusting = true;
+            m_Converter->SetInputRateScale(m_DriftEstimator.GetRateScale());
+            LOOPBACK_LOG(LogLevel::Info, 0, "Clock drift of {}ppm measured: compensating it",
+                (INT32)std::lround(m_DriftEstimator.GetDriftPpm()));
+            // The resampler delays the audio from now on
+            m_DriftEstimator.OnLevelStep();
+        }
+    }
+
+    // Convert straight into the ring, splitting packets larger than the ring's largest write
+    while (frames > 0)
+    {
+        UINT32 packetFrames = std::min(frames, m_MaxPacketFrames);
+        BYTE* dst = m_Ring.BeginWrite();
+        UINT32 framesWritten = 0;
+        {
+            LOOPBACK_TRACE_SPAN("Convert");
+            framesWritten = m_Converter->Convert(data, packetFrames, dst, m_Ring.GetMaxWriteFrames());
+        }
+
+        // Over the maximum latency, cut a slice out of the packet or play it faster instead of flushing the queue
+        if (bHasLevel && m_JitterBuffer.IsInitialized())
+        {
+            UINT32 dropFrames = m_JitterBuffer.GetDropFrames(latencyFrames, framesWritten);
+            framesWritten = m_JitterBuffer.DropFrames(dst, framesWritten, dropFrames);
+            latencyFrames -= dropFrames;
+            if (dropFrames > 0)
+            {
+                PipelineCounters::Add(PipelineCounter::LateFramesCut, dropFrames);
+            }
+            framesWritten = m_JitterBuffer.Stretch(dst, framesWritten, m_Ring.GetMaxWriteFrames());
+        }
+        EndWrite(framesWritten);
+
+        // Once caught up, the time stretch lets go of the audio it held back
+        if (m_JitterBuffer.IsInitialized())
+        {
+            while ((framesWritten = m_JitterBuffer.DrainStretch(m_Ring.BeginWrite(), m_Ring.GetMaxWriteFrames())) > 0)
+            {
+                EndWrite(framesWritten);
+            }
+        }
+
+        data += (size_t)packetFrames * m_CaptureBlockAlign;
+        frames -= packetFrames;
+    }
+}
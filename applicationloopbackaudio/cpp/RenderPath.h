@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Platform.h"
+#include "DriftEstimator.h"
+#include "JitterBuffer.h"
+#include "RenderPump.h"
+#include "SpscFrameRing.h"
+
+/**
+* Conversion of the captured frames to the output format (resampling, channel remix, sample format), as a RenderPath
+* needs it. Implemented by LoopbackCaptureBase around resampleAudioStream.
+*/
+class IRenderConverter
+{
+public:
+    virtual ~IRenderConverter() = default;
+
+    // Starts converting a new stream from a clean state
+    virtual void Reset() = 0;
+    // Most output frames Convert can write for frames captured frames, at any phase and rate scale
+    virtual UINT32 GetMaxConvertedFrames(UINT32 frames) = 0;
+    // Converts frames captured frames into dst, which has room for maxFrames output frames. Returns the number of
+    // frames written.
+    virtual UINT32 Convert(BYTE* src, UINT32 frames, BYTE* dst, UINT32 maxFrames) = 0;
+    // True if SetInputRateScale can follow a drifting capture clock, see PolyphaseResampler::SetInputRateScale
+    virtual bool IsAdjustable() const { return false; }
+    virtual void SetInputRateScale(double /*scale*/) {}
+    // True if the converter can become adjustable once a drift is measured, with GetMaxConvertedFrames already
+    // covering it. StartAdjusting switches it over between two packets; it is adjustable from then on if it succeeds.
+    virtual bool CanStartAdjusting() const { return false; }
+    virtual bool StartAdjusting() { return false; }
+};
+
+/**
+* Settings of a RenderPath
+*/
+struct RenderPathOptions
+{
+    // Capacity of the ring between the capture thread and the render pump, in milliseconds of output audio
+    UINT32 bufferMs = 200;
+    // Wakeup interval of the pump thread. 0 starts a manual pump, driven by RenderPath::Pump.
+    UINT32 wakeIntervalMs = 5;
+    // Output audio the pump buffers before it starts the endpoint, in milliseconds, or the target latency if higher. One
+    // engine period leaves the packets no margin: the first drift, before it is measured, makes the endpoint play silence.
+    UINT32 prefillMs = 20;
+    LatencyPolicy latencyPolicy;
+};
+
+/**
+* Render side of the pipeline: converts the captured packets into an SpscFrameRing that a RenderPump drains into the
+* output endpoint, holding the latency within a LatencyPolicy on the way.
+*
+* Before each packet is written, the level of the render path (the frames written to the ring that the endpoint has
+* not played yet) is estimated from the play position the pump published. With the age of the packet, it makes up the
+* latency, which steers the rate of an adjustable converter to the target latency through a DriftEstimator, and tells
+* the JitterBuffer how far over the maximum latency the packet would play. A converter that can start adjusting only does so once the estimator measured a drift with the converter out
+* of the loop. Late packets, cuts, stretches, overruns, silence played by a starved endpoint and capture
+* discontinuities step the level; the estimator locks again after each of them instead of taking the step for drift.
+*
+* Times are steady clock nanoseconds, or the virtual time of a manual pump: the capture loops and the latency harness
+* drive the same code.
+*/
+class RenderPath
+{
+public:
+    RenderPath() = default;
+    RenderPath(const RenderPath&) = delete;
+    RenderPath& operator=(const RenderPath&) = delete;
+
+    // Allocates the ring for packets of up to maxPacketFrames captured frames and starts the pump
+    HRESULT Start(IRenderTarget* target, IRenderConverter* converter, const WAVEFORMATEX& captureFormat,
+        const WAVEFORMATEX& outputFormat, UINT32 maxPacketFrames, const RenderPathOptions& options);
+    // Stops the pump and the endpoint. Returns the error that stopped the pump early, if any.
+    HRESULT Stop();
+    bool IsStarted() const { return m_Converter != nullptr; }
+
+    // Converts a captured packet into the ring. Never blocks: frames that do not fit in the ring are dropped.
+    // packetAgeUs is the time since the first frame of the packet was captured, 0 if unknown. Capture thread only.
+    void WritePacket(BYTE* data, UINT32 frames, UINT64 packetAgeUs, INT64 nowNs);
+    // The capture source lost audio before the next packet. Capture thread only.
+    void OnCaptureDiscontinuity() { m_bDiscontinuity = true; }
+    // One wakeup of a manual pump
+    HRESULT Pump(INT64 nowNs) { return m_Pump.Pump(nowNs); }
+
+    SpscFrameRingStats GetRingStats() const { return m_Ring.GetStats(); }
+    RenderPumpStats GetPumpStats() const { return m_Pump.GetStats(); }
+    bool HasJitterBuffer() const { return m_JitterBuffer.IsInitialized(); }
+    const JitterBufferStats& GetJitterStats() const { return m_JitterBuffer.GetStats(); }
+    // Initialized when the converter is adjustable or can start adjusting
+    const DriftEstimator& GetDriftEstimator() const { return m_DriftEstimator; }
+
+private:
+    // Sum of the counters of the events that step the level, see WritePacket
+    UINT64 CountLevelSteps() const;
+    // Publishes frames written to the BeginWrite region, counting the ones a full ring drops
+    void EndWrite(UINT32 frames);
+
+    IRenderConverter* m_Converter = nullptr;
+    UINT32 m_CaptureRate = 0;
+    UINT32 m_CaptureBlockAlign = 0;
+    UINT32 m_OutputRate = 0;
+    // Largest packet converted at once. Larger packets are split.
+    UINT32 m_MaxPacketFrames = 0;
+    bool m_bStreamStarted = false;
+    // The converter follows the drift estimate
+    bool m_bAdjusting = false;
+    // Level steps counted and discontinuity reported up to the last packet
+    UINT64 m_LevelSteps = 0;
+    bool m_bDiscontinuity = false;
+
+    // Converted frames waiting for the pump. Written by the capture thread only, read by the pump only.
+    SpscFrameRing m_Ring;
+    RenderPump m_Pump;
+    DriftEstimator m_DriftEstimator;
+    JitterBuffer m_JitterBuffer;
+};
@@ -0,0 +1,361 @@
+#include "RenderPump.h"
+#include "LogRing.h"
+#include "PipelineCounters.h"
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#ifdef _WIN32
+#include <avrt.h>
+#endif
+
+RenderPump::~RenderPump()
+{
+    Stop();
+}
+
+//
+//  Start()
+//
+//  Starts the consumer thread. The target itself is started by the thread once the ring is prefilled.
+//
+HRESULT RenderPump::Start(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 wakeIntervalMs, UINT32 prefillFrames)
+{
+    if (wakeIntervalMs == 0)
+    {
+        return E_INVALIDARG;
+    }
+    HRESULT hr = Attach(target, ring, sampleRate, prefillFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_WakeIntervalMs = wakeIntervalMs;
+    m_bStopRequested = false;
+    m_Thread = std::thread(&RenderPump::ThreadProc, this);
+    return S_OK;
+}
+
+HRESULT RenderPump::StartManual(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 prefillFrames)
+{
+    HRESULT hr = Attach(target, ring, sampleRate, prefillFrames);
+    if (SUCCEEDED(hr))
+    {
+        m_bManual = true;
+    }
+    return hr;
+}
+
+HRESULT RenderPump::Pump(INT64 timeNs)
+{
+    if (!m_bManual)
+    {
+        return E_UNEXPECTED;
+    }
+    if (FAILED(m_hrThread))
+    {
+        return m_hrThread;
+    }
+    m_hrThread = PumpOnce(timeNs);
+    return m_hrThread;
+}
+
+HRESULT RenderPump::Attach(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 prefillFrames)
+{
+    if (target == nullptr || ring == nullptr || !ring->IsInitialized() || sampleRate == 0)
+    {
+        return E_INVALIDARG;
+    }
+    if (m_Thread.joinable() || m_bManual)
+    {
+        return E_UNEXPECTED;
+    }
+
+    HRESULT hr = target->GetBufferSize(&m_BufferFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_Target = target;
+    m_Ring = ring;
+    m_SampleRate = sampleRate;
+    m_bStarved = false;
+    m_EnginePeriodFrames = 0;
+    m_bHasTick = false;
+    m_PrefillFrames = std::min(prefillFrames, ring->GetCapacityFrames());
+    m_bTargetStarted = false;
+    m_PositionSequence.store(0, std::memory_order_relaxed);
+    m_hrThread = S_OK;
+    return S_OK;
+}
+
+HRESULT RenderPump::Stop()
+{
+    if (!m_Thread.joinable() && !m_bManual)
+    {
+        return S_OK;
+    }
+
+    if (m_Thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_bStopRequested = true;
+        }
+        m_StopRequested.notify_one();
+        m_Thread.join();
+    }
+    m_bManual = false;
+
+    if (m_bTargetStarted)
+    {
+        m_Target->Stop();
+        m_bTargetStarted = false;
+    }
+
+    return m_hrThread;
+}
+
+RenderPumpStats RenderPump::GetStats() const
+{
+    RenderPumpStats stats;
+    stats.framesRendered = m_FramesRendered.load(std::memory_order_relaxed);
+    stats.wakeups = m_Wakeups.load(std::memory_order_relaxed);
+    stats.starvedWakeups = m_StarvedWakeups.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool RenderPump::GetPlayPosition(UINT64* pPlayedFrames, INT64* pTimeNs) const
+{
+    for (;;)
+    {
+        UINT32 sequence = m_PositionSequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+        {
+            return false;
+        }
+        if (sequence & 1)
+        {
+            continue;
+        }
+        UINT64 playedFrames = m_PlayedFrames.load(std::memory_order_relaxed);
+        INT64 timeNs = m_PlayedTimeNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_PositionSequence.load(std::memory_order_relaxed) == sequence)
+        {
+            *pPlayedFrames = playedFrames;
+            *pTimeNs = timeNs;
+            return true;
+        }
+    }
+}
+
+void RenderPump::PublishPlayPosition(UINT64 playedFrames, INT64 timeNs)
+{
+    UINT32 sequence = m_PositionSequence.load(std::memory_order_relaxed);
+    m_PositionSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_PlayedFrames.store(playedFrames, std::memory_order_relaxed);
+    m_PlayedTimeNs.store(timeNs, std::memory_order_relaxed);
+    m_PositionSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void RenderPump::ThreadProc()
+{
+#ifdef _WIN32
+    // Same scheduling class as the capture work queue
+    DWORD taskIndex = 0;
+    HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+#endif
+
+    LOOPBACK_TRACE_THREAD("Render pump");
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_StopRequested.wait_for(lock, std::chrono::milliseconds(m_WakeIntervalMs), [this] { return m_bStopRequested; }))
+    {
+        lock.unlock();
+        INT64 nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        HRESULT hr = PumpOnce(nowNs);
+        lock.lock();
+
+        if (FAILED(hr))
+        {
+            // The endpoint is gone (device removed, format changed...). Capture keeps running; the ring just fills up.
+            LOOPBACK_LOG(LogLevel::Error, 0, "Render pump stopped: {:x}", (UINT32)hr);
+            m_hrThread = hr;
+            break;
+        }
+    }
+
+#ifdef _WIN32
+    if (hTask != NULL)
+    {
+        AvRevertMmThreadCharacteristics(hTask);
+    }
+#endif
+}
+
+//
+//  PumpOnce()
+//
+//  Copies as many frames as both the ring and the endpoint buffer allow
+//
+HRESULT RenderPump::PumpOnce(INT64 timeNs)
+{
+    m_Wakeups.fetch_add(1, std::memory_order_relaxed);
+
+    UINT32 readable = m_Ring->GetReadableFrames();
+    if (!m_bTargetStarted && (readable == 0 || readable < m_PrefillFrames))
+    {
+        return S_OK;
+    }
+
+    UINT32 padding = 0;
+    HRESULT hr = m_Target->GetCurrentPadding(&padding);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    if (m_bTargetStarted)
+    {
+        UpdateEngineClock(timeNs, padding);
+        if (HasPlayedSilence(timeNs, padding))
+        {
+            m_StarvedWakeups.fetch_add(1, std::memory_order_relaxed);
+            PipelineCounters::Add(PipelineCounter::RenderStarvedWakeups);
+            LOOPBACK_LOG(LogLevel::Warning, 1000, "Render endpoint starved: {} frames left in the ring", readable);
+        }
+        // Everything written to the endpoint that is not pending in its buffer has been played, by the last engine
+        // tick: extrapolating from the tick rather than from the wakeup keeps the position from depending on where the
+        // wakeup falls between two ticks
+        PublishPlayPosition(m_FramesRendered.load(std::memory_order_relaxed) - padding, (INT64)std::llround(GetLastTickNs(timeNs)));
+    }
+
+    UINT32 frames = std::min(readable, m_BufferFrames - padding);
+    if (frames > 0)
+    {
+        LOOPBACK_TRACE_SPAN("Render buffer");
+        BYTE* pData = nullptr;
+        hr = m_Target->GetBuffer(frames, &pData);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        frames = m_Ring->Read(pData, frames);
+        hr = m_Target->ReleaseBuffer(frames, 0);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_FramesRendered.fetch_add(frames, std::memory_order_relaxed);
+        PipelineCounters::Add(PipelineCounter::FramesRendered, frames);
+    }
+    m_LastWakeNs = timeNs;
+    m_LastPaddingFrames = padding + frames;
+    if (m_LastPaddingFrames > 0)
+    {
+        m_RefillNs = timeNs;
+        m_RefillPaddingFrames = m_LastPaddingFrames;
+        m_bStarved = false;
+    }
+
+    if (!m_bTargetStarted)
+    {
+        hr = m_Target->Start();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_bTargetStarted = true;
+    }
+
+    return S_OK;
+}
+
+//
+//  UpdateEngineClock()
+//
+//  Learns the engine period from the drop of the padding since the last wakeup, and brackets the last tick: it is in
+//  the last period before now, after the last wakeup. The bracket of the earlier tick, moved forward by whole periods
+//  and widened by the largest clock drift over that time, narrows it down, unless they miss each other, e.g. after
+//  the endpoint restarted.
+//
+void RenderPump::UpdateEngineClock(INT64 timeNs, UINT32 padding)
+{
+    if (padding >= m_LastPaddingFrames)
+    {
+        return;
+    }
+    if (padding > 0)
+    {
+        UINT32 consumed = m_LastPaddingFrames - padding;
+        m_EnginePeriodFrames = (m_EnginePeriodFrames == 0) ? consumed : std::min(m_EnginePeriodFrames, consumed);
+    }
+
+    double lowNs = (double)m_LastWakeNs;
+    double highNs = (double)timeNs;
+    if (m_EnginePeriodFrames > 0)
+    {
+        double periodNs = m_EnginePeriodFrames * 1e9 / m_SampleRate;
+        lowNs = std::max(lowNs, highNs - periodNs);
+        if (m_bHasTick)
+        {
+            double shiftNs = std::round((highNs - m_TickHighNs) / periodNs) * periodNs;
+            double marginNs = std::fabs(shiftNs) * MaxClockDriftPpm * 1e-6;
+            double earlierLowNs = m_TickLowNs + shiftNs - marginNs;
+            double earlierHighNs = m_TickHighNs + shiftNs + marginNs;
+            if (earlierLowNs < highNs && earlierHighNs > lowNs)
+            {
+                lowNs = std::max(lowNs, earlierLowNs);
+                highNs = std::min(highNs, earlierHighNs);
+            }
+        }
+    }
+    m_bHasTick = true;
+    m_TickLowNs = lowNs;
+    m_TickHighNs = highNs;
+}
+
+//
+//  GetLastTickNs()
+//
+//  The estimated time of the last engine tick before timeNs, or timeNs until the ticks are bracketed
+//
+double RenderPump::GetLastTickNs(INT64 timeNs) const
+{
+    if (!m_bHasTick || m_EnginePeriodFrames == 0)
+    {
+        return (double)timeNs;
+    }
+    double periodNs = m_EnginePeriodFrames * 1e9 / m_SampleRate;
+    double tickNs = (m_TickLowNs + m_TickHighNs) / 2;
+    return tickNs + std::floor((timeNs - tickNs) / periodNs) * periodNs;
+}
+
+//
+//  HasPlayedSilence()
+//
+//  With the buffer empty, the frames the last refill left ran short at the tick after their last full period; the
+//  engine has played silence if that tick is past. Until the ticks are bracketed, the engine is taken to play
+//  continuously. Returns true once per gap.
+//
+bool RenderPump::HasPlayedSilence(INT64 timeNs, UINT32 padding)
+{
+    if (padding > 0 || m_bStarved)
+    {
+        return false;
+    }
+
+    double silenceNs = m_RefillNs + m_RefillPaddingFrames * 1e9 / m_SampleRate;
+    if (m_bHasTick && m_EnginePeriodFrames > 0)
+    {
+        double periodNs = m_EnginePeriodFrames * 1e9 / m_SampleRate;
+        double firstTickNs = GetLastTickNs(m_RefillNs) + periodNs;
+        silenceNs = firstTickNs + (m_RefillPaddingFrames / m_EnginePeriodFrames) * periodNs;
+    }
+    m_bStarved = (timeNs >= silenceNs);
+    return m_bStarved;
+}
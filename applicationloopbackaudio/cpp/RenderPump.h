@@ -0,0 +1,108 @@
+#pragma once
+
+#include "RenderTarget.h"
+#include "SpscFrameRing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+* Counters of a RenderPump. Safe to read from any thread while the pump runs.
+*/
+struct RenderPumpStats
+{
+    UINT64 framesRendered = 0;
+    UINT64 wakeups = 0;
+    // Wakeups that found the endpoint had run out of frames long enough ago to play silence, once per gap. An empty
+    // buffer refilled before the endpoint needed the next frames is not counted.
+    UINT64 starvedWakeups = 0;
+};
+
+/**
+* Consumer thread that moves frames from an SpscFrameRing into an IRenderTarget.
+*
+* Wakes up every wakeIntervalMs and tops the endpoint buffer up with as many frames as the ring holds. The target is
+* started once the ring holds prefillFrames frames, so the endpoint does not start on an almost empty buffer. Frames
+* captured while the target is slow stay in the ring instead of being dropped.
+*
+* The endpoint buffer often runs empty just before a wakeup refills it, which is not a starve. The engine takes one
+* period of frames out of the buffer at each of its ticks: a drop of the padding between two wakeups brackets a tick,
+* the brackets of successive ticks narrow each other down, and the smallest drop that leaves frames in the buffer is
+* the period. From them, the pump works out the tick at which the frames of the last refill ran short, and counts a
+* starve when it finds the buffer empty after that tick.
+*
+* A pump started with StartManual has no thread: its owner calls Pump at each wakeup, with the time of its own clock.
+* Simulations use it to run the render path on a virtual clock.
+*/
+class RenderPump
+{
+public:
+    RenderPump() = default;
+    ~RenderPump();
+
+    // sampleRate is the rate of the endpoint
+    HRESULT Start(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 wakeIntervalMs, UINT32 prefillFrames);
+    // Same as Start, without the thread
+    HRESULT StartManual(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 prefillFrames);
+    // One wakeup of a manual pump. timeNs is the time of the wakeup on the clock GetPlayPosition reports.
+    HRESULT Pump(INT64 timeNs);
+    // Stops the thread and the target. Returns the error that stopped the thread early, if any.
+    HRESULT Stop();
+
+    RenderPumpStats GetStats() const;
+    // Frames the endpoint had played at the last wakeup, and the steady clock time in nanoseconds they were played by
+    // (the Pump time of a manual pump): the engine tick that played the last of them once the ticks are bracketed, the
+    // wakeup until then. Returns false until the target has started. Safe to call from any thread while the pump runs.
+    bool GetPlayPosition(UINT64* pPlayedFrames, INT64* pTimeNs) const;
+
+private:
+    // Largest drift between the endpoint clock and the steady clock the tick bracket allows for
+    static constexpr UINT32 MaxClockDriftPpm = 1000;
+
+    HRESULT Attach(IRenderTarget* target, SpscFrameRing* ring, UINT32 sampleRate, UINT32 prefillFrames);
+    void ThreadProc();
+    HRESULT PumpOnce(INT64 timeNs);
+    void UpdateEngineClock(INT64 timeNs, UINT32 padding);
+    double GetLastTickNs(INT64 timeNs) const;
+    bool HasPlayedSilence(INT64 timeNs, UINT32 padding);
+    void PublishPlayPosition(UINT64 playedFrames, INT64 timeNs);
+
+    IRenderTarget* m_Target = nullptr;
+    SpscFrameRing* m_Ring = nullptr;
+    UINT32 m_WakeIntervalMs = 5;
+    UINT32 m_PrefillFrames = 0;
+    UINT32 m_BufferFrames = 0;
+    UINT32 m_SampleRate = 0;
+    bool m_bTargetStarted = false;
+    // Time of the last wakeup of the started target and the padding it left
+    INT64 m_LastWakeNs = 0;
+    UINT32 m_LastPaddingFrames = 0;
+    // Time of the last wakeup that left frames in the endpoint buffer, the padding it left, and whether the engine has
+    // been found to play silence since
+    INT64 m_RefillNs = 0;
+    UINT32 m_RefillPaddingFrames = 0;
+    bool m_bStarved = false;
+    // Engine period, and a bracket of the time of one of its ticks once the padding has dropped
+    UINT32 m_EnginePeriodFrames = 0;
+    bool m_bHasTick = false;
+    double m_TickLowNs = 0.0;
+    double m_TickHighNs = 0.0;
+    bool m_bManual = false;
+    HRESULT m_hrThread = S_OK;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_StopRequested;
+    bool m_bStopRequested = false;
+
+    std::atomic<UINT64> m_FramesRendered { 0 };
+    std::atomic<UINT64> m_Wakeups { 0 };
+    std::atomic<UINT64> m_StarvedWakeups { 0 };
+
+    // Play position, published under a sequence lock: odd while the pump updates it, 0 until the first update
+    std::atomic<UINT32> m_PositionSequence { 0 };
+    std::atomic<UINT64> m_PlayedFrames { 0 };
+    std::atomic<INT64> m_PlayedTimeNs { 0 };
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Destination of rendered audio frames.
+*
+* Mirrors the subset of IAudioClient and IAudioRenderClient the render pump needs, so it can feed a live output
+* endpoint or a simulated one.
+*/
+class IRenderTarget
+{
+public:
+    virtual ~IRenderTarget() = default;
+
+    virtual HRESULT Start() = 0;
+    virtual HRESULT Stop() = 0;
+
+    // Size of the endpoint buffer, in frames
+    virtual HRESULT GetBufferSize(UINT32* pNumBufferFrames) = 0;
+    // Frames written to the endpoint buffer that have not been played yet
+    virtual HRESULT GetCurrentPadding(UINT32* pNumPaddingFrames) = 0;
+    virtual HRESULT GetBuffer(UINT32 NumFramesRequested, BYTE** ppData) = 0;
+    virtual HRESULT ReleaseBuffer(UINT32 NumFramesWritten, DWORD dwFlags) = 0;
+};
@@ -0,0 +1,766 @@
+#include "SampleConvert.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+template <SampleFormat Format>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<SampleFormat::Int16>
+{
+    static const bool bFloat = false;
+    static const UINT32 Bytes = 2;
+    static const UINT32 Bits = 16;
+};
+
+template <>
+struct SampleTraits<SampleFormat::Int24>
+{
+    static const bool bFloat = false;
+    static const UINT32 Bytes = 3;
+    static const UINT32 Bits = 24;
+};
+
+template <>
+struct SampleTraits<SampleFormat::Int32>
+{
+    static const bool bFloat = false;
+    static const UINT32 Bytes = 4;
+    static const UINT32 Bits = 32;
+};
+
+template <>
+struct SampleTraits<SampleFormat::Float32>
+{
+    static const bool bFloat = true;
+    static const UINT32 Bytes = 4;
+    typedef float Type;
+};
+
+template <>
+struct SampleTraits<SampleFormat::Float64>
+{
+    static const bool bFloat = true;
+    static const UINT32 Bytes = 8;
+    typedef double Type;
+};
+
+// Full scale of an integer format, and the clipping range of float to integer conversions
+template <SampleFormat Format>
+static constexpr double IntScale() { return (double)(1ull << (SampleTraits<Format>::Bits - 1)); }
+template <SampleFormat Format>
+static constexpr INT32 IntMax() { return (INT32)((1ull << (SampleTraits<Format>::Bits - 1)) - 1); }
+
+// Integer samples scaled to the full 32-bit range
+static const double Int32ToReal = 1.0 / 2147483648.0;
+
+//
+//  Scalar reference kernels
+//
+
+// Reads an integer sample, shifted up to the full 32-bit range
+template <SampleFormat Format>
+static inline INT32 ReadInt(const BYTE* p)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        int16_t value;
+        memcpy(&value, p, sizeof(value));
+        return (INT32)((UINT32)(WORD)value << 16);
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        return (INT32)((UINT32)p[0] << 8 | (UINT32)p[1] << 16 | (UINT32)p[2] << 24);
+    }
+    else
+    {
+        INT32 value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+}
+
+// Writes an integer sample that is already in the range of the format
+template <SampleFormat Format>
+static inline void WriteInt(BYTE* p, INT32 value)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        int16_t sample = (int16_t)value;
+        memcpy(p, &sample, sizeof(sample));
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        p[0] = (BYTE)value;
+        p[1] = (BYTE)(value >> 8);
+        p[2] = (BYTE)(value >> 16);
+    }
+    else
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+}
+
+// Drops the bits of a full range sample the format does not hold, rounding to nearest
+template <SampleFormat Format>
+static inline INT32 NarrowInt(INT32 value)
+{
+    const int shift = 32 - SampleTraits<Format>::Bits;
+    if constexpr (shift == 0)
+    {
+        return value;
+    }
+    else
+    {
+        // Adding the highest dropped bit after the shift cannot overflow; only the positive maximum rounds out of range
+        INT32 rounded = (value >> shift) + ((value >> (shift - 1)) & 1);
+        return std::min(rounded, IntMax<Format>());
+    }
+}
+
+template <SampleFormat Format>
+static inline double ReadReal(const BYTE* p)
+{
+    typename SampleTraits<Format>::Type value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+template <SampleFormat Format>
+static inline void WriteReal(BYTE* p, double value)
+{
+    typename SampleTraits<Format>::Type sample = (typename SampleTraits<Format>::Type)value;
+    memcpy(p, &sample, sizeof(sample));
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+static inline void ConvertSample(const BYTE* src, BYTE* dst)
+{
+    if constexpr (Src == Dst)
+    {
+        memcpy(dst, src, SampleTraits<Src>::Bytes);
+    }
+    else if constexpr (!SampleTraits<Src>::bFloat && !SampleTraits<Dst>::bFloat)
+    {
+        WriteInt<Dst>(dst, NarrowInt<Dst>(ReadInt<Src>(src)));
+    }
+    else if constexpr (!SampleTraits<Src>::bFloat)
+    {
+        WriteReal<Dst>(dst, ReadInt<Src>(src) * Int32ToReal);
+    }
+    else if constexpr (SampleTraits<Dst>::bFloat)
+    {
+        WriteReal<Dst>(dst, ReadReal<Src>(src));
+    }
+    else
+    {
+        // The bounds come first so NaN clips to the negative end, as the vector kernels do
+        double value = ReadReal<Src>(src) * IntScale<Dst>();
+        value = std::min((double)IntMax<Dst>(), std::max(-IntScale<Dst>(), value));
+        WriteInt<Dst>(dst, (INT32)lrint(value));
+    }
+}
+
+// Samples in the smallest run of whole frames that is also a whole number of 4-sample vector blocks
+static constexpr UINT32 FrameBlockSamples(UINT32 channels)
+{
+    return channels * 4 / ((channels % 4 == 0) ? 4 : (channels % 2 == 0) ? 2 : 1);
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+struct ScalarKernel
+{
+    static void Convert(const BYTE* src, BYTE* dst, size_t samples)
+    {
+        for (size_t i = 0; i < samples; i++)
+        {
+            ConvertSample<Src, Dst>(src, dst);
+            src += SampleTraits<Src>::Bytes;
+            dst += SampleTraits<Dst>::Bytes;
+        }
+    }
+
+    template <UINT32 Channels>
+    static void ConvertFrames(const BYTE* src, BYTE* dst, UINT32 frames)
+    {
+        if constexpr (Src == Dst)
+        {
+            memcpy(dst, src, (size_t)frames * Channels * SampleTraits<Src>::Bytes);
+            return;
+        }
+        for (UINT32 i = 0; i < frames; i++)
+        {
+            for (UINT32 channel = 0; channel < Channels; channel++)
+            {
+                ConvertSample<Src, Dst>(src + channel * SampleTraits<Src>::Bytes, dst + channel * SampleTraits<Dst>::Bytes);
+            }
+            src += Channels * SampleTraits<Src>::Bytes;
+            dst += Channels * SampleTraits<Dst>::Bytes;
+        }
+    }
+};
+
+//
+//  Vector kernels
+//
+//  Each kernel converts blocks of 4 samples and leaves the remainder to the scalar reference. Integers are widened to
+//  the full 32-bit range on load, like ReadInt, so every pairing is a load, at most one conversion and a store.
+//
+
+#if defined(CPU_X86)
+template <SampleFormat Format>
+TARGET_SSE41 static inline __m128i LoadInt4SSE41(const BYTE* p)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        return _mm_slli_epi32(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))), 16);
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        // Gather the 12 bytes without reading past them, then move each sample to the top 3 bytes of its lane
+        INT32 tail;
+        memcpy(&tail, p + 8, sizeof(tail));
+        __m128i bytes = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_cvtsi32_si128(tail));
+        return _mm_shuffle_epi8(bytes, _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+    }
+    else
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+}
+
+// Stores 4 integer samples that are already in the range of the format
+template <SampleFormat Format>
+TARGET_SSE41 static inline void StoreInt4SSE41(BYTE* p, __m128i values)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(values, values));
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        __m128i bytes = _mm_shuffle_epi8(values, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), bytes);
+        INT32 tail = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+        memcpy(p + 8, &tail, sizeof(tail));
+    }
+    else
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), values);
+    }
+}
+
+template <SampleFormat Format>
+TARGET_SSE41 static inline __m128i NarrowInt4SSE41(__m128i values)
+{
+    const int shift = 32 - SampleTraits<Format>::Bits;
+    if constexpr (shift == 0)
+    {
+        return values;
+    }
+    else
+    {
+        __m128i rounded = _mm_add_epi32(_mm_srai_epi32(values, shift), _mm_and_si128(_mm_srai_epi32(values, shift - 1), _mm_set1_epi32(1)));
+        return _mm_min_epi32(rounded, _mm_set1_epi32(IntMax<Format>()));
+    }
+}
+
+// Scales, clips and rounds 4 floats to integers of the format
+template <SampleFormat Format>
+TARGET_SSE41 static inline __m128i FloatToInt4SSE41(__m128 values)
+{
+    __m128 scaled = _mm_mul_ps(values, _mm_set1_ps((float)IntScale<Format>()));
+    // MAXPS returns its second operand for NaN, so NaN clips to the negative end like the scalar kernel
+    scaled = _mm_max_ps(scaled, _mm_set1_ps((float)-IntScale<Format>()));
+    if constexpr (Format == SampleFormat::Int32)
+    {
+        // 2^31 - 1 is not a float: conversions of 2^31 and above return 0x80000000, which is flipped to 0x7FFFFFFF
+        __m128i overflow = _mm_castps_si128(_mm_cmpge_ps(scaled, _mm_set1_ps(2147483648.0f)));
+        return _mm_xor_si128(_mm_cvtps_epi32(scaled), overflow);
+    }
+    else
+    {
+        return _mm_cvtps_epi32(_mm_min_ps(scaled, _mm_set1_ps((float)IntMax<Format>())));
+    }
+}
+
+template <SampleFormat Format>
+TARGET_SSE41 static inline __m128i DoubleToInt4SSE41(__m128d low, __m128d high)
+{
+    const __m128d scale = _mm_set1_pd(IntScale<Format>());
+    const __m128d minimum = _mm_set1_pd(-IntScale<Format>());
+    const __m128d maximum = _mm_set1_pd((double)IntMax<Format>());
+    low = _mm_min_pd(_mm_max_pd(_mm_mul_pd(low, scale), minimum), maximum);
+    high = _mm_min_pd(_mm_max_pd(_mm_mul_pd(high, scale), minimum), maximum);
+    return _mm_unpacklo_epi64(_mm_cvtpd_epi32(low), _mm_cvtpd_epi32(high));
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+TARGET_SSE41 static inline void Convert4SSE41(const BYTE* src, BYTE* dst)
+{
+    const bool bSrcFloat = SampleTraits<Src>::bFloat;
+    const bool bDstFloat = SampleTraits<Dst>::bFloat;
+    if constexpr (Src == Dst)
+    {
+        memcpy(dst, src, 4 * SampleTraits<Src>::Bytes);
+    }
+    else if constexpr (!bSrcFloat && !bDstFloat)
+    {
+        StoreInt4SSE41<Dst>(dst, NarrowInt4SSE41<Dst>(LoadInt4SSE41<Src>(src)));
+    }
+    else if constexpr (!bSrcFloat && Dst == SampleFormat::Float32)
+    {
+        // Scaling by a power of two is exact, so this rounds once, like the scalar conversion through double
+        __m128 values = _mm_mul_ps(_mm_cvtepi32_ps(LoadInt4SSE41<Src>(src)), _mm_set1_ps((float)Int32ToReal));
+        _mm_storeu_ps(reinterpret_cast<float*>(dst), values);
+    }
+    else if constexpr (!bSrcFloat)
+    {
+        __m128i values = LoadInt4SSE41<Src>(src);
+        const __m128d scale = _mm_set1_pd(Int32ToReal);
+        _mm_storeu_pd(reinterpret_cast<double*>(dst), _mm_mul_pd(_mm_cvtepi32_pd(values), scale));
+        _mm_storeu_pd(reinterpret_cast<double*>(dst) + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(values, 8)), scale));
+    }
+    else if constexpr (Src == SampleFormat::Float32 && Dst == SampleFormat::Float64)
+    {
+        __m128 values = _mm_loadu_ps(reinterpret_cast<const float*>(src));
+        _mm_storeu_pd(reinterpret_cast<double*>(dst), _mm_cvtps_pd(values));
+        _mm_storeu_pd(reinterpret_cast<double*>(dst) + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+    }
+    else if constexpr (Src == SampleFormat::Float64 && Dst == SampleFormat::Float32)
+    {
+        __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(reinterpret_cast<const double*>(src)));
+        __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(reinterpret_cast<const double*>(src) + 2));
+        _mm_storeu_ps(reinterpret_cast<float*>(dst), _mm_movelh_ps(low, high));
+    }
+    else if constexpr (Src == SampleFormat::Float32)
+    {
+        StoreInt4SSE41<Dst>(dst, FloatToInt4SSE41<Dst>(_mm_loadu_ps(reinterpret_cast<const float*>(src))));
+    }
+    else
+    {
+        __m128d low = _mm_loadu_pd(reinterpret_cast<const double*>(src));
+        __m128d high = _mm_loadu_pd(reinterpret_cast<const double*>(src) + 2);
+        StoreInt4SSE41<Dst>(dst, DoubleToInt4SSE41<Dst>(low, high));
+    }
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+struct SSE41Kernel
+{
+    TARGET_SSE41 static void Convert(const BYTE* src, BYTE* dst, size_t samples)
+    {
+        size_t i = 0;
+        for (; i + 4 <= samples; i += 4)
+        {
+            Convert4SSE41<Src, Dst>(src, dst);
+            src += 4 * SampleTraits<Src>::Bytes;
+            dst += 4 * SampleTraits<Dst>::Bytes;
+        }
+        ScalarKernel<Src, Dst>::Convert(src, dst, samples - i);
+    }
+
+    // Converts runs of frames that fill whole vector blocks, with a constant trip count the compiler unrolls
+    template <UINT32 Channels>
+    TARGET_SSE41 static void ConvertFrames(const BYTE* src, BYTE* dst, UINT32 frames)
+    {
+        if constexpr (Src == Dst)
+        {
+            ScalarKernel<Src, Dst>::template ConvertFrames<Channels>(src, dst, frames);
+            return;
+        }
+        const UINT32 blockSamples = FrameBlockSamples(Channels);
+        const UINT32 blockFrames = blockSamples / Channels;
+        UINT32 i = 0;
+        for (; i + blockFrames <= frames; i += blockFrames)
+        {
+            for (UINT32 k = 0; k < blockSamples; k += 4)
+            {
+                Convert4SSE41<Src, Dst>(src + k * SampleTraits<Src>::Bytes, dst + k * SampleTraits<Dst>::Bytes);
+            }
+            src += blockSamples * SampleTraits<Src>::Bytes;
+            dst += blockSamples * SampleTraits<Dst>::Bytes;
+        }
+        ScalarKernel<Src, Dst>::template ConvertFrames<Channels>(src, dst, frames - i);
+    }
+};
+#endif
+
+#if defined(CPU_NEON) && (defined(_M_ARM64) || defined(__aarch64__))
+#define SAMPLE_CONVERT_NEON 1
+
+template <SampleFormat Format>
+static inline int32x4_t LoadInt4NEON(const BYTE* p)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        return vshll_n_s16(vld1_s16(reinterpret_cast<const int16_t*>(p)), 16);
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        INT32 values[4] = { ReadInt<Format>(p), ReadInt<Format>(p + 3), ReadInt<Format>(p + 6), ReadInt<Format>(p + 9) };
+        return vld1q_s32(values);
+    }
+    else
+    {
+        return vld1q_s32(reinterpret_cast<const int32_t*>(p));
+    }
+}
+
+template <SampleFormat Format>
+static inline void StoreInt4NEON(BYTE* p, int32x4_t values)
+{
+    if constexpr (Format == SampleFormat::Int16)
+    {
+        vst1_s16(reinterpret_cast<int16_t*>(p), vmovn_s32(values));
+    }
+    else if constexpr (Format == SampleFormat::Int24)
+    {
+        INT32 samples[4];
+        vst1q_s32(samples, values);
+        for (int i = 0; i < 4; i++)
+        {
+            WriteInt<Format>(p + 3 * i, samples[i]);
+        }
+    }
+    else
+    {
+        vst1q_s32(reinterpret_cast<int32_t*>(p), values);
+    }
+}
+
+template <SampleFormat Format>
+static inline int32x4_t NarrowInt4NEON(int32x4_t values)
+{
+    const int shift = 32 - SampleTraits<Format>::Bits;
+    if constexpr (shift == 0)
+    {
+        return values;
+    }
+    else
+    {
+        int32x4_t rounded = vaddq_s32(vshrq_n_s32(values, shift), vandq_s32(vshrq_n_s32(values, shift - 1), vdupq_n_s32(1)));
+        return vminq_s32(rounded, vdupq_n_s32(IntMax<Format>()));
+    }
+}
+
+template <SampleFormat Format>
+static inline int32x4_t FloatToInt4NEON(float32x4_t values)
+{
+    // FMAXNM returns the number when the other operand is NaN, so NaN clips to the negative end
+    float32x4_t scaled = vmaxnmq_f32(vmulq_n_f32(values, (float)IntScale<Format>()), vdupq_n_f32((float)-IntScale<Format>()));
+    if constexpr (Format != SampleFormat::Int32)
+    {
+        scaled = vminnmq_f32(scaled, vdupq_n_f32((float)IntMax<Format>()));
+    }
+    // FCVTNS saturates, which clips 2^31 and above to 0x7FFFFFFF
+    return vcvtnq_s32_f32(scaled);
+}
+
+template <SampleFormat Format>
+static inline int32x2_t DoubleToInt2NEON(float64x2_t values)
+{
+    values = vmulq_n_f64(values, IntScale<Format>());
+    values = vminnmq_f64(vmaxnmq_f64(values, vdupq_n_f64(-IntScale<Format>())), vdupq_n_f64((double)IntMax<Format>()));
+    return vmovn_s64(vcvtnq_s64_f64(values));
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+static inline void Convert4NEON(const BYTE* src, BYTE* dst)
+{
+    const bool bSrcFloat = SampleTraits<Src>::bFloat;
+    const bool bDstFloat = SampleTraits<Dst>::bFloat;
+    if constexpr (Src == Dst)
+    {
+        memcpy(dst, src, 4 * SampleTraits<Src>::Bytes);
+    }
+    else if constexpr (!bSrcFloat && !bDstFloat)
+    {
+        StoreInt4NEON<Dst>(dst, NarrowInt4NEON<Dst>(LoadInt4NEON<Src>(src)));
+    }
+    else if constexpr (!bSrcFloat && Dst == SampleFormat::Float32)
+    {
+        float32x4_t values = vmulq_n_f32(vcvtq_f32_s32(LoadInt4NEON<Src>(src)), (float)Int32ToReal);
+        vst1q_f32(reinterpret_cast<float*>(dst), values);
+    }
+    else if constexpr (!bSrcFloat)
+    {
+        int32x4_t values = LoadInt4NEON<Src>(src);
+        vst1q_f64(reinterpret_cast<double*>(dst), vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(values))), Int32ToReal));
+        vst1q_f64(reinterpret_cast<double*>(dst) + 2, vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(values))), Int32ToReal));
+    }
+    else if constexpr (Src == SampleFormat::Float32 && Dst == SampleFormat::Float64)
+    {
+        float32x4_t values = vld1q_f32(reinterpret_cast<const float*>(src));
+        vst1q_f64(reinterpret_cast<double*>(dst), vcvt_f64_f32(vget_low_f32(values)));
+        vst1q_f64(reinterpret_cast<double*>(dst) + 2, vcvt_high_f64_f32(values));
+    }
+    else if constexpr (Src == SampleFormat::Float64 && Dst == SampleFormat::Float32)
+    {
+        float32x2_t low = vcvt_f32_f64(vld1q_f64(reinterpret_cast<const double*>(src)));
+        vst1q_f32(reinterpret_cast<float*>(dst), vcvt_high_f32_f64(low, vld1q_f64(reinterpret_cast<const double*>(src) + 2)));
+    }
+    else if constexpr (Src == SampleFormat::Float32)
+    {
+        StoreInt4NEON<Dst>(dst, FloatToInt4NEON<Dst>(vld1q_f32(reinterpret_cast<const float*>(src))));
+    }
+    else
+    {
+        int32x2_t low = DoubleToInt2NEON<Dst>(vld1q_f64(reinterpret_cast<const double*>(src)));
+        int32x2_t high = DoubleToInt2NEON<Dst>(vld1q_f64(reinterpret_cast<const double*>(src) + 2));
+        StoreInt4NEON<Dst>(dst, vcombine_s32(low, high));
+    }
+}
+
+template <SampleFormat Src, SampleFormat Dst>
+struct NEONKernel
+{
+    static void Convert(const BYTE* src, BYTE* dst, size_t samples)
+    {
+        size_t i = 0;
+        for (; i + 4 <= samples; i += 4)
+        {
+            Convert4NEON<Src, Dst>(src, dst);
+            src += 4 * SampleTraits<Src>::Bytes;
+            dst += 4 * SampleTraits<Dst>::Bytes;
+        }
+        ScalarKernel<Src, Dst>::Convert(src, dst, samples - i);
+    }
+
+    // Converts runs of frames that fill whole vector blocks, with a constant trip count the compiler unrolls
+    template <UINT32 Channels>
+    static void ConvertFrames(const BYTE* src, BYTE* dst, UINT32 frames)
+    {
+        if constexpr (Src == Dst)
+        {
+            ScalarKernel<Src, Dst>::template ConvertFrames<Channels>(src, dst, frames);
+            return;
+        }
+        const UINT32 blockSamples = FrameBlockSamples(Channels);
+        const UINT32 blockFrames = blockSamples / Channels;
+        UINT32 i = 0;
+        for (; i + blockFrames <= frames; i += blockFrames)
+        {
+            for (UINT32 k = 0; k < blockSamples; k += 4)
+            {
+                Convert4NEON<Src, Dst>(src + k * SampleTraits<Src>::Bytes, dst + k * SampleTraits<Dst>::Bytes);
+            }
+            src += blockSamples * SampleTraits<Src>::Bytes;
+            dst += blockSamples * SampleTraits<Dst>::Bytes;
+        }
+        ScalarKernel<Src, Dst>::template ConvertFrames<Channels>(src, dst, frames - i);
+    }
+};
+#endif
+
+// Adapts the frame converters of a kernel to the shape SelectKernel expects
+template <template <SampleFormat, SampleFormat> class Kernel, UINT32 Channels>
+struct FrameKernel
+{
+    template <SampleFormat Src, SampleFormat Dst>
+    struct Of
+    {
+        static constexpr FrameConvertFn Convert = &Kernel<Src, Dst>::template ConvertFrames<Channels>;
+    };
+};
+
+// Samples that do not change format are copied
+template <SampleFormat Format>
+static void CopySamples(const BYTE* src, BYTE* dst, size_t samples)
+{
+    memcpy(dst, src, samples * SampleTraits<Format>::Bytes);
+}
+
+template <typename Fn, template <SampleFormat, SampleFormat> class Kernel, SampleFormat Src>
+static Fn SelectKernel(SampleFormat dst)
+{
+    switch (dst)
+    {
+    case SampleFormat::Int16:
+        return Kernel<Src, SampleFormat::Int16>::Convert;
+    case SampleFormat::Int24:
+        return Kernel<Src, SampleFormat::Int24>::Convert;
+    case SampleFormat::Int32:
+        return Kernel<Src, SampleFormat::Int32>::Convert;
+    case SampleFormat::Float32:
+        return Kernel<Src, SampleFormat::Float32>::Convert;
+    case SampleFormat::Float64:
+        return Kernel<Src, SampleFormat::Float64>::Convert;
+    default:
+        return nullptr;
+    }
+}
+
+template <typename Fn, template <SampleFormat, SampleFormat> class Kernel>
+static Fn SelectKernel(SampleFormat src, SampleFormat dst)
+{
+    switch (src)
+    {
+    case SampleFormat::Int16:
+        return SelectKernel<Fn, Kernel, SampleFormat::Int16>(dst);
+    case SampleFormat::Int24:
+        return SelectKernel<Fn, Kernel, SampleFormat::Int24>(dst);
+    case SampleFormat::Int32:
+        return SelectKernel<Fn, Kernel, SampleFormat::Int32>(dst);
+    case SampleFormat::Float32:
+        return SelectKernel<Fn, Kernel, SampleFormat::Float32>(dst);
+    case SampleFormat::Float64:
+        return SelectKernel<Fn, Kernel, SampleFormat::Float64>(dst);
+    default:
+        return nullptr;
+    }
+}
+
+//
+//  SelectFrameKernel()
+//
+//  Picks the specialization of a kernel for (src, dst, channels) out of the table the templates generate
+//
+template <template <SampleFormat, SampleFormat> class Kernel>
+static FrameConvertFn SelectFrameKernel(SampleFormat src, SampleFormat dst, UINT32 channels)
+{
+    switch (channels)
+    {
+    case 1:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 1>::template Of>(src, dst);
+    case 2:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 2>::template Of>(src, dst);
+    case 3:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 3>::template Of>(src, dst);
+    case 4:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 4>::template Of>(src, dst);
+    case 5:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 5>::template Of>(src, dst);
+    case 6:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 6>::template Of>(src, dst);
+    case 7:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 7>::template Of>(src, dst);
+    case 8:
+        return SelectKernel<FrameConvertFn, FrameKernel<Kernel, 8>::template Of>(src, dst);
+    default:
+        return nullptr;
+    }
+}
+
+SampleFormat GetSampleFormat(const WAVEFORMATEX& format)
+{
+    bool bExtensible = format.wFormatTag == WAVE_FORMAT_EXTENSIBLE && format.cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    const GUID* pSubFormat = bExtensible ? &reinterpret_cast<const WAVEFORMATEXTENSIBLE&>(format).SubFormat : nullptr;
+
+    if (format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT || (pSubFormat != nullptr && *pSubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT))
+    {
+        switch (format.wBitsPerSample)
+        {
+        case 32:
+            return SampleFormat::Float32;
+        case 64:
+            return SampleFormat::Float64;
+        }
+    }
+    else if (format.wFormatTag == WAVE_FORMAT_PCM || (pSubFormat != nullptr && *pSubFormat == KSDATAFORMAT_SUBTYPE_PCM))
+    {
+        switch (format.wBitsPerSample)
+        {
+        case 16:
+            return SampleFormat::Int16;
+        case 24:
+            return SampleFormat::Int24;
+        case 32:
+            return SampleFormat::Int32;
+        }
+    }
+    return SampleFormat::Unknown;
+}
+
+UINT32 GetSampleBytes(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::Int16:
+        return 2;
+    case SampleFormat::Int24:
+        return 3;
+    case SampleFormat::Int32:
+    case SampleFormat::Float32:
+        return 4;
+    case SampleFormat::Float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Resolves Auto to the widest instruction set the CPU supports
+static SampleConvertKernel ResolveKernel(SampleConvertKernel kernel)
+{
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    if (kernel == SampleConvertKernel::Auto)
+    {
+        kernel = cpu.sse41 ? SampleConvertKernel::SSE41 : cpu.neon ? SampleConvertKernel::NEON : SampleConvertKernel::Scalar;
+    }
+    return kernel;
+}
+
+SampleConvertFn GetSampleConverter(SampleFormat src, SampleFormat dst, SampleConvertKernel kernel)
+{
+    if (src == dst)
+    {
+        switch (src)
+        {
+        case SampleFormat::Int16:
+            return CopySamples<SampleFormat::Int16>;
+        case SampleFormat::Int24:
+            return CopySamples<SampleFormat::Int24>;
+        case SampleFormat::Int32:
+            return CopySamples<SampleFormat::Int32>;
+        case SampleFormat::Float32:
+            return CopySamples<SampleFormat::Float32>;
+        case SampleFormat::Float64:
+            return CopySamples<SampleFormat::Float64>;
+        default:
+            return nullptr;
+        }
+    }
+
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    switch (kernel = ResolveKernel(kernel))
+    {
+    case SampleConvertKernel::Scalar:
+        return SelectKernel<SampleConvertFn, ScalarKernel>(src, dst);
+#if defined(CPU_X86)
+    case SampleConvertKernel::SSE41:
+        return cpu.sse41 ? SelectKernel<SampleConvertFn, SSE41Kernel>(src, dst) : nullptr;
+#endif
+#if defined(SAMPLE_CONVERT_NEON)
+    case SampleConvertKernel::NEON:
+        return SelectKernel<SampleConvertFn, NEONKernel>(src, dst);
+#endif
+    default:
+        // 32-bit ARM has no kernel of its own, so it keeps the auto-vectorized scalar one
+        return (kernel == SampleConvertKernel::NEON && cpu.neon) ? SelectKernel<SampleConvertFn, ScalarKernel>(src, dst) : nullptr;
+    }
+}
+
+FrameConvertFn GetFrameConverter(SampleFormat src, SampleFormat dst, UINT32 channels, SampleConvertKernel kernel)
+{
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    switch (kernel = ResolveKernel(kernel))
+    {
+    case SampleConvertKernel::Scalar:
+        return SelectFrameKernel<ScalarKernel>(src, dst, channels);
+#if defined(CPU_X86)
+    case SampleConvertKernel::SSE41:
+        return cpu.sse41 ? SelectFrameKernel<SSE41Kernel>(src, dst, channels) : nullptr;
+#endif
+#if defined(SAMPLE_CONVERT_NEON)
+    case SampleConvertKernel::NEON:
+        return SelectFrameKernel<NEONKernel>(src, dst, channels);
+#endif
+    default:
+        return (kernel == SampleConvertKernel::NEON && cpu.neon) ? SelectFrameKernel<ScalarKernel>(src, dst, channels) : nullptr;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Sample formats the endpoints present and the conversion kernels handle. 24-bit samples are packed in 3 bytes; 24
+* valid bits in a 32-bit container are Int32.
+*/
+enum class SampleFormat
+{
+    Unknown,
+    Int16,
+    Int24,
+    Int32,
+    Float32,
+    Float64,
+};
+
+/**
+* Instruction set used by the conversion kernels. Auto picks the widest one the CPU supports.
+*/
+enum class SampleConvertKernel
+{
+    Auto,
+    Scalar,
+    SSE41,
+    NEON,
+};
+
+// Converts interleaved samples from one format to another. Source and destination must not overlap.
+typedef void (*SampleConvertFn)(const BYTE* src, BYTE* dst, size_t samples);
+
+// Converts frames interleaved frames of the channel count the function was specialized for
+typedef void (*FrameConvertFn)(const BYTE* src, BYTE* dst, UINT32 frames);
+
+// Largest channel count GetFrameConverter has specializations for
+static const UINT32 MaxFrameConvertChannels = 8;
+
+// Sample format of the samples described by format, or Unknown if no kernel handles it
+SampleFormat GetSampleFormat(const WAVEFORMATEX& format);
+UINT32 GetSampleBytes(SampleFormat format);
+
+/**
+* Returns the kernel converting src samples to dst samples, or nullptr if the pairing or the requested instruction set
+* is not supported.
+*
+* Integers are read as fractions of full scale (a 16-bit sample is divided by 32768). Integer to integer conversions
+* widen exactly and narrow with rounding to nearest; float to integer conversions clip to the integer range and round
+* to nearest even. Every kernel produces exactly the bytes the Scalar kernel produces for the same input.
+*/
+SampleConvertFn GetSampleConverter(SampleFormat src, SampleFormat dst, SampleConvertKernel kernel = SampleConvertKernel::Auto);
+
+/**
+* Returns the converter of frames of channels interleaved src samples to dst samples, or nullptr if the pairing, the
+* channel count (up to MaxFrameConvertChannels) or the requested instruction set is not supported.
+*
+* Every (src, dst, channels) combination is a separate instantiation in which the sample formats and the frame layout
+* are compile-time constants: the per-frame loops have fixed trip counts and no format branches. Pick the converter
+* once when the formats are negotiated; the results are the same bytes as GetSampleConverter's.
+*/
+FrameConvertFn GetFrameConverter(SampleFormat src, SampleFormat dst, UINT32 channels, SampleConvertKernel kernel = SampleConvertKernel::Auto);
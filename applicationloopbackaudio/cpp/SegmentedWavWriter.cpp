@@ -0,0 +1,312 @@
+#include "SegmentedWavWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+
+SegmentedWavWriter::~SegmentedWavWriter()
+{
+    Finalize();
+}
+
+//
+//  Create()
+//
+//  Creates the first segment, then starts the background thread that prepares the second one
+//
+HRESULT SegmentedWavWriter::Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options, UINT64 segmentFrames)
+{
+    if (m_Current || format.nBlockAlign == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_FileName = fileName;
+    m_Format = format;
+    m_Options = options;
+    m_cbSegment = segmentFrames * format.nBlockAlign;
+    m_CurrentIndex = 0;
+    m_CurrentStartFrame = 0;
+    m_cbTotalData = 0;
+    m_hrBackground = S_OK;
+    m_bStopRequested = false;
+
+    if (segmentFrames == 0)
+    {
+        m_Current = CreateAudioFileWriter(fileName);
+        m_CurrentFileName = fileName;
+        HRESULT hr = m_Current->Create(fileName, format, options);
+        if (FAILED(hr))
+        {
+            m_Current.reset();
+        }
+        return hr;
+    }
+
+    Segment first;
+    HRESULT hr = CreateSegment(0, &first);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    std::filesystem::path manifestName = fileName;
+    manifestName.replace_extension(".manifest.jsonl");
+    m_Manifest.open(manifestName, std::ios::out | std::ios::trunc);
+    if (!m_Manifest)
+    {
+        first.writer->Finalize();
+        return E_INVALIDARG;
+    }
+
+    m_Current = std::move(first.writer);
+    m_CurrentFileName = first.fileName;
+
+    m_Next = Segment();
+    m_Next.index = 1;
+    m_bNextRequested = true;
+    m_Thread = std::thread(&SegmentedWavWriter::ThreadProc, this);
+    return S_OK;
+}
+
+std::filesystem::path SegmentedWavWriter::GetSegmentFileName(UINT32 index) const
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%05u", index);
+
+    std::filesystem::path name = m_FileName.stem();
+    name += suffix;
+    name += m_FileName.extension();
+    return m_FileName.parent_path() / name;
+}
+
+HRESULT SegmentedWavWriter::CreateSegment(UINT32 index, Segment* pSegment)
+{
+    pSegment->fileName = GetSegmentFileName(index);
+    pSegment->writer = CreateAudioFileWriter(pSegment->fileName);
+    pSegment->index = index;
+    return pSegment->writer->Create(pSegment->fileName, m_Format, m_Options);
+}
+
+UINT64 SegmentedWavWriter::GetSegmentBytesLeft() const
+{
+    if (m_cbSegment == 0)
+    {
+        return ~0ULL;
+    }
+    return m_cbSegment - m_Current->GetDataSize();
+}
+
+HRESULT SegmentedWavWriter::WriteData(const void* data, size_t bytes)
+{
+    const BYTE* src = static_cast<const BYTE*>(data);
+    while (bytes > 0)
+    {
+        size_t cbWrite = (size_t)std::min<UINT64>(bytes, GetSegmentBytesLeft());
+        HRESULT hr = m_Current->WriteData(src, cbWrite);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_cbTotalData += cbWrite;
+        src += cbWrite;
+        bytes -= cbWrite;
+
+        if (GetSegmentBytesLeft() == 0 && FAILED(hr = RollOver()))
+        {
+            return hr;
+        }
+    }
+    return S_OK;
+}
+
+BYTE* SegmentedWavWriter::GetDataBuffer(size_t* pcbAvailable)
+{
+    BYTE* p = m_Current->GetDataBuffer(pcbAvailable);
+    *pcbAvailable = (size_t)std::min<UINT64>(*pcbAvailable, GetSegmentBytesLeft());
+    return p;
+}
+
+HRESULT SegmentedWavWriter::CommitData(size_t bytes)
+{
+    HRESULT hr = m_Current->CommitData(bytes);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    m_cbTotalData += bytes;
+
+    if (GetSegmentBytesLeft() == 0)
+    {
+        return RollOver();
+    }
+    return S_OK;
+}
+
+//
+//  RollOver()
+//
+//  Swaps in the segment the background thread prepared. Only waits if the previous rollover's preparation has not
+//  finished yet, which takes a whole segment's worth of audio to happen.
+//
+HRESULT SegmentedWavWriter::RollOver()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_NextReady.wait(lock, [this] { return m_Next.writer != nullptr || FAILED(m_hrBackground); });
+    if (!m_Next.writer)
+    {
+        return m_hrBackground;
+    }
+
+    Segment full;
+    full.writer = std::move(m_Current);
+    full.fileName = m_CurrentFileName;
+    full.index = m_CurrentIndex;
+    full.startFrame = m_CurrentStartFrame;
+    m_Retired.push_back(std::move(full));
+
+    m_Current = std::move(m_Next.writer);
+    m_CurrentFileName = m_Next.fileName;
+    m_CurrentIndex = m_Next.index;
+    m_CurrentStartFrame += m_cbSegment / m_Format.nBlockAlign;
+
+    m_Next = Segment();
+    m_Next.index = m_CurrentIndex + 1;
+    m_bNextRequested = true;
+    lock.unlock();
+
+    m_WorkAvailable.notify_one();
+    return S_OK;
+}
+
+void SegmentedWavWriter::ThreadProc()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    for (;;)
+    {
+        m_WorkAvailable.wait(lock, [this] { return m_bStopRequested || m_bNextRequested || !m_Retired.empty(); });
+
+        HRESULT hr = S_OK;
+        if (m_bNextRequested && !m_bStopRequested)
+        {
+            // The next rollover depends on this, so it goes before closing the previous segment
+            m_bNextRequested = false;
+            Segment next;
+            UINT32 index = m_Next.index;
+            lock.unlock();
+            hr = CreateSegment(index, &next);
+            lock.lock();
+
+            if (SUCCEEDED(hr))
+            {
+                m_Next = std::move(next);
+            }
+            m_NextReady.notify_all();
+        }
+        else if (!m_Retired.empty())
+        {
+            Segment segment = std::move(m_Retired.front());
+            m_Retired.pop_front();
+            lock.unlock();
+            hr = CloseSegment(segment);
+            lock.lock();
+        }
+        else if (m_bStopRequested)
+        {
+            break;
+        }
+
+        if (FAILED(hr) && SUCCEEDED(m_hrBackground))
+        {
+            m_hrBackground = hr;
+            m_NextReady.notify_all();
+        }
+    }
+}
+
+//
+//  CloseSegment()
+//
+//  Finalizes a full segment and lists it in the manifest
+//
+HRESULT SegmentedWavWriter::CloseSegment(Segment& segment)
+{
+    UINT64 cbData = segment.writer->GetDataSize();
+    HRESULT hr = segment.writer->Finalize();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Segment names are generated from the output file name; escape the characters JSON does not allow in strings
+    std::string name;
+    for (char c : segment.fileName.filename().u8string())
+    {
+        if (c == '"' || c == '\\')
+        {
+            name += '\\';
+        }
+        name += c;
+    }
+
+    m_Manifest << "{\"segment\":" << segment.index << ",\"file\":\"" << name << "\",\"startFrame\":" << segment.startFrame
+        << ",\"frames\":" << cbData / m_Format.nBlockAlign << ",\"sampleRate\":" << m_Format.nSamplesPerSec
+        << ",\"dataBytes\":" << cbData << "}\n";
+    m_Manifest.flush();
+    return m_Manifest ? S_OK : E_FAIL;
+}
+
+//
+//  Finalize()
+//
+//  Closes the last segment through the background thread, so the manifest lists segments in order, then removes the
+//  segment that was prepared for a rollover that never came
+//
+HRESULT SegmentedWavWriter::Finalize()
+{
+    if (!m_Current)
+    {
+        return S_OK;
+    }
+
+    if (!m_Thread.joinable())
+    {
+        HRESULT hr = m_Current->Finalize();
+        m_Current.reset();
+        return hr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        // A recording that stopped exactly on a boundary leaves an empty segment behind
+        if (m_Current->GetDataSize() == 0 && m_CurrentIndex > 0)
+        {
+            m_Current->Finalize();
+            std::error_code ec;
+            std::filesystem::remove(m_CurrentFileName, ec);
+        }
+        else
+        {
+            Segment last;
+            last.writer = std::move(m_Current);
+            last.fileName = m_CurrentFileName;
+            last.index = m_CurrentIndex;
+            last.startFrame = m_CurrentStartFrame;
+            m_Retired.push_back(std::move(last));
+        }
+        m_Current.reset();
+        m_bStopRequested = true;
+    }
+    m_WorkAvailable.notify_one();
+    m_Thread.join();
+
+    if (m_Next.writer)
+    {
+        m_Next.writer->Finalize();
+        std::error_code ec;
+        std::filesystem::remove(m_Next.fileName, ec);
+        m_Next = Segment();
+    }
+    m_Manifest.close();
+
+    return m_hrBackground;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "AudioFileWriter.h"
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+/**
+* Recording writer that splits the recording into segments of a fixed number of frames. Each segment is a complete
+* WAV or FLAC file, as picked by CreateAudioFileWriter from the file name.
+*
+* Segment n of "capture.wav" is "capture_0000n.wav". Boundaries are sample accurate: every segment but the last holds
+* exactly segmentFrames frames, and the first frame of a segment directly follows the last frame of the previous one.
+*
+* A background thread creates the next segment and writes its header ahead of time, and finalizes the segments that
+* were filled, so rolling over is only a pointer swap for the caller. Each finalized segment gets a line in the
+* manifest ("capture.manifest.jsonl"), which is appended to only once the segment is closed: a consumer can process
+* every segment listed there while the recording continues.
+*
+* With segmentFrames set to 0 the recording goes to a single file at the given path, with no manifest and no thread.
+*/
+class SegmentedWavWriter
+{
+public:
+    SegmentedWavWriter() = default;
+    SegmentedWavWriter(const SegmentedWavWriter&) = delete;
+    SegmentedWavWriter& operator=(const SegmentedWavWriter&) = delete;
+    ~SegmentedWavWriter();
+
+    HRESULT Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options, UINT64 segmentFrames);
+    bool IsOpen() const { return m_Current && m_Current->IsOpen(); }
+
+    // Appends data, rolling over to the next segment at the segment boundaries
+    HRESULT WriteData(const void* data, size_t bytes);
+    // Memory the next data bytes can be written to in place (mapped files only). Never extends past the end of the
+    // current segment.
+    BYTE* GetDataBuffer(size_t* pcbAvailable);
+    // Adds bytes written to the GetDataBuffer memory, then rolls over if the segment is full
+    HRESULT CommitData(size_t bytes);
+    // Commits the header sizes of the current segment. Finalized segments are always complete.
+    HRESULT CommitHeader() { return m_Current->CommitHeader(); }
+    HRESULT Flush() { return m_Current->Flush(); }
+    // Finalizes the current segment, waits for the background thread and completes the manifest
+    HRESULT Finalize();
+
+    // Data size and data offset of the current segment
+    UINT64 GetDataSize() const { return m_Current->GetDataSize(); }
+    UINT64 GetDataOffset() const { return m_Current->GetDataOffset(); }
+    // Data written to all segments so far
+    UINT64 GetTotalDataSize() const { return m_cbTotalData; }
+    UINT32 GetSegmentCount() const { return m_CurrentIndex + 1; }
+
+private:
+    struct Segment
+    {
+        std::unique_ptr<IAudioFileWriter> writer;
+        std::filesystem::path fileName;
+        UINT32 index = 0;
+        UINT64 startFrame = 0;
+    };
+
+    std::filesystem::path GetSegmentFileName(UINT32 index) const;
+    HRESULT CreateSegment(UINT32 index, Segment* pSegment);
+    // Bytes the current segment can still take
+    UINT64 GetSegmentBytesLeft() const;
+    // Hands the full current segment to the background thread and makes the prepared one current
+    HRESULT RollOver();
+    void ThreadProc();
+    // Finalizes a segment and appends its manifest line
+    HRESULT CloseSegment(Segment& segment);
+
+    std::filesystem::path m_FileName;
+    WAVEFORMATEX m_Format {};
+    AudioFileWriterOptions m_Options;
+    UINT64 m_cbSegment = 0;
+
+    // Owned by the writing thread
+    std::unique_ptr<IAudioFileWriter> m_Current;
+    UINT32 m_CurrentIndex = 0;
+    std::filesystem::path m_CurrentFileName;
+    UINT64 m_CurrentStartFrame = 0;
+    UINT64 m_cbTotalData = 0;
+
+    // Shared with the background thread
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_NextReady;
+    bool m_bStopRequested = false;
+    // Segment created ahead of time, or empty while it is being created
+    Segment m_Next;
+    bool m_bNextRequested = false;
+    HRESULT m_hrBackground = S_OK;
+    std::deque<Segment> m_Retired;
+
+    // Written by the background thread, then by Finalize once the thread is gone
+    std::ofstream m_Manifest;
+};
@@ -0,0 +1,164 @@
+#include "SpanTrace.h"
+
+#ifdef LOOPBACK_ENABLE_TRACING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace
+{
+    struct SpanEvent
+    {
+        const char* name;
+        INT64 startNs;
+        INT64 endNs;
+    };
+
+    // Relaxed atomics, so the export can read the ring while its thread overwrites it
+    struct SpanSlot
+    {
+        std::atomic<const char*> name;
+        std::atomic<INT64> startNs;
+        std::atomic<INT64> endNs;
+    };
+
+    struct alignas(64) ThreadSpans
+    {
+        // Written by the owning thread only. Release stores, so the spans below it are complete when it is read.
+        std::atomic<UINT64> count;
+        std::atomic<const char*> name;
+        SpanSlot slots[SpanTrace::ThreadCapacity];
+    };
+
+    // Zero-initialized, so the pool costs no memory until the threads touch their rings
+    ThreadSpans s_Threads[SpanTrace::MaxThreads];
+    std::atomic<UINT32> s_ThreadsClaimed { 0 };
+    // Spans of the threads past MaxThreads
+    std::atomic<UINT64> s_Dropped { 0 };
+    thread_local ThreadSpans* t_Spans = nullptr;
+    thread_local bool t_bClaimed = false;
+
+    // Time origin of the timeline
+    const INT64 s_StartNs = SpanTrace::GetTimeNs();
+
+    ThreadSpans* GetThreadSpans()
+    {
+        if (!t_bClaimed)
+        {
+            UINT32 index = s_ThreadsClaimed.fetch_add(1, std::memory_order_relaxed);
+            t_Spans = (index < SpanTrace::MaxThreads) ? &s_Threads[index] : nullptr;
+            t_bClaimed = true;
+        }
+        return t_Spans;
+    }
+
+    UINT32 GetTraceProcessId()
+    {
+#ifdef _WIN32
+        return (UINT32)GetCurrentProcessId();
+#else
+        return (UINT32)getpid();
+#endif
+    }
+}
+
+INT64 SpanTrace::GetTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SpanTrace::Record(const char* name, INT64 startNs, INT64 endNs)
+{
+    ThreadSpans* spans = GetThreadSpans();
+    if (spans == nullptr)
+    {
+        s_Dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    UINT64 count = spans->count.load(std::memory_order_relaxed);
+    SpanSlot& slot = spans->slots[count % ThreadCapacity];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.endNs.store(endNs, std::memory_order_relaxed);
+    spans->count.store(count + 1, std::memory_order_release);
+}
+
+void SpanTrace::SetThreadName(const char* name)
+{
+    ThreadSpans* spans = GetThreadSpans();
+    if (spans != nullptr)
+    {
+        spans->name.store(name, std::memory_order_relaxed);
+    }
+}
+
+//
+//  WriteChromeTrace()
+//
+//  One complete ("X") event per span, with times in microseconds since the process started, and one thread_name
+//  metadata event per track. The rings are copied first, then the spans their threads overwrote during the copy are
+//  left out.
+//
+HRESULT SpanTrace::WriteChromeTrace(const std::filesystem::path& path)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return E_FAIL;
+    }
+
+    UINT32 processId = GetTraceProcessId();
+    UINT32 threads = std::min(s_ThreadsClaimed.load(std::memory_order_relaxed), MaxThreads);
+    file << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedSpans\":" << s_Dropped.load(std::memory_order_relaxed) << "},\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << processId << ",\"args\":{\"name\":\"ApplicationLoopback\"}}";
+
+    std::vector<SpanEvent> events;
+    events.reserve(ThreadCapacity);
+    char line[256];
+    for (UINT32 i = 0; i < threads; i++)
+    {
+        const ThreadSpans& spans = s_Threads[i];
+        UINT32 tid = i + 1;
+        const char* name = spans.name.load(std::memory_order_relaxed);
+        if (name != nullptr)
+        {
+            file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << processId << ",\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+        }
+
+        UINT64 count = spans.count.load(std::memory_order_acquire);
+        UINT64 first = count - std::min<UINT64>(count, ThreadCapacity);
+        events.clear();
+        for (UINT64 j = first; j < count; j++)
+        {
+            const SpanSlot& slot = spans.slots[j % ThreadCapacity];
+            events.push_back({ slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+                slot.endNs.load(std::memory_order_relaxed) });
+        }
+
+        // The slots of the spans recorded since are overwritten, and so is the one being recorded now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        UINT64 recorded = spans.count.load(std::memory_order_relaxed);
+        UINT64 firstIntact = std::max(first, recorded + 1 - std::min<UINT64>(recorded + 1, ThreadCapacity));
+        for (UINT64 j = firstIntact; j < count; j++)
+        {
+            const SpanEvent& event = events[(size_t)(j - first)];
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, processId, tid, (event.startNs - s_StartNs) / 1000.0, (event.endNs - event.startNs) / 1000.0);
+            file << line;
+        }
+    }
+    file << "\n]}\n";
+
+    return file.flush() ? S_OK : E_FAIL;
+}
+
+#endif
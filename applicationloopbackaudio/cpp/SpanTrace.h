@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+* Timeline of scoped spans across the pipeline threads, exported in the Chrome trace event format that
+* chrome://tracing and ui.perfetto.dev open.
+*
+* Only compiled in when LOOPBACK_ENABLE_TRACING is defined (Debug configurations, or the CMake option of the same
+* name). Otherwise the LOOPBACK_TRACE_ macros expand to nothing and no trace code is built.
+*
+* Each thread records into its own fixed ring of spans, claimed on its first span out of a static pool, so recording a
+* span is two clock reads and four stores: no lock, no atomic read-modify-write, no allocation. A ring keeps the
+* last ThreadCapacity spans of its thread. Every thread is a track of the timeline, named by LOOPBACK_TRACE_THREAD.
+*/
+#ifdef LOOPBACK_ENABLE_TRACING
+
+#include <filesystem>
+
+namespace SpanTrace
+{
+    const UINT32 MaxThreads = 32;
+    const UINT32 ThreadCapacity = 32768;
+
+    // Steady clock time, in nanoseconds
+    INT64 GetTimeNs();
+    // name must be a string literal: only the pointer is kept
+    void Record(const char* name, INT64 startNs, INT64 endNs);
+    // Names the track of the calling thread. name must be a string literal.
+    void SetThreadName(const char* name);
+
+    // Writes the spans recorded so far as a Chrome trace JSON file. Can be called while the threads record.
+    HRESULT WriteChromeTrace(const std::filesystem::path& path);
+}
+
+/**
+* Records the span from its construction to its destruction
+*/
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name) : m_Name(name), m_StartNs(SpanTrace::GetTimeNs()) {}
+    ~TraceSpan() { SpanTrace::Record(m_Name, m_StartNs, SpanTrace::GetTimeNs()); }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* m_Name;
+    INT64 m_StartNs;
+};
+
+#define LOOPBACK_TRACE_CONCAT_(a, b) a##b
+#define LOOPBACK_TRACE_CONCAT(a, b) LOOPBACK_TRACE_CONCAT_(a, b)
+// Traces the rest of the enclosing scope as a span named name
+#define LOOPBACK_TRACE_SPAN(name) TraceSpan LOOPBACK_TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define LOOPBACK_TRACE_THREAD(name) SpanTrace::SetThreadName(name)
+
+#else
+
+#define LOOPBACK_TRACE_SPAN(name) ((void)0)
+#define LOOPBACK_TRACE_THREAD(name) ((void)0)
+
+#endif
@@ -0,0 +1,172 @@
+#include "SpscFrameRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+HRESULT SpscFrameRing::Initialize(UINT32 frameBytes, UINT32 capacityFrames, UINT32 maxWriteFrames)
+{
+    if (frameBytes == 0 || capacityFrames == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_FrameBytes = frameBytes;
+    m_CapacityFrames = capacityFrames;
+    m_MaxWriteFrames = maxWriteFrames;
+    m_Storage.assign(((size_t)capacityFrames + maxWriteFrames) * frameBytes, 0);
+    m_Scratch.assign((size_t)maxWriteFrames * frameBytes, 0);
+
+    m_WriteIndex.store(0, std::memory_order_relaxed);
+    m_ReadIndex.store(0, std::memory_order_relaxed);
+    m_CachedReadIndex = 0;
+    m_CachedWriteIndex = 0;
+    m_bWriteToScratch = false;
+    m_OverrunFrames.store(0, std::memory_order_relaxed);
+    m_UnderrunFrames.store(0, std::memory_order_relaxed);
+    m_HighWaterFrames.store(0, std::memory_order_relaxed);
+
+    return S_OK;
+}
+
+UINT32 SpscFrameRing::GetWritableFrames()
+{
+    UINT64 writeIndex = m_WriteIndex.load(std::memory_order_relaxed);
+    m_CachedReadIndex = m_ReadIndex.load(std::memory_order_acquire);
+    return m_CapacityFrames - (UINT32)(writeIndex - m_CachedReadIndex);
+}
+
+BYTE* SpscFrameRing::BeginWrite()
+{
+    UINT64 writeIndex = m_WriteIndex.load(std::memory_order_relaxed);
+    UINT32 writable = m_CapacityFrames - (UINT32)(writeIndex - m_CachedReadIndex);
+    if (writable < m_MaxWriteFrames)
+    {
+        writable = GetWritableFrames();
+    }
+
+    // Writing in place is only safe when the whole region is free. Otherwise the part past the free space would
+    // overwrite frames the consumer has not read yet.
+    m_bWriteToScratch = (writable < m_MaxWriteFrames);
+    if (m_bWriteToScratch)
+    {
+        return m_Scratch.data();
+    }
+    return &m_Storage[(size_t)(writeIndex % m_CapacityFrames) * m_FrameBytes];
+}
+
+UINT32 SpscFrameRing::EndWrite(UINT32 frameCount)
+{
+    if (frameCount > m_MaxWriteFrames)
+    {
+        m_OverrunFrames.fetch_add(frameCount - m_MaxWriteFrames, std::memory_order_relaxed);
+        frameCount = m_MaxWriteFrames;
+    }
+
+    if (m_bWriteToScratch)
+    {
+        m_bWriteToScratch = false;
+        return Write(m_Scratch.data(), frameCount);
+    }
+
+    // Move the part that landed in the slack past the end of the ring back to its start
+    UINT64 writeIndex = m_WriteIndex.load(std::memory_order_relaxed);
+    UINT32 offset = (UINT32)(writeIndex % m_CapacityFrames);
+    if (offset + frameCount > m_CapacityFrames)
+    {
+        UINT32 overflow = offset + frameCount - m_CapacityFrames;
+        memcpy(m_Storage.data(), &m_Storage[(size_t)m_CapacityFrames * m_FrameBytes], (size_t)overflow * m_FrameBytes);
+    }
+
+    Publish(writeIndex, frameCount);
+    return frameCount;
+}
+
+UINT32 SpscFrameRing::Write(const BYTE* frames, UINT32 frameCount)
+{
+    UINT64 writeIndex = m_WriteIndex.load(std::memory_order_relaxed);
+    UINT32 count = std::min(frameCount, GetWritableFrames());
+    if (count < frameCount)
+    {
+        m_OverrunFrames.fetch_add(frameCount - count, std::memory_order_relaxed);
+    }
+
+    UINT32 offset = (UINT32)(writeIndex % m_CapacityFrames);
+    UINT32 first = std::min(count, m_CapacityFrames - offset);
+    memcpy(&m_Storage[(size_t)offset * m_FrameBytes], frames, (size_t)first * m_FrameBytes);
+    memcpy(m_Storage.data(), frames + (size_t)first * m_FrameBytes, (size_t)(count - first) * m_FrameBytes);
+
+    Publish(writeIndex, count);
+    return count;
+}
+
+void SpscFrameRing::Publish(UINT64 writeIndex, UINT32 frameCount)
+{
+    // The fill level is measured against the consumer's current read index: the cached one is only refreshed when
+    // the ring looks full, and would count frames read long ago
+    m_CachedReadIndex = m_ReadIndex.load(std::memory_order_acquire);
+    m_WriteIndex.store(writeIndex + frameCount, std::memory_order_release);
+
+    // Only the producer updates the high water mark, so a plain load/store pair is enough
+    UINT32 fill = (UINT32)(writeIndex + frameCount - m_CachedReadIndex);
+    if (fill > m_HighWaterFrames.load(std::memory_order_relaxed))
+    {
+        m_HighWaterFrames.store(fill, std::memory_order_relaxed);
+    }
+}
+
+UINT32 SpscFrameRing::GetReadableFrames()
+{
+    UINT64 readIndex = m_ReadIndex.load(std::memory_order_relaxed);
+    m_CachedWriteIndex = m_WriteIndex.load(std::memory_order_acquire);
+    return (UINT32)(m_CachedWriteIndex - readIndex);
+}
+
+UINT32 SpscFrameRing::Read(BYTE* dst, UINT32 frameCount)
+{
+    UINT64 readIndex = m_ReadIndex.load(std::memory_order_relaxed);
+    UINT32 readable = (UINT32)(m_CachedWriteIndex - readIndex);
+    if (readable < frameCount)
+    {
+        readable = GetReadableFrames();
+    }
+
+    UINT32 count = std::min(frameCount, readable);
+    if (count < frameCount)
+    {
+        m_UnderrunFrames.fetch_add(frameCount - count, std::memory_order_relaxed);
+    }
+
+    UINT32 offset = (UINT32)(readIndex % m_CapacityFrames);
+    UINT32 first = std::min(count, m_CapacityFrames - offset);
+    memcpy(dst, &m_Storage[(size_t)offset * m_FrameBytes], (size_t)first * m_FrameBytes);
+    memcpy(dst + (size_t)first * m_FrameBytes, m_Storage.data(), (size_t)(count - first) * m_FrameBytes);
+
+    m_ReadIndex.store(readIndex + count, std::memory_order_release);
+    return count;
+}
+
+UINT32 SpscFrameRing::Discard(UINT32 frameCount)
+{
+    UINT64 readIndex = m_ReadIndex.load(std::memory_order_relaxed);
+    UINT32 count = std::min(frameCount, GetReadableFrames());
+    m_ReadIndex.store(readIndex + count, std::memory_order_release);
+    return count;
+}
+
+SpscFrameRingStats SpscFrameRing::GetStats() const
+{
+    SpscFrameRingStats stats;
+
+    // Load the read index first so the fill level computed from the two indices can never be negative
+    UINT64 readIndex = m_ReadIndex.load(std::memory_order_acquire);
+    UINT64 writeIndex = m_WriteIndex.load(std::memory_order_acquire);
+
+    stats.capacityFrames = m_CapacityFrames;
+    stats.fillFrames = (UINT32)std::min<UINT64>(writeIndex - readIndex, m_CapacityFrames);
+    stats.highWaterFrames = m_HighWaterFrames.load(std::memory_order_relaxed);
+    stats.framesWritten = writeIndex;
+    stats.framesRead = readIndex;
+    stats.overrunFrames = m_OverrunFrames.load(std::memory_order_relaxed);
+    stats.underrunFrames = m_UnderrunFrames.load(std::memory_order_relaxed);
+    return stats;
+}
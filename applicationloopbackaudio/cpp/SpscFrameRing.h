@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <atomic>
+#include <vector>
+
+/**
+* Fill level counters of an SpscFrameRing. Safe to read from any thread while the ring is in use.
+*/
+struct SpscFrameRingStats
+{
+    UINT32 capacityFrames = 0;
+    // Frames written but not read yet
+    UINT32 fillFrames = 0;
+    // Largest fill level seen since the ring was initialized
+    UINT32 highWaterFrames = 0;
+    UINT64 framesWritten = 0;
+    UINT64 framesRead = 0;
+    // Frames the producer dropped because the ring was full
+    UINT64 overrunFrames = 0;
+    // Frames the consumer asked for but were not available
+    UINT64 underrunFrames = 0;
+};
+
+/**
+* Wait-free single-producer/single-consumer ring of audio frames.
+*
+* Decouples the capture thread (producer) from a consumer such as the render pump. Neither side ever blocks or takes a
+* lock: when the ring is full, the frames that do not fit are dropped and counted, so a stalled consumer can never hold
+* up capture. The producer and consumer indices live on separate cache lines to avoid false sharing.
+*
+* The producer writes in place: BeginWrite returns a contiguous region of up to GetMaxWriteFrames frames, and EndWrite
+* publishes the frames actually written. The storage has GetMaxWriteFrames frames of slack past its end, so a write
+* that straddles the end of the ring is one copy of the overflowing part instead of a copy of the whole packet.
+*/
+class SpscFrameRing
+{
+public:
+    SpscFrameRing() = default;
+    SpscFrameRing(const SpscFrameRing&) = delete;
+    SpscFrameRing& operator=(const SpscFrameRing&) = delete;
+
+    // Allocates a ring of capacityFrames frames of frameBytes bytes. Must not be called while either side is running.
+    // maxWriteFrames is the largest BeginWrite region; pass 0 when the producer only uses Write.
+    HRESULT Initialize(UINT32 frameBytes, UINT32 capacityFrames, UINT32 maxWriteFrames);
+    bool IsInitialized() const { return m_CapacityFrames != 0; }
+
+    UINT32 GetFrameBytes() const { return m_FrameBytes; }
+    UINT32 GetCapacityFrames() const { return m_CapacityFrames; }
+    UINT32 GetMaxWriteFrames() const { return m_MaxWriteFrames; }
+
+    // Producer side
+    UINT32 GetWritableFrames();
+    // Returns the region the next GetMaxWriteFrames frames must be written to
+    BYTE* BeginWrite();
+    // Publishes the first frameCount frames of the BeginWrite region. Returns the number of frames that fit; the rest
+    // are dropped and counted as an overrun.
+    UINT32 EndWrite(UINT32 frameCount);
+    // Copies frameCount frames into the ring. Same overrun behavior as EndWrite.
+    UINT32 Write(const BYTE* frames, UINT32 frameCount);
+
+    // Consumer side
+    UINT32 GetReadableFrames();
+    // Copies up to frameCount frames into dst. Returns the number of frames copied.
+    UINT32 Read(BYTE* dst, UINT32 frameCount);
+    // Drops up to frameCount of the oldest frames. Returns the number of frames dropped.
+    UINT32 Discard(UINT32 frameCount);
+
+    SpscFrameRingStats GetStats() const;
+
+private:
+    static const size_t CacheLineSize = 64;
+
+    void Publish(UINT64 writeIndex, UINT32 frameCount);
+
+    // Written by the producer
+    alignas(CacheLineSize) std::atomic<UINT64> m_WriteIndex { 0 };
+    // Producer's last view of m_ReadIndex. Refreshed when the ring looks full and when a write is published.
+    UINT64 m_CachedReadIndex = 0;
+    // BeginWrite handed out m_Scratch instead of the ring storage
+    bool m_bWriteToScratch = false;
+    std::atomic<UINT64> m_OverrunFrames { 0 };
+    std::atomic<UINT32> m_HighWaterFrames { 0 };
+
+    // Written by the consumer
+    alignas(CacheLineSize) std::atomic<UINT64> m_ReadIndex { 0 };
+    // Consumer's last view of m_WriteIndex. Refreshed only when the ring looks empty.
+    UINT64 m_CachedWriteIndex = 0;
+    std::atomic<UINT64> m_UnderrunFrames { 0 };
+
+    // Read only once initialized
+    alignas(CacheLineSize) UINT32 m_FrameBytes = 0;
+    UINT32 m_CapacityFrames = 0;
+    UINT32 m_MaxWriteFrames = 0;
+    // m_CapacityFrames + m_MaxWriteFrames frames
+    std::vector<BYTE> m_Storage;
+    // Producer staging area used when the ring cannot take a whole GetMaxWriteFrames write in place
+    std::vector<BYTE> m_Scratch;
+};
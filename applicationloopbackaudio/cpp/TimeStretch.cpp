@@ -0,0 +1,245 @@
+#include "TimeStretch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+
+// Offsets tried by the coarse pass of Seek. The best one is then refined to the exact frame.
+static const UINT32 SeekStep = 4;
+
+HRESULT TimeStretch::Initialize(UINT32 channels, UINT32 sampleRate, UINT32 maxWriteFrames)
+{
+    if (channels == 0 || sampleRate == 0 || maxWriteFrames == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_Channels = channels;
+    m_OverlapFrames = std::max(sampleRate * OverlapMs / 1000, (UINT32)1);
+    m_SeekFrames = sampleRate * SeekMs / 1000;
+    m_Speed = 1.0;
+
+    // Room for two writes on top of what the stretch holds back: the input of the pending segment, its seek range, and
+    // the hop past the nominal position at the highest speed
+    m_Capacity = 2 * (size_t)maxWriteFrames + 4 * (size_t)m_OverlapFrames + m_SeekFrames;
+    m_Buffer.assign(m_Capacity * channels, 0.0f);
+
+    // Raised cosine: the two gains always sum to 1
+    m_FadeIn.resize(m_OverlapFrames);
+    for (UINT32 i = 0; i < m_OverlapFrames; i++)
+    {
+        double x = std::sin(0.5 * PI * (i + 0.5) / m_OverlapFrames);
+        m_FadeIn[i] = (float)(x * x);
+    }
+    m_MonoNatural.resize(m_OverlapFrames);
+    m_MonoSearch.resize((size_t)m_OverlapFrames + m_SeekFrames);
+
+    Reset();
+    m_Stats = TimeStretchStats();
+    return S_OK;
+}
+
+void TimeStretch::Reset()
+{
+    m_Start = 0;
+    m_End = 0;
+    m_Natural = 0;
+    m_Nominal = 0.0;
+    m_bSegmentPending = false;
+    m_SegmentStart = 0;
+    m_SegmentFrames = 0;
+}
+
+void TimeStretch::SetSpeed(double speed)
+{
+    m_Speed = std::max(1.0, std::min(speed, 1.0 + MaxSpeedupPercent / 100.0));
+}
+
+void TimeStretch::Write(const float* frames, UINT32 frameCount)
+{
+    if (m_End + frameCount > m_Capacity && m_Start > 0)
+    {
+        // Every position still in use is at or past m_Start
+        std::memmove(m_Buffer.data(), m_Buffer.data() + m_Start * m_Channels, (m_End - m_Start) * m_Channels * sizeof(float));
+        m_End -= m_Start;
+        m_Natural -= m_Start;
+        m_SegmentStart -= std::min(m_SegmentStart, m_Start);
+        m_Nominal -= (double)m_Start;
+        m_Start = 0;
+    }
+
+    UINT32 count = (UINT32)std::min((size_t)frameCount, m_Capacity - m_End);
+    std::memcpy(m_Buffer.data() + m_End * m_Channels, frames, (size_t)count * m_Channels * sizeof(float));
+    m_End += count;
+    m_Stats.framesIn += count;
+    m_Stats.overflowFrames += frameCount - count;
+}
+
+//
+//  Read()
+//
+//  Starts a segment whenever the previous one has been read and enough input is buffered for the next one and its seek
+//  range
+//
+UINT32 TimeStretch::Read(float* frames, UINT32 maxFrames)
+{
+    UINT32 framesRead = 0;
+    while (framesRead < maxFrames)
+    {
+        if (!m_bSegmentPending)
+        {
+            // Nominal start of the next segment: one hop times the speed after the nominal start of the last one
+            double nominal = m_Nominal + m_OverlapFrames * (m_Speed - 1.0);
+            size_t nominalStart = (size_t)nominal;
+            if (m_End < nominalStart + m_SeekFrames + m_OverlapFrames || m_End < m_Natural + m_OverlapFrames)
+            {
+                break;
+            }
+
+            m_SegmentStart = Seek(nominalStart);
+            m_Nominal = nominal + m_OverlapFrames;
+            m_bSegmentPending = true;
+            m_SegmentFrames = 0;
+        }
+        framesRead += ReadSegment(frames + (size_t)framesRead * m_Channels, maxFrames - framesRead);
+    }
+
+    m_Stats.framesOut += framesRead;
+    return framesRead;
+}
+
+UINT32 TimeStretch::Drain(float* frames, UINT32 maxFrames)
+{
+    UINT32 framesRead = 0;
+    if (m_bSegmentPending)
+    {
+        framesRead = ReadSegment(frames, maxFrames);
+    }
+
+    // Crossfading the tail of the last segment into the natural continuation gives the natural continuation back
+    if (!m_bSegmentPending)
+    {
+        UINT32 count = (UINT32)std::min(m_End - m_Natural, (size_t)(maxFrames - framesRead));
+        std::memcpy(frames + (size_t)framesRead * m_Channels, m_Buffer.data() + m_Natural * m_Channels, (size_t)count * m_Channels * sizeof(float));
+        framesRead += count;
+        m_Natural += count;
+        m_Start = m_Natural;
+        m_Nominal = (double)m_Natural;
+        if (m_Natural == m_End)
+        {
+            Reset();
+        }
+    }
+
+    m_Stats.framesOut += framesRead;
+    return framesRead;
+}
+
+//
+//  ReadSegment()
+//
+//  The pending segment fades in over the tail of the previous one, which fades out along its natural continuation
+//
+UINT32 TimeStretch::ReadSegment(float* frames, UINT32 maxFrames)
+{
+    UINT32 count = std::min(m_OverlapFrames - m_SegmentFrames, maxFrames);
+    for (UINT32 i = m_SegmentFrames; i < m_SegmentFrames + count; i++)
+    {
+        float gain = m_FadeIn[i];
+        const float* fadeOut = m_Buffer.data() + (m_Natural + i) * m_Channels;
+        const float* fadeIn = m_Buffer.data() + (m_SegmentStart + i) * m_Channels;
+        for (UINT32 channel = 0; channel < m_Channels; channel++)
+        {
+            *frames++ = fadeOut[channel] + gain * (fadeIn[channel] - fadeOut[channel]);
+        }
+    }
+
+    m_SegmentFrames += count;
+    if (m_SegmentFrames == m_OverlapFrames)
+    {
+        m_bSegmentPending = false;
+        m_Natural = m_SegmentStart + m_OverlapFrames;
+        // The segment started at or past the nominal position, so nothing before it is needed again
+        m_Start = (size_t)m_Nominal;
+        m_Stats.segments++;
+    }
+    return count;
+}
+
+//
+//  Seek()
+//
+//  Maximizes the normalized cross-correlation of the mono mixes: every SeekStep frames first, then frame by frame
+//  around the best coarse offset
+//
+size_t TimeStretch::Seek(size_t nominalStart) const
+{
+    // The natural continuation matches itself exactly
+    if (m_Natural >= nominalStart && m_Natural <= nominalStart + m_SeekFrames)
+    {
+        return m_Natural;
+    }
+
+    auto mix = [&](size_t start, UINT32 count, float* mono)
+    {
+        const float* frame = m_Buffer.data() + start * m_Channels;
+        for (UINT32 i = 0; i < count; i++, frame += m_Channels)
+        {
+            float sum = 0.0f;
+            for (UINT32 channel = 0; channel < m_Channels; channel++)
+            {
+                sum += frame[channel];
+            }
+            mono[i] = sum;
+        }
+    };
+    mix(m_Natural, m_OverlapFrames, m_MonoNatural.data());
+    mix(nominalStart, m_OverlapFrames + m_SeekFrames, m_MonoSearch.data());
+
+    // Sign-preserving square of the normalized correlation, to compare without a square root
+    auto score = [&](UINT32 offset)
+    {
+        const float* candidate = m_MonoSearch.data() + offset;
+        double correlation = 0.0;
+        double energy = 1e-9;
+        for (UINT32 i = 0; i < m_OverlapFrames; i++)
+        {
+            correlation += (double)m_MonoNatural[i] * candidate[i];
+            energy += (double)candidate[i] * candidate[i];
+        }
+        return correlation * std::fabs(correlation) / energy;
+    };
+
+    UINT32 bestOffset = 0;
+    double bestScore = score(0);
+    for (UINT32 offset = SeekStep; offset <= m_SeekFrames; offset += SeekStep)
+    {
+        double s = score(offset);
+        if (s > bestScore)
+        {
+            bestScore = s;
+            bestOffset = offset;
+        }
+    }
+
+    UINT32 first = bestOffset - std::min(bestOffset, SeekStep - 1);
+    UINT32 last = std::min(bestOffset + SeekStep - 1, m_SeekFrames);
+    UINT32 coarseOffset = bestOffset;
+    for (UINT32 offset = first; offset <= last; offset++)
+    {
+        if (offset == coarseOffset)
+        {
+            continue;
+        }
+        double s = score(offset);
+        if (s > bestScore)
+        {
+            bestScore = s;
+            bestOffset = offset;
+        }
+    }
+
+    return nominalStart + bestOffset;
+}
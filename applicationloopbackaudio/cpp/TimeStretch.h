@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+
+/**
+* Counters of a TimeStretch
+*/
+struct TimeStretchStats
+{
+    UINT64 framesIn = 0;
+    UINT64 framesOut = 0;
+    UINT64 segments = 0;
+    // Input frames dropped because the stretch was not read fast enough
+    UINT64 overflowFrames = 0;
+};
+
+/**
+* Streaming WSOLA (waveform similarity overlap-add) time stretch for interleaved float samples. Plays its input faster
+* than real time without changing the pitch.
+*
+* The output is built from segments of two overlap lengths, windowed by a raised cosine and overlap-added at a hop of
+* one overlap length. The input position of each segment advances by the hop times the speed, and is then moved by up to
+* the seek length to the position whose start looks most like the natural continuation of the previous segment, so the
+* segments join in phase. The pitch is kept, and the audio skipped at each join is a whole number of periods.
+*
+* At a speed of 1 the natural continuation is always in the seek range and matches itself exactly, so the output is the
+* input unchanged. Drain returns the rest of the input after the last segment the same way, which makes it seamless to
+* switch the stretch in while catching up and out again once caught up. Holds back up to about two overlap lengths plus
+* the seek length of input while stretching.
+*/
+class TimeStretch
+{
+public:
+    // Overlap length: half of the segment window. Long enough to span a period of a low voice.
+    static const UINT32 OverlapMs = 8;
+    // Range searched for the best join past the nominal position of a segment
+    static const UINT32 SeekMs = 6;
+    // Largest speed SetSpeed accepts
+    static const UINT32 MaxSpeedupPercent = 50;
+
+    // maxWriteFrames is the largest Write
+    HRESULT Initialize(UINT32 channels, UINT32 sampleRate, UINT32 maxWriteFrames);
+    bool IsInitialized() const { return m_Channels != 0; }
+
+    // Drops the buffered input
+    void Reset();
+    // Playback speed of the input written from now on, from 1 (unchanged) up to 1 + MaxSpeedupPercent/100
+    void SetSpeed(double speed);
+    double GetSpeed() const { return m_Speed; }
+
+    void Write(const float* frames, UINT32 frameCount);
+    // Reads up to maxFrames stretched frames. Returns the number of frames read.
+    UINT32 Read(float* frames, UINT32 maxFrames);
+    // Reads up to maxFrames of the buffered input at speed 1, continuing seamlessly from the last Read. Returns the
+    // number of frames read; the stretch is empty once it returns 0.
+    UINT32 Drain(float* frames, UINT32 maxFrames);
+    // Input frames written but not played yet
+    UINT32 GetBufferedFrames() const { return (UINT32)(m_End - m_Natural); }
+
+    const TimeStretchStats& GetStats() const { return m_Stats; }
+
+private:
+    // Start of the next segment: the position in [nominalStart, nominalStart + seek length] whose first overlap length
+    // matches the natural continuation best
+    size_t Seek(size_t nominalStart) const;
+    // Reads up to maxFrames frames of the pending segment
+    UINT32 ReadSegment(float* frames, UINT32 maxFrames);
+
+    UINT32 m_Channels = 0;
+    UINT32 m_OverlapFrames = 0;
+    UINT32 m_SeekFrames = 0;
+    double m_Speed = 1.0;
+
+    // Input, from m_Start to m_End, in frames. Compacted to the front when a write does not fit.
+    std::vector<float> m_Buffer;
+    size_t m_Capacity = 0;
+    size_t m_Start = 0;
+    size_t m_End = 0;
+    // Natural continuation of the last segment, i.e. the input it would have played next
+    size_t m_Natural = 0;
+    // Where the last segment would end without the seek adjustments. Advances by the hop times the speed.
+    double m_Nominal = 0.0;
+
+    // Segment being read, starting at m_SegmentStart in the input, and the frames of it already read
+    bool m_bSegmentPending = false;
+    size_t m_SegmentStart = 0;
+    UINT32 m_SegmentFrames = 0;
+
+    // Fade-in gains over one overlap length; the fade-out gains are 1 minus them
+    std::vector<float> m_FadeIn;
+    // Mono mixes searched by Seek
+    mutable std::vector<float> m_MonoNatural;
+    mutable std::vector<float> m_MonoSearch;
+
+    TimeStretchStats m_Stats;
+};
@@ -0,0 +1,336 @@
+#include "WavFileSink.h"
+#include "PipelineCounters.h"
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+WavFileSink::~WavFileSink()
+{
+    Stop();
+}
+
+//
+//  Start()
+//
+//  Creates the file, writes its header and starts the writer thread
+//
+HRESULT WavFileSink::Start(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const WavFileSinkOptions& options)
+{
+    if (m_Thread.joinable() || format.nBlockAlign == 0 || options.maxWriteBytes < options.minWriteBytes ||
+        options.maxWriteBytes < format.nBlockAlign || options.pollIntervalMs == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // The segment length is the shorter of the two limits that are set
+    UINT64 segmentFrames = 0;
+    if (options.segmentMs != 0)
+    {
+        segmentFrames = std::max<UINT64>((UINT64)format.nSamplesPerSec * options.segmentMs / 1000, 1);
+    }
+    if (options.segmentBytes != 0)
+    {
+        UINT64 frames = std::max<UINT64>(options.segmentBytes / format.nBlockAlign, 1);
+        segmentFrames = (segmentFrames == 0) ? frames : std::min(segmentFrames, frames);
+    }
+
+    m_Options = options;
+    if (IsFlacFileName(fileName))
+    {
+        // Encoded output has no file layout to map the ring into
+        m_Options.fileMode = OutputFileMode::Buffered;
+    }
+
+    AudioFileWriterOptions writerOptions;
+    writerOptions.fileMode = m_Options.fileMode;
+    writerOptions.flacLevel = m_Options.flacLevel;
+    HRESULT hr = m_Writer.Create(fileName, format, writerOptions, segmentFrames);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    UINT32 capacityFrames = std::max<UINT32>((UINT32)((UINT64)format.nSamplesPerSec * options.bufferMs / 1000), 1);
+    hr = m_Ring.Initialize(format.nBlockAlign, capacityFrames, 0);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Mapped mode only stages the frames that straddle two extents
+    m_Batch.assign((m_Options.fileMode == OutputFileMode::Mapped) ? format.nBlockAlign : options.maxWriteBytes, 0);
+    m_cbBatch = 0;
+    m_hrWrite = S_OK;
+    m_bStopRequested = false;
+    m_LastCommitHns = GetQpcTimeHns();
+    m_cbLastCommit = 0;
+
+    m_bRunning.store(true, std::memory_order_release);
+    m_Thread = std::thread(&WavFileSink::ThreadProc, this);
+    return S_OK;
+}
+
+HRESULT WavFileSink::Stop()
+{
+    if (!m_Thread.joinable())
+    {
+        return S_OK;
+    }
+
+    m_bRunning.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bStopRequested = true;
+    }
+    m_StopRequested.notify_one();
+    m_Thread.join();
+
+    HRESULT hr = m_Writer.Finalize();
+    return FAILED(m_hrWrite) ? m_hrWrite : hr;
+}
+
+void WavFileSink::Push(const BYTE* data, UINT32 frames)
+{
+    if (IsRunning())
+    {
+        UINT32 framesQueued = m_Ring.Write(data, frames);
+        if (framesQueued < frames)
+        {
+            PipelineCounters::Add(PipelineCounter::FileOverrunFrames, frames - framesQueued);
+        }
+    }
+}
+
+WavFileSinkStats WavFileSink::GetStats() const
+{
+    SpscFrameRingStats ringStats = m_Ring.GetStats();
+
+    WavFileSinkStats stats;
+    stats.bytesWritten = m_BytesWritten.load(std::memory_order_relaxed);
+    stats.writes = m_Writes.load(std::memory_order_relaxed);
+    stats.maxWriteHns = m_MaxWriteHns.load(std::memory_order_relaxed);
+    stats.droppedFrames = ringStats.overrunFrames;
+    stats.highWaterFrames = ringStats.highWaterFrames;
+    stats.capacityFrames = ringStats.capacityFrames;
+    stats.headerCommits = m_HeaderCommits.load(std::memory_order_relaxed);
+    stats.flushes = m_Flushes.load(std::memory_order_relaxed);
+    stats.maxFlushHns = m_MaxFlushHns.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void WavFileSink::ThreadProc()
+{
+    LOOPBACK_TRACE_THREAD("File writer");
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_StopRequested.wait_for(lock, std::chrono::milliseconds(m_Options.pollIntervalMs), [this] { return m_bStopRequested; }))
+    {
+        lock.unlock();
+        HRESULT hr = Drain(false);
+        if (SUCCEEDED(hr) && SUCCEEDED(m_hrWrite))
+        {
+            hr = CommitHeaderIfDue();
+        }
+        lock.lock();
+
+        if (FAILED(hr))
+        {
+            // Keep draining the ring so the capture side sees a consumer, but stop writing
+            m_hrWrite = hr;
+        }
+    }
+    lock.unlock();
+
+    HRESULT hr = Drain(true);
+    if (SUCCEEDED(m_hrWrite))
+    {
+        m_hrWrite = hr;
+    }
+}
+
+//
+//  Drain()
+//
+//  Moves everything the ring holds into the batch buffer, writing it out whenever it holds minWriteBytes.
+//  On the final drain the remaining tail is written too.
+//
+HRESULT WavFileSink::Drain(bool bFinal)
+{
+    if (m_Options.fileMode == OutputFileMode::Mapped && SUCCEEDED(m_hrWrite))
+    {
+        return DrainMapped();
+    }
+
+    const UINT32 frameBytes = m_Ring.GetFrameBytes();
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        UINT32 frames = (UINT32)std::min<size_t>(m_Ring.GetReadableFrames(), (m_Batch.size() - m_cbBatch) / frameBytes);
+        if (frames > 0)
+        {
+            m_cbBatch += (size_t)m_Ring.Read(&m_Batch[m_cbBatch], frames) * frameBytes;
+        }
+
+        if (FAILED(m_hrWrite))
+        {
+            // The file is broken. Drop the data instead of letting the capture side overrun.
+            m_cbBatch = 0;
+        }
+        else if (m_cbBatch >= m_Options.minWriteBytes)
+        {
+            // End the write on an aligned file offset. The tail goes out with the next batch.
+            UINT64 endOffset = m_Writer.GetDataOffset() + m_Writer.GetDataSize() + m_cbBatch;
+            size_t cbTail = (size_t)(endOffset % AlignmentBytes);
+            size_t cbWrite = (cbTail < m_cbBatch) ? m_cbBatch - cbTail : m_cbBatch;
+            hr = WriteBatch(cbWrite);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+
+        if (frames == 0)
+        {
+            break;
+        }
+    }
+
+    if (bFinal && m_cbBatch > 0 && SUCCEEDED(m_hrWrite))
+    {
+        hr = WriteBatch(m_cbBatch);
+    }
+    return hr;
+}
+
+//
+//  DrainMapped()
+//
+//  Reads everything the ring holds directly into the mapped file. There is no tail to hold back: the page cache
+//  already sees page aligned writes.
+//
+HRESULT WavFileSink::DrainMapped()
+{
+    const UINT32 frameBytes = m_Ring.GetFrameBytes();
+
+    for (;;)
+    {
+        UINT32 readable = m_Ring.GetReadableFrames();
+        if (readable == 0)
+        {
+            return S_OK;
+        }
+
+        LOOPBACK_TRACE_SPAN("Write mapped");
+        UINT64 start = GetQpcTimeHns();
+        size_t cbAvailable = 0;
+        BYTE* dst = m_Writer.GetDataBuffer(&cbAvailable);
+        if (dst == nullptr)
+        {
+            return E_FAIL;
+        }
+
+        HRESULT hr = S_OK;
+        UINT32 frames = (UINT32)std::min<size_t>(readable, cbAvailable / frameBytes);
+        size_t cbWrite = 0;
+        if (frames > 0)
+        {
+            cbWrite = (size_t)m_Ring.Read(dst, frames) * frameBytes;
+            hr = m_Writer.CommitData(cbWrite);
+        }
+        else
+        {
+            // Less than a frame is left in the mapped extent. Write one frame through the copying path, which
+            // splits it across the two extents.
+            cbWrite = (size_t)m_Ring.Read(m_Batch.data(), 1) * frameBytes;
+            hr = m_Writer.WriteData(m_Batch.data(), cbWrite);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        UINT64 elapsed = GetQpcTimeHns() - start;
+        m_BytesWritten.fetch_add(cbWrite, std::memory_order_relaxed);
+        m_Writes.fetch_add(1, std::memory_order_relaxed);
+        if (elapsed > m_MaxWriteHns.load(std::memory_order_relaxed))
+        {
+            m_MaxWriteHns.store(elapsed, std::memory_order_relaxed);
+        }
+    }
+}
+
+//
+//  CommitHeaderIfDue()
+//
+//  Patches the header sizes to cover the data written so far. Data always reaches the file before the header that
+//  claims it, so the committed sizes never run past the written data.
+//
+HRESULT WavFileSink::CommitHeaderIfDue()
+{
+    UINT64 now = GetQpcTimeHns();
+    UINT64 cbWritten = m_Writer.GetTotalDataSize();
+    if (cbWritten == m_cbLastCommit)
+    {
+        return S_OK;
+    }
+
+    bool bTimeDue = (m_Options.headerCommitMs != 0 && now - m_LastCommitHns >= (UINT64)m_Options.headerCommitMs * HNS_PER_SEC / 1000);
+    bool bBytesDue = (m_Options.headerCommitBytes != 0 && cbWritten - m_cbLastCommit >= m_Options.headerCommitBytes);
+    if (!bTimeDue && !bBytesDue)
+    {
+        return S_OK;
+    }
+
+    LOOPBACK_TRACE_SPAN("Commit header");
+    HRESULT hr = m_Writer.CommitHeader();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    m_LastCommitHns = now;
+    m_cbLastCommit = cbWritten;
+    UINT64 commits = m_HeaderCommits.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (m_Options.flushEveryCommits != 0 && commits % m_Options.flushEveryCommits == 0)
+    {
+        UINT64 start = GetQpcTimeHns();
+        hr = m_Writer.Flush();
+        UINT64 elapsed = GetQpcTimeHns() - start;
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        m_Flushes.fetch_add(1, std::memory_order_relaxed);
+        if (elapsed > m_MaxFlushHns.load(std::memory_order_relaxed))
+        {
+            m_MaxFlushHns.store(elapsed, std::memory_order_relaxed);
+        }
+    }
+    return S_OK;
+}
+
+HRESULT WavFileSink::WriteBatch(size_t cbWrite)
+{
+    LOOPBACK_TRACE_SPAN("Write batch");
+    UINT64 start = GetQpcTimeHns();
+    HRESULT hr = m_Writer.WriteData(m_Batch.data(), cbWrite);
+    UINT64 elapsed = GetQpcTimeHns() - start;
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_cbBatch -= cbWrite;
+    memmove(m_Batch.data(), &m_Batch[cbWrite], m_cbBatch);
+
+    m_BytesWritten.fetch_add(cbWrite, std::memory_order_relaxed);
+    m_Writes.fetch_add(1, std::memory_order_relaxed);
+    if (elapsed > m_MaxWriteHns.load(std::memory_order_relaxed))
+    {
+        m_MaxWriteHns.store(elapsed, std::memory_order_relaxed);
+    }
+    return S_OK;
+}
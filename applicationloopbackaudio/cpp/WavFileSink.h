@@ -0,0 +1,133 @@
+#pragma once
+
+#include "SpscFrameRing.h"
+#include "SegmentedWavWriter.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* Tuning of a WavFileSink
+*/
+struct WavFileSinkOptions
+{
+    // Audio the sink can hold while the disk is stalled before it starts dropping frames
+    UINT32 bufferMs = 10000;
+    // Captured data is batched until at least this much is pending...
+    UINT32 minWriteBytes = 256 * 1024;
+    // ...and written in chunks of at most this size
+    UINT32 maxWriteBytes = 4 * 1024 * 1024;
+    // How often the writer thread looks for pending data
+    UINT32 pollIntervalMs = 20;
+    // Mapped reads the ring straight into the mapped file instead of batching into write calls
+    OutputFileMode fileMode = OutputFileMode::Buffered;
+    // The header sizes are committed once this much time has passed since the last commit (0 = never)...
+    UINT32 headerCommitMs = 1000;
+    // ...or once this much data was written since the last commit (0 = never)
+    UINT32 headerCommitBytes = 16 * 1024 * 1024;
+    // Every this many header commits, the file is also flushed to disk (0 = only when the sink stops)
+    UINT32 flushEveryCommits = 0;
+    // The recording rolls over to a new segment file after this much audio (0 = never)...
+    UINT32 segmentMs = 0;
+    // ...or after this much data, rounded down to whole frames (0 = never). See SegmentedWavWriter.
+    UINT64 segmentBytes = 0;
+    // Compression level of .flac recordings, 0 (fastest) to 8 (smallest). See FlacEncoder::GetLevelSettings.
+    UINT32 flacLevel = 5;
+};
+
+/**
+* Counters of a WavFileSink. Safe to read from any thread while the sink runs.
+*/
+struct WavFileSinkStats
+{
+    UINT64 bytesWritten = 0;
+    UINT64 writes = 0;
+    // Slowest single write, in 100-nanosecond units
+    UINT64 maxWriteHns = 0;
+    // Frames lost because the writer fell more than bufferMs behind
+    UINT64 droppedFrames = 0;
+    UINT32 highWaterFrames = 0;
+    UINT32 capacityFrames = 0;
+    UINT64 headerCommits = 0;
+    UINT64 flushes = 0;
+    // Slowest flush, in 100-nanosecond units
+    UINT64 maxFlushHns = 0;
+};
+
+/**
+* Records captured packets to a WAV file from a dedicated writer thread.
+*
+* The capture thread only copies packets into a wait-free ring (Push); it never touches the disk and never blocks.
+* The writer thread drains the ring into a large batch buffer and issues few big writes whose end offsets are aligned
+* to AlignmentBytes, so the file system sees sequential, page aligned I/O. Stop drains whatever is left and
+* finalizes the header, so the file is complete even if the disk was slow during the recording.
+*
+* The header sizes are committed periodically (headerCommitMs / headerCommitBytes) with two small positional writes, so a
+* recording interrupted by a crash or a kill is a valid file up to the last commit; RepairWavFile recovers the rest.
+* Flushing to disk is batched over flushEveryCommits commits, so durability against power loss costs one flush per
+* batch instead of one per packet.
+*
+* With segmentMs or segmentBytes set, the recording is split into sample-accurate segments that a background thread
+* opens ahead of time and closes behind the writer, see SegmentedWavWriter.
+*
+* File names ending in .flac are recorded as FLAC: the writer thread encodes the drained audio before it goes to
+* disk (see FlacWriter), which typically halves the storage of a recording.
+*
+* With OutputFileMode::Mapped the batch buffer is bypassed: the writer thread reads the ring directly into the mapped
+* extent of the file, and the kernel writes the dirty pages back in the background.
+*/
+class WavFileSink
+{
+public:
+    static const UINT32 AlignmentBytes = 64 * 1024;
+
+    WavFileSink() = default;
+    ~WavFileSink();
+
+    HRESULT Start(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const WavFileSinkOptions& options = WavFileSinkOptions());
+    // Drains the pending data, finalizes the file and stops the writer thread. Returns the first write error, if any.
+    HRESULT Stop();
+    bool IsRunning() const { return m_bRunning.load(std::memory_order_acquire); }
+
+    // Called by the capture thread for every captured packet
+    void Push(const BYTE* data, UINT32 frames);
+
+    WavFileSinkStats GetStats() const;
+
+private:
+    void ThreadProc();
+    HRESULT Drain(bool bFinal);
+    HRESULT DrainMapped();
+    HRESULT WriteBatch(size_t cbWrite);
+    // Commits the header (and flushes every flushEveryCommits commits) when a commit threshold is reached
+    HRESULT CommitHeaderIfDue();
+
+    SegmentedWavWriter m_Writer;
+    SpscFrameRing m_Ring;
+    WavFileSinkOptions m_Options;
+    std::atomic<bool> m_bRunning { false };
+    HRESULT m_hrWrite = S_OK;
+
+    // Owned by the writer thread
+    std::vector<BYTE> m_Batch;
+    size_t m_cbBatch = 0;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_StopRequested;
+    bool m_bStopRequested = false;
+
+    std::atomic<UINT64> m_BytesWritten { 0 };
+    std::atomic<UINT64> m_Writes { 0 };
+    std::atomic<UINT64> m_MaxWriteHns { 0 };
+
+    // Owned by the writer thread
+    UINT64 m_LastCommitHns = 0;
+    UINT64 m_cbLastCommit = 0;
+    std::atomic<UINT64> m_HeaderCommits { 0 };
+    std::atomic<UINT64> m_Flushes { 0 };
+    std::atomic<UINT64> m_MaxFlushHns { 0 };
+};
@@ -0,0 +1,126 @@
+#include "WavRepair.h"
+
+#include "OutputFile.h"
+#include "WavWriter.h"
+
+#include <algorithm>
+#include <fstream>
+
+//
+//  RepairWavFile()
+//
+//  Parses the header WavWriter::Create wrote, works out how much data the file really holds and rewrites the sizes
+//
+HRESULT RepairWavFile(const std::filesystem::path& fileName, WavRepairResult* pResult)
+{
+    *pResult = WavRepairResult();
+
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in)
+    {
+        return E_INVALIDARG;
+    }
+
+    in.seekg(0, std::ios::end);
+    UINT64 cbFileSize = (UINT64)in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    DWORD riff[3] = {};
+    if (!in.read(reinterpret_cast<char*>(riff), sizeof(riff)) || (riff[0] != FCC('RIFF') && riff[0] != FCC('RF64')) || riff[2] != FCC('WAVE'))
+    {
+        return E_INVALIDARG;
+    }
+
+    WORD nBlockAlign = 0;
+    // WavWriter reserved room for a ds64 chunk right after the RIFF descriptor
+    bool bHaveDs64Room = false;
+    UINT64 cbDataSize64 = 0;
+    UINT64 cbDataOffset = 0;
+    DWORD cbDataSize32 = 0;
+    DWORD chunk[2] = {};
+    while (in.read(reinterpret_cast<char*>(chunk), sizeof(chunk)))
+    {
+        UINT64 cbChunkStart = (UINT64)in.tellg();
+        if (cbChunkStart == WavWriter::DataSize64ChunkOffset + sizeof(chunk) && chunk[1] == WavWriter::DataSize64ChunkSize &&
+            (chunk[0] == FCC('JUNK') || chunk[0] == FCC('ds64')))
+        {
+            bHaveDs64Room = true;
+            if (chunk[0] == FCC('ds64'))
+            {
+                UINT64 sizes[2] = {};
+                in.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+                cbDataSize64 = sizes[1];
+            }
+        }
+        else if (chunk[0] == FCC('fmt ') && chunk[1] >= 16)
+        {
+            WAVEFORMATEX format {};
+            in.read(reinterpret_cast<char*>(&format), 16);
+            nBlockAlign = format.nBlockAlign;
+        }
+        else if (chunk[0] == FCC('data'))
+        {
+            cbDataOffset = cbChunkStart;
+            cbDataSize32 = chunk[1];
+            break;
+        }
+        // Chunks are padded to an even size
+        in.seekg((std::streamoff)(cbChunkStart + chunk[1] + (chunk[1] & 1)));
+    }
+
+    if (cbDataOffset == 0 || nBlockAlign == 0 || cbDataOffset > cbFileSize || cbDataOffset > 0xFFFFFFFF)
+    {
+        return E_INVALIDARG;
+    }
+
+    UINT64 cbAvailable = cbFileSize - cbDataOffset;
+    UINT64 cbCommitted = (riff[0] == FCC('RF64') && cbDataSize32 == 0xFFFFFFFF) ? cbDataSize64 : cbDataSize32;
+    cbCommitted = std::min(cbCommitted, cbAvailable);
+
+    in.close();
+
+    // Every whole frame past the data offset is audio, silent or not. The pad byte of a finalized odd-sized data
+    // chunk is not.
+    if ((cbCommitted & 1) && cbAvailable == cbCommitted + 1)
+    {
+        cbAvailable = cbCommitted;
+    }
+    UINT64 cbDataSize = cbAvailable - cbAvailable % nBlockAlign;
+
+    pResult->fileSize = cbFileSize;
+    pResult->dataOffset = cbDataOffset;
+    pResult->committedDataSize = cbCommitted;
+    pResult->dataSize = cbDataSize;
+    pResult->bRF64 = WavWriter::IsRF64((DWORD)cbDataOffset, cbDataSize);
+
+    UINT64 cbRepairedFileSize = cbDataOffset + cbDataSize + (cbDataSize & 1);
+    if (cbDataSize == cbCommitted && cbRepairedFileSize == cbFileSize && cbDataSize32 != 0)
+    {
+        return S_OK;
+    }
+    if (pResult->bRF64 && !bHaveDs64Room)
+    {
+        // Not written by WavWriter; there is no room for the 64-bit sizes
+        return E_INVALIDARG;
+    }
+
+    OutputFile out;
+    HRESULT hr = out.Open(fileName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Drop the partial frame, then pad the data chunk to an even size
+    BYTE pad = 0;
+    if (FAILED(hr = out.SetSize(cbDataOffset + cbDataSize)) ||
+        ((cbDataSize & 1) && FAILED(hr = out.Write(&pad, 1))) ||
+        FAILED(hr = WavWriter::WriteSizes(out, (DWORD)cbDataOffset, cbDataSize)) ||
+        FAILED(hr = out.Flush()))
+    {
+        return hr;
+    }
+
+    pResult->bRepaired = true;
+    return out.Close();
+}
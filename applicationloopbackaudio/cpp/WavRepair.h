@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <filesystem>
+
+/**
+* What RepairWavFile found and changed
+*/
+struct WavRepairResult
+{
+    UINT64 fileSize = 0;
+    // Offset of the first sample
+    UINT64 dataOffset = 0;
+    // Data size the header held before the repair (the last committed size)
+    UINT64 committedDataSize = 0;
+    // Data size after the repair
+    UINT64 dataSize = 0;
+    bool bRF64 = false;
+    // False if the header already matched the file
+    bool bRepaired = false;
+};
+
+/**
+* Rebuilds the chunk sizes of a recording that was not finalized (the process crashed or was killed, or the machine
+* lost power) from the length of the file.
+*
+* The data chunk is taken to extend to the end of the file, rounded down to whole frames: only a partial last frame
+* is dropped, and a size past the end of the file is cut back to it. Silent frames are kept, so a recording written
+* with the mapped output file keeps the unwritten part of its last preallocated extent as silence. Files that outgrow
+* 4 GB become RF64, which needs the JUNK chunk WavWriter reserves after the RIFF descriptor.
+*/
+HRESULT RepairWavFile(const std::filesystem::path& fileName, WavRepairResult* pResult);
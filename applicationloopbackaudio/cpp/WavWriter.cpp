@@ -0,0 +1,194 @@
+#include "WavWriter.h"
+
+#pragma pack(push, 1)
+// Payload of the ds64 chunk of an RF64 file. The JUNK chunk reserved by Create has the same size.
+struct DataSize64Chunk
+{
+    UINT64 riffSize;
+    UINT64 dataSize;
+    UINT64 sampleCount;
+    DWORD tableLength;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(DataSize64Chunk) == WavWriter::DataSize64ChunkSize, "ds64 chunk size mismatch");
+
+// Placeholder of the 32-bit sizes of an RF64 file. The real values are in the ds64 chunk.
+static const DWORD RF64SizePlaceholder = 0xFFFFFFFF;
+
+//
+//  Create()
+//
+//  Creates the file and writes the RIFF header with empty chunk sizes
+//
+HRESULT WavWriter::Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options)
+{
+    m_File = CreateOutputFile(options.fileMode);
+
+    HRESULT hr = m_File->Create(fileName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_cbHeaderSize = 0;
+    m_cbDataSize = 0;
+
+    // WAVEFORMATEXTENSIBLE does not fit in a .wav file. In this case, generate a file without header.
+    m_bHeader = (format.wFormatTag != WAVE_FORMAT_EXTENSIBLE);
+    if (!m_bHeader)
+    {
+        return S_OK;
+    }
+
+    // 1. RIFF chunk descriptor
+    DWORD header[] = {
+        FCC('RIFF'),        // RIFF header
+        0,                  // Total size of WAV (will be filled in later)
+        FCC('WAVE'),        // WAVE FourCC
+    };
+    if (FAILED(hr = m_File->Write(header, sizeof(header))))
+    {
+        return hr;
+    }
+
+    // 2. Room for the ds64 chunk, in case the file outgrows 4 GB
+    DWORD junk[] = { FCC('JUNK'), sizeof(DataSize64Chunk) };
+    DataSize64Chunk reserved {};
+    if (FAILED(hr = m_File->Write(junk, sizeof(junk))) || FAILED(hr = m_File->Write(&reserved, sizeof(reserved))))
+    {
+        return hr;
+    }
+
+    // 3. The fmt sub-chunk. PCM and float formats carry no extra bytes.
+    DWORD fmtHeader[] = { FCC('fmt '), sizeof(WAVEFORMATEX) };
+    WAVEFORMATEX fmt = format;
+    fmt.cbSize = 0;
+    if (FAILED(hr = m_File->Write(fmtHeader, sizeof(fmtHeader))) || FAILED(hr = m_File->Write(&fmt, sizeof(fmt))))
+    {
+        return hr;
+    }
+
+    // 4. The data sub-chunk
+    DWORD data[] = { FCC('data'), 0 };  // Start of 'data' chunk
+    if (FAILED(hr = m_File->Write(data, sizeof(data))))
+    {
+        return hr;
+    }
+
+    m_cbHeaderSize = (DWORD)m_File->GetPosition();
+    return S_OK;
+}
+
+HRESULT WavWriter::WriteData(const void* data, size_t bytes)
+{
+    HRESULT hr = m_File->Write(data, bytes);
+    if (SUCCEEDED(hr))
+    {
+        m_cbDataSize += bytes;
+    }
+    return hr;
+}
+
+HRESULT WavWriter::CommitData(size_t bytes)
+{
+    HRESULT hr = m_File->CommitAppend(bytes);
+    if (SUCCEEDED(hr))
+    {
+        m_cbDataSize += bytes;
+    }
+    return hr;
+}
+
+//
+//  WriteSizes()
+//
+//  Writes the size of the 'data' chunk and of the whole RIFF chunk into the header. Files past 4 GB switch to RF64:
+//  the 32-bit sizes become 0xFFFFFFFF and the real ones go into the ds64 chunk that replaces the JUNK chunk.
+//
+HRESULT WavWriter::WriteSizes(IOutputFile& file, DWORD cbHeaderSize, UINT64 cbDataSize)
+{
+    HRESULT hr = S_OK;
+
+    // Total file size, minus RIFF chunk and size
+    // sizeof(DWORD) == sizeof(FOURCC)
+    UINT64 cbRiffSize = cbHeaderSize + cbDataSize + (cbDataSize & 1) - 8;
+
+    if (IsRF64(cbHeaderSize, cbDataSize))
+    {
+        DWORD riff[] = { FCC('RF64'), RF64SizePlaceholder };
+        DWORD ds64[] = { FCC('ds64'), sizeof(DataSize64Chunk) };
+        DataSize64Chunk sizes {};
+        sizes.riffSize = cbRiffSize;
+        sizes.dataSize = cbDataSize;
+        // Only meaningful for non-PCM formats; readers use the data size for PCM and float
+        sizes.sampleCount = 0;
+        sizes.tableLength = 0;
+
+        // The ds64 chunk goes first so a reader never sees RF64 without valid 64-bit sizes
+        if (FAILED(hr = file.WriteAt(DataSize64ChunkOffset, ds64, sizeof(ds64))) ||
+            FAILED(hr = file.WriteAt(DataSize64ChunkOffset + sizeof(ds64), &sizes, sizeof(sizes))) ||
+            FAILED(hr = file.WriteAt(cbHeaderSize - sizeof(DWORD), &RF64SizePlaceholder, sizeof(DWORD))) ||
+            FAILED(hr = file.WriteAt(0, riff, sizeof(riff))))
+        {
+            return hr;
+        }
+        return S_OK;
+    }
+
+    // Write the size of the 'data' chunk first
+    DWORD cbDataSize32 = (DWORD)cbDataSize;
+    DWORD cbTotalSize = (DWORD)cbRiffSize;
+    if (FAILED(hr = file.WriteAt(cbHeaderSize - sizeof(DWORD), &cbDataSize32, sizeof(DWORD))) ||
+        FAILED(hr = file.WriteAt(sizeof(DWORD), &cbTotalSize, sizeof(DWORD))))
+    {
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT WavWriter::CommitHeader()
+{
+    if (!IsOpen() || !m_bHeader)
+    {
+        return S_OK;
+    }
+    return WriteSizes(*m_File, m_cbHeaderSize, m_cbDataSize);
+}
+
+//
+//  Finalize()
+//
+//  Pads the data chunk to an even size and writes the final chunk sizes, then flushes and closes the file
+//
+HRESULT WavWriter::Finalize()
+{
+    if (!IsOpen())
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
+    if (m_bHeader)
+    {
+        // Chunks are padded to an even size
+        if (m_cbDataSize & 1)
+        {
+            BYTE pad = 0;
+            hr = m_File->Write(&pad, 1);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteSizes(*m_File, m_cbHeaderSize, m_cbDataSize);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_File->Flush();
+    }
+    HRESULT hrClose = m_File->Close();
+
+    return SUCCEEDED(hr) ? hrClose : hr;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AudioFileWriter.h"
+
+/**
+* Writes a WAV file: the RIFF header, then the sample data appended with WriteData. The chunk sizes are left at zero
+* until Finalize patches them.
+*
+* The header reserves a JUNK chunk right after the RIFF descriptor. While the file stays under 4 GB it is a plain WAV
+* file that readers skip the JUNK chunk of; once the sizes no longer fit in 32 bits, Finalize turns it into an RF64
+* (EBU Tech 3306 / BW64) file by rewriting the RIFF FourCC and replacing the JUNK chunk with a ds64 chunk holding the
+* 64-bit sizes. Recordings therefore never have to stop at 4 GB.
+*
+* WAVEFORMATEXTENSIBLE captures are written as raw samples without a header, as the capture classes always did.
+*/
+class WavWriter : public IAudioFileWriter
+{
+public:
+    HRESULT Create(const std::filesystem::path& fileName, const WAVEFORMATEX& format, const AudioFileWriterOptions& options = AudioFileWriterOptions()) override;
+    bool IsOpen() const override { return m_File && m_File->IsOpen(); }
+
+    HRESULT WriteData(const void* data, size_t bytes) override;
+    // Memory the next data bytes can be written to in place (mapped files only), see IOutputFile::GetAppendBuffer
+    BYTE* GetDataBuffer(size_t* pcbAvailable) override { return m_File->GetAppendBuffer(pcbAvailable); }
+    // Adds bytes written to the GetDataBuffer memory to the data chunk
+    HRESULT CommitData(size_t bytes) override;
+    // Patches the chunk sizes for the data written so far. Two positional writes.
+    HRESULT CommitHeader() override;
+    HRESULT Flush() override { return m_File->Flush(); }
+    // Patches the chunk sizes, flushes and closes the file
+    HRESULT Finalize() override;
+
+    UINT64 GetDataSize() const override { return m_cbDataSize; }
+    UINT64 GetDataOffset() const override { return m_cbHeaderSize; }
+    // True once the data has outgrown the 32-bit RIFF sizes
+    bool IsRF64() const { return IsRF64(m_cbHeaderSize, m_cbDataSize); }
+
+    // Writes the RIFF and data chunk sizes (and the ds64 chunk for RF64 files) into a header laid out by Create.
+    // Shared with the repair of interrupted recordings.
+    static HRESULT WriteSizes(IOutputFile& file, DWORD cbHeaderSize, UINT64 cbDataSize);
+    static bool IsRF64(DWORD cbHeaderSize, UINT64 cbDataSize) { return cbDataSize + cbHeaderSize > 0xFFFFFFFFull; }
+    // Offset and size of the JUNK chunk Create reserves for the ds64 chunk
+    static const UINT64 DataSize64ChunkOffset = 12;
+    static const DWORD DataSize64ChunkSize = 28;
+
+private:
+
+    std::unique_ptr<IOutputFile> m_File;
+    bool m_bHeader = false;
+    DWORD m_cbHeaderSize = 0;
+    UINT64 m_cbDataSize = 0;
+};
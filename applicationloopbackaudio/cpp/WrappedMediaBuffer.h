@@ -0,0 +1,85 @@
+#pragma once
+
+#include <mfapi.h>
+#include <wrl\implements.h>
+
+/**
+* IMFMediaBuffer over memory owned by someone else.
+*
+* Used as the output buffer of the Media Foundation resampler so it writes straight into the render client's buffer
+* instead of into an intermediate buffer that then has to be copied. The target is set before every ProcessOutput call.
+*/
+class CWrappedMediaBuffer :
+    public Microsoft::WRL::RuntimeClass< Microsoft::WRL::RuntimeClassFlags< Microsoft::WRL::ClassicCom >, IMFMediaBuffer >
+{
+public:
+    void SetTarget(BYTE* pData, DWORD cbMaxLength)
+    {
+        m_pData = pData;
+        m_cbMaxLength = cbMaxLength;
+        m_cbCurrentLength = 0;
+    }
+
+    // IMFMediaBuffer
+    STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength) override
+    {
+        if (ppbBuffer == nullptr)
+        {
+            return E_POINTER;
+        }
+        if (m_pData == nullptr)
+        {
+            return E_UNEXPECTED;
+        }
+        *ppbBuffer = m_pData;
+        if (pcbMaxLength != nullptr)
+        {
+            *pcbMaxLength = m_cbMaxLength;
+        }
+        if (pcbCurrentLength != nullptr)
+        {
+            *pcbCurrentLength = m_cbCurrentLength;
+        }
+        return S_OK;
+    }
+
+    STDMETHODIMP Unlock() override
+    {
+        return S_OK;
+    }
+
+    STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength) override
+    {
+        if (pcbCurrentLength == nullptr)
+        {
+            return E_POINTER;
+        }
+        *pcbCurrentLength = m_cbCurrentLength;
+        return S_OK;
+    }
+
+    STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength) override
+    {
+        if (cbCurrentLength > m_cbMaxLength)
+        {
+            return E_INVALIDARG;
+        }
+        m_cbCurrentLength = cbCurrentLength;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength) override
+    {
+        if (pcbMaxLength == nullptr)
+        {
+            return E_POINTER;
+        }
+        *pcbMaxLength = m_cbMaxLength;
+        return S_OK;
+    }
+
+private:
+    BYTE* m_pData = nullptr;
+    DWORD m_cbMaxLength = 0;
+    DWORD m_cbCurrentLength = 0;
+};
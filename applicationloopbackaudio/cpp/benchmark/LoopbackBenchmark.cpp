@@ -0,0 +1,831 @@
+// LoopbackBenchmark.cpp : Measures the throughput and per-call latency of the portable pipeline stages on synthetic
+// audio, writes the results as JSON and compares them against a baseline run.
+//
+
+#include "Platform.h"
+#include "AudioFileWriter.h"
+#include "ChannelRemix.h"
+#include "CpuFeatures.h"
+#include "LatencyHistogram.h"
+#include "PolyphaseResampler.h"
+#include "SampleConvert.h"
+#include "SegmentedWavWriter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Packet sizes of a 10 ms device period at 44.1 and 48 kHz, and a large packet of a long period
+    const UINT32 s_PacketFrames[] = { 441, 480, 1024 };
+
+    // Untimed calls before the measurement, to fill the caches and the filter histories
+    const UINT32 WarmUpCalls = 50;
+    // Fewest timed calls of a measurement, however long they take
+    const UINT32 MinCalls = 200;
+    // Recordings are finalized and started over past this size, so a run never fills the disk
+    const UINT64 MaxRecordingBytes = 64 * 1024 * 1024;
+
+    struct BenchmarkOptions
+    {
+        // Only the cases whose name contains this
+        std::string filter;
+        // Shortest measurement time of a case
+        UINT32 minTimeMs = 200;
+        // Rounds of measurements. The one with the fastest median is kept for each case, so interference from the rest
+        // of the machine, which only ever slows a measurement down, does not pass for a regression.
+        UINT32 repeat = 1;
+        // JSON results file. Written to stdout when empty.
+        std::string outputPath;
+        // Results of an earlier run to compare with
+        std::string baselinePath;
+        // A case whose median call got slower than its baseline by more than this fails the run
+        double thresholdPercent = 10.0;
+        bool bList = false;
+    };
+
+    struct BenchmarkResult
+    {
+        std::string name;
+        std::string component;
+        UINT32 packetFrames = 0;
+        UINT64 calls = 0;
+        double framesPerSecond = 0;
+        double realtimeFactor = 0;
+        LatencyHistogramSnapshot callNs;
+        bool bHasBaseline = false;
+        // Speed of the median call against the baseline: +10 is 10% faster
+        double baselineChangePercent = 0;
+    };
+
+    //
+    //  FillSignal()
+    //
+    //  Two sines per channel plus low-level noise, so the samples are neither silent nor trivially compressible
+    //
+    void FillSignal(float* samples, UINT32 frames, UINT32 channels, UINT32 sampleRate)
+    {
+        const double twoPi = 6.283185307179586;
+        UINT32 noise = 1;
+        for (UINT32 i = 0; i < frames; i++)
+        {
+            for (UINT32 c = 0; c < channels; c++)
+            {
+                noise = noise * 1664525 + 1013904223;
+                double t = (double)i / sampleRate;
+                double value = 0.4 * sin(twoPi * (440.0 + 110.0 * c) * t) + 0.2 * sin(twoPi * 3150.0 * t) +
+                    0.01 * ((double)(noise >> 8) / (1 << 24) - 0.5);
+                samples[(size_t)i * channels + c] = (float)value;
+            }
+        }
+    }
+
+    const char* GetSampleFormatName(SampleFormat format)
+    {
+        switch (format)
+        {
+        case SampleFormat::Int16: return "int16";
+        case SampleFormat::Int24: return "int24";
+        case SampleFormat::Int32: return "int32";
+        case SampleFormat::Float32: return "float32";
+        case SampleFormat::Float64: return "float64";
+        default: return "unknown";
+        }
+    }
+
+    const char* GetQualityName(ResamplerQuality quality)
+    {
+        switch (quality)
+        {
+        case ResamplerQuality::Low: return "low";
+        case ResamplerQuality::Medium: return "medium";
+        case ResamplerQuality::High: return "high";
+        default: return "best";
+        }
+    }
+
+    /**
+    * One pipeline stage driven packet by packet. Setup prepares the stage for a packet size, Run processes one
+    * packet and is the only timed call.
+    */
+    class BenchmarkCase
+    {
+    public:
+        BenchmarkCase(const char* component, const std::string& name, UINT32 sampleRate)
+            : m_Component(component), m_Name(std::string(component) + "/" + name), m_SampleRate(sampleRate)
+        {
+        }
+        virtual ~BenchmarkCase() = default;
+
+        const char* GetComponent() const { return m_Component; }
+        // Name of the case, without the packet size
+        const std::string& GetName() const { return m_Name; }
+        // Rate of the input frames, the real-time rate of the stage
+        UINT32 GetSampleRate() const { return m_SampleRate; }
+
+        virtual HRESULT Setup(UINT32 packetFrames) = 0;
+        // Processes one packet of packetFrames input frames
+        virtual HRESULT Run() = 0;
+        // Untimed work after a Run, e.g. starting a new file
+        virtual HRESULT Maintain() { return S_OK; }
+        virtual HRESULT Teardown() { return S_OK; }
+
+    protected:
+        // Fills one second of input frames of format, from which NextPacket hands out the packets in turn
+        HRESULT SetInput(SampleFormat format, UINT32 channels, UINT32 packetFrames)
+        {
+            m_InputFrames = m_SampleRate;
+            m_PacketFrames = packetFrames;
+            m_FrameBytes = GetSampleBytes(format) * channels;
+            m_Offset = 0;
+
+            std::vector<float> signal((size_t)m_InputFrames * channels);
+            FillSignal(signal.data(), m_InputFrames, channels, m_SampleRate);
+            m_Input.resize((size_t)m_InputFrames * m_FrameBytes);
+            if (format == SampleFormat::Float32)
+            {
+                memcpy(m_Input.data(), signal.data(), m_Input.size());
+                return S_OK;
+            }
+
+            SampleConvertFn convert = GetSampleConverter(SampleFormat::Float32, format, SampleConvertKernel::Scalar);
+            if (convert == nullptr)
+            {
+                return E_INVALIDARG;
+            }
+            convert((const BYTE*)signal.data(), m_Input.data(), signal.size());
+            return S_OK;
+        }
+
+        const BYTE* NextPacket()
+        {
+            if (m_Offset + m_PacketFrames > m_InputFrames)
+            {
+                m_Offset = 0;
+            }
+            const BYTE* packet = m_Input.data() + (size_t)m_Offset * m_FrameBytes;
+            m_Offset += m_PacketFrames;
+            return packet;
+        }
+
+        UINT32 m_PacketFrames = 0;
+        UINT32 m_FrameBytes = 0;
+
+    private:
+        const char* m_Component;
+        std::string m_Name;
+        UINT32 m_SampleRate;
+        std::vector<BYTE> m_Input;
+        UINT32 m_InputFrames = 0;
+        UINT32 m_Offset = 0;
+    };
+
+    /**
+    * PolyphaseResampler on stereo float packets, at the nominal ratio or following a drifting input clock
+    */
+    class ResampleBenchmark : public BenchmarkCase
+    {
+    public:
+        ResampleBenchmark(ResamplerQuality quality, UINT32 inputRate, UINT32 outputRate, double driftPpm = 0.0)
+            : BenchmarkCase("resample", std::string(GetQualityName(quality)) + (driftPpm != 0.0 ? "-drift/" : "/") +
+                std::to_string(inputRate) + "-" + std::to_string(outputRate), inputRate),
+            m_Quality(quality), m_OutputRate(outputRate), m_DriftPpm(driftPpm)
+        {
+        }
+
+        HRESULT Setup(UINT32 packetFrames) override
+        {
+            HRESULT hr = m_Resampler.Initialize(GetSampleRate(), m_OutputRate, Channels, m_Quality, ResamplerKernel::Auto, m_DriftPpm != 0.0);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            if (m_DriftPpm != 0.0)
+            {
+                m_Resampler.SetInputRateScale(1.0 + m_DriftPpm / 1e6);
+            }
+            m_Output.resize((size_t)m_Resampler.GetMaxOutputFrames(packetFrames) * Channels);
+            return SetInput(SampleFormat::Float32, Channels, packetFrames);
+        }
+
+        HRESULT Run() override
+        {
+            m_Resampler.Process((const float*)NextPacket(), m_PacketFrames, m_Output.data());
+            return S_OK;
+        }
+
+    private:
+        static const UINT32 Channels = 2;
+
+        ResamplerQuality m_Quality;
+        UINT32 m_OutputRate;
+        double m_DriftPpm;
+        PolyphaseResampler m_Resampler;
+        std::vector<float> m_Output;
+    };
+
+    /**
+    * Frame converter of the render path between two sample formats
+    */
+    class ConvertBenchmark : public BenchmarkCase
+    {
+    public:
+        ConvertBenchmark(SampleFormat src, SampleFormat dst, UINT32 channels)
+            : BenchmarkCase("convert", std::string(GetSampleFormatName(src)) + "-" + GetSampleFormatName(dst) + "/" +
+                std::to_string(channels) + "ch", 48000),
+            m_Src(src), m_Dst(dst), m_Channels(channels)
+        {
+        }
+
+        HRESULT Setup(UINT32 packetFrames) override
+        {
+            m_Convert = GetFrameConverter(m_Src, m_Dst, m_Channels);
+            if (m_Convert == nullptr)
+            {
+                return E_INVALIDARG;
+            }
+            m_Output.resize((size_t)packetFrames * m_Channels * GetSampleBytes(m_Dst));
+            return SetInput(m_Src, m_Channels, packetFrames);
+        }
+
+        HRESULT Run() override
+        {
+            m_Convert(NextPacket(), m_Output.data(), m_PacketFrames);
+            return S_OK;
+        }
+
+    private:
+        SampleFormat m_Src;
+        SampleFormat m_Dst;
+        UINT32 m_Channels;
+        FrameConvertFn m_Convert = nullptr;
+        std::vector<BYTE> m_Output;
+    };
+
+    /**
+    * ChannelRemix with the standard matrix between the default layouts of two channel counts
+    */
+    class RemixBenchmark : public BenchmarkCase
+    {
+    public:
+        RemixBenchmark(SampleFormat src, UINT32 srcChannels, SampleFormat dst, UINT32 dstChannels)
+            : BenchmarkCase("remix", std::to_string(srcChannels) + "ch-" + GetSampleFormatName(src) + "/" +
+                std::to_string(dstChannels) + "ch-" + GetSampleFormatName(dst), 48000),
+            m_Src(src), m_SrcChannels(srcChannels), m_Dst(dst), m_DstChannels(dstChannels)
+        {
+        }
+
+        HRESULT Setup(UINT32 packetFrames) override
+        {
+            HRESULT hr = m_Remix.Initialize(m_Src, m_SrcChannels, 0, m_Dst, m_DstChannels, 0);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            m_Output.resize((size_t)packetFrames * m_DstChannels * GetSampleBytes(m_Dst));
+            return SetInput(m_Src, m_SrcChannels, packetFrames);
+        }
+
+        HRESULT Run() override
+        {
+            m_Remix.Process(NextPacket(), m_Output.data(), m_PacketFrames);
+            return S_OK;
+        }
+
+    private:
+        SampleFormat m_Src;
+        UINT32 m_SrcChannels;
+        SampleFormat m_Dst;
+        UINT32 m_DstChannels;
+        ChannelRemix m_Remix;
+        std::vector<BYTE> m_Output;
+    };
+
+    enum class WriterKind
+    {
+        Wav,
+        Flac,
+        Segmented,
+    };
+
+    /**
+    * Recording writer appending 16-bit stereo packets to a file in the scratch directory
+    */
+    class WriterBenchmark : public BenchmarkCase
+    {
+    public:
+        WriterBenchmark(WriterKind kind, OutputFileMode fileMode, const std::filesystem::path& directory)
+            : BenchmarkCase("write", GetWriterName(kind, fileMode), 48000), m_Kind(kind), m_Directory(directory)
+        {
+            m_Options.fileMode = fileMode;
+        }
+
+        HRESULT Setup(UINT32 packetFrames) override
+        {
+            m_Format.wFormatTag = WAVE_FORMAT_PCM;
+            m_Format.nChannels = Channels;
+            m_Format.nSamplesPerSec = GetSampleRate();
+            m_Format.wBitsPerSample = 16;
+            m_Format.nBlockAlign = Channels * 2;
+            m_Format.nAvgBytesPerSec = m_Format.nSamplesPerSec * m_Format.nBlockAlign;
+            m_Format.cbSize = 0;
+
+            HRESULT hr = SetInput(SampleFormat::Int16, Channels, packetFrames);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            return Create();
+        }
+
+        HRESULT Run() override
+        {
+            const BYTE* packet = NextPacket();
+            size_t bytes = (size_t)m_PacketFrames * m_FrameBytes;
+            m_cbWritten += bytes;
+            return (m_Kind == WriterKind::Segmented) ? m_Segmented.WriteData(packet, bytes) : m_Writer->WriteData(packet, bytes);
+        }
+
+        HRESULT Maintain() override
+        {
+            if (m_cbWritten < MaxRecordingBytes)
+            {
+                return S_OK;
+            }
+
+            HRESULT hr = Teardown();
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            return Create();
+        }
+
+        HRESULT Teardown() override
+        {
+            HRESULT hr = S_OK;
+            if (m_Kind == WriterKind::Segmented)
+            {
+                if (m_Segmented.IsOpen())
+                {
+                    hr = m_Segmented.Finalize();
+                }
+            }
+            else if (m_Writer && m_Writer->IsOpen())
+            {
+                hr = m_Writer->Finalize();
+            }
+            m_Writer.reset();
+
+            std::error_code error;
+            std::filesystem::remove_all(m_Directory / GetName(), error);
+            return hr;
+        }
+
+    private:
+        static const UINT32 Channels = 2;
+        static const UINT32 SegmentSeconds = 10;
+
+        static std::string GetWriterName(WriterKind kind, OutputFileMode fileMode)
+        {
+            const char* mode = (fileMode == OutputFileMode::Mapped) ? "mapped" : "buffered";
+            switch (kind)
+            {
+            case WriterKind::Flac: return std::string("flac/") + mode;
+            case WriterKind::Segmented: return std::string("wav-segmented/") + mode;
+            default: return std::string("wav/") + mode;
+            }
+        }
+
+        HRESULT Create()
+        {
+            std::filesystem::path directory = m_Directory / GetName();
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            if (error)
+            {
+                return E_FAIL;
+            }
+
+            m_cbWritten = 0;
+            if (m_Kind == WriterKind::Segmented)
+            {
+                return m_Segmented.Create(directory / "capture.wav", m_Format, m_Options, (UINT64)SegmentSeconds * GetSampleRate());
+            }
+
+            std::filesystem::path fileName = directory / ((m_Kind == WriterKind::Flac) ? "capture.flac" : "capture.wav");
+            m_Writer = CreateAudioFileWriter(fileName);
+            return m_Writer->Create(fileName, m_Format, m_Options);
+        }
+
+        WriterKind m_Kind;
+        std::filesystem::path m_Directory;
+        AudioFileWriterOptions m_Options;
+        WAVEFORMATEX m_Format {};
+        std::unique_ptr<IAudioFileWriter> m_Writer;
+        SegmentedWavWriter m_Segmented;
+        UINT64 m_cbWritten = 0;
+    };
+
+    std::vector<std::unique_ptr<BenchmarkCase>> CreateCases(const std::filesystem::path& scratchDirectory)
+    {
+        std::vector<std::unique_ptr<BenchmarkCase>> cases;
+        for (ResamplerQuality quality : { ResamplerQuality::Low, ResamplerQuality::Medium, ResamplerQuality::High, ResamplerQuality::Best })
+        {
+            cases.push_back(std::make_unique<ResampleBenchmark>(quality, 44100, 48000));
+            cases.push_back(std::make_unique<ResampleBenchmark>(quality, 48000, 44100));
+        }
+        // The drift compensation path: fractional phase steps and two dot products per output
+        cases.push_back(std::make_unique<ResampleBenchmark>(ResamplerQuality::High, 48000, 48000, 100.0));
+
+        cases.push_back(std::make_unique<ConvertBenchmark>(SampleFormat::Int16, SampleFormat::Float32, 2));
+        cases.push_back(std::make_unique<ConvertBenchmark>(SampleFormat::Int24, SampleFormat::Float32, 2));
+        cases.push_back(std::make_unique<ConvertBenchmark>(SampleFormat::Float32, SampleFormat::Int16, 2));
+        cases.push_back(std::make_unique<ConvertBenchmark>(SampleFormat::Float32, SampleFormat::Int24, 2));
+
+        cases.push_back(std::make_unique<RemixBenchmark>(SampleFormat::Float32, 6, SampleFormat::Float32, 2));
+        cases.push_back(std::make_unique<RemixBenchmark>(SampleFormat::Float32, 2, SampleFormat::Float32, 6));
+        cases.push_back(std::make_unique<RemixBenchmark>(SampleFormat::Int16, 8, SampleFormat::Float32, 2));
+
+        for (OutputFileMode fileMode : { OutputFileMode::Buffered, OutputFileMode::Mapped })
+        {
+            cases.push_back(std::make_unique<WriterBenchmark>(WriterKind::Wav, fileMode, scratchDirectory));
+            cases.push_back(std::make_unique<WriterBenchmark>(WriterKind::Segmented, fileMode, scratchDirectory));
+        }
+        cases.push_back(std::make_unique<WriterBenchmark>(WriterKind::Flac, OutputFileMode::Buffered, scratchDirectory));
+        return cases;
+    }
+
+    //
+    //  Measure()
+    //
+    //  Runs the case until it has been timed for at least minTimeMs and MinCalls calls. Throughput counts the time
+    //  spent in Run only. It includes the rare slow calls (page faults, file system stalls), which the median does not,
+    //  so the median is what the baseline comparison uses.
+    //
+    HRESULT Measure(BenchmarkCase& benchmarkCase, UINT32 packetFrames, const BenchmarkOptions& options, BenchmarkResult* pResult)
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        HRESULT hr = benchmarkCase.Setup(packetFrames);
+        for (UINT32 i = 0; SUCCEEDED(hr) && i < WarmUpCalls; i++)
+        {
+            hr = benchmarkCase.Run();
+        }
+
+        // Large enough not to be allocated on the stack
+        std::unique_ptr<LatencyHistogram> callNs = std::make_unique<LatencyHistogram>();
+        UINT64 busyNs = 0;
+        UINT64 calls = 0;
+        const UINT64 minTimeNs = (UINT64)options.minTimeMs * 1000000;
+        while (SUCCEEDED(hr) && (busyNs < minTimeNs || calls < MinCalls))
+        {
+            Clock::time_point start = Clock::now();
+            hr = benchmarkCase.Run();
+            UINT64 elapsedNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            callNs->Record(elapsedNs);
+            busyNs += elapsedNs;
+            calls++;
+            if (SUCCEEDED(hr))
+            {
+                hr = benchmarkCase.Maintain();
+            }
+        }
+
+        HRESULT hrTeardown = benchmarkCase.Teardown();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        if (FAILED(hrTeardown))
+        {
+            return hrTeardown;
+        }
+
+        pResult->name = benchmarkCase.GetName() + "/" + std::to_string(packetFrames);
+        pResult->component = benchmarkCase.GetComponent();
+        pResult->packetFrames = packetFrames;
+        pResult->calls = calls;
+        pResult->framesPerSecond = (double)calls * packetFrames * 1e9 / (double)(busyNs > 0 ? busyNs : 1);
+        pResult->realtimeFactor = pResult->framesPerSecond / benchmarkCase.GetSampleRate();
+        pResult->callNs = callNs->GetSnapshot();
+        return S_OK;
+    }
+
+    //
+    //  ReadBaseline()
+    //
+    //  Reads the median call time of each case from a results file written by this program. This is not a general
+    //  JSON parser: it relies on "name" preceding "nsPerCall" in every result.
+    //
+    HRESULT ReadBaseline(const std::string& path, std::map<std::string, double>* pBaseline)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return E_INVALIDARG;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        const std::string nameKey = "\"name\": \"";
+        const std::string valueKey = "\"nsPerCall\": { \"p50\": ";
+        size_t position = 0;
+        while ((position = text.find(nameKey, position)) != std::string::npos)
+        {
+            size_t nameStart = position + nameKey.size();
+            size_t nameEnd = text.find('"', nameStart);
+            size_t value = text.find(valueKey, nameStart);
+            if (nameEnd == std::string::npos || value == std::string::npos)
+            {
+                break;
+            }
+            (*pBaseline)[text.substr(nameStart, nameEnd - nameStart)] = strtod(text.c_str() + value + valueKey.size(), nullptr);
+            position = nameEnd;
+        }
+        return pBaseline->empty() ? E_INVALIDARG : S_OK;
+    }
+
+    void WriteResults(std::ostream& out, const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options)
+    {
+        const CpuFeatures& cpu = CpuFeatures::Get();
+        out << "{\n"
+            << "  \"schema\": 1,\n"
+            << "  \"minTimeMs\": " << options.minTimeMs << ",\n"
+            << "  \"repeat\": " << options.repeat << ",\n"
+            << "  \"cpu\": { \"sse41\": " << (cpu.sse41 ? "true" : "false") << ", \"avx2\": " << (cpu.avx2 ? "true" : "false")
+            << ", \"neon\": " << (cpu.neon ? "true" : "false") << " },\n"
+            << "  \"results\": [\n";
+        char number[64];
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchmarkResult& result = results[i];
+            out << "    {\n"
+                << "      \"name\": \"" << result.name << "\",\n"
+                << "      \"component\": \"" << result.component << "\",\n"
+                << "      \"packetFrames\": " << result.packetFrames << ",\n"
+                << "      \"calls\": " << result.calls << ",\n";
+            snprintf(number, sizeof(number), "%.6g", result.framesPerSecond);
+            out << "      \"framesPerSecond\": " << number << ",\n";
+            snprintf(number, sizeof(number), "%.6g", result.realtimeFactor);
+            out << "      \"realtimeFactor\": " << number << ",\n";
+            if (result.bHasBaseline)
+            {
+                snprintf(number, sizeof(number), "%.2f", result.baselineChangePercent);
+                out << "      \"baselineChangePercent\": " << number << ",\n";
+            }
+            out << "      \"nsPerCall\": { \"p50\": " << result.callNs.p50 << ", \"p99\": " << result.callNs.p99
+                << ", \"p999\": " << result.callNs.p999 << ", \"max\": " << result.callNs.max << " }\n"
+                << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+
+    void usage()
+    {
+        std::cerr <<
+            "Usage: LoopbackBenchmark [--filter <text>] [--min-time <ms>] [--repeat <n>] [--output <file.json>] [--baseline <file.json>]\n"
+            "                         [--threshold <percent>] [--list]\n"
+            "\n"
+            "--filter only runs the cases whose name contains the text, e.g. resample/high or /480\n"
+            "--min-time is the shortest time each case is measured for (default 200 ms)\n"
+            "--repeat measures each case n times and keeps the fastest median (default 1); a case slower than its\n"
+            "         baseline is measured n times more before it counts as a regression\n"
+            "--output writes the JSON results to a file instead of stdout\n"
+            "--baseline compares the median call time with the results of an earlier run; the exit code is 1 if a case\n"
+            "           got slower than its baseline by more than --threshold percent (default 10)\n"
+            "--list prints the names of the cases\n";
+    }
+
+    bool ParseOptions(int argc, char* argv[], BenchmarkOptions* pOptions)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--list")
+            {
+                pOptions->bList = true;
+                continue;
+            }
+            if (i + 1 == argc)
+            {
+                return false;
+            }
+
+            const char* value = argv[++i];
+            if (arg == "--filter")
+            {
+                pOptions->filter = value;
+            }
+            else if (arg == "--min-time")
+            {
+                pOptions->minTimeMs = (UINT32)strtoul(value, nullptr, 0);
+            }
+            else if (arg == "--repeat")
+            {
+                pOptions->repeat = (UINT32)strtoul(value, nullptr, 0);
+                if (pOptions->repeat == 0)
+                {
+                    pOptions->repeat = 1;
+                }
+            }
+            else if (arg == "--output")
+            {
+                pOptions->outputPath = value;
+            }
+            else if (arg == "--baseline")
+            {
+                pOptions->baselinePath = value;
+            }
+            else if (arg == "--threshold")
+            {
+                pOptions->thresholdPercent = strtod(value, nullptr);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    UINT32 GetProcessId()
+    {
+#ifdef _WIN32
+        return (UINT32)GetCurrentProcessId();
+#else
+        return (UINT32)getpid();
+#endif
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        usage();
+        return 2;
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baselinePath.empty() && FAILED(ReadBaseline(options.baselinePath, &baseline)))
+    {
+        std::cerr << "Cannot read the baseline " << options.baselinePath << std::endl;
+        return 2;
+    }
+
+    std::error_code error;
+    std::filesystem::path scratchDirectory = std::filesystem::temp_directory_path(error) / ("LoopbackBenchmark-" + std::to_string(GetProcessId()));
+    std::vector<std::unique_ptr<BenchmarkCase>> cases = CreateCases(scratchDirectory);
+
+    // The rounds of --repeat run the whole selection one after the other rather than each case n times in a row, so a
+    // burst of load on the machine does not slow down every measurement of the same case
+    struct SelectedCase
+    {
+        BenchmarkCase* benchmarkCase;
+        UINT32 packetFrames;
+        std::string name;
+    };
+    std::vector<SelectedCase> selected;
+    for (const std::unique_ptr<BenchmarkCase>& benchmarkCase : cases)
+    {
+        for (UINT32 packetFrames : s_PacketFrames)
+        {
+            std::string name = benchmarkCase->GetName() + "/" + std::to_string(packetFrames);
+            if (name.find(options.filter) == std::string::npos)
+            {
+                continue;
+            }
+            if (options.bList)
+            {
+                std::cout << name << "\n";
+                continue;
+            }
+            selected.push_back({ benchmarkCase.get(), packetFrames, name });
+        }
+    }
+
+    std::vector<BenchmarkResult> best(selected.size());
+    std::vector<HRESULT> status(selected.size(), S_OK);
+    std::vector<bool> measured(selected.size(), false);
+    auto measureRound = [&](size_t i)
+    {
+        BenchmarkResult roundResult;
+        HRESULT hr = Measure(*selected[i].benchmarkCase, selected[i].packetFrames, options, &roundResult);
+        if (FAILED(hr))
+        {
+            status[i] = hr;
+        }
+        else if (!measured[i] || roundResult.callNs.p50 < best[i].callNs.p50)
+        {
+            measured[i] = true;
+            best[i] = roundResult;
+        }
+    };
+    auto isSlower = [&](size_t i)
+    {
+        auto baselineResult = baseline.find(best[i].name);
+        return baselineResult != baseline.end() && best[i].callNs.p50 > 0 &&
+            (baselineResult->second / best[i].callNs.p50 - 1.0) * 100.0 < -options.thresholdPercent;
+    };
+    for (UINT32 round = 0; round < options.repeat; round++)
+    {
+        if (options.repeat > 1)
+        {
+            fprintf(stderr, "Round %u of %u\n", round + 1, options.repeat);
+        }
+        for (size_t i = 0; i < selected.size(); i++)
+        {
+            if (SUCCEEDED(status[i]))
+            {
+                measureRound(i);
+            }
+        }
+    }
+    // A case that looks slower than its baseline gets as many rounds again before it counts as a regression
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        for (UINT32 round = 0; round < options.repeat && SUCCEEDED(status[i]) && isSlower(i); round++)
+        {
+            measureRound(i);
+        }
+    }
+
+    std::vector<BenchmarkResult> results;
+    bool bRegression = false;
+    bool bFailed = false;
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        if (FAILED(status[i]))
+        {
+            fprintf(stderr, "%-40s failed: 0x%08X\n", selected[i].name.c_str(), (unsigned)status[i]);
+            bFailed = true;
+            continue;
+        }
+
+        BenchmarkResult& result = best[i];
+        auto baselineResult = baseline.find(result.name);
+        if (baselineResult != baseline.end() && result.callNs.p50 > 0)
+        {
+            result.bHasBaseline = true;
+            result.baselineChangePercent = (baselineResult->second / result.callNs.p50 - 1.0) * 100.0;
+        }
+        bool bSlower = result.bHasBaseline && result.baselineChangePercent < -options.thresholdPercent;
+        bRegression = bRegression || bSlower;
+
+        fprintf(stderr, "%-40s %12.0f frames/s %9.1fx realtime  p50 %8llu ns  p99 %8llu ns",
+            result.name.c_str(), result.framesPerSecond, result.realtimeFactor,
+            (unsigned long long)result.callNs.p50, (unsigned long long)result.callNs.p99);
+        if (result.bHasBaseline)
+        {
+            fprintf(stderr, "  %+6.1f%%%s", result.baselineChangePercent, bSlower ? "  SLOWER" : "");
+        }
+        fprintf(stderr, "\n");
+        results.push_back(result);
+    }
+    std::filesystem::remove_all(scratchDirectory, error);
+    if (options.bList)
+    {
+        return 0;
+    }
+
+    if (options.outputPath.empty())
+    {
+        WriteResults(std::cout, results, options);
+    }
+    else
+    {
+        std::ofstream file(options.outputPath, std::ios::binary | std::ios::trunc);
+        WriteResults(file, results, options);
+        if (!file.flush())
+        {
+            std::cerr << "Cannot write " << options.outputPath << std::endl;
+            return 2;
+        }
+    }
+
+    if (bRegression)
+    {
+        std::cerr << "Some cases are more than " << options.thresholdPercent << "% slower than the baseline" << std::endl;
+        return 1;
+    }
+    return bFailed ? 2 : 0;
+}
@@ -0,0 +1,784 @@
+// LatencyHarness.cpp : Runs the render path against a simulated capture client and a simulated render endpoint on
+// virtual clocks, and measures the end-to-end latency, the drops and the buffer fill over simulated hours.
+//
+// Everything runs on one thread in virtual time, so a run takes a fraction of the simulated time and the same options
+// always produce the same results.
+//
+
+#include "Platform.h"
+#include "LatencyHistogram.h"
+#include "LogRing.h"
+#include "PacketArrivalPredictor.h"
+#include "PolyphaseResampler.h"
+#include "RenderPath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const INT64 NsPerSec = 1000000000;
+    const UINT32 Channels = 2;
+
+    struct HarnessOptions
+    {
+        double durationSeconds = 3600.0;
+        UINT32 seed = 1;
+
+        // Capture client: one packet per device period
+        UINT32 captureRate = 48000;
+        double capturePeriodMs = 10.0;
+        // Deviation of the capture device clock from the render device clock, in parts per million
+        double captureDriftPpm = 0.0;
+        // The capture thread runs up to this long after the packet it was woken for is ready, uniformly distributed
+        double captureJitterMs = 1.0;
+        // Chance that a capture wakeup is delayed by stallMs more, e.g. by a page fault or a higher priority thread
+        double stallProbability = 0.0005;
+        double stallMs = 30.0;
+        // Polls every pollMs instead of waking up for each packet. 0 for the event-driven loop.
+        double capturePollMs = 0.0;
+        // Polls when PacketArrivalPredictor expects the next packet instead (the Sync capture loop)
+        bool bCapturePredictive = false;
+
+        // Render endpoint: consumes one engine period at a time from its buffer
+        UINT32 renderRate = 48000;
+        double renderPeriodMs = 10.0;
+        double renderBufferMs = 20.0;
+        double renderDriftPpm = 0.0;
+        // Render pump wakeups, each delayed by up to pumpJitterMs
+        double pumpIntervalMs = 5.0;
+        double pumpJitterMs = 1.0;
+
+        // Render path
+        UINT32 ringMs = 200;
+        UINT32 prefillMs = 20;
+        LatencyPolicy latencyPolicy;
+        ResamplerQuality quality = ResamplerQuality::Best;
+        bool bDriftCompensation = true;
+
+        double reportIntervalSeconds = 60.0;
+        std::string outputPath;
+    };
+
+    // xorshift32: the same sequence for the same seed on every platform
+    class Random
+    {
+    public:
+        explicit Random(UINT32 seed) : m_State(seed != 0 ? seed : 1) {}
+
+        // Uniform in [0, 1)
+        double Next()
+        {
+            m_State ^= m_State << 13;
+            m_State ^= m_State >> 17;
+            m_State ^= m_State << 5;
+            return (double)m_State / 4294967296.0;
+        }
+
+    private:
+        UINT32 m_State;
+    };
+
+    INT64 MsToNs(double ms)
+    {
+        return (INT64)llround(ms * 1e6);
+    }
+
+    /**
+    * Converts the float frames of the simulated capture client to the float frames of the endpoint, with the same
+    * adjustable polyphase resampler as the capture classes. Formats of the same rate are copied, until the render path
+    * measures a drift to compensate when bAdjustable is set.
+    */
+    class SimulatedConverter : public IRenderConverter
+    {
+    public:
+        HRESULT Initialize(UINT32 captureRate, UINT32 renderRate, ResamplerQuality quality, bool bAdjustable)
+        {
+            m_Rate = captureRate;
+            m_Quality = quality;
+            m_bDeferred = (captureRate == renderRate && bAdjustable);
+            if (captureRate == renderRate)
+            {
+                return S_OK;
+            }
+            return m_Resampler.Initialize(captureRate, renderRate, Channels, quality, ResamplerKernel::Auto, bAdjustable);
+        }
+
+        // Group delay of the resampler, in capture frames
+        UINT32 GetLatencyFrames() const { return m_Resampler.IsInitialized() ? m_Resampler.GetLatencyFrames() : 0; }
+        double GetInputRateScale() const { return m_Resampler.GetInputRateScale(); }
+
+        void Reset() override
+        {
+            if (m_Resampler.IsInitialized())
+            {
+                m_Resampler.Reset();
+            }
+        }
+
+        UINT32 GetMaxConvertedFrames(UINT32 frames) override
+        {
+            if (m_bDeferred)
+            {
+                return (UINT32)std::ceil(frames / (1.0 - PolyphaseResampler::MaxRateScalePpm * 1e-6)) + 2;
+            }
+            return m_Resampler.IsInitialized() ? m_Resampler.GetMaxOutputFrames(frames) : frames;
+        }
+
+        UINT32 Convert(BYTE* src, UINT32 frames, BYTE* dst, UINT32 /*maxFrames*/) override
+        {
+            if (!m_Resampler.IsInitialized())
+            {
+                memcpy(dst, src, (size_t)frames * Channels * sizeof(float));
+                return frames;
+            }
+            return m_Resampler.Process((const float*)src, frames, (float*)dst);
+        }
+
+        bool IsAdjustable() const override { return m_Resampler.IsAdjustable(); }
+        void SetInputRateScale(double scale) override { m_Resampler.SetInputRateScale(scale); }
+        bool CanStartAdjusting() const override { return m_bDeferred; }
+
+        bool StartAdjusting() override
+        {
+            if (!m_bDeferred)
+            {
+                return false;
+            }
+            m_bDeferred = false;
+            return SUCCEEDED(m_Resampler.Initialize(m_Rate, m_Rate, Channels, m_Quality, ResamplerKernel::Auto, true));
+        }
+
+    private:
+        PolyphaseResampler m_Resampler;
+        UINT32 m_Rate = 0;
+        ResamplerQuality m_Quality = ResamplerQuality::Best;
+        // Copying until StartAdjusting brings the resampler in
+        bool m_bDeferred = false;
+    };
+
+    /**
+    * Render endpoint on a virtual clock. Once started, the engine takes one period of frames out of the buffer at
+    * every period boundary of the device clock; a period the buffer cannot fill is played partly silent.
+    */
+    class SimulatedRenderTarget : public IRenderTarget
+    {
+    public:
+        void Initialize(UINT32 rate, double periodMs, double bufferMs, double driftPpm)
+        {
+            m_PeriodFrames = (UINT32)llround(rate * periodMs / 1000.0);
+            m_BufferFrames = (UINT32)llround(rate * bufferMs / 1000.0);
+            m_FrameNs = 1e9 / (rate * (1.0 + driftPpm / 1e6));
+            m_Scratch.resize((size_t)m_BufferFrames * Channels);
+        }
+
+        HRESULT Start() override
+        {
+            m_bStarted = true;
+            m_StartNs = m_NowNs;
+            m_Ticks = 0;
+            return S_OK;
+        }
+
+        HRESULT Stop() override
+        {
+            m_bStarted = false;
+            return S_OK;
+        }
+
+        HRESULT GetBufferSize(UINT32* pNumBufferFrames) override
+        {
+            *pNumBufferFrames = m_BufferFrames;
+            return S_OK;
+        }
+
+        HRESULT GetCurrentPadding(UINT32* pNumPaddingFrames) override
+        {
+            *pNumPaddingFrames = GetPadding();
+            return S_OK;
+        }
+
+        HRESULT GetBuffer(UINT32 NumFramesRequested, BYTE** ppData) override
+        {
+            if (NumFramesRequested > m_BufferFrames - GetPadding())
+            {
+                return AUDCLNT_E_INVALID_SIZE;
+            }
+            *ppData = (BYTE*)m_Scratch.data();
+            return S_OK;
+        }
+
+        HRESULT ReleaseBuffer(UINT32 NumFramesWritten, DWORD /*dwFlags*/) override
+        {
+            m_FramesWritten += NumFramesWritten;
+            return S_OK;
+        }
+
+        UINT32 GetPadding() const { return (UINT32)(m_FramesWritten - m_FramesPlayed); }
+        UINT64 GetFramesPlayed() const { return m_FramesPlayed; }
+        UINT64 GetSilentFrames() const { return m_SilentFrames; }
+        UINT64 GetGlitches() const { return m_Glitches; }
+        double GetFrameNs() const { return m_FrameNs; }
+
+        // Time of the next engine period, or the largest time when the engine is stopped
+        INT64 GetNextTickNs() const
+        {
+            return m_bStarted ? m_StartNs + (INT64)llround((double)(m_Ticks + 1) * m_PeriodFrames * m_FrameNs) : std::numeric_limits<INT64>::max();
+        }
+
+        void SetTime(INT64 nowNs) { m_NowNs = nowNs; }
+
+        // Plays the next engine period. Returns the number of buffered frames it played, from GetFramesPlayed() on.
+        UINT32 Tick()
+        {
+            m_NowNs = GetNextTickNs();
+            m_Ticks++;
+            UINT32 frames = std::min(m_PeriodFrames, GetPadding());
+            if (frames < m_PeriodFrames)
+            {
+                m_SilentFrames += m_PeriodFrames - frames;
+                m_Glitches++;
+            }
+            m_FramesPlayed += frames;
+            return frames;
+        }
+
+    private:
+        UINT32 m_PeriodFrames = 0;
+        UINT32 m_BufferFrames = 0;
+        double m_FrameNs = 0.0;
+        std::vector<float> m_Scratch;
+
+        bool m_bStarted = false;
+        INT64 m_NowNs = 0;
+        INT64 m_StartNs = 0;
+        UINT64 m_Ticks = 0;
+        UINT64 m_FramesWritten = 0;
+        UINT64 m_FramesPlayed = 0;
+        UINT64 m_SilentFrames = 0;
+        UINT64 m_Glitches = 0;
+    };
+
+    /**
+    * Results of one report interval
+    */
+    struct IntervalReport
+    {
+        double endSeconds = 0.0;
+        LatencyHistogramSnapshot latencyUs;
+        UINT32 maxRingFrames = 0;
+        UINT32 minPaddingFrames = 0;
+        double driftPpm = 0.0;
+        double rateScale = 1.0;
+        UINT64 cutFrames = 0;
+        UINT64 overrunFrames = 0;
+        UINT64 glitches = 0;
+    };
+
+    /**
+    * Drives a RenderPath with a manual pump from three event sources on the virtual clock: the capture thread
+    * wakeups, the pump wakeups and the engine periods of the render endpoint.
+    *
+    * The latency of a packet is measured from the capture of its first frame to the engine period that plays the
+    * output frame it became, plus the group delay of the resampler. Each packet leaves a marker with the ring index of
+    * its first output frame; the pump copies the ring to the endpoint in order, so that index is also the frame's index
+    * in the endpoint.
+    */
+    class LatencyHarness
+    {
+    public:
+        explicit LatencyHarness(const HarnessOptions& options) : m_Options(options), m_Random(options.seed) {}
+
+        HRESULT Run();
+        void PrintSummary() const;
+        void WriteResults(std::ostream& out) const;
+
+    private:
+        struct LatencyMarker
+        {
+            UINT64 frameIndex;
+            INT64 captureNs;
+        };
+
+        INT64 GetPacketCaptureNs(UINT64 packet) const { return (INT64)llround((double)packet * m_CapturePeriodNs); }
+        INT64 GetNextCaptureWakeNs(INT64 nowNs);
+        HRESULT OnCaptureWake(INT64 nowNs);
+        HRESULT OnPumpWake(INT64 nowNs);
+        void OnEngineTick();
+        void EndInterval(double endSeconds);
+
+        HarnessOptions m_Options;
+        Random m_Random;
+        SimulatedConverter m_Converter;
+        SimulatedRenderTarget m_Target;
+        RenderPath m_RenderPath;
+
+        UINT32 m_CapturePeriodFrames = 0;
+        double m_CapturePeriodNs = 0.0;
+        UINT64 m_NextPacket = 0;
+        double m_Phase = 0.0;
+        std::vector<float> m_Packet;
+        std::deque<LatencyMarker> m_Markers;
+
+        PacketArrivalPredictor m_Predictor;
+
+        UINT64 m_Packets = 0;
+        UINT64 m_CaptureWakeups = 0;
+        UINT64 m_EmptyCaptureWakeups = 0;
+        std::unique_ptr<LatencyHistogram> m_LatencyUs = std::make_unique<LatencyHistogram>();
+        std::unique_ptr<LatencyHistogram> m_IntervalLatencyUs = std::make_unique<LatencyHistogram>();
+        // Time from when a packet is ready to when the capture thread reads it
+        std::unique_ptr<LatencyHistogram> m_CaptureDelayUs = std::make_unique<LatencyHistogram>();
+        std::unique_ptr<LatencyHistogram> m_RingFrames = std::make_unique<LatencyHistogram>();
+        std::unique_ptr<LatencyHistogram> m_PaddingFrames = std::make_unique<LatencyHistogram>();
+        std::vector<IntervalReport> m_Intervals;
+        IntervalReport m_Interval;
+        IntervalReport m_Totals;
+    };
+
+    //
+    //  GetNextCaptureWakeNs()
+    //
+    //  The event-driven loop wakes up once the next packet is ready, the polling loop once the poll interval is over,
+    //  the predictive loop when the predictor expects the next packet, plus the scheduling delay of the thread
+    //
+    INT64 LatencyHarness::GetNextCaptureWakeNs(INT64 nowNs)
+    {
+        INT64 wakeNs = GetPacketCaptureNs(m_NextPacket + 1);
+        if (m_Options.bCapturePredictive)
+        {
+            wakeNs = (INT64)m_Predictor.GetNextWakeHns((UINT64)nowNs / 100) * 100;
+        }
+        else if (m_Options.capturePollMs > 0.0)
+        {
+            wakeNs = nowNs + MsToNs(m_Options.capturePollMs);
+        }
+        wakeNs += MsToNs(m_Random.Next() * m_Options.captureJitterMs);
+        if (m_Random.Next() < m_Options.stallProbability)
+        {
+            wakeNs += MsToNs(m_Options.stallMs);
+        }
+        return std::max(wakeNs, nowNs);
+    }
+
+    //
+    //  OnCaptureWake()
+    //
+    //  Reads every packet the capture client has ready, like the capture loops do
+    //
+    HRESULT LatencyHarness::OnCaptureWake(INT64 nowNs)
+    {
+        const double phaseStep = 6.283185307179586 * 440.0 / m_Options.captureRate;
+        UINT64 firstPacket = m_NextPacket;
+        m_CaptureWakeups++;
+        while (GetPacketCaptureNs(m_NextPacket + 1) <= nowNs)
+        {
+            INT64 captureNs = GetPacketCaptureNs(m_NextPacket);
+            m_CaptureDelayUs->Record((UINT64)(nowNs - GetPacketCaptureNs(m_NextPacket + 1)) / 1000);
+            for (UINT32 i = 0; i < m_CapturePeriodFrames; i++)
+            {
+                float value = (float)(0.5 * sin(m_Phase));
+                m_Packet[(size_t)i * Channels] = value;
+                m_Packet[(size_t)i * Channels + 1] = value;
+                m_Phase = fmod(m_Phase + phaseStep, 6.283185307179586);
+            }
+
+            UINT64 ringIndex = m_RenderPath.GetRingStats().framesWritten;
+            UINT64 cutFrames = m_RenderPath.HasJitterBuffer() ? m_RenderPath.GetJitterStats().framesDropped : 0;
+            m_RenderPath.WritePacket((BYTE*)m_Packet.data(), m_CapturePeriodFrames, (UINT64)(nowNs - captureNs) / 1000, nowNs);
+            UINT32 fillFrames = m_RenderPath.GetRingStats().fillFrames;
+            m_RingFrames->Record(fillFrames);
+            m_Interval.maxRingFrames = std::max(m_Interval.maxRingFrames, fillFrames);
+
+            // The frames cut from the start of the packet never play: its first output frame was captured later. The
+            // resampler delays it by its group delay, if it is in the path by now.
+            if (m_RenderPath.GetRingStats().framesWritten > ringIndex)
+            {
+                cutFrames = (m_RenderPath.HasJitterBuffer() ? m_RenderPath.GetJitterStats().framesDropped : 0) - cutFrames;
+                INT64 filterDelayNs = (INT64)m_Converter.GetLatencyFrames() * NsPerSec / m_Options.captureRate;
+                m_Markers.push_back({ ringIndex, captureNs - filterDelayNs + (INT64)llround(cutFrames * 1e9 / m_Options.renderRate) });
+            }
+            if (m_Predictor.IsInitialized())
+            {
+                m_Predictor.OnPacket((UINT64)captureNs / 100, m_CapturePeriodFrames, (UINT64)nowNs / 100);
+            }
+            m_NextPacket++;
+            m_Packets++;
+        }
+
+        if (m_NextPacket == firstPacket)
+        {
+            m_EmptyCaptureWakeups++;
+            if (m_Predictor.IsInitialized())
+            {
+                m_Predictor.OnEmptyWakeup((UINT64)nowNs / 100);
+            }
+        }
+        return S_OK;
+    }
+
+    HRESULT LatencyHarness::OnPumpWake(INT64 nowNs)
+    {
+        m_Target.SetTime(nowNs);
+        HRESULT hr = m_RenderPath.Pump(nowNs);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        UINT32 padding = m_Target.GetPadding();
+        m_PaddingFrames->Record(padding);
+        m_Interval.minPaddingFrames = std::min(m_Interval.minPaddingFrames, padding);
+        return S_OK;
+    }
+
+    void LatencyHarness::OnEngineTick()
+    {
+        INT64 tickNs = m_Target.GetNextTickNs();
+        UINT64 firstFrame = m_Target.GetFramesPlayed();
+        UINT32 frames = m_Target.Tick();
+        while (!m_Markers.empty() && m_Markers.front().frameIndex < firstFrame + frames)
+        {
+            const LatencyMarker& marker = m_Markers.front();
+            double playNs = tickNs + (double)(marker.frameIndex - std::min(marker.frameIndex, firstFrame)) * m_Target.GetFrameNs();
+            INT64 latencyNs = (INT64)playNs - marker.captureNs;
+            UINT64 latencyUs = (UINT64)std::max(latencyNs, (INT64)0) / 1000;
+            m_LatencyUs->Record(latencyUs);
+            m_IntervalLatencyUs->Record(latencyUs);
+            m_Markers.pop_front();
+        }
+    }
+
+    void LatencyHarness::EndInterval(double endSeconds)
+    {
+        SpscFrameRingStats ringStats = m_RenderPath.GetRingStats();
+        UINT64 cutFrames = m_RenderPath.HasJitterBuffer() ? m_RenderPath.GetJitterStats().framesDropped : 0;
+        const DriftEstimator& driftEstimator = m_RenderPath.GetDriftEstimator();
+
+        IntervalReport report = m_Interval;
+        report.endSeconds = endSeconds;
+        report.latencyUs = m_IntervalLatencyUs->GetSnapshot();
+        report.driftPpm = driftEstimator.IsLocked() ? driftEstimator.GetDriftPpm() : 0.0;
+        report.rateScale = m_Converter.GetInputRateScale();
+        report.cutFrames = cutFrames - m_Totals.cutFrames;
+        report.overrunFrames = ringStats.overrunFrames - m_Totals.overrunFrames;
+        report.glitches = m_Target.GetGlitches() - m_Totals.glitches;
+        m_Intervals.push_back(report);
+
+        m_Totals.cutFrames = cutFrames;
+        m_Totals.overrunFrames = ringStats.overrunFrames;
+        m_Totals.glitches = m_Target.GetGlitches();
+        m_IntervalLatencyUs->Reset();
+        m_Interval = IntervalReport();
+        m_Interval.minPaddingFrames = std::numeric_limits<UINT32>::max();
+    }
+
+    //
+    //  Run()
+    //
+    //  Processes the events in time order until the end of the simulated time. At equal times the endpoint plays
+    //  first, then the pump refills it, then the capture thread writes.
+    //
+    HRESULT LatencyHarness::Run()
+    {
+        const HarnessOptions& options = m_Options;
+        m_CapturePeriodFrames = (UINT32)llround(options.captureRate * options.capturePeriodMs / 1000.0);
+        m_CapturePeriodNs = m_CapturePeriodFrames * 1e9 / (options.captureRate * (1.0 + options.captureDriftPpm / 1e6));
+        if (m_CapturePeriodFrames == 0 || options.pumpIntervalMs <= 0.0)
+        {
+            return E_INVALIDARG;
+        }
+        m_Packet.resize((size_t)m_CapturePeriodFrames * Channels);
+
+        HRESULT hr = S_OK;
+        if (options.bCapturePredictive)
+        {
+            hr = m_Predictor.Initialize(options.captureRate, (UINT64)llround(options.capturePeriodMs * 10000.0));
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+
+        hr = m_Converter.Initialize(options.captureRate, options.renderRate, options.quality, options.bDriftCompensation);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_Target.Initialize(options.renderRate, options.renderPeriodMs, options.renderBufferMs, options.renderDriftPpm);
+
+        WAVEFORMATEX captureFormat {};
+        captureFormat.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+        captureFormat.nChannels = Channels;
+        captureFormat.nSamplesPerSec = options.captureRate;
+        captureFormat.wBitsPerSample = 32;
+        captureFormat.nBlockAlign = Channels * sizeof(float);
+        captureFormat.nAvgBytesPerSec = captureFormat.nSamplesPerSec * captureFormat.nBlockAlign;
+        WAVEFORMATEX renderFormat = captureFormat;
+        renderFormat.nSamplesPerSec = options.renderRate;
+        renderFormat.nAvgBytesPerSec = renderFormat.nSamplesPerSec * renderFormat.nBlockAlign;
+
+        RenderPathOptions pathOptions;
+        pathOptions.bufferMs = options.ringMs;
+        pathOptions.wakeIntervalMs = 0;
+        pathOptions.prefillMs = options.prefillMs;
+        pathOptions.latencyPolicy = options.latencyPolicy;
+        // Two periods, as the capture classes size it for the live endpoints
+        hr = m_RenderPath.Start(&m_Target, &m_Converter, captureFormat, renderFormat, 2 * m_CapturePeriodFrames, pathOptions);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        const INT64 endNs = (INT64)llround(options.durationSeconds * 1e9);
+        const INT64 reportNs = std::max(MsToNs(options.reportIntervalSeconds * 1000.0), (INT64)1);
+        INT64 nextReportNs = reportNs;
+        INT64 captureWakeNs = GetNextCaptureWakeNs(0);
+        INT64 pumpWakeNs = MsToNs(options.pumpIntervalMs);
+        m_Interval.minPaddingFrames = std::numeric_limits<UINT32>::max();
+        for (;;)
+        {
+            INT64 tickNs = m_Target.GetNextTickNs();
+            INT64 nowNs = std::min({ tickNs, pumpWakeNs, captureWakeNs });
+            while (nextReportNs <= std::min(nowNs, endNs))
+            {
+                EndInterval((double)nextReportNs / NsPerSec);
+                nextReportNs += reportNs;
+            }
+            if (nowNs > endNs)
+            {
+                break;
+            }
+
+            if (nowNs == tickNs)
+            {
+                OnEngineTick();
+            }
+            else if (nowNs == pumpWakeNs)
+            {
+                hr = OnPumpWake(nowNs);
+                pumpWakeNs += MsToNs(options.pumpIntervalMs);
+                pumpWakeNs += MsToNs(m_Random.Next() * options.pumpJitterMs);
+            }
+            else
+            {
+                hr = OnCaptureWake(nowNs);
+                captureWakeNs = GetNextCaptureWakeNs(nowNs);
+            }
+            if (FAILED(hr))
+            {
+                break;
+            }
+        }
+
+        m_RenderPath.Stop();
+        return hr;
+    }
+
+    void LatencyHarness::PrintSummary() const
+    {
+        LatencyHistogramSnapshot latency = m_LatencyUs->GetSnapshot();
+        LatencyHistogramSnapshot captureDelay = m_CaptureDelayUs->GetSnapshot();
+        LatencyHistogramSnapshot ring = m_RingFrames->GetSnapshot();
+        LatencyHistogramSnapshot padding = m_PaddingFrames->GetSnapshot();
+        SpscFrameRingStats ringStats = m_RenderPath.GetRingStats();
+        JitterBufferStats jitterStats = m_RenderPath.HasJitterBuffer() ? m_RenderPath.GetJitterStats() : JitterBufferStats();
+
+        for (const IntervalReport& report : m_Intervals)
+        {
+            fprintf(stderr, "%8.0fs  latency p50 %6.1f ms  p99 %6.1f ms  max %6.1f ms  ring max %5u  padding min %5u  drift %+7.1f ppm  cut %6llu  overrun %6llu  glitches %4llu\n",
+                report.endSeconds, report.latencyUs.p50 / 1000.0, report.latencyUs.p99 / 1000.0, report.latencyUs.max / 1000.0,
+                report.maxRingFrames, report.minPaddingFrames == std::numeric_limits<UINT32>::max() ? 0 : report.minPaddingFrames,
+                report.driftPpm, (unsigned long long)report.cutFrames, (unsigned long long)report.overrunFrames, (unsigned long long)report.glitches);
+        }
+        fprintf(stderr, "\n%llu packets over %.0f simulated seconds\n", (unsigned long long)m_Packets, m_Options.durationSeconds);
+        fprintf(stderr, "Capture wakeups: %llu (%.2f per packet), %llu empty; read delay p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            (unsigned long long)m_CaptureWakeups, m_Packets > 0 ? (double)m_CaptureWakeups / m_Packets : 0.0,
+            (unsigned long long)m_EmptyCaptureWakeups, captureDelay.p50 / 1000.0, captureDelay.p99 / 1000.0, captureDelay.max / 1000.0);
+        fprintf(stderr, "End-to-end latency: p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms (%llu packets)\n",
+            latency.p50 / 1000.0, latency.p99 / 1000.0, latency.p999 / 1000.0, latency.max / 1000.0, (unsigned long long)latency.count);
+        fprintf(stderr, "Render ring: p50 %llu, p99 %llu, max %llu of %u frames, %llu frames dropped\n",
+            (unsigned long long)ring.p50, (unsigned long long)ring.p99, (unsigned long long)ring.max, ringStats.capacityFrames,
+            (unsigned long long)ringStats.overrunFrames);
+        fprintf(stderr, "Endpoint padding: p50 %llu, max %llu frames, %llu glitches (%llu silent frames), %llu starved pump wakeups\n",
+            (unsigned long long)padding.p50, (unsigned long long)padding.max, (unsigned long long)m_Target.GetGlitches(),
+            (unsigned long long)m_Target.GetSilentFrames(), (unsigned long long)m_RenderPath.GetPumpStats().starvedWakeups);
+        fprintf(stderr, "Jitter buffer: %llu late packets, %llu catch-ups, %llu frames cut, %llu frames saved stretching\n",
+            (unsigned long long)jitterStats.latePackets, (unsigned long long)jitterStats.catchUps,
+            (unsigned long long)jitterStats.framesDropped, (unsigned long long)jitterStats.framesSaved);
+    }
+
+    void WriteHistogram(std::ostream& out, const char* name, const LatencyHistogramSnapshot& snapshot, const char* suffix)
+    {
+        out << "    \"" << name << "\": { \"count\": " << snapshot.count << ", \"p50\": " << snapshot.p50 << ", \"p99\": " << snapshot.p99
+            << ", \"p999\": " << snapshot.p999 << ", \"max\": " << snapshot.max << " }" << suffix << "\n";
+    }
+
+    void LatencyHarness::WriteResults(std::ostream& out) const
+    {
+        const HarnessOptions& options = m_Options;
+        SpscFrameRingStats ringStats = m_RenderPath.GetRingStats();
+        JitterBufferStats jitterStats = m_RenderPath.HasJitterBuffer() ? m_RenderPath.GetJitterStats() : JitterBufferStats();
+
+        out << "{\n"
+            << "  \"options\": {\n"
+            << "    \"durationSeconds\": " << options.durationSeconds << ", \"seed\": " << options.seed << ",\n"
+            << "    \"captureRate\": " << options.captureRate << ", \"capturePeriodMs\": " << options.capturePeriodMs
+            << ", \"captureDriftPpm\": " << options.captureDriftPpm << ", \"captureJitterMs\": " << options.captureJitterMs
+            << ", \"stallProbability\": " << options.stallProbability << ", \"stallMs\": " << options.stallMs
+            << ", \"capturePollMs\": " << options.capturePollMs
+            << ", \"capturePredictive\": " << (options.bCapturePredictive ? "true" : "false") << ",\n"
+            << "    \"renderRate\": " << options.renderRate << ", \"renderPeriodMs\": " << options.renderPeriodMs
+            << ", \"renderBufferMs\": " << options.renderBufferMs << ", \"renderDriftPpm\": " << options.renderDriftPpm
+            << ", \"pumpIntervalMs\": " << options.pumpIntervalMs << ", \"pumpJitterMs\": " << options.pumpJitterMs << ",\n"
+            << "    \"ringMs\": " << options.ringMs << ", \"prefillMs\": " << options.prefillMs
+            << ", \"targetMs\": " << options.latencyPolicy.targetMs << ", \"maxMs\": " << options.latencyPolicy.maxMs
+            << ", \"catchUp\": \"" << (options.latencyPolicy.catchUp == CatchUpMode::TimeStretch ? "stretch" : "cut") << "\""
+            << ", \"driftCompensation\": " << (options.bDriftCompensation ? "true" : "false") << "\n"
+            << "  },\n"
+            << "  \"packets\": " << m_Packets << ",\n"
+            << "  \"captureWakeups\": " << m_CaptureWakeups << ", \"emptyCaptureWakeups\": " << m_EmptyCaptureWakeups << ",\n"
+            << "  \"histograms\": {\n";
+        WriteHistogram(out, "latencyUs", m_LatencyUs->GetSnapshot(), ",");
+        WriteHistogram(out, "captureDelayUs", m_CaptureDelayUs->GetSnapshot(), ",");
+        WriteHistogram(out, "ringFrames", m_RingFrames->GetSnapshot(), ",");
+        WriteHistogram(out, "paddingFrames", m_PaddingFrames->GetSnapshot(), "");
+        out << "  },\n"
+            << "  \"drops\": {\n"
+            << "    \"ringOverrunFrames\": " << ringStats.overrunFrames << ",\n"
+            << "    \"latePackets\": " << jitterStats.latePackets << ",\n"
+            << "    \"catchUps\": " << jitterStats.catchUps << ",\n"
+            << "    \"cutFrames\": " << jitterStats.framesDropped << ",\n"
+            << "    \"stretchSavedFrames\": " << jitterStats.framesSaved << ",\n"
+            << "    \"glitches\": " << m_Target.GetGlitches() << ",\n"
+            << "    \"silentFrames\": " << m_Target.GetSilentFrames() << ",\n"
+            << "    \"starvedPumpWakeups\": " << m_RenderPath.GetPumpStats().starvedWakeups << "\n"
+            << "  },\n"
+            << "  \"intervals\": [\n";
+        for (size_t i = 0; i < m_Intervals.size(); i++)
+        {
+            const IntervalReport& report = m_Intervals[i];
+            char line[512];
+            snprintf(line, sizeof(line),
+                "    { \"endSeconds\": %.0f, \"latencyUs\": { \"p50\": %llu, \"p99\": %llu, \"max\": %llu }, \"maxRingFrames\": %u, "
+                "\"minPaddingFrames\": %u, \"driftPpm\": %.3f, \"rateScale\": %.9f, \"cutFrames\": %llu, \"overrunFrames\": %llu, \"glitches\": %llu }%s\n",
+                report.endSeconds, (unsigned long long)report.latencyUs.p50, (unsigned long long)report.latencyUs.p99,
+                (unsigned long long)report.latencyUs.max, report.maxRingFrames,
+                report.minPaddingFrames == std::numeric_limits<UINT32>::max() ? 0 : report.minPaddingFrames, report.driftPpm,
+                report.rateScale, (unsigned long long)report.cutFrames, (unsigned long long)report.overrunFrames,
+                (unsigned long long)report.glitches, (i + 1 < m_Intervals.size()) ? "," : "");
+            out << line;
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+
+    void usage()
+    {
+        std::cerr <<
+            "Usage: LatencyHarness [--<option> <value>]...\n"
+            "\n"
+            "Simulation:   --duration <s> (3600)  --seed <n> (1)  --report-interval <s> (60)  --output <file.json>\n"
+            "Capture:      --capture-rate <Hz> (48000)  --capture-period-ms (10)  --capture-drift-ppm (0)\n"
+            "              --capture-jitter-ms (1)  --stall-probability (0.0005)  --stall-ms (30)\n"
+            "              --capture-poll-ms (0 = event driven)  --capture-predictive <on|off>\n"
+            "Render:       --render-rate <Hz> (48000)  --render-period-ms (10)  --render-buffer-ms (20)  --render-drift-ppm (0)\n"
+            "              --pump-interval-ms (5)  --pump-jitter-ms (1)\n"
+            "Render path:  --ring-ms (200)  --prefill-ms (20)  --target-ms (0)  --max-ms (60)  --late-capture-ms (15)\n"
+            "              --catch-up <cut|stretch>  --quality <low|medium|high|best>  --drift-compensation <on|off> (on)\n"
+            "\n"
+            "Prints one line per report interval and a summary to stderr, and the results as JSON to stdout or --output.\n";
+    }
+
+    bool ParseOptions(int argc, char* argv[], HarnessOptions* pOptions)
+    {
+        HarnessOptions& o = *pOptions;
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            std::string arg = argv[i];
+            std::string value = argv[i + 1];
+            double number = strtod(value.c_str(), nullptr);
+            if (arg == "--duration") o.durationSeconds = number;
+            else if (arg == "--seed") o.seed = (UINT32)number;
+            else if (arg == "--report-interval") o.reportIntervalSeconds = number;
+            else if (arg == "--output") o.outputPath = value;
+            else if (arg == "--capture-rate") o.captureRate = (UINT32)number;
+            else if (arg == "--capture-period-ms") o.capturePeriodMs = number;
+            else if (arg == "--capture-drift-ppm") o.captureDriftPpm = number;
+            else if (arg == "--capture-jitter-ms") o.captureJitterMs = number;
+            else if (arg == "--stall-probability") o.stallProbability = number;
+            else if (arg == "--stall-ms") o.stallMs = number;
+            else if (arg == "--capture-poll-ms") o.capturePollMs = number;
+            else if (arg == "--capture-predictive" && (value == "on" || value == "off")) o.bCapturePredictive = (value == "on");
+            else if (arg == "--render-rate") o.renderRate = (UINT32)number;
+            else if (arg == "--render-period-ms") o.renderPeriodMs = number;
+            else if (arg == "--render-buffer-ms") o.renderBufferMs = number;
+            else if (arg == "--render-drift-ppm") o.renderDriftPpm = number;
+            else if (arg == "--pump-interval-ms") o.pumpIntervalMs = number;
+            else if (arg == "--pump-jitter-ms") o.pumpJitterMs = number;
+            else if (arg == "--ring-ms") o.ringMs = (UINT32)number;
+            else if (arg == "--prefill-ms") o.prefillMs = (UINT32)number;
+            else if (arg == "--target-ms") o.latencyPolicy.targetMs = (UINT32)number;
+            else if (arg == "--max-ms") o.latencyPolicy.maxMs = (UINT32)number;
+            else if (arg == "--late-capture-ms") o.latencyPolicy.lateCaptureMs = (UINT32)number;
+            else if (arg == "--catch-up" && (value == "cut" || value == "stretch"))
+            {
+                o.latencyPolicy.catchUp = (value == "stretch") ? CatchUpMode::TimeStretch : CatchUpMode::Cut;
+            }
+            else if (arg == "--quality" && value == "low") o.quality = ResamplerQuality::Low;
+            else if (arg == "--quality" && value == "medium") o.quality = ResamplerQuality::Medium;
+            else if (arg == "--quality" && value == "high") o.quality = ResamplerQuality::High;
+            else if (arg == "--quality" && value == "best") o.quality = ResamplerQuality::Best;
+            else if (arg == "--drift-compensation" && (value == "on" || value == "off")) o.bDriftCompensation = (value == "on");
+            else return false;
+        }
+        return argc % 2 == 1 && o.durationSeconds > 0.0 && o.captureRate > 0 && o.renderRate > 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    HarnessOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        usage();
+        return 2;
+    }
+
+    // The render path logs every late packet and cut; only errors are worth seeing here
+    LogRing::Get().SetLevel(LogLevel::Error);
+
+    std::unique_ptr<LatencyHarness> harness = std::make_unique<LatencyHarness>(options);
+    HRESULT hr = harness->Run();
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "Simulation failed: 0x%08X\n", (unsigned)hr);
+        return 2;
+    }
+
+    harness->PrintSummary();
+    if (options.outputPath.empty())
+    {
+        harness->WriteResults(std::cout);
+    }
+    else
+    {
+        std::ofstream file(options.outputPath, std::ios::binary | std::ios::trunc);
+        harness->WriteResults(file);
+        if (!file.flush())
+        {
+            std::cerr << "Cannot write " << options.outputPath << std::endl;
+            return 2;
+        }
+    }
+    return 0;
+}
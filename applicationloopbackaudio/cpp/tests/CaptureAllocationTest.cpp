@@ -0,0 +1,319 @@
+// CaptureAllocationTest.cpp : Runs the capture-to-render path on a virtual clock, from a synthetic capture source
+// through the file sink, the native resampler, the channel remix and the jitter buffer to a simulated endpoint, and
+// fails if the capture thread allocates once it has warmed up.
+//
+
+#include "Platform.h"
+#include "AllocationCounter.h"
+#include "CaptureSource.h"
+#include "ChannelRemix.h"
+#include "LogRing.h"
+#include "PolyphaseResampler.h"
+#include "RenderPath.h"
+#include "SampleConvert.h"
+#include "WavFileSink.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    const INT64 NsPerMs = 1000000;
+    const UINT32 CaptureRate = 44100;
+    const UINT32 CaptureChannels = 2;
+    const UINT32 RenderRate = 48000;
+    const UINT32 RenderChannels = 6;
+    const UINT32 MaxPacketFrames = 2048;
+
+    // Seconds of the run not counted: the output starts, the drift loop locks and every buffer reaches its size
+    const INT64 WarmUpNs = 5000 * NsPerMs;
+    const INT64 DurationNs = 60000 * NsPerMs;
+    // Once warmed up, the capture thread stalls for StallNs every StallIntervalNs, so the late packet, catch-up and
+    // starved endpoint paths run while the allocations are counted
+    const INT64 StallIntervalNs = 7000 * NsPerMs;
+    const INT64 StallNs = 80 * NsPerMs;
+
+    /**
+    * Converts the 16-bit stereo capture packets to 5.1 float frames at the render rate, the way LoopbackCaptureBase
+    * does with the native resampler: to float, through the adjustable resampler, and through the channel remix.
+    */
+    class TestConverter : public IRenderConverter
+    {
+    public:
+        HRESULT Initialize()
+        {
+            m_ConvertToFloat = GetFrameConverter(SampleFormat::Int16, SampleFormat::Float32, CaptureChannels);
+            if (m_ConvertToFloat == nullptr)
+            {
+                return E_NOTIMPL;
+            }
+            HRESULT hr = m_Resampler.Initialize(CaptureRate, RenderRate, CaptureChannels, ResamplerQuality::Best,
+                ResamplerKernel::Auto, true);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            hr = m_Remix.Initialize(SampleFormat::Float32, CaptureChannels, 0, SampleFormat::Float32, RenderChannels, 0);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            m_Input.resize((size_t)MaxPacketFrames * CaptureChannels);
+            m_Output.resize((size_t)m_Resampler.GetMaxOutputFrames(MaxPacketFrames) * CaptureChannels);
+            return S_OK;
+        }
+
+        void Reset() override { m_Resampler.Reset(); }
+        UINT32 GetMaxConvertedFrames(UINT32 frames) override { return m_Resampler.GetMaxOutputFrames(frames); }
+
+        UINT32 Convert(BYTE* src, UINT32 frames, BYTE* dst, UINT32 /*maxFrames*/) override
+        {
+            m_ConvertToFloat(src, (BYTE*)m_Input.data(), frames);
+            UINT32 framesWritten = m_Resampler.Process(m_Input.data(), frames, m_Output.data());
+            m_Remix.Process((const BYTE*)m_Output.data(), dst, framesWritten);
+            return framesWritten;
+        }
+
+        bool IsAdjustable() const override { return m_Resampler.IsAdjustable(); }
+        void SetInputRateScale(double scale) override { m_Resampler.SetInputRateScale(scale); }
+
+    private:
+        FrameConvertFn m_ConvertToFloat = nullptr;
+        PolyphaseResampler m_Resampler;
+        ChannelRemix m_Remix;
+        std::vector<float> m_Input;
+        std::vector<float> m_Output;
+    };
+
+    /**
+    * Endpoint playing its buffer at a drifting clock. The frames it has not got in time are played silent.
+    */
+    class TestRenderTarget : public IRenderTarget
+    {
+    public:
+        TestRenderTarget()
+            : m_Buffer((size_t)BufferFrames * RenderChannels)
+        {
+        }
+
+        HRESULT Start() override
+        {
+            m_bStarted = true;
+            m_StartNs = m_NowNs;
+            m_DeviceFrames = 0;
+            return S_OK;
+        }
+
+        HRESULT Stop() override
+        {
+            m_bStarted = false;
+            return S_OK;
+        }
+
+        HRESULT GetBufferSize(UINT32* pNumBufferFrames) override
+        {
+            *pNumBufferFrames = BufferFrames;
+            return S_OK;
+        }
+
+        HRESULT GetCurrentPadding(UINT32* pNumPaddingFrames) override
+        {
+            *pNumPaddingFrames = (UINT32)(m_FramesWritten - m_FramesPlayed);
+            return S_OK;
+        }
+
+        HRESULT GetBuffer(UINT32 NumFramesRequested, BYTE** ppData) override
+        {
+            if (NumFramesRequested > BufferFrames - (m_FramesWritten - m_FramesPlayed))
+            {
+                return AUDCLNT_E_INVALID_SIZE;
+            }
+            *ppData = (BYTE*)m_Buffer.data();
+            return S_OK;
+        }
+
+        HRESULT ReleaseBuffer(UINT32 NumFramesWritten, DWORD /*dwFlags*/) override
+        {
+            m_FramesWritten += NumFramesWritten;
+            return S_OK;
+        }
+
+        // Plays the frames due by nowNs
+        void SetTime(INT64 nowNs)
+        {
+            m_NowNs = nowNs;
+            if (m_bStarted)
+            {
+                UINT64 deviceFrames = (UINT64)((double)(nowNs - m_StartNs) * RenderRate * (1.0 + DriftPpm / 1e6) / 1e9);
+                m_FramesPlayed += std::min(deviceFrames - m_DeviceFrames, m_FramesWritten - m_FramesPlayed);
+                m_DeviceFrames = deviceFrames;
+            }
+        }
+
+    private:
+        static const UINT32 BufferFrames = RenderRate / 50;
+        // Drift of the endpoint clock, so the drift loop keeps steering the resampler
+        static constexpr double DriftPpm = 150.0;
+
+        std::vector<float> m_Buffer;
+        bool m_bStarted = false;
+        INT64 m_NowNs = 0;
+        INT64 m_StartNs = 0;
+        // Frames the device clock has played since the start, silent ones included
+        UINT64 m_DeviceFrames = 0;
+        UINT64 m_FramesPlayed = 0;
+        UINT64 m_FramesWritten = 0;
+    };
+
+    /**
+    * Steady-state allocations of one run of the path with the given catch-up mode. Returns false if the run could not
+    * be set up.
+    */
+    bool RunPath(CatchUpMode catchUp, UINT64* pCaptureAllocations, UINT64* pPumpAllocations)
+    {
+        WAVEFORMATEX captureFormat {};
+        captureFormat.wFormatTag = WAVE_FORMAT_PCM;
+        captureFormat.nChannels = CaptureChannels;
+        captureFormat.nSamplesPerSec = CaptureRate;
+        captureFormat.wBitsPerSample = 16;
+        captureFormat.nBlockAlign = CaptureChannels * 2;
+        captureFormat.nAvgBytesPerSec = CaptureRate * captureFormat.nBlockAlign;
+
+        WAVEFORMATEX renderFormat {};
+        renderFormat.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+        renderFormat.nChannels = RenderChannels;
+        renderFormat.nSamplesPerSec = RenderRate;
+        renderFormat.wBitsPerSample = 32;
+        renderFormat.nBlockAlign = RenderChannels * 4;
+        renderFormat.nAvgBytesPerSec = RenderRate * renderFormat.nBlockAlign;
+
+        // Device periods of 10 ms, some of them delivered as two packets
+        CaptureSourceTiming timing;
+        timing.periodFrames = CaptureRate / 100;
+        timing.splitProbability = 0.2;
+        timing.realTime = false;
+        SyntheticCaptureSource source(captureFormat, timing);
+
+        TestConverter converter;
+        TestRenderTarget target;
+        RenderPath renderPath;
+        RenderPathOptions options;
+        options.wakeIntervalMs = 0;
+        options.latencyPolicy.catchUp = catchUp;
+        WavFileSink fileSink;
+        std::filesystem::path fileName = std::filesystem::temp_directory_path() / "CaptureAllocationTest.wav";
+
+        if (FAILED(converter.Initialize()) ||
+            FAILED(renderPath.Start(&target, &converter, captureFormat, renderFormat, MaxPacketFrames, options)) ||
+            FAILED(fileSink.Start(fileName, captureFormat)))
+        {
+            return false;
+        }
+
+        UINT64 framesRead = 0;
+        INT64 nextCaptureNs = 0;
+        INT64 nextPumpNs = 0;
+        *pCaptureAllocations = 0;
+        *pPumpAllocations = 0;
+        for (INT64 nowNs = 0; nowNs < DurationNs; nowNs += NsPerMs)
+        {
+            bool bCounted = nowNs >= WarmUpNs;
+            target.SetTime(nowNs);
+
+            if (nowNs >= nextCaptureNs)
+            {
+                // One wakeup of the capture loop: drains every packet the source has captured by now
+                UINT64 allocationsBefore = AllocationCounter::GetThreadAllocations();
+                UINT64 framesCaptured = (UINT64)nowNs * CaptureRate / 1000000000;
+                UINT32 frames = 0;
+                while (SUCCEEDED(source.GetNextPacketSize(&frames)) && frames > 0 && framesRead + frames <= framesCaptured)
+                {
+                    BYTE* data = nullptr;
+                    DWORD flags = 0;
+                    UINT64 devicePosition = 0;
+                    UINT64 qpcPosition = 0;
+                    if (FAILED(source.GetBuffer(&data, &frames, &flags, &devicePosition, &qpcPosition)))
+                    {
+                        return false;
+                    }
+                    fileSink.Push(data, frames);
+                    INT64 captureNs = (INT64)(devicePosition * 1000000000 / CaptureRate);
+                    renderPath.WritePacket(data, frames, (UINT64)(nowNs - captureNs) / 1000, nowNs);
+                    source.ReleaseBuffer(frames);
+                    framesRead += frames;
+                }
+                if (bCounted)
+                {
+                    *pCaptureAllocations += AllocationCounter::GetThreadAllocations() - allocationsBefore;
+                }
+
+                nextCaptureNs = nowNs + 10 * NsPerMs;
+                if (nowNs >= WarmUpNs && nowNs % StallIntervalNs < 10 * NsPerMs)
+                {
+                    nextCaptureNs += StallNs;
+                }
+            }
+
+            if (nowNs >= nextPumpNs)
+            {
+                UINT64 allocationsBefore = AllocationCounter::GetThreadAllocations();
+                if (FAILED(renderPath.Pump(nowNs)))
+                {
+                    return false;
+                }
+                if (bCounted)
+                {
+                    *pPumpAllocations += AllocationCounter::GetThreadAllocations() - allocationsBefore;
+                }
+                nextPumpNs = nowNs + 5 * NsPerMs;
+            }
+        }
+
+        renderPath.Stop();
+        fileSink.Stop();
+        std::error_code ec;
+        std::filesystem::remove(fileName, ec);
+        return true;
+    }
+}
+
+int main()
+{
+    if (!AllocationCounter::IsEnabled())
+    {
+        std::cerr << "Built without LOOPBACK_COUNT_ALLOCATIONS" << std::endl;
+        return 1;
+    }
+
+    // Like the capture application, the log ring exists before the capture starts
+    LogRing::Get().SetLevel(LogLevel::Error);
+    LogRing::Get().Start();
+
+    int result = 0;
+    const CatchUpMode modes[] = { CatchUpMode::Cut, CatchUpMode::TimeStretch };
+    const char* const modeNames[] = { "cut", "stretch" };
+    for (size_t i = 0; i < 2; i++)
+    {
+        UINT64 captureAllocations = 0;
+        UINT64 pumpAllocations = 0;
+        if (!RunPath(modes[i], &captureAllocations, &pumpAllocations))
+        {
+            std::cerr << modeNames[i] << ": could not run the capture path" << std::endl;
+            result = 1;
+            continue;
+        }
+        std::cout << modeNames[i] << ": " << captureAllocations << " capture allocations, " << pumpAllocations
+            << " render allocations after warm-up" << std::endl;
+        if (captureAllocations != 0 || pumpAllocations != 0)
+        {
+            result = 1;
+        }
+    }
+
+    LogRing::Get().Stop();
+    return result;
+}
@@ -0,0 +1,360 @@
+// ConversionExactnessTest.cpp : Checks that every sample format converter and channel remix kernel the dispatch can
+// pick writes exactly the bytes of the scalar reference, for every format pair, channel count and layout, at odd
+// lengths, unaligned buffers and the values that clip, round or are not numbers.
+//
+
+#include "Platform.h"
+#include "ChannelRemix.h"
+#include "CpuFeatures.h"
+#include "SampleConvert.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    const SampleFormat s_Formats[] = { SampleFormat::Int16, SampleFormat::Int24, SampleFormat::Int32, SampleFormat::Float32, SampleFormat::Float64 };
+    const char* const s_FormatNames[] = { "unknown", "int16", "int24", "int32", "float32", "float64" };
+
+    // Lengths around the 4-sample vector blocks and the 256-frame chunks of the remix, plus a long odd run
+    const UINT32 s_Lengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 255, 256, 257, 1001 };
+
+    // Bytes after each output buffer that no kernel may touch
+    const size_t GuardBytes = 64;
+    const BYTE GuardByte = 0xA5;
+
+    struct SampleConvertKernelCase
+    {
+        SampleConvertKernel kernel;
+        const char* name;
+    };
+    const SampleConvertKernelCase s_ConvertKernels[] = {
+        { SampleConvertKernel::Auto, "auto" },
+        { SampleConvertKernel::Scalar, "scalar" },
+        { SampleConvertKernel::SSE41, "sse41" },
+        { SampleConvertKernel::NEON, "neon" },
+    };
+
+    struct ChannelRemixKernelCase
+    {
+        ChannelRemixKernel kernel;
+        const char* name;
+    };
+    const ChannelRemixKernelCase s_RemixKernels[] = {
+        { ChannelRemixKernel::Auto, "auto" },
+        { ChannelRemixKernel::SSE, "sse" },
+        { ChannelRemixKernel::AVX2, "avx2" },
+        { ChannelRemixKernel::NEON, "neon" },
+    };
+
+    UINT32 s_Checks = 0;
+    UINT32 s_Failures = 0;
+
+    class Random
+    {
+    public:
+        UINT32 Next()
+        {
+            m_State ^= m_State << 13;
+            m_State ^= m_State >> 17;
+            m_State ^= m_State << 5;
+            return m_State;
+        }
+        double NextUnit() { return Next() / 4294967296.0; }
+
+    private:
+        UINT32 m_State = 0x12345678;
+    };
+
+    template <typename T>
+    void StoreValue(BYTE* p, T value)
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+
+    //
+    //  FillSamples()
+    //
+    //  Integers get random bit patterns, which cover the whole range and every rounding case. Floats get a mix of
+    //  ordinary samples, the ends of full scale, values past them, half-LSB boundaries of the integer formats,
+    //  infinities, NaNs, denormals and negative zero. bNaN leaves the NaNs out.
+    //
+    void FillSamples(SampleFormat format, BYTE* dst, size_t samples, Random& random, bool bNaN = true)
+    {
+        const double specials[] = {
+            0.0, -0.0, 1.0, -1.0, 0.999999, -0.999999, 1.0000001, -1.0000001, 1.5, -1.5, 2.0, -2.0, 1e10, -1e10,
+            0.5 / 32768, -0.5 / 32768, 1.5 / 32768, -1.5 / 32768, 32767.5 / 32768, -32768.5 / 32768,
+            0.5 / 8388608, -0.5 / 8388608, 8388607.5 / 8388608, 0.5 / 2147483648.0, 2147483647.5 / 2147483648.0,
+            std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+            std::numeric_limits<float>::denorm_min(), -std::numeric_limits<float>::denorm_min(), 1e-40,
+            std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+        };
+        const size_t nanCount = 2;
+        const size_t specialCount = sizeof(specials) / sizeof(specials[0]) - (bNaN ? 0 : nanCount);
+        UINT32 sampleBytes = GetSampleBytes(format);
+
+        for (size_t i = 0; i < samples; i++, dst += sampleBytes)
+        {
+            if (format != SampleFormat::Float32 && format != SampleFormat::Float64)
+            {
+                for (UINT32 b = 0; b < sampleBytes; b++)
+                {
+                    dst[b] = (BYTE)random.Next();
+                }
+                continue;
+            }
+
+            UINT32 choice = random.Next() % 4;
+            double value = (choice == 0) ? specials[random.Next() % specialCount]
+                : (choice == 1) ? (random.NextUnit() * 2.0 - 1.0) * 1.25
+                : (random.NextUnit() * 2.0 - 1.0);
+            if (format == SampleFormat::Float32)
+            {
+                StoreValue(dst, (float)value);
+            }
+            else
+            {
+                StoreValue(dst, value);
+            }
+        }
+    }
+
+    void Check(bool bPassed, const char* what, const char* kernel, SampleFormat src, SampleFormat dst, UINT32 a, UINT32 b)
+    {
+        s_Checks++;
+        if (!bPassed)
+        {
+            s_Failures++;
+            if (s_Failures <= 20)
+            {
+                printf("FAILED %s %s %s -> %s (%u, %u)\n", what, kernel, s_FormatNames[(int)src], s_FormatNames[(int)dst], a, b);
+            }
+        }
+    }
+
+    bool GuardIntact(const std::vector<BYTE>& buffer, size_t cbUsed)
+    {
+        for (size_t i = cbUsed; i < cbUsed + GuardBytes; i++)
+        {
+            if (buffer[i] != GuardByte)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //
+    //  CheckReference()
+    //
+    //  Pins the scalar reference itself on the clipping and rounding rules SampleConvert.h documents, so the kernels are
+    //  not only compared with something that agrees with them
+    //
+    void CheckReference()
+    {
+        SampleConvertFn floatToInt16 = GetSampleConverter(SampleFormat::Float32, SampleFormat::Int16, SampleConvertKernel::Scalar);
+        const float floats[] = { 1.0f, -1.0f, 1.5f, -1.5f, std::numeric_limits<float>::quiet_NaN(),
+            std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), 0.5f / 32768, 1.5f / 32768,
+            2.5f / 32768, -0.5f / 32768 };
+        const int16_t expectedInt16[] = { 32767, -32768, 32767, -32768, -32768, 32767, -32768, 0, 2, 2, 0 };
+        int16_t int16s[sizeof(floats) / sizeof(floats[0])] = {};
+        floatToInt16((const BYTE*)floats, (BYTE*)int16s, sizeof(floats) / sizeof(floats[0]));
+        for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++)
+        {
+            Check(int16s[i] == expectedInt16[i], "reference", "scalar", SampleFormat::Float32, SampleFormat::Int16, (UINT32)i, 0);
+        }
+
+        // Narrowing rounds half up and saturates at the top
+        SampleConvertFn int32ToInt16 = GetSampleConverter(SampleFormat::Int32, SampleFormat::Int16, SampleConvertKernel::Scalar);
+        const INT32 int32s[] = { 0x00008000, 0x00007FFF, -0x00008000, 0x7FFFFFFF, (INT32)0x80000000, 0x7FFF8000 };
+        const int16_t expectedNarrow[] = { 1, 0, 0, 32767, -32768, 32767 };
+        int32ToInt16((const BYTE*)int32s, (BYTE*)int16s, sizeof(int32s) / sizeof(int32s[0]));
+        for (size_t i = 0; i < sizeof(int32s) / sizeof(int32s[0]); i++)
+        {
+            Check(int16s[i] == expectedNarrow[i], "reference", "scalar", SampleFormat::Int32, SampleFormat::Int16, (UINT32)i, 0);
+        }
+
+        // Integers are fractions of full scale
+        SampleConvertFn int16ToFloat = GetSampleConverter(SampleFormat::Int16, SampleFormat::Float32, SampleConvertKernel::Scalar);
+        const int16_t int16In[] = { -32768, 32767, 1 };
+        const float expectedFloat[] = { -1.0f, 32767.0f / 32768, 1.0f / 32768 };
+        float floatOut[3] = {};
+        int16ToFloat((const BYTE*)int16In, (BYTE*)floatOut, 3);
+        for (size_t i = 0; i < 3; i++)
+        {
+            Check(floatOut[i] == expectedFloat[i], "reference", "scalar", SampleFormat::Int16, SampleFormat::Float32, (UINT32)i, 0);
+        }
+    }
+
+    //
+    //  CheckSampleConverters()
+    //
+    //  Every kernel of every format pair against GetSampleConverter's scalar kernel, from aligned and unaligned
+    //  sources
+    //
+    void CheckSampleConverters(Random& random)
+    {
+        for (SampleFormat src : s_Formats)
+        {
+            for (SampleFormat dst : s_Formats)
+            {
+                SampleConvertFn reference = GetSampleConverter(src, dst, SampleConvertKernel::Scalar);
+                Check(reference != nullptr && GetSampleConverter(src, dst) != nullptr, "dispatch", "auto", src, dst, 0, 0);
+                if (reference == nullptr)
+                {
+                    continue;
+                }
+
+                for (const SampleConvertKernelCase& kernelCase : s_ConvertKernels)
+                {
+                    SampleConvertFn convert = GetSampleConverter(src, dst, kernelCase.kernel);
+                    if (convert == nullptr)
+                    {
+                        // Instruction set of another architecture or CPU
+                        continue;
+                    }
+                    for (UINT32 samples : s_Lengths)
+                    {
+                        for (UINT32 offset = 0; offset < 2; offset++)
+                        {
+                            size_t cbSrc = (size_t)samples * GetSampleBytes(src);
+                            size_t cbDst = (size_t)samples * GetSampleBytes(dst);
+                            std::vector<BYTE> input(cbSrc + offset + 1);
+                            FillSamples(src, input.data() + offset, samples, random);
+                            std::vector<BYTE> expected(cbDst + GuardBytes, GuardByte);
+                            std::vector<BYTE> actual(cbDst + GuardBytes + offset, GuardByte);
+                            reference(input.data() + offset, expected.data(), samples);
+                            convert(input.data() + offset, actual.data() + offset, samples);
+                            bool bSame = memcmp(expected.data(), actual.data() + offset, cbDst) == 0;
+                            std::vector<BYTE> tail(actual.begin() + offset, actual.end());
+                            Check(bSame && GuardIntact(tail, cbDst), "samples", kernelCase.name, src, dst, samples, offset);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //
+    //  CheckFrameConverters()
+    //
+    //  Every entry of the specialized table, (src, dst, channels) for every kernel, against the scalar sample
+    //  converter run over the same samples
+    //
+    void CheckFrameConverters(Random& random)
+    {
+        for (SampleFormat src : s_Formats)
+        {
+            for (SampleFormat dst : s_Formats)
+            {
+                SampleConvertFn reference = GetSampleConverter(src, dst, SampleConvertKernel::Scalar);
+                for (UINT32 channels = 1; channels <= MaxFrameConvertChannels; channels++)
+                {
+                    Check(GetFrameConverter(src, dst, channels) != nullptr, "dispatch", "auto", src, dst, channels, 0);
+                    for (const SampleConvertKernelCase& kernelCase : s_ConvertKernels)
+                    {
+                        FrameConvertFn convert = GetFrameConverter(src, dst, channels, kernelCase.kernel);
+                        if (convert == nullptr)
+                        {
+                            continue;
+                        }
+                        for (UINT32 frames : s_Lengths)
+                        {
+                            size_t samples = (size_t)frames * channels;
+                            size_t cbDst = samples * GetSampleBytes(dst);
+                            std::vector<BYTE> input(samples * GetSampleBytes(src) + 1);
+                            FillSamples(src, input.data(), samples, random);
+                            std::vector<BYTE> expected(cbDst + GuardBytes, GuardByte);
+                            std::vector<BYTE> actual(cbDst + GuardBytes, GuardByte);
+                            reference(input.data(), expected.data(), samples);
+                            convert(input.data(), actual.data(), frames);
+                            Check(memcmp(expected.data(), actual.data(), cbDst) == 0 && GuardIntact(actual, cbDst),
+                                "frames", kernelCase.name, src, dst, channels, frames);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //
+    //  CheckChannelRemix()
+    //
+    //  Every vector kernel of the remix against the scalar one, for every pair of channel counts with their default
+    //  layouts and for a dense user matrix, between every pair of sample formats. Without NaNs: which of two NaNs a sum
+    //  keeps depends on the order the compiler gives the operands of an add.
+    //
+    void CheckChannelRemix(Random& random)
+    {
+        for (SampleFormat src : s_Formats)
+        {
+            for (SampleFormat dst : s_Formats)
+            {
+                for (UINT32 srcChannels = 1; srcChannels <= ChannelRemix::MaxChannels; srcChannels++)
+                {
+                    for (UINT32 dstChannels = 1; dstChannels <= ChannelRemix::MaxChannels; dstChannels++)
+                    {
+                        std::vector<float> userMatrix((size_t)srcChannels * dstChannels);
+                        for (float& gain : userMatrix)
+                        {
+                            gain = (float)(random.NextUnit() * 2.0 - 1.0);
+                        }
+
+                        for (const float* matrix : { (const float*)nullptr, (const float*)userMatrix.data() })
+                        {
+                            ChannelRemix reference;
+                            HRESULT hr = reference.Initialize(src, srcChannels, 0, dst, dstChannels, 0, matrix, ChannelRemixKernel::Scalar);
+                            Check(SUCCEEDED(hr), "remix init", "scalar", src, dst, srcChannels, dstChannels);
+                            if (FAILED(hr))
+                            {
+                                continue;
+                            }
+
+                            for (const ChannelRemixKernelCase& kernelCase : s_RemixKernels)
+                            {
+                                ChannelRemix remix;
+                                if (FAILED(remix.Initialize(src, srcChannels, 0, dst, dstChannels, 0, matrix, kernelCase.kernel)) ||
+                                    (kernelCase.kernel != ChannelRemixKernel::Auto && remix.GetKernel() != kernelCase.kernel))
+                                {
+                                    // Instruction set of another architecture or CPU
+                                    continue;
+                                }
+                                for (UINT32 frames : s_Lengths)
+                                {
+                                    size_t cbDst = (size_t)frames * dstChannels * GetSampleBytes(dst);
+                                    std::vector<BYTE> input((size_t)frames * srcChannels * GetSampleBytes(src) + 1);
+                                    FillSamples(src, input.data(), (size_t)frames * srcChannels, random, false);
+                                    std::vector<BYTE> expected(cbDst + GuardBytes, GuardByte);
+                                    std::vector<BYTE> actual(cbDst + GuardBytes, GuardByte);
+                                    reference.Process(input.data(), expected.data(), frames);
+                                    remix.Process(input.data(), actual.data(), frames);
+                                    Check(memcmp(expected.data(), actual.data(), cbDst) == 0 && GuardIntact(actual, cbDst),
+                                        "remix", kernelCase.name, src, dst, srcChannels * 10 + dstChannels, frames);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    const CpuFeatures& cpu = CpuFeatures::Get();
+    printf("CPU: sse41 %d, avx2 %d, neon %d\n", cpu.sse41, cpu.avx2, cpu.neon);
+
+    Random random;
+    CheckReference();
+    CheckSampleConverters(random);
+    CheckFrameConverters(random);
+    CheckChannelRemix(random);
+
+    printf("%u checks, %u failed\n", s_Checks, s_Failures);
+    return (s_Failures == 0) ? 0 : 1;
+}